@@ -0,0 +1,139 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file BatchLane.h
+ * Template for a fixed number of values of the same quantity that are processed as one.
+ *
+ * Each arithmetic operator applies the scalar operator to every lane, so an expression written for scalars
+ * gives the same result in every lane as the scalar expression. The operand types are promoted as they would
+ * be for scalars, e.g. a float lane multiplied by a double lane gives a double lane. The loops have a
+ * constant trip count so the compiler can vectorise them.
+ */
+
+#pragma once
+
+#include <type_traits>
+
+template <typename data_type, unsigned width>
+struct BatchLane {
+	data_type v[width];
+
+	BatchLane() = default;
+
+	// convert the lanes from another type, the equivalent of a scalar implicit conversion
+	template <typename other_type>
+	BatchLane(const BatchLane<other_type, width> &other)
+	{
+		for (unsigned i = 0; i < width; i++) {
+			v[i] = (data_type)other.v[i];
+		}
+	}
+
+	// set every lane to a scalar
+	BatchLane &operator=(data_type value)
+	{
+		for (unsigned i = 0; i < width; i++) {
+			v[i] = value;
+		}
+
+		return *this;
+	}
+
+	data_type &operator[](unsigned lane) { return v[lane]; }
+	const data_type &operator[](unsigned lane) const { return v[lane]; }
+
+	BatchLane operator-() const
+	{
+		BatchLane r;
+
+		for (unsigned i = 0; i < width; i++) {
+			r.v[i] = -v[i];
+		}
+
+		return r;
+	}
+
+	template <typename other_type>
+	BatchLane &operator+=(const BatchLane<other_type, width> &other)
+	{
+		for (unsigned i = 0; i < width; i++) {
+			v[i] += other.v[i];
+		}
+
+		return *this;
+	}
+
+	template <typename other_type>
+	BatchLane &operator-=(const BatchLane<other_type, width> &other)
+	{
+		for (unsigned i = 0; i < width; i++) {
+			v[i] -= other.v[i];
+		}
+
+		return *this;
+	}
+};
+
+// lane by lane binary operators between two lanes and between a lane and a scalar
+#define BATCH_LANE_OPERATOR(op) \
+	template <typename a_type, typename b_type, unsigned width> \
+	inline BatchLane<decltype(a_type() op b_type()), width> operator op(const BatchLane<a_type, width> &a, const BatchLane<b_type, width> &b) \
+	{ \
+		BatchLane<decltype(a_type() op b_type()), width> r; \
+		for (unsigned i = 0; i < width; i++) { r.v[i] = a.v[i] op b.v[i]; } \
+		return r; \
+	} \
+	template <typename a_type, typename b_type, unsigned width, \
+		  typename = typename std::enable_if<std::is_arithmetic<b_type>::value>::type> \
+	inline BatchLane<decltype(a_type() op b_type()), width> operator op(const BatchLane<a_type, width> &a, b_type b) \
+	{ \
+		BatchLane<decltype(a_type() op b_type()), width> r; \
+		for (unsigned i = 0; i < width; i++) { r.v[i] = a.v[i] op b; } \
+		return r; \
+	} \
+	template <typename a_type, typename b_type, unsigned width, \
+		  typename = typename std::enable_if<std::is_arithmetic<a_type>::value>::type> \
+	inline BatchLane<decltype(a_type() op b_type()), width> operator op(a_type a, const BatchLane<b_type, width> &b) \
+	{ \
+		BatchLane<decltype(a_type() op b_type()), width> r; \
+		for (unsigned i = 0; i < width; i++) { r.v[i] = a op b.v[i]; } \
+		return r; \
+	}
+
+BATCH_LANE_OPERATOR(+)
+BATCH_LANE_OPERATOR(-)
+BATCH_LANE_OPERATOR(*)
+BATCH_LANE_OPERATOR(/)
+
+#undef BATCH_LANE_OPERATOR
@@ -37,21 +37,128 @@
  * Template RingBuffer.
  */
 
+#pragma once
+
 #include <inttypes.h>
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
+#include <atomic>
+#include <array>
+
+// If ECL_BUFFER_TIME_INDEX is defined, the sample timestamps are also held in a dense array that starts on a
+// cache line boundary, so that the timestamp searches do not need to read the rest of each sample.
+#ifndef ECL_CACHE_LINE_SIZE
+#define ECL_CACHE_LINE_SIZE 64
+#endif
+
+// Storage for the RingBuffer data. A max_size of zero allocates the requested size on the heap, otherwise
+// the data is held in a fixed size array inside the buffer object and no heap allocation is performed.
+template <typename data_type, unsigned max_size>
+class RingBufferStorage
+{
+public:
+	data_type *reserve(unsigned size) { return size <= max_size ? _data.data() : NULL; }
+	void release(data_type *) {}
+	static size_t heap_bytes(unsigned) { return 0; }
+
+#ifdef ECL_BUFFER_TIME_INDEX
+	uint64_t *reserve_time(unsigned size) { return size <= max_size ? _time_us : NULL; }
+	void release_time(uint64_t *) {}
+#endif
+
+private:
+	std::array<data_type, max_size> _data;
+#ifdef ECL_BUFFER_TIME_INDEX
+	alignas(ECL_CACHE_LINE_SIZE) uint64_t _time_us[max_size];
+#endif
+};
 
 template <typename data_type>
+class RingBufferStorage<data_type, 0>
+{
+public:
+	data_type *reserve(unsigned size) { return new data_type[size]; }
+	void release(data_type *buffer) { delete[] buffer; }
+
+	// heap requested by reserve() and reserve_time() for a buffer of the given length, excluding allocator overhead
+	static size_t heap_bytes(unsigned size)
+	{
+#ifdef ECL_BUFFER_TIME_INDEX
+		return size * sizeof(data_type) + (size + ECL_CACHE_LINE_SIZE / sizeof(uint64_t)) * sizeof(uint64_t);
+#else
+		return size * sizeof(data_type);
+#endif
+	}
+
+#ifdef ECL_BUFFER_TIME_INDEX
+	uint64_t *reserve_time(unsigned size)
+	{
+		// over allocate so that the returned array can start on a cache line boundary
+		const uintptr_t align = ECL_CACHE_LINE_SIZE;
+		_time_alloc = new uint64_t[size + align / sizeof(uint64_t)];
+
+		if (_time_alloc == NULL) {
+			return NULL;
+		}
+
+		return reinterpret_cast<uint64_t *>((reinterpret_cast<uintptr_t>(_time_alloc) + align - 1) & ~(align - 1));
+	}
+
+	void release_time(uint64_t *)
+	{
+		delete[] _time_alloc;
+		_time_alloc = NULL;
+	}
+
+private:
+	uint64_t *_time_alloc = NULL;
+#endif
+};
+
+template <typename data_type, unsigned max_size = 0>
 class RingBuffer
 {
 public:
 	RingBuffer()
 	{
 		_buffer = NULL;
+#ifdef ECL_BUFFER_TIME_INDEX
+		_time_us = NULL;
+#endif
 		_head = _tail = _size = 0;
 		_first_write = true;
+		_max_age_us = 100000;
+	}
+	~RingBuffer() { unallocate(); }
+
+	// the copies own their data so that a complete filter can be copied, e.g. to checkpoint it
+	RingBuffer(const RingBuffer &other) : RingBuffer() { *this = other; }
+
+	RingBuffer &operator=(const RingBuffer &other)
+	{
+		if (this == &other) {
+			return *this;
+		}
+
+		if (other._size == 0) {
+			unallocate();
+
+		} else if (other._size != _size && !allocate(other._size)) {
+			return *this;
+		}
+
+		for (unsigned index = 0; index < _size; index++) {
+			_buffer[index] = other._buffer[index];
+			set_time(index, other.get_time(index));
+		}
+
+		_head = other._head;
+		_tail = other._tail;
+		_first_write = other._first_write;
+		_max_age_us = other._max_age_us;
+		return *this;
 	}
-	~RingBuffer() { delete[] _buffer; }
 
 	bool allocate(int size)
 	{
@@ -59,20 +166,29 @@ public:
 			return false;
 		}
 
-		if (_buffer != NULL) {
-			delete[] _buffer;
-		}
+		unallocate();
 
-		_buffer = new data_type[size];
+		_buffer = _storage.reserve(size);
+
+#ifdef ECL_BUFFER_TIME_INDEX
+		_time_us = _storage.reserve_time(size);
+
+		if (_time_us == NULL) {
+			unallocate();
+			return false;
+		}
+#endif
 
 		if (_buffer == NULL) {
+			unallocate();
 			return false;
 		}
 
+		_head = _tail = 0;
 		_size = size;
 		// set the time elements to zero so that bad data is not retrieved from the buffers
 		for (unsigned index=0; index < _size; index++) {
-			_buffer[index].time_us = 0;
+			set_time(index, 0);
 		}
 		_first_write = true;
 		return true;
@@ -81,11 +197,97 @@ public:
 	void unallocate()
 	{
 		if (_buffer != NULL) {
-			delete[] _buffer;
+			_storage.release(_buffer);
+			_buffer = NULL;
 		}
+
+#ifdef ECL_BUFFER_TIME_INDEX
+		if (_time_us != NULL) {
+			_storage.release_time(_time_us);
+			_time_us = NULL;
+		}
+#endif
+
+		_head = _tail = _size = 0;
 	}
 
-	inline void push(data_type sample)
+	// change the buffer length keeping the newest samples that fit, the samples keep their time order.
+	// returns false if the storage for the new length is not available, the buffer is then unchanged unless
+	// the timestamp index could not be allocated, in which case the buffer is unallocated.
+	bool resize(int size)
+	{
+		if (size <= 0) {
+			return false;
+		}
+
+		if (_size == 0) {
+			return allocate(size);
+		}
+
+		if ((unsigned)size == _size) {
+			return true;
+		}
+
+		const unsigned count = get_count();
+		const unsigned keep = count < (unsigned)size ? count : (unsigned)size;
+
+		// rotate the storage so that the oldest sample kept is first, the samples remain in the same cyclic order
+		const unsigned first = (_tail + count - keep) % _size;
+		std::rotate(_buffer, _buffer + first, _buffer + _size);
+		_tail = (_tail + _size - first) % _size;
+		_head = (_head + _size - first) % _size;
+
+		// static storage is reused in place, heap storage is replaced and the samples kept are copied across
+		data_type *buffer = _storage.reserve(size);
+
+		if (buffer == NULL) {
+			return false;
+		}
+
+		if (buffer != _buffer) {
+			for (unsigned index = 0; index < keep; index++) {
+				buffer[index] = _buffer[index];
+			}
+
+			_storage.release(_buffer);
+			_buffer = buffer;
+		}
+
+#ifdef ECL_BUFFER_TIME_INDEX
+		// the timestamp index is rebuilt from the sample timestamps
+		_storage.release_time(_time_us);
+		_time_us = _storage.reserve_time(size);
+
+		if (_time_us == NULL) {
+			unallocate();
+			return false;
+		}
+#endif
+
+		_size = size;
+
+		for (unsigned index = 0; index < _size; index++) {
+			set_time(index, index < keep ? _buffer[index].time_us : 0);
+		}
+
+		_tail = 0;
+		_head = keep > 0 ? keep - 1 : 0;
+		_first_write = keep == 0;
+		return true;
+	}
+
+	// heap used by a buffer of the given length, zero when the buffer is held in static storage
+	static size_t heap_bytes(unsigned size) { return RingBufferStorage<data_type, max_size>::heap_bytes(size); }
+
+	inline void push(const data_type &sample)
+	{
+		data_type &slot = emplace(sample.time_us);
+		slot = sample;
+	}
+
+	// advance the head and return a reference to the new newest sample so that it can be written in place
+	// the referenced sample contains the overwritten data apart from the timestamp
+	inline data_type &emplace(uint64_t time_us)
 	{
 		int head_new = _head;
 
@@ -96,7 +298,6 @@ public:
 			head_new = (_head + 1) % _size;
 		}
 
-		_buffer[head_new] = sample;
 		_head = head_new;
 
 		// move tail if we overwrite it
@@ -106,61 +307,76 @@ public:
 		} else {
 			_first_write = false;
 		}
+
+		set_time(_head, time_us);
+
+		return _buffer[_head];
 	}
 
-	inline data_type get_oldest()
+	inline const data_type &get_oldest() const
 	{
 		return _buffer[_tail];
 	}
 
-	inline data_type get_newest()
+	inline const data_type &get_newest() const
 	{
 		return _buffer[_head];
 	}
 
+	// set the maximum time difference allowed between the requested timestamp and the returned sample
+	void set_max_sample_age(uint64_t max_age_us)
+	{
+		_max_age_us = max_age_us;
+	}
+
 	inline bool pop_first_older_than(uint64_t timestamp, data_type *sample)
 	{
-		// start looking from newest observation data
-		for (unsigned i = 0; i < _size; i++) {
-			int index = (_head - i);
-			index = index < 0 ? _size + index : index;
+		unsigned index;
 
-			if (timestamp >= _buffer[index].time_us && timestamp - _buffer[index].time_us < 100000) {
+		if (find_first_older_than(timestamp, &index)) {
 
-				// TODO Re-evaluate the static cast and usage patterns
-				memcpy(static_cast<void *>(sample), static_cast<void *>(&_buffer[index]), sizeof(*sample));
+			*sample = _buffer[index];
 
-				// Now we can set the tail to the item which comes after the one we removed
-				// since we don't want to have any older data in the buffer
-				if (index == static_cast<int>(_head)) {
-					_tail = _head;
-					_first_write = true;
+			// Now we can set the tail to the item which comes after the one we removed
+			// since we don't want to have any older data in the buffer
+			if (index == _head) {
+				_tail = _head;
+				_first_write = true;
 
-				} else {
-					_tail = (index + 1) % _size;
-				}
+			} else {
+				_tail = (index + 1) % _size;
+			}
 
-				_buffer[index].time_us = 0;
+			set_time(index, 0);
 
-				return true;
-			}
+			return true;
+		}
 
-			if (index == static_cast<int>(_tail)) {
-				// we have reached the tail and haven't got a match
-				return false;
-			}
+		return false;
+	}
+
+	// same as pop_first_older_than() but the buffer contents are left unchanged
+	inline bool get_first_older_than(uint64_t timestamp, data_type *sample)
+	{
+		unsigned index;
+
+		if (find_first_older_than(timestamp, &index)) {
+			*sample = _buffer[index];
+			return true;
 		}
 
 		return false;
 	}
 
+	// access the sample at the specified index. The sample timestamp must not be modified
+	// as it is only set by push() and emplace().
 	data_type &operator[](unsigned index)
 	{
 		return _buffer[index];
 	}
 
 	// return data at the specified index
-	inline data_type get_from_index(unsigned index)
+	inline const data_type &get_from_index(unsigned index) const
 	{
 		if (index >= _size) {
 			index = _size-1;
@@ -169,23 +385,227 @@ public:
 	}
 
 	// push data to the specified index
-	inline void push_to_index(unsigned index, data_type sample)
+	inline void push_to_index(unsigned index, const data_type &sample)
 	{
 		if (index >= _size) {
 			index = _size-1;
 		}
 		_buffer[index] = sample;
+		set_time(index, sample.time_us);
+	}
+
+	// access the sample offset samples newer than the oldest sample, the offset must be less than get_count().
+	// The sample timestamp must not be modified.
+	inline data_type &get_from_oldest(unsigned offset)
+	{
+		return _buffer[(_tail + offset) % _size];
+	}
+
+	// return the number of samples held by the buffer
+	unsigned get_count() const
+	{
+		if (_size == 0 || _first_write) {
+			return 0;
+		}
+
+		return (_head + _size - _tail) % _size + 1;
 	}
 
 	// return the length of the buffer
-	unsigned get_length()
+	unsigned get_length() const
 	{
 		return _size;
 	}
 
 private:
+	// find the index of the newest sample that is not newer than the timestamp and not older than the maximum sample age
+	inline bool find_first_older_than(uint64_t timestamp, unsigned *index)
+	{
+		if (_size == 0) {
+			return false;
+		}
+
+		// the data between the tail and head is stored in time order, so use a binary search to find the number
+		// of samples, counting from the tail, that are not newer than the timestamp
+		unsigned length = (_head + _size - _tail) % _size + 1;
+		unsigned lower = 0;
+		unsigned upper = length;
+
+		while (lower < upper) {
+			unsigned middle = (lower + upper) / 2;
+
+			if (get_time((_tail + middle) % _size) <= timestamp) {
+				lower = middle + 1;
+
+			} else {
+				upper = middle;
+			}
+		}
+
+		if (lower == 0) {
+			// all data is newer than the timestamp
+			return false;
+		}
+
+		// the newest sample not newer than the timestamp
+		*index = (_tail + lower - 1) % _size;
+
+		return timestamp - get_time(*index) < _max_age_us;
+	}
+
+	inline uint64_t get_time(unsigned index) const
+	{
+#ifdef ECL_BUFFER_TIME_INDEX
+		return _time_us[index];
+#else
+		return _buffer[index].time_us;
+#endif
+	}
+
+	inline void set_time(unsigned index, uint64_t time_us)
+	{
+		_buffer[index].time_us = time_us;
+#ifdef ECL_BUFFER_TIME_INDEX
+		_time_us[index] = time_us;
+#endif
+	}
+
+	RingBufferStorage<data_type, max_size> _storage;
 	data_type *_buffer;
+#ifdef ECL_BUFFER_TIME_INDEX
+	uint64_t *_time_us;	// dense copy of the sample timestamps used by the searches
+#endif
 	unsigned _head, _tail, _size;
 	bool _first_write;
+	uint64_t _max_age_us;	// maximum time difference between the requested timestamp and a returned sample (usec)
+
+};
+
+// Lock free variant of RingBuffer for use with a single producer thread calling push() and a single consumer
+// thread calling pop_oldest() and pop_first_older_than(). Unlike RingBuffer, data is never overwritten. If the
+// buffer is full then push() rejects the new sample, because the oldest sample may be being read by the consumer.
+template <typename data_type>
+class SpscRingBuffer
+{
+public:
+	SpscRingBuffer()
+	{
+		_buffer = NULL;
+		_size = 0;
+		_write_count = 0;
+		_read_count = 0;
+		_max_age_us = 100000;
+	}
+	~SpscRingBuffer() { delete[] _buffer; }
+
+	// allocate the buffer. This must not be called while the producer or consumer are using the buffer.
+	bool allocate(int size)
+	{
+		if (size <= 0) {
+			return false;
+		}
+
+		if (_buffer != NULL) {
+			delete[] _buffer;
+		}
+
+		_buffer = new data_type[size];
+
+		if (_buffer == NULL) {
+			return false;
+		}
+
+		_size = size;
+		_write_count = 0;
+		_read_count = 0;
+		return true;
+	}
+
+	// called by the producer. Returns false if the buffer is full and the sample has been rejected.
+	inline bool push(const data_type &sample)
+	{
+		const unsigned write_count = _write_count.load(std::memory_order_relaxed);
+
+		if (distance(_read_count.load(std::memory_order_acquire), write_count) >= _size) {
+			return false;
+		}
+
+		_buffer[index(write_count)] = sample;
+		_write_count.store(next(write_count), std::memory_order_release);
+		return true;
+	}
+
+	// called by the consumer. Returns false if the buffer is empty.
+	inline bool pop_oldest(data_type *sample)
+	{
+		const unsigned read_count = _read_count.load(std::memory_order_relaxed);
+
+		if (read_count == _write_count.load(std::memory_order_acquire)) {
+			return false;
+		}
+
+		*sample = _buffer[index(read_count)];
+		_read_count.store(next(read_count), std::memory_order_release);
+		return true;
+	}
+
+	// called by the consumer. Has the same behaviour as RingBuffer::pop_first_older_than(): the newest sample
+	// at or before the timestamp is returned and all older samples are discarded.
+	inline bool pop_first_older_than(uint64_t timestamp, data_type *sample)
+	{
+		const unsigned read_count = _read_count.load(std::memory_order_relaxed);
+		const unsigned write_count = _write_count.load(std::memory_order_acquire);
+
+		// start looking from newest observation data
+		for (unsigned count = write_count; count != read_count; count = previous(count)) {
+			const data_type &candidate = _buffer[index(previous(count))];
+
+			if (timestamp >= candidate.time_us && timestamp - candidate.time_us < _max_age_us) {
+				*sample = candidate;
+
+				// release the slot of the sample and all older slots back to the producer
+				_read_count.store(count, std::memory_order_release);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// set the maximum time difference allowed between the requested timestamp and the returned sample
+	void set_max_sample_age(uint64_t max_age_us)
+	{
+		_max_age_us = max_age_us;
+	}
+
+	// return the number of samples waiting to be read
+	unsigned get_count() const
+	{
+		return distance(_read_count.load(std::memory_order_acquire), _write_count.load(std::memory_order_acquire));
+	}
+
+	// return the length of the buffer
+	unsigned get_length() const
+	{
+		return _size;
+	}
+
+private:
+	data_type *_buffer;
+	unsigned _size;
+	uint64_t _max_age_us;	// maximum time difference between the requested timestamp and a returned sample (usec)
+
+	// counters of the samples written and read. Only the producer writes _write_count and only the consumer
+	// writes _read_count. The counters wrap at twice the buffer length so that a full buffer can be told apart
+	// from an empty one and the slot index stays continuous when a counter wraps, for any buffer length.
+	std::atomic<unsigned> _write_count;
+	std::atomic<unsigned> _read_count;
+
+	inline unsigned next(unsigned count) const { return (count + 1 == 2 * _size) ? 0 : count + 1; }
+	inline unsigned previous(unsigned count) const { return (count == 0) ? 2 * _size - 1 : count - 1; }
+	inline unsigned index(unsigned count) const { return (count < _size) ? count : count - _size; }
+
+	// number of samples from the from count to the to count
+	inline unsigned distance(unsigned from, unsigned to) const { return (to >= from) ? to - from : to + 2 * _size - from; }
 
 };
@@ -0,0 +1,113 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file SeqLock.h
+ * Template sequence lock for publishing data from one writer to readers on other threads.
+ *
+ * The writer never waits. A reader copies the data and retries if the writer published
+ * during the copy, so readers never see a partially written value and take no lock.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+template <typename data_type>
+class SeqLock
+{
+	static_assert(std::is_trivially_copyable<data_type>::value, "SeqLock data must be trivially copyable");
+
+public:
+	SeqLock() : _sequence(0) {}
+	~SeqLock() = default;
+
+	// copy the last published value, the other lock must not be written to during the copy
+	SeqLock(const SeqLock &other) : _data(other._data), _sequence(0) {}
+
+	SeqLock &operator=(const SeqLock &other)
+	{
+		write(other._data);
+		return *this;
+	}
+
+	// publish a new value, must only be called from a single writer thread
+	void write(const data_type &value)
+	{
+		const unsigned sequence = _sequence.load(std::memory_order_relaxed);
+
+		// an odd sequence number marks a write in progress
+		_sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		memcpy(&_data, &value, sizeof(data_type));
+
+		_sequence.store(sequence + 2, std::memory_order_release);
+	}
+
+	// copy the last published value, returns false if nothing has been published or if a consistent
+	// copy could not be taken within max_attempts because the writer kept publishing
+	bool read(data_type &value, unsigned max_attempts = 4) const
+	{
+		for (unsigned attempt = 0; attempt < max_attempts; attempt++) {
+			const unsigned sequence = _sequence.load(std::memory_order_acquire);
+
+			if (sequence == 0) {
+				return false;
+			}
+
+			if (sequence & 1) {
+				continue;
+			}
+
+			memcpy(&value, &_data, sizeof(data_type));
+			std::atomic_thread_fence(std::memory_order_acquire);
+
+			if (_sequence.load(std::memory_order_relaxed) == sequence) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// number of values published since construction
+	unsigned get_count() const { return _sequence.load(std::memory_order_acquire) / 2; }
+
+private:
+	data_type _data{};
+	std::atomic<unsigned> _sequence;
+
+};
@@ -0,0 +1,152 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file SymmetricMatrix.h
+ * Template class for a square symmetric matrix which only stores the upper triangle.
+ */
+
+#ifndef SYMMETRIC_MATRIX_H
+#define SYMMETRIC_MATRIX_H
+
+#include <stdint.h>
+#include <cstring>
+
+template <typename data_type, uint8_t N>
+class SymmetricMatrix
+{
+public:
+	// number of elements required to store the upper triangle including the diagonal
+	static const uint16_t num_elements = (uint16_t)N * (N + 1) / 2;
+
+	// row access helper so that elements can be accessed using P[row][column] syntax
+	class Row
+	{
+	public:
+		Row(SymmetricMatrix &mat, uint8_t row) : _mat(mat), _row(row) {}
+
+		data_type &operator[](uint8_t column) { return _mat(_row, column); }
+
+	private:
+		SymmetricMatrix &_mat;
+		uint8_t _row;
+	};
+
+	class ConstRow
+	{
+	public:
+		ConstRow(const SymmetricMatrix &mat, uint8_t row) : _mat(mat), _row(row) {}
+
+		const data_type &operator[](uint8_t column) const { return _mat(_row, column); }
+
+	private:
+		const SymmetricMatrix &_mat;
+		uint8_t _row;
+	};
+
+	SymmetricMatrix() { setZero(); }
+
+	// single accessor for all elements. Element (row,column) and (column,row) share the same storage
+	// so writing one half of the matrix automatically updates the other half.
+	inline data_type &operator()(uint8_t row, uint8_t column) { return _data[index(row, column)]; }
+	inline const data_type &operator()(uint8_t row, uint8_t column) const { return _data[index(row, column)]; }
+
+	inline Row operator[](uint8_t row) { return Row(*this, row); }
+	inline ConstRow operator[](uint8_t row) const { return ConstRow(*this, row); }
+
+	// set all elements to zero
+	void setZero() { memset(_data, 0, sizeof(_data)); }
+
+	// zero the specified range of rows and the corresponding columns
+	void zeroRowsCols(uint8_t first, uint8_t last)
+	{
+		for (uint8_t row = first; row <= last; row++) {
+			for (uint8_t column = 0; column < N; column++) {
+				_data[index(row, column)] = 0;
+			}
+		}
+	}
+
+	// subtract the upper triangle of the outer product of the column vector u and row vector v.
+	// Element (row,column) is reduced by u[row]*v[column] for row <= column. Each column of the
+	// upper triangle is stored contiguously so the inner loop can be vectorised by the compiler.
+	// The product and difference are evaluated in accum_type and rounded once when stored.
+	template <typename accum_type = data_type>
+	void subtractUpperProduct(const data_type *u, const data_type *v)
+	{
+		data_type *column_data = _data;
+
+		for (uint8_t column = 0; column < N; column++) {
+			const accum_type v_column = v[column];
+
+			for (uint8_t row = 0; row <= column; row++) {
+				column_data[row] = (data_type)(column_data[row] - u[row] * v_column);
+			}
+
+			column_data += column + 1;
+		}
+	}
+
+	// subtract the upper triangle of the sum of the outer products u0*v0 + u1*v1 in a single pass
+	template <typename accum_type = data_type>
+	void subtractUpperProduct(const data_type *u0, const data_type *v0, const data_type *u1, const data_type *v1)
+	{
+		data_type *column_data = _data;
+
+		for (uint8_t column = 0; column < N; column++) {
+			const accum_type v0_column = v0[column];
+			const accum_type v1_column = v1[column];
+
+			for (uint8_t row = 0; row <= column; row++) {
+				column_data[row] = (data_type)(column_data[row] - (u0[row] * v0_column + u1[row] * v1_column));
+			}
+
+			column_data += column + 1;
+		}
+	}
+
+	// direct access to the packed storage
+	data_type *data() { return _data; }
+	const data_type *data() const { return _data; }
+
+private:
+	// storage index of the upper triangle element for the row and column
+	static inline uint16_t index(uint8_t row, uint8_t column)
+	{
+		return (row <= column) ? (uint16_t)column * (column + 1) / 2 + row : (uint16_t)row * (row + 1) / 2 + column;
+	}
+
+	data_type _data[num_elements];
+};
+
+#endif // SYMMETRIC_MATRIX_H
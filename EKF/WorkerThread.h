@@ -0,0 +1,150 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file WorkerThread.h
+ * A single persistent thread that runs one job at a time for the thread that owns it.
+ *
+ * Jobs are handed over through atomic counters rather than a mutex and condition variable so the
+ * hand over latency is small enough to split a single filter update between two cores. The worker
+ * busy waits for a short time before yielding, so it should run on a core of its own.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <pthread.h>
+#include <sched.h>
+
+class WorkerThread
+{
+public:
+	WorkerThread() = default;
+	~WorkerThread() { stop(); }
+
+	WorkerThread(const WorkerThread &) = delete;
+	WorkerThread &operator=(const WorkerThread &) = delete;
+
+	// create the thread, returns false if it could not be created
+	bool start()
+	{
+		if (_running) {
+			return true;
+		}
+
+		_stop.store(false, std::memory_order_relaxed);
+		_running = (pthread_create(&_thread, nullptr, &WorkerThread::threadMain, this) == 0);
+		return _running;
+	}
+
+	// finish the current job and join the thread
+	void stop()
+	{
+		if (_running) {
+			_stop.store(true, std::memory_order_release);
+			pthread_join(_thread, nullptr);
+			_running = false;
+		}
+	}
+
+	bool running() const { return _running; }
+
+	// hand a job to the worker, returns false if the worker is not running and the caller has to run the job
+	// itself. Only one job can be outstanding, so wait() must be called before the next post().
+	bool post(void (*job)(void *), void *arg)
+	{
+		if (!_running) {
+			return false;
+		}
+
+		_job = job;
+		_arg = arg;
+		_posted.store(_posted.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		return true;
+	}
+
+	// wait for the posted job to complete, all writes made by the job are visible on return
+	void wait()
+	{
+		const unsigned posted = _posted.load(std::memory_order_relaxed);
+		unsigned polls = 0;
+
+		while (_done.load(std::memory_order_acquire) != posted) {
+			// let the worker run if it shares the processor with this thread
+			if (++polls > _spin_limit) {
+				sched_yield();
+			}
+		}
+	}
+
+private:
+	// number of empty polls before the worker yields the processor between polls
+	static constexpr unsigned _spin_limit = 10000;
+
+	static void *threadMain(void *arg)
+	{
+		static_cast<WorkerThread *>(arg)->run();
+		return nullptr;
+	}
+
+	void run()
+	{
+		unsigned done = _done.load(std::memory_order_relaxed);
+		unsigned idle_polls = 0;
+
+		while (!_stop.load(std::memory_order_acquire)) {
+			if (_posted.load(std::memory_order_acquire) == done) {
+				if (++idle_polls > _spin_limit) {
+					sched_yield();
+				}
+
+				continue;
+			}
+
+			_job(_arg);
+			_done.store(++done, std::memory_order_release);
+			idle_polls = 0;
+		}
+	}
+
+	pthread_t _thread{};
+	bool _running{false};
+
+	void (*_job)(void *) {nullptr};
+	void *_arg{nullptr};
+
+	std::atomic<unsigned> _posted{0};	// number of jobs handed to the worker
+	std::atomic<unsigned> _done{0};		// number of jobs the worker has completed
+	std::atomic<bool> _stop{false};
+
+};
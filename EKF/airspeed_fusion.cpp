@@ -43,16 +43,83 @@
 #include "../ecl.h"
 #include "ekf.h"
 #include "mathlib.h"
+#include "fast_math.h"
 
-void Ekf::fuseAirspeed()
+#ifndef ECL_EKF_NO_WIND_STATES
+void Ekf::calcAirDataTerms(airDataTerms &terms)
 {
+	// copy the states the airspeed and sideslip observations depend on
+	terms.q0 = _state.quat_nominal(0);
+	terms.q1 = _state.quat_nominal(1);
+	terms.q2 = _state.quat_nominal(2);
+	terms.q3 = _state.quat_nominal(3);
+	terms.vn = _state.vel(0);
+	terms.ve = _state.vel(1);
+	terms.vd = _state.vel(2);
+	terms.vwn = _state.wind_vel(0);
+	terms.vwe = _state.wind_vel(1);
+
+	// calculate the predicted airspeed
+	terms.tas_pred = ecl::sqrt((terms.ve - terms.vwe) * (terms.ve - terms.vwe) + (terms.vn - terms.vwn) * (terms.vn - terms.vwn) + terms.vd * terms.vd);
+
+	// relative wind velocity rotated into body axes
+	Vector3f rel_wind;
+	rel_wind(0) = terms.vn - terms.vwn;
+	rel_wind(1) = terms.ve - terms.vwe;
+	rel_wind(2) = terms.vd;
+	terms.rel_wind_body = stateToBody() * rel_wind;
+
+	memset(terms.state_delta, 0, sizeof(terms.state_delta));
+}
+
+void Ekf::fuseAirData()
+{
+	if (!_fuse_airspeed && !_fuse_sideslip) {
+		return;
+	}
+
+	// the relative wind terms are evaluated once at the prior state and shared by both observations
+	airDataTerms terms;
+	calcAirDataTerms(terms);
+
+	if (_fuse_airspeed && _fuse_sideslip) {
+		// the observations are processed sequentially, so the sideslip innovation is corrected
+		// for the change in the states made by the airspeed update
+		const stateSample state_prior = _state;
+
+		fuseAirspeed(terms);
+
+		for (uint8_t i = 0; i < 4; i++) {
+			terms.state_delta[i] = _state.quat_nominal(i) - state_prior.quat_nominal(i);
+		}
+
+		for (uint8_t i = 0; i < 3; i++) {
+			terms.state_delta[i + 4] = _state.vel(i) - state_prior.vel(i);
+		}
+
+		terms.state_delta[7] = _state.wind_vel(0) - state_prior.wind_vel(0);
+		terms.state_delta[8] = _state.wind_vel(1) - state_prior.wind_vel(1);
+
+		fuseSideslip(terms);
+
+	} else if (_fuse_airspeed) {
+		fuseAirspeed(terms);
+
+	} else {
+		fuseSideslip(terms);
+	}
+
+	_fuse_airspeed = false;
+	_fuse_sideslip = false;
+}
+
+void Ekf::fuseAirspeed(const airDataTerms &terms)
+{
+	EKF_TIMED_SCOPE(EKF_TIMING_FUSE_AIRSPEED);
+
 	// Initialize variables
-	float vn; // Velocity in north direction
-	float ve; // Velocity in east direction
-	float vd; // Velocity in downwards direction
-	float vwn; // Wind speed in north direction
-	float vwe; // Wind speed in east direction
-	float v_tas_pred; // Predicted measurement
+	const float vd = terms.vd; // Velocity in downwards direction
+	const float v_tas_pred = terms.tas_pred; // Predicted measurement
 	float R_TAS = sq(math::constrain(_params.eas_noise, 0.5f, 5.0f) * math::constrain(_airspeed_sample_delayed.eas2tas, 0.9f,
 			 10.0f)); // Variance for true airspeed measurement - (m/sec)^2
 	float SH_TAS[3] = {}; // Varialbe used to optimise calculations of measurement jacobian
@@ -60,31 +127,12 @@ void Ekf::fuseAirspeed()
 	float SK_TAS[2] = {}; // Varialbe used to optimise calculations of the Kalman gain vector
 	float Kfusion[24] = {}; // Kalman gain vector
 
-	// Copy required states to local variable names
-	vn = _state.vel(0);
-	ve = _state.vel(1);
-	vd = _state.vel(2);
-	vwn = _state.wind_vel(0);
-	vwe = _state.wind_vel(1);
-
-	// Calculate the predicted airspeed
-	v_tas_pred = sqrtf((ve - vwe) * (ve - vwe) + (vn - vwn) * (vn - vwn) + vd * vd);
-
 	// Perform fusion of True Airspeed measurement
 	if (v_tas_pred > 1.0f) {
-		// Calculate the observation jacobian
-		// intermediate variable from algebraic optimisation
+		// intermediate variable from algebraic optimisation used by the innovation variance and observation jacobian
 		SH_TAS[0] = 1.0f/v_tas_pred;
-		SH_TAS[1] = (SH_TAS[0]*(2.0f*ve - 2.0f*vwe))*0.5f;
-		SH_TAS[2] = (SH_TAS[0]*(2.0f*vn - 2.0f*vwn))*0.5f;
-
-		for (uint8_t i = 0; i < _k_num_states; i++) { H_TAS[i] = 0.0f; }
-
-		H_TAS[4] = SH_TAS[2];
-		H_TAS[5] = SH_TAS[1];
-		H_TAS[6] = vd*SH_TAS[0];
-		H_TAS[22] = -SH_TAS[2];
-		H_TAS[23] = -SH_TAS[1];
+		SH_TAS[1] = (SH_TAS[0]*(2.0f*terms.ve - 2.0f*terms.vwe))*0.5f;
+		SH_TAS[2] = (SH_TAS[0]*(2.0f*terms.vn - 2.0f*terms.vwn))*0.5f;
 
 		// We don't want to update the innovation variance if the calculation is ill conditioned
 		float _airspeed_innov_var_temp = (R_TAS + SH_TAS[2]*(P[4][4]*SH_TAS[2] + P[5][4]*SH_TAS[1] - P[22][4]*SH_TAS[2] - P[23][4]*SH_TAS[1] + P[6][4]*vd*SH_TAS[0]) + SH_TAS[1]*(P[4][5]*SH_TAS[2] + P[5][5]*SH_TAS[1] - P[22][5]*SH_TAS[2] - P[23][5]*SH_TAS[1] + P[6][5]*vd*SH_TAS[0]) - SH_TAS[2]*(P[4][22]*SH_TAS[2] + P[5][22]*SH_TAS[1] - P[22][22]*SH_TAS[2] - P[23][22]*SH_TAS[1] + P[6][22]*vd*SH_TAS[0]) - SH_TAS[1]*(P[4][23]*SH_TAS[2] + P[5][23]*SH_TAS[1] - P[22][23]*SH_TAS[2] - P[23][23]*SH_TAS[1] + P[6][23]*vd*SH_TAS[0]) + vd*SH_TAS[0]*(P[4][6]*SH_TAS[2] + P[5][6]*SH_TAS[1] - P[22][6]*SH_TAS[2] - P[23][6]*SH_TAS[1] + P[6][6]*vd*SH_TAS[0]));
@@ -100,6 +148,31 @@ void Ekf::fuseAirspeed()
 			return;
 		}
 
+		// Calculate measurement innovation
+		_airspeed_innov = v_tas_pred -
+				  _airspeed_sample_delayed.true_airspeed;
+
+		// Calculate the innovation variance
+		_airspeed_innov_var = 1.0f / SK_TAS[0];
+
+		// Compute the ratio of innovation to gate size
+		_tas_test_ratio = sq(_airspeed_innov) / (sq(fmaxf(_params.tas_innov_gate, 1.0f)) * _airspeed_innov_var);
+		EKF_RECORD_FUSION(FLIGHT_RECORDER_AIRSPEED, _airspeed_innov, _airspeed_innov_var, _tas_test_ratio,
+				  _tas_test_ratio > 1.0f);
+
+		// If the innovation consistency check fails then don't fuse the sample and indicate bad airspeed health
+		if (_tas_test_ratio > 1.0f) {
+			_innov_check_fail_status.flags.reject_airspeed = true;
+			return;
+		}
+		else {
+			_innov_check_fail_status.flags.reject_airspeed = false;
+		}
+
+		// Airspeed measurement sample has passed check so record it
+		_time_last_arsp_fuse = _time_last_imu;
+
+		// calculate the Kalman gains now that the measurement has passed the innovation test
 		SK_TAS[1] = SH_TAS[1];
 
 		if (((_time_last_imu - _time_last_gps) < 1e6) || ((_time_last_imu - _time_last_ext_vision) < 1e6) || ((_time_last_imu - _time_last_optflow) < 1e6)) {
@@ -135,82 +208,26 @@ void Ekf::fuseAirspeed()
 		Kfusion[22] = SK_TAS[0]*(P[22][4]*SH_TAS[2] - P[22][22]*SH_TAS[2] + P[22][5]*SK_TAS[1] - P[22][23]*SK_TAS[1] + P[22][6]*vd*SH_TAS[0]);
 		Kfusion[23] = SK_TAS[0]*(P[23][4]*SH_TAS[2] - P[23][22]*SH_TAS[2] + P[23][5]*SK_TAS[1] - P[23][23]*SK_TAS[1] + P[23][6]*vd*SH_TAS[0]);
 
+		// form the observation jacobian used by the covariance update
+		for (uint8_t i = 0; i < _k_num_states; i++) { H_TAS[i] = 0.0f; }
 
-		// Calculate measurement innovation
-		_airspeed_innov = v_tas_pred -
-				  _airspeed_sample_delayed.true_airspeed;
-
-		// Calculate the innovation variance
-		_airspeed_innov_var = 1.0f / SK_TAS[0];
-
-		// Compute the ratio of innovation to gate size
-		_tas_test_ratio = sq(_airspeed_innov) / (sq(fmaxf(_params.tas_innov_gate, 1.0f)) * _airspeed_innov_var);
-
-		// If the innovation consistency check fails then don't fuse the sample and indicate bad airspeed health
-		if (_tas_test_ratio > 1.0f) {
-			_innov_check_fail_status.flags.reject_airspeed = true;
-			return;
-		}
-		else {
-			_innov_check_fail_status.flags.reject_airspeed = false;
-		}
-
-		// Airspeed measurement sample has passed check so record it
-		_time_last_arsp_fuse = _time_last_imu;
+		H_TAS[4] = SH_TAS[2];
+		H_TAS[5] = SH_TAS[1];
+		H_TAS[6] = vd*SH_TAS[0];
+		H_TAS[22] = -SH_TAS[2];
+		H_TAS[23] = -SH_TAS[1];
 
 		// apply covariance correction via P_new = (I -K*H)*P
-		// first calculate expression for KHP
-		// then calculate P - KHP
-		float KHP[_k_num_states][_k_num_states];
-		float KH[5];
-		for (unsigned row = 0; row < _k_num_states; row++) {
-
-			KH[0] = Kfusion[row] * H_TAS[4];
-			KH[1] = Kfusion[row] * H_TAS[5];
-			KH[2] = Kfusion[row] * H_TAS[6];
-			KH[3] = Kfusion[row] * H_TAS[22];
-			KH[4] = Kfusion[row] * H_TAS[23];
-
-			for (unsigned column = 0; column < _k_num_states; column++) {
-				float tmp = KH[0] * P[4][column];
-				tmp += KH[1] * P[5][column];
-				tmp += KH[2] * P[6][column];
-				tmp += KH[3] * P[22][column];
-				tmp += KH[4] * P[23][column];
-				KHP[row][column] = tmp;
-			}
-		}
-
 		// if the covariance correction will result in a negative variance, then
 		// the covariance marix is unhealthy and must be corrected
-		bool healthy = true;
-		_fault_status.flags.bad_airspeed = false;
-		for (int i = 0; i < _k_num_states; i++) {
-			if (P[i][i] < KHP[i][i]) {
-				// zero rows and columns
-				zeroRows(P,i,i);
-				zeroCols(P,i,i);
-
-				//flag as unhealthy
-				healthy = false;
-
-				// update individual measurement health status
-				_fault_status.flags.bad_airspeed = true;
-
-			}
-		}
+		const uint8_t H_index[5] = {4, 5, 6, 22, 23};
+		bool healthy = updateCovariance(Kfusion, H_TAS, H_index, 5);
+		_fault_status.flags.bad_airspeed = !healthy;
 
-		// only apply covariance and state corrrections if healthy
+		// only apply state corrections if healthy
 		if (healthy) {
-			// apply the covariance corrections
-			for (unsigned row = 0; row < _k_num_states; row++) {
-				for (unsigned column = 0; column < _k_num_states; column++) {
-					P[row][column] = P[row][column] - KHP[row][column];
-				}
-			}
-
 			// correct the covariance marix for gross errors
-			fixCovarianceErrors();
+			fixTouchedCovarianceErrors();
 
 			// apply the state corrections
 			fuse(Kfusion, _airspeed_innov);
@@ -218,12 +235,7 @@ void Ekf::fuseAirspeed()
 		}
 	}
 }
-
-void Ekf::get_wind_velocity(float *wind)
-{
-	wind[0] = _state.wind_vel(0);
-	wind[1] = _state.wind_vel(1);
-}
+#endif
 
 /*
  * Reset the wind states using the current airspeed measurement, ground relative nav velocity, yaw angle and assumption of zero sideslip
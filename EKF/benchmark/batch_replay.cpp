@@ -0,0 +1,344 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file batch_replay.cpp
+ * Runs the ekf over one or more sensor logs as fast as possible and writes the estimator output
+ * for each log to a columnar binary file. Logs are processed in parallel with one ekf instance per worker thread.
+ *
+ * Usage: ecl_batch_replay [-j <threads>] [-o <output dir>] <log file> [<log file> ...]
+ *
+ * The log formats are described in sensor_log.h. The output for <name>.<ext> is written to <name>.ekf
+ * in the output directory, or next to the log if no directory is given, using the little endian layout:
+ *
+ * char   magic[8]       "ECLEKF01"
+ * uint32 num_columns
+ * uint32 reserved
+ * uint64 num_rows
+ * num_columns x {char name[32]; uint32 type; uint32 reserved;}   type 0 = uint64, 1 = float32
+ * column data, each column stored contiguously in descriptor order
+ *
+ * A row is written for each ekf prediction step. The first column is the IMU time stamp in usec.
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sensor_log.h"
+
+namespace
+{
+
+enum column_type {
+	COLUMN_UINT64 = 0,
+	COLUMN_FLOAT32
+};
+
+// accumulates the estimator output for a log one row at a time and writes it out column by column
+class estimate_writer
+{
+public:
+	void append(Ekf &ekf)
+	{
+		uint64_t time_us;
+		ekf.copy_timestamp(&time_us);
+		_time_us.push_back(time_us);
+		_column = 0;
+
+		float data[24];
+
+		ekf.copy_quaternion(data);
+		add("quat", data, 4);
+		ekf.get_velocity(data);
+		add("vel", data, 3);
+		ekf.get_position(data);
+		add("pos", data, 3);
+
+		ekf.get_state_delayed(data);
+		add("state", data, 24);
+
+		ekf.get_vel_pos_innov(data);
+		add("vel_pos_innov", data, 6);
+		ekf.get_vel_pos_innov_var(data);
+		add("vel_pos_innov_var", data, 6);
+		ekf.get_mag_innov(data);
+		add("mag_innov", data, 3);
+		ekf.get_mag_innov_var(data);
+		add("mag_innov_var", data, 3);
+		ekf.get_heading_innov(data);
+		add("heading_innov", data, 1);
+		ekf.get_heading_innov_var(data);
+		add("heading_innov_var", data, 1);
+		ekf.get_airspeed_innov(data);
+		add("airspeed_innov", data, 1);
+		ekf.get_airspeed_innov_var(data);
+		add("airspeed_innov_var", data, 1);
+		ekf.get_beta_innov(data);
+		add("beta_innov", data, 1);
+		ekf.get_beta_innov_var(data);
+		add("beta_innov_var", data, 1);
+		ekf.get_flow_innov(data);
+		add("flow_innov", data, 2);
+		ekf.get_flow_innov_var(data);
+		add("flow_innov_var", data, 2);
+		ekf.get_hagl_innov(data);
+		add("hagl_innov", data, 1);
+		ekf.get_hagl_innov_var(data);
+		add("hagl_innov_var", data, 1);
+		ekf.get_drag_innov(data);
+		add("drag_innov", data, 2);
+		ekf.get_drag_innov_var(data);
+		add("drag_innov_var", data, 2);
+
+		// the status words are exactly representable as floats
+		uint16_t status[4];
+		ekf.get_innovation_test_status(&status[0], &data[0], &data[1], &data[2], &data[3], &data[4], &data[5]);
+		add("mag_test_ratio", &data[0], 1);
+		add("vel_test_ratio", &data[1], 1);
+		add("pos_test_ratio", &data[2], 1);
+		add("hgt_test_ratio", &data[3], 1);
+		add("tas_test_ratio", &data[4], 1);
+		add("hagl_test_ratio", &data[5], 1);
+
+		ekf.get_control_mode(&status[1]);
+		ekf.get_filter_fault_status(&status[2]);
+		ekf.get_ekf_soln_status(&status[3]);
+
+		for (unsigned i = 0; i < 4; i++) {
+			data[i] = status[i];
+		}
+
+		add("innov_check_status", &data[0], 1);
+		add("control_mode", &data[1], 1);
+		add("fault_status", &data[2], 1);
+		add("soln_status", &data[3], 1);
+	}
+
+	size_t get_num_rows() const { return _time_us.size(); }
+
+	bool write(const char *filename) const
+	{
+		FILE *file = fopen(filename, "wb");
+
+		if (file == NULL) {
+			printf("unable to create %s\n", filename);
+			return false;
+		}
+
+		const char magic[8] = {'E', 'C', 'L', 'E', 'K', 'F', '0', '1'};
+		uint32_t num_columns = _columns.size() + 1;
+		uint32_t reserved = 0;
+		uint64_t num_rows = _time_us.size();
+
+		bool ok = fwrite(magic, sizeof(magic), 1, file) == 1
+			  && fwrite(&num_columns, sizeof(num_columns), 1, file) == 1
+			  && fwrite(&reserved, sizeof(reserved), 1, file) == 1
+			  && fwrite(&num_rows, sizeof(num_rows), 1, file) == 1
+			  && write_descriptor(file, "time_us", COLUMN_UINT64);
+
+		for (size_t i = 0; ok && i < _columns.size(); i++) {
+			ok = write_descriptor(file, _names[i].c_str(), COLUMN_FLOAT32);
+		}
+
+		ok = ok && fwrite(_time_us.data(), sizeof(uint64_t), num_rows, file) == num_rows;
+
+		for (size_t i = 0; ok && i < _columns.size(); i++) {
+			ok = fwrite(_columns[i].data(), sizeof(float), num_rows, file) == num_rows;
+		}
+
+		if (fclose(file) != 0 || !ok) {
+			printf("error writing %s\n", filename);
+			return false;
+		}
+
+		return true;
+	}
+
+private:
+	std::vector<uint64_t> _time_us;
+	std::vector<std::vector<float>> _columns;
+	std::vector<std::string> _names;
+	size_t _column{0};	// index of the next column to be filled in the current row
+
+	// append values to the next columns, creating the columns when the first row is added
+	void add(const char *name, const float *values, unsigned count)
+	{
+		for (unsigned i = 0; i < count; i++) {
+			if (_column == _columns.size()) {
+				std::string column_name(name);
+
+				if (count > 1) {
+					column_name += "_" + std::to_string(i);
+				}
+
+				_names.push_back(column_name);
+				_columns.push_back(std::vector<float>());
+			}
+
+			_columns[_column++].push_back(values[i]);
+		}
+	}
+
+	static bool write_descriptor(FILE *file, const char *name, column_type type)
+	{
+		char padded_name[32] = {};
+		strncpy(padded_name, name, sizeof(padded_name) - 1);
+		uint32_t descriptor[2] = {(uint32_t)type, 0};
+
+		return fwrite(padded_name, sizeof(padded_name), 1, file) == 1
+		       && fwrite(descriptor, sizeof(descriptor), 1, file) == 1;
+	}
+};
+
+// build the output file name from the log file name and optional output directory
+std::string output_filename(const std::string &log_filename, const char *output_dir)
+{
+	size_t name_start = log_filename.find_last_of('/');
+	name_start = (name_start == std::string::npos) ? 0 : name_start + 1;
+
+	std::string name = log_filename.substr(name_start);
+	size_t extension = name.find_last_of('.');
+
+	if (extension != std::string::npos && extension > 0) {
+		name.erase(extension);
+	}
+
+	std::string path = (output_dir != NULL) ? std::string(output_dir) + "/" : log_filename.substr(0, name_start);
+
+	return path + name + ".ekf";
+}
+
+bool process_log(const std::string &log_filename, const std::string &output_filename)
+{
+	// the log is streamed so only the estimator output is held in memory
+	sensor_log_reader reader;
+
+	if (!reader.open(log_filename.c_str())) {
+		return false;
+	}
+
+	// each log gets a newly constructed filter so results do not depend on the processing order
+	Ekf ekf;
+	estimate_writer writer;
+	log_record record;
+
+	while (reader.next(record)) {
+		replay_sensor_record(ekf, record);
+
+		if (record.type == SENSOR_IMU) {
+			// a prediction step is only performed when a new down-sampled IMU sample is available
+			imuSample imu_sample;
+			bool predict = ekf.get_imu_sample_down_sampled(imu_sample);
+			ekf.update();
+
+			if (predict) {
+				writer.append(ekf);
+			}
+		}
+	}
+
+	if (reader.failed() || !writer.write(output_filename.c_str())) {
+		return false;
+	}
+
+	printf("%s: %llu rows written to %s\n", log_filename.c_str(), (unsigned long long)writer.get_num_rows(),
+	       output_filename.c_str());
+	return true;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned num_threads = std::thread::hardware_concurrency();
+	const char *output_dir = NULL;
+	std::vector<std::string> logs;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			num_threads = (unsigned)atoi(argv[++i]);
+
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			output_dir = argv[++i];
+
+		} else {
+			logs.push_back(argv[i]);
+		}
+	}
+
+	if (logs.empty()) {
+		printf("usage: %s [-j <threads>] [-o <output dir>] <log file> [<log file> ...]\n", argv[0]);
+		return 1;
+	}
+
+	if (num_threads == 0) {
+		num_threads = 1;
+	}
+
+	if (num_threads > logs.size()) {
+		num_threads = logs.size();
+	}
+
+	// workers take the next unprocessed log until all have been processed
+	std::atomic<size_t> next_log(0);
+	std::atomic<unsigned> num_failed(0);
+	std::vector<std::thread> workers;
+
+	for (unsigned i = 0; i < num_threads; i++) {
+		workers.push_back(std::thread([&]() {
+			size_t log_index;
+
+			while ((log_index = next_log++) < logs.size()) {
+				if (!process_log(logs[log_index], output_filename(logs[log_index], output_dir))) {
+					num_failed++;
+				}
+			}
+		}));
+	}
+
+	for (size_t i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+
+	if (num_failed > 0) {
+		printf("%u of %llu logs failed\n", num_failed.load(), (unsigned long long)logs.size());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,573 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file kernel_benchmark.cpp
+ * Microbenchmarks of the observation buffers, quaternion math, covariance prediction and each observation
+ * fusion routine, so that the effect of a change on a single kernel can be measured.
+ *
+ * Usage: ecl_kernel_benchmark [-f <name filter>] [-o <csv file>]
+ *
+ * The filter kernels are run on a canned filter state, which is the filter after a synthetic 30 second log
+ * with the vehicle then set moving with the magnetic field and wind states active. The measurements are
+ * consistent with the canned state and the innovation gates are widened so that every fusion routine
+ * completes its state and covariance update. The states and covariance matrix are restored before each call.
+ *
+ * Each benchmark is run in 15 batches of at least 1 msec and the results are written as CSV, to stdout unless a
+ * file is given, with the columns:
+ *
+ * name         benchmark name
+ * size         buffer length for the buffer benchmarks, otherwise 0
+ * calls        number of calls in each batch
+ * median_ns    median of the batch mean execution times (nsec)
+ * min_ns       minimum of the batch mean execution times (nsec)
+ * net_ns       median_ns less the median time of restoring the canned state (nsec)
+ * updated      1 if the kernel changed the states, covariance matrix or terrain estimate, 0 if it did not, blank if
+ *              not applicable
+ *
+ * The EkfBatch benchmarks run the batched prediction and velocity and position fusion on size copies of the
+ * canned state and report net_ns as the median time per filter instance.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "sensor_log.h"
+#include "../ekf_batch.h"
+#include "../fast_math.h"
+
+// gives the benchmark access to the individual kernels and the state of a filter
+class EkfKernelAccess
+{
+public:
+	explicit EkfKernelAccess(Ekf &ekf) : _ekf(ekf) {}
+
+	// make the canned state used by all the filter kernels from a converged filter
+	void prepare()
+	{
+		Ekf &ekf = _ekf;
+
+		// the innovation gates are widened so the measurements are always fused
+		parameters &params = *ekf.getParamHandle();
+		params.mag_innov_gate = 100.0f;
+		params.heading_innov_gate = 100.0f;
+		params.vel_innov_gate = 100.0f;
+		params.posNE_innov_gate = 100.0f;
+		params.baro_innov_gate = 100.0f;
+		params.tas_innov_gate = 100.0f;
+		params.beta_innov_gate = 100.0f;
+		params.flow_innov_gate = 100.0f;
+		params.range_innov_gate = 100.0f;
+
+		// moving vehicle with the magnetic field and wind states active
+		ekf._state.vel = matrix::Vector3f(12.0f, 4.0f, -0.5f);
+#ifndef ECL_EKF_NO_WIND_STATES
+		ekf._state.wind_vel = matrix::Vector2f(3.0f, -2.0f);
+		ekf.P[22][22] = ekf.P[23][23] = 1.0f;
+		ekf._control_status.flags.wind = true;
+#endif
+#ifndef ECL_EKF_NO_MAG_STATES
+
+		for (unsigned i = 16; i < 22; i++) {
+			ekf.P[i][i] = fmaxf(ekf.P[i][i], 1e-4f);
+		}
+
+#endif
+		ekf._control_status.flags.in_air = true;
+		ekf._R_to_earth = ekf.quat_to_invrotmat(ekf._state.quat_nominal);
+
+		// measurements close to the values predicted from the states
+		ekf._mag_sample_delayed.mag = ekf._R_to_earth.transpose() * ekf._state.mag_I + ekf._state.mag_B
+					      + matrix::Vector3f(0.01f, -0.01f, 0.005f);
+
+		ekf._gps_sample_delayed.vel = ekf._state.vel + matrix::Vector3f(0.1f, -0.1f, 0.05f);
+		ekf._gps_sample_delayed.pos = matrix::Vector2f(ekf._state.pos(0) + 0.5f, ekf._state.pos(1) - 0.3f);
+		ekf._baro_sample_delayed.hgt = -ekf._state.pos(2) + ekf._baro_hgt_offset + ekf._hgt_sensor_offset + 0.2f;
+		ekf._fuse_hor_vel = ekf._fuse_vert_vel = ekf._fuse_pos = ekf._fuse_height = true;
+
+		Vector3f rel_wind = ekf._state.vel;
+#ifndef ECL_EKF_NO_WIND_STATES
+		rel_wind(0) -= ekf._state.wind_vel(0);
+		rel_wind(1) -= ekf._state.wind_vel(1);
+#endif
+		const Vector3f rel_wind_body = ekf._R_to_earth.transpose() * rel_wind;
+		ekf._airspeed_sample_delayed.true_airspeed = rel_wind.norm() + 0.3f;
+		ekf._airspeed_sample_delayed.eas2tas = 1.0f;
+		ekf._drag_sample_delayed.accelXY = matrix::Vector2f(-0.1f * rel_wind_body(0), -0.1f * rel_wind_body(1));
+
+		// level flight 5 m above flat ground
+		ekf._R_rng_to_earth_2_2 = ekf._R_to_earth(2, 2);
+		ekf._terrain_vpos = ekf._state.pos(2) + 5.0f;
+		ekf._terrain_var = 0.1f;
+		ekf.resetTerrainHypotheses();
+		ekf._range_sample_delayed.rng = 5.1f / ekf._R_rng_to_earth_2_2;
+
+		ekf._flow_sample_delayed.quality = 255;
+		ekf._flow_sample_delayed.dt = 0.05f;
+		ekf._flow_sample_delayed.gyroXYZ = matrix::Vector3f(0.001f, -0.001f, 0.0f);
+		ekf._flow_sample_delayed.flowRadXYcomp = matrix::Vector2f(rel_wind_body(1) / 5.0f * 0.05f, -rel_wind_body(0) / 5.0f * 0.05f);
+		ekf._flow_sample_delayed.flowRadXY = ekf._flow_sample_delayed.flowRadXYcomp;
+
+		_state = ekf._state;
+		_P = ekf.P;
+		memcpy(_terrain_hyp_vpos, ekf._terrain_hyp_vpos, sizeof(_terrain_hyp_vpos));
+		memcpy(_terrain_hyp_var, ekf._terrain_hyp_var, sizeof(_terrain_hyp_var));
+		memcpy(_terrain_hyp_weight, ekf._terrain_hyp_weight, sizeof(_terrain_hyp_weight));
+	}
+
+	void restore()
+	{
+		_ekf._state = _state;
+		_ekf.P = _P;
+		memcpy(_ekf._terrain_hyp_vpos, _terrain_hyp_vpos, sizeof(_terrain_hyp_vpos));
+		memcpy(_ekf._terrain_hyp_var, _terrain_hyp_var, sizeof(_terrain_hyp_var));
+		memcpy(_ekf._terrain_hyp_weight, _terrain_hyp_weight, sizeof(_terrain_hyp_weight));
+	}
+
+	// returns true if the states, covariance matrix or terrain estimates differ from the canned state
+	bool updated() const
+	{
+		return memcmp(&_ekf._state, &_state, sizeof(_state)) != 0 || memcmp(&_ekf.P, &_P, sizeof(_P)) != 0
+		       || memcmp(_ekf._terrain_hyp_vpos, _terrain_hyp_vpos, sizeof(_terrain_hyp_vpos)) != 0
+		       || memcmp(_ekf._terrain_hyp_var, _terrain_hyp_var, sizeof(_terrain_hyp_var)) != 0;
+	}
+
+	void predictCovariance() { _ekf.predictCovariance(); }
+	void fuseVelPosHeight() { _ekf._fuse_hor_vel = _ekf._fuse_vert_vel = _ekf._fuse_pos = _ekf._fuse_height = true; _ekf.fuseVelPosHeight(); }
+	void fuseHeading() { _ekf.fuseHeading(); }
+	void fuseOptFlow() { _ekf.fuseOptFlow(); }
+	void fuseHagl() { _ekf.fuseHagl(); }
+#ifndef ECL_EKF_NO_MAG_STATES
+	void fuseMag(bool batched) { _ekf._params.mag_fuse_batch = batched ? 1 : 0; _ekf.fuseMag(); }
+	void fuseDeclination() { _ekf.fuseDeclination(); }
+#endif
+#ifndef ECL_EKF_NO_WIND_STATES
+	void fuseAirData(bool airspeed, bool sideslip) { _ekf._fuse_airspeed = airspeed; _ekf._fuse_sideslip = sideslip; _ekf.fuseAirData(); }
+	void fuseDrag() { _ekf.fuseDrag(); }
+#endif
+	Matrix3f quat_to_invrotmat(const Quaternion &quat) { return _ekf.quat_to_invrotmat(quat); }
+	const Ekf &ekf() const { return _ekf; }
+	const imuSample &imu_sample_delayed() const { return _ekf._imu_sample_delayed; }
+	const gpsSample &gps_sample_delayed() const { return _ekf._gps_sample_delayed; }
+
+private:
+	Ekf &_ekf;
+	stateSample _state{};
+	decltype(Ekf::P) _P;
+	float _terrain_hyp_vpos[Ekf::_k_num_terrain_hyp] {};
+	float _terrain_hyp_var[Ekf::_k_num_terrain_hyp] {};
+	float _terrain_hyp_weight[Ekf::_k_num_terrain_hyp] {};
+};
+
+namespace
+{
+
+typedef std::chrono::steady_clock benchmark_clock;
+
+const unsigned num_batches = 15;
+const double min_batch_ns = 1e6;
+
+struct benchmark_result {
+	std::string name;
+	unsigned size;
+	uint64_t calls;
+	double median_ns;
+	double min_ns;
+	double net_ns;
+	int updated;	// -1 if not applicable
+};
+
+template <typename function_type>
+double time_batch(uint64_t calls, function_type &function)
+{
+	const auto start = benchmark_clock::now();
+
+	for (uint64_t i = 0; i < calls; i++) {
+		function();
+	}
+
+	return std::chrono::duration<double, std::nano>(benchmark_clock::now() - start).count();
+}
+
+// time a function, the number of calls in a batch is doubled until a batch lasts at least min_batch_ns
+template <typename function_type>
+benchmark_result measure(const char *name, unsigned size, function_type function)
+{
+	benchmark_result result{name, size, 1, 0.0, 0.0, 0.0, -1};
+
+	while (time_batch(result.calls, function) < min_batch_ns && result.calls < (1ULL << 30)) {
+		result.calls *= 2;
+	}
+
+	std::vector<double> batch_ns(num_batches);
+
+	for (unsigned i = 0; i < num_batches; i++) {
+		batch_ns[i] = time_batch(result.calls, function) / (double)result.calls;
+	}
+
+	std::sort(batch_ns.begin(), batch_ns.end());
+	result.median_ns = batch_ns[num_batches / 2];
+	result.min_ns = batch_ns[0];
+	result.net_ns = result.median_ns;
+	return result;
+}
+
+volatile float sink;
+
+// deterministic test quaternions and vectors
+uint32_t random_state = 2463534242u;
+
+float random_float(float min, float max)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return min + (max - min) * (float)(random_state >> 8) / 16777216.0f;
+}
+
+void ringbuffer_benchmarks(const std::string &filter, std::vector<benchmark_result> &results)
+{
+	const unsigned lengths[] = {4, 12, 32, 100};
+
+	for (unsigned length : lengths) {
+		RingBuffer<gpsSample> buffer;
+		buffer.allocate(length);
+		buffer.set_max_sample_age(1000000000ULL);
+		gpsSample sample{};
+		uint64_t time_us = 0;
+
+		for (unsigned i = 0; i < length; i++) {
+			sample.time_us = time_us += 10000;
+			buffer.push(sample);
+		}
+
+		if (std::string("RingBuffer.push").find(filter) != std::string::npos) {
+			results.push_back(measure("RingBuffer.push", length, [&]() {
+				sample.time_us = time_us += 10000;
+				buffer.push(sample);
+			}));
+		}
+
+		// keep the buffer half full, the sample popped is half the buffer length older than the newest
+		if (std::string("RingBuffer.push_pop_first_older_than").find(filter) != std::string::npos) {
+			results.push_back(measure("RingBuffer.push_pop_first_older_than", length, [&]() {
+				sample.time_us = time_us += 10000;
+				buffer.push(sample);
+				gpsSample popped{};
+				buffer.pop_first_older_than(time_us - 10000 * (length / 2), &popped);
+				sink = popped.hgt;
+			}));
+		}
+
+		// a request older than all samples in the buffer fails after searching the buffer
+		if (std::string("RingBuffer.pop_first_older_than_miss").find(filter) != std::string::npos) {
+			results.push_back(measure("RingBuffer.pop_first_older_than_miss", length, [&]() {
+				gpsSample popped{};
+				sink = buffer.pop_first_older_than(1, &popped) ? 1.0f : 0.0f;
+			}));
+		}
+	}
+}
+
+void quaternion_benchmarks(EkfKernelAccess &access, const std::string &filter, std::vector<benchmark_result> &results)
+{
+	const unsigned count = 256;
+	std::vector<Quaternion> quats(count);
+	std::vector<Vector3f> vectors(count);
+
+	for (unsigned i = 0; i < count; i++) {
+		quats[i] = Quaternion(random_float(-1.0f, 1.0f), random_float(-1.0f, 1.0f), random_float(-1.0f, 1.0f),
+				 random_float(-1.0f, 1.0f));
+		quats[i].normalize();
+		vectors[i] = matrix::Vector3f(random_float(-0.02f, 0.02f), random_float(-0.02f, 0.02f), random_float(-0.02f, 0.02f));
+	}
+
+	unsigned index = 0;
+
+	if (std::string("quat_to_invrotmat").find(filter) != std::string::npos) {
+		results.push_back(measure("quat_to_invrotmat", 0, [&]() {
+			const Matrix3f R = access.quat_to_invrotmat(quats[index++ % count]);
+			sink = R(0, 1);
+		}));
+	}
+
+	if (std::string("Quaternion.product").find(filter) != std::string::npos) {
+		results.push_back(measure("Quaternion.product", 0, [&]() {
+			const Quaternion q = quats[index % count] * quats[(index + 1) % count];
+			index++;
+			sink = q(1);
+		}));
+	}
+
+	if (std::string("Quaternion.to_dcm").find(filter) != std::string::npos) {
+		results.push_back(measure("Quaternion.to_dcm", 0, [&]() {
+			const matrix::Dcmf R(quats[index++ % count]);
+			sink = R(0, 1);
+		}));
+	}
+
+	if (std::string("Quaternion.from_rotation_vector").find(filter) != std::string::npos) {
+		results.push_back(measure("Quaternion.from_rotation_vector", 0, [&]() {
+			Quaternion q;
+			ecl::quat_from_rotation_vector(q, vectors[index++ % count]);
+			sink = q(1);
+		}));
+	}
+
+	if (std::string("Quaternion.normalize").find(filter) != std::string::npos) {
+		results.push_back(measure("Quaternion.normalize", 0, [&]() {
+			Quaternion q = quats[index++ % count] * 1.001f;
+			ecl::normalize_quat(q);
+			sink = q(1);
+		}));
+	}
+
+	if (std::string("Quaternion.rotate_vector").find(filter) != std::string::npos) {
+		results.push_back(measure("Quaternion.rotate_vector", 0, [&]() {
+			const Vector3f v = quats[index % count].conjugate(vectors[index % count]);
+			index++;
+			sink = v(0);
+		}));
+	}
+}
+
+template <typename function_type>
+void kernel_benchmark(const char *name, EkfKernelAccess &access, double restore_ns, const std::string &filter,
+		      std::vector<benchmark_result> &results, function_type function)
+{
+	if (std::string(name).find(filter) == std::string::npos) {
+		return;
+	}
+
+	access.restore();
+	function();
+	const bool updated = access.updated();
+
+	benchmark_result result = measure(name, 0, [&]() {
+		access.restore();
+		function();
+	});
+
+	result.net_ns = result.median_ns - restore_ns;
+	result.updated = updated ? 1 : 0;
+	results.push_back(result);
+}
+
+void filter_benchmarks(EkfKernelAccess &access, const std::string &filter, std::vector<benchmark_result> &results)
+{
+	benchmark_result restore = measure("restore_state", 0, [&]() { access.restore(); });
+	const double restore_ns = restore.median_ns;
+
+	if (restore.name.find(filter) != std::string::npos) {
+		results.push_back(restore);
+	}
+
+	kernel_benchmark("predictCovariance", access, restore_ns, filter, results, [&]() { access.predictCovariance(); });
+	kernel_benchmark("fuseVelPosHeight", access, restore_ns, filter, results, [&]() { access.fuseVelPosHeight(); });
+	kernel_benchmark("fuseHeading", access, restore_ns, filter, results, [&]() { access.fuseHeading(); });
+#ifndef ECL_EKF_NO_MAG_STATES
+	kernel_benchmark("fuseMag", access, restore_ns, filter, results, [&]() { access.fuseMag(false); });
+	kernel_benchmark("fuseMag.batched", access, restore_ns, filter, results, [&]() { access.fuseMag(true); });
+	kernel_benchmark("fuseDeclination", access, restore_ns, filter, results, [&]() { access.fuseDeclination(); });
+#endif
+#ifndef ECL_EKF_NO_WIND_STATES
+	kernel_benchmark("fuseAirData.airspeed", access, restore_ns, filter, results, [&]() { access.fuseAirData(true, false); });
+	kernel_benchmark("fuseAirData.sideslip", access, restore_ns, filter, results, [&]() { access.fuseAirData(false, true); });
+	kernel_benchmark("fuseAirData.both", access, restore_ns, filter, results, [&]() { access.fuseAirData(true, true); });
+	kernel_benchmark("fuseDrag", access, restore_ns, filter, results, [&]() { access.fuseDrag(); });
+#endif
+	kernel_benchmark("fuseOptFlow", access, restore_ns, filter, results, [&]() { access.fuseOptFlow(); });
+	kernel_benchmark("fuseHagl", access, restore_ns, filter, results, [&]() { access.fuseHagl(); });
+}
+
+void batch_benchmarks(EkfKernelAccess &access, const std::string &filter, std::vector<benchmark_result> &results)
+{
+	const unsigned sizes[] = {EkfBatch::lane_width, 64, 1024};
+	const imuSample &imu = access.imu_sample_delayed();
+	const gpsSample &gps = access.gps_sample_delayed();
+
+	for (unsigned size : sizes) {
+		EkfBatch batch;
+
+		if (!batch.allocate(size)) {
+			continue;
+		}
+
+		batch.setParameters(*const_cast<Ekf &>(access.ekf()).getParamHandle());
+
+		// the same samples and observations are used for every instance
+		std::vector<float> imu_data[8];
+		std::vector<float> obs_data[12];
+
+		for (unsigned i = 0; i < 3; i++) {
+			imu_data[i].assign(size, imu.delta_ang(i));
+			imu_data[i + 3].assign(size, imu.delta_vel(i));
+			obs_data[i].assign(size, gps.vel(i));
+			obs_data[i + 6].assign(size, 0.25f);
+		}
+
+		imu_data[6].assign(size, imu.delta_ang_dt);
+		imu_data[7].assign(size, imu.delta_vel_dt);
+
+		for (unsigned i = 0; i < 2; i++) {
+			obs_data[i + 3].assign(size, gps.pos(i));
+			obs_data[i + 9].assign(size, 1.0f);
+		}
+
+		ekf_batch_imu batch_imu{};
+		batch_imu.time_us = imu.time_us;
+
+		for (unsigned i = 0; i < 3; i++) {
+			batch_imu.delta_ang[i] = imu_data[i].data();
+			batch_imu.delta_vel[i] = imu_data[i + 3].data();
+		}
+
+		batch_imu.delta_ang_dt = imu_data[6].data();
+		batch_imu.delta_vel_dt = imu_data[7].data();
+
+		ekf_batch_vel_pos batch_obs{};
+
+		for (unsigned i = 0; i < 5; i++) {
+			batch_obs.obs[i] = obs_data[i].data();
+			batch_obs.obs_var[i] = obs_data[i + 6].data();
+		}
+
+		batch_obs.gate[0] = batch_obs.gate[1] = batch_obs.gate[2] = 100.0f;
+
+		const auto reset = [&]() {
+			for (unsigned i = 0; i < size; i++) {
+				batch.set_instance(i, access.ekf());
+			}
+		};
+
+		const struct {
+			const char *name;
+			std::function<void()> function;
+		} kernels[] = {
+			{"EkfBatch.predict", [&]() { batch.predict(batch_imu); }},
+			{"EkfBatch.fuseVelPos", [&]() { batch.fuseVelPos(batch_obs); }},
+		};
+
+		for (const auto &kernel : kernels) {
+			if (std::string(kernel.name).find(filter) == std::string::npos) {
+				continue;
+			}
+
+			reset();
+			benchmark_result result = measure(kernel.name, size, kernel.function);
+			result.net_ns = result.median_ns / (double)size;
+			results.push_back(result);
+		}
+	}
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	std::string filter;
+	const char *output = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			filter = argv[++i];
+
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			output = argv[++i];
+
+		} else {
+			printf("usage: %s [-f <name filter>] [-o <csv file>]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	// converge a filter on a synthetic log to give the canned state
+	std::vector<log_record> records;
+	generate_sensor_log(30.0f, records);
+	Ekf ekf;
+
+	for (const log_record &record : records) {
+		replay_sensor_record(ekf, record);
+
+		if (record.type == SENSOR_IMU) {
+			ekf.update();
+		}
+	}
+
+	EkfKernelAccess access(ekf);
+	access.prepare();
+
+	std::vector<benchmark_result> results;
+	ringbuffer_benchmarks(filter, results);
+	quaternion_benchmarks(access, filter, results);
+	filter_benchmarks(access, filter, results);
+	batch_benchmarks(access, filter, results);
+
+	FILE *file = output != NULL ? fopen(output, "w") : stdout;
+
+	if (file == NULL) {
+		printf("unable to create %s\n", output);
+		return 1;
+	}
+
+	// separate the table from any filter messages written to stdout
+	if (file == stdout) {
+		printf("\n");
+	}
+
+	fprintf(file, "name,size,calls,median_ns,min_ns,net_ns,updated\n");
+
+	for (const benchmark_result &result : results) {
+		fprintf(file, "%s,%u,%llu,%.2f,%.2f,%.2f,", result.name.c_str(), result.size, (unsigned long long)result.calls,
+			result.median_ns, result.min_ns, result.net_ns);
+
+		if (result.updated >= 0) {
+			fprintf(file, "%d", result.updated);
+		}
+
+		fprintf(file, "\n");
+	}
+
+	if (output != NULL && fclose(file) != 0) {
+		printf("error writing %s\n", output);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,169 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file math_benchmark.cpp
+ * Checks the fast math approximations against double precision reference functions and compares
+ * their execution time with the C library. Returns a non zero exit code if an error bound in
+ * fast_math.h is exceeded.
+ *
+ * Usage: ecl_math_benchmark
+ */
+
+#ifndef ECL_FAST_MATH
+#define ECL_FAST_MATH
+#endif
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "../fast_math.h"
+
+namespace
+{
+
+const unsigned num_samples = 1000000;
+const unsigned num_timing_passes = 20;
+
+// xorshift generator so the test arguments are the same on every platform
+uint32_t random_state = 2463534242u;
+
+float random_float(float min, float max)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return min + (max - min) * (float)(random_state >> 8) / 16777216.0f;
+}
+
+float sink = 0.0f;
+
+template <typename function_type>
+double time_ns(const std::vector<float> &x, const std::vector<float> &y, function_type function)
+{
+	float sum = 0.0f;
+	const auto start = std::chrono::steady_clock::now();
+
+	for (unsigned pass = 0; pass < num_timing_passes; pass++) {
+		for (size_t i = 0; i < x.size(); i++) {
+			sum += function(x[i], y[i]);
+		}
+	}
+
+	const auto end = std::chrono::steady_clock::now();
+	sink += sum;
+	return std::chrono::duration<double, std::nano>(end - start).count() / (num_timing_passes * x.size());
+}
+
+bool report(const char *name, double max_error, float bound, double fast_ns, double libm_ns)
+{
+	const bool pass = max_error <= bound;
+	printf("%-10s max error %10.3g bound %10.3g %s  %6.2f ns  libm %6.2f ns\n", name, max_error, (double)bound,
+	       pass ? "pass" : "FAIL", fast_ns, libm_ns);
+	return pass;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	bool pass = true;
+	std::vector<float> x(num_samples);
+	std::vector<float> y(num_samples);
+
+	// reciprocal square root over the range of variances and vector lengths used by the filter
+	double max_error = 0.0;
+
+	for (unsigned i = 0; i < num_samples; i++) {
+		x[i] = powf(10.0f, random_float(-12.0f, 12.0f));
+		const double reference = 1.0 / std::sqrt((double)x[i]);
+		max_error = std::fmax(max_error, std::fabs(ecl::inv_sqrt(x[i]) - reference) / reference);
+		max_error = std::fmax(max_error, std::fabs(ecl::sqrt(x[i]) - 1.0 / reference) * reference);
+	}
+
+	pass &= report("inv_sqrt", max_error, ecl::inv_sqrt_max_rel_error,
+			time_ns(x, y, [](float a, float b) { return ecl::inv_sqrt(a); }),
+			time_ns(x, y, [](float a, float b) { return 1.0f / sqrtf(a); }));
+
+	// sine and cosine
+	max_error = 0.0;
+
+	for (unsigned i = 0; i < num_samples; i++) {
+		x[i] = random_float(-ecl::sin_cos_max_arg, ecl::sin_cos_max_arg);
+
+		if (i < num_samples / 2) {
+			// most arguments in the filter are small angles
+			x[i] *= 0.01f;
+		}
+
+		float s;
+		float c;
+		ecl::sin_cos(x[i], s, c);
+		max_error = std::fmax(max_error, std::fabs(s - std::sin((double)x[i])));
+		max_error = std::fmax(max_error, std::fabs(c - std::cos((double)x[i])));
+	}
+
+	pass &= report("sin_cos", max_error, ecl::sin_cos_max_abs_error,
+			time_ns(x, y, [](float a, float b) { float s, c; ecl::sin_cos(a, s, c); return s + c; }),
+			time_ns(x, y, [](float a, float b) { return sinf(a) + cosf(a); }));
+
+	// four quadrant arc tangent including the axes
+	max_error = 0.0;
+
+	for (unsigned i = 0; i < num_samples; i++) {
+		x[i] = random_float(-10.0f, 10.0f);
+		y[i] = random_float(-10.0f, 10.0f);
+
+		if (i % 1000 == 0) {
+			x[i] = 0.0f;
+
+		} else if (i % 1000 == 1) {
+			y[i] = 0.0f;
+		}
+
+		if (x[i] == 0.0f && y[i] == 0.0f) {
+			continue;
+		}
+
+		max_error = std::fmax(max_error, std::fabs(ecl::atan2(y[i], x[i]) - std::atan2((double)y[i], (double)x[i])));
+	}
+
+	pass &= report("atan2", max_error, ecl::atan2_max_abs_error,
+			time_ns(x, y, [](float a, float b) { return ecl::atan2(b, a); }),
+			time_ns(x, y, [](float a, float b) { return atan2f(b, a); }));
+
+	printf("%s\n", pass ? "all error bounds met" : "error bounds exceeded");
+	return (pass && sink != 1.0f) ? 0 : 1;
+}
@@ -0,0 +1,260 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file memory_report.cpp
+ * Reports the memory needed by one EKF instance for a parameter configuration and checks it against a budget.
+ *
+ * Usage: ecl_memory_report [-p <name>=<value>] [-s <static bytes>] [-m <heap bytes>] [-k <stack bytes>] [<log file>]
+ *
+ * The buffer lengths, static and heap memory are calculated by Ekf::get_memory_footprint() for the default
+ * parameters with any -p values applied, which can be given more than once. The stack high water mark is measured by
+ * replaying the log, or a synthetic 60 second log if none is given, on a thread with a pre-filled stack. It covers
+ * the calls made by the replay, so it is a lower bound of the worst case. The worst case call chain of Ekf::update()
+ * is found from the compiler call graph by python/stack_usage.py.
+ *
+ * The report is written as one "name value" pair per line. The exit status is 1 if the parameters need longer
+ * buffers than the filter supports or any of the given budgets is exceeded.
+ */
+
+#include <pthread.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "sensor_log.h"
+
+namespace
+{
+
+// parameters that set the buffer lengths
+struct buffer_parameter {
+	const char *name;
+	float parameters::*float_value;
+	int parameters::*int_value;
+};
+
+const buffer_parameter buffer_parameters[] = {
+	{"mag_delay_ms", &parameters::mag_delay_ms, nullptr},
+	{"baro_delay_ms", &parameters::baro_delay_ms, nullptr},
+	{"gps_delay_ms", &parameters::gps_delay_ms, nullptr},
+	{"airspeed_delay_ms", &parameters::airspeed_delay_ms, nullptr},
+	{"flow_delay_ms", &parameters::flow_delay_ms, nullptr},
+	{"range_delay_ms", &parameters::range_delay_ms, nullptr},
+	{"ev_delay_ms", &parameters::ev_delay_ms, nullptr},
+	{"sensor_interval_min_ms", nullptr, &parameters::sensor_interval_min_ms},
+	{"filter_update_period_ms", nullptr, &parameters::filter_update_period_ms},
+	{"filter_update_adaptive", nullptr, &parameters::filter_update_adaptive},
+	{"filter_update_period_min_ms", nullptr, &parameters::filter_update_period_min_ms},
+};
+
+const unsigned num_buffer_parameters = sizeof(buffer_parameters) / sizeof(buffer_parameters[0]);
+
+// set a parameter from a name=value argument, returns false if the name is not known
+bool set_parameter(parameters &params, const char *argument)
+{
+	const char *value = strchr(argument, '=');
+
+	if (value == NULL) {
+		return false;
+	}
+
+	for (unsigned i = 0; i < num_buffer_parameters; i++) {
+		const buffer_parameter &parameter = buffer_parameters[i];
+
+		if (strlen(parameter.name) == (size_t)(value - argument) && strncmp(argument, parameter.name, value - argument) == 0) {
+			if (parameter.float_value != nullptr) {
+				params.*parameter.float_value = (float)atof(value + 1);
+
+			} else {
+				params.*parameter.int_value = atoi(value + 1);
+			}
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// a thread stack is filled with the pattern before the replay and the high water mark is found from the lowest
+// address that has changed, which assumes the stack grows down
+const size_t replay_stack_bytes = 256 * 1024;
+const unsigned char stack_fill = 0xa5;
+
+struct replay_job {
+	Ekf *ekf;			// the filter is not on the measured stack
+	const std::vector<log_record> *records;
+	uintptr_t caller_stack;		// stack address in the function that calls the filter
+};
+
+void *replay(void *arg)
+{
+	replay_job *job = static_cast<replay_job *>(arg);
+	volatile char marker = 0;
+	job->caller_stack = reinterpret_cast<uintptr_t>(&marker);
+
+	for (const log_record &record : *job->records) {
+		replay_sensor_record(*job->ekf, record);
+
+		if (record.type == SENSOR_IMU) {
+			job->ekf->update();
+		}
+	}
+
+	return NULL;
+}
+
+// replay the log on a thread with a pre-filled stack and return the stack high water mark below the function that
+// calls the filter, 0 if it failed
+size_t measure_stack(const parameters &params, const std::vector<log_record> &records)
+{
+	std::vector<unsigned char> stack(replay_stack_bytes, stack_fill);
+	Ekf ekf;
+	*ekf.getParamHandle() = params;
+	replay_job job{&ekf, &records, 0};
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	if (pthread_attr_init(&attr) != 0) {
+		return 0;
+	}
+
+	const bool started = pthread_attr_setstack(&attr, stack.data(), stack.size()) == 0
+			     && pthread_create(&thread, &attr, replay, &job) == 0;
+	pthread_attr_destroy(&attr);
+
+	if (!started || pthread_join(thread, NULL) != 0) {
+		return 0;
+	}
+
+	size_t unused = 0;
+
+	while (unused < stack.size() && stack[unused] == stack_fill) {
+		unused++;
+	}
+
+	const uintptr_t lowest_used = reinterpret_cast<uintptr_t>(stack.data() + unused);
+	return job.caller_stack > lowest_used ? job.caller_stack - lowest_used : 0;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	parameters params;
+	size_t static_max = 0;
+	size_t heap_max = 0;
+	size_t stack_max = 0;
+	const char *log_filename = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+			if (!set_parameter(params, argv[++i])) {
+				printf("unknown parameter %s\n", argv[i]);
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			static_max = strtoul(argv[++i], NULL, 10);
+
+		} else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			heap_max = strtoul(argv[++i], NULL, 10);
+
+		} else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+			stack_max = strtoul(argv[++i], NULL, 10);
+
+		} else if (argv[i][0] != '-' && log_filename == NULL) {
+			log_filename = argv[i];
+
+		} else {
+			printf("usage: %s [-p <name>=<value>] [-s <static bytes>] [-m <heap bytes>] [-k <stack bytes>] [<log file>]\n",
+			       argv[0]);
+			return 1;
+		}
+	}
+
+	ekf_memory_footprint footprint;
+	const bool supported = Ekf::get_memory_footprint(params, &footprint);
+
+	std::vector<log_record> records;
+
+	if (log_filename == NULL) {
+		generate_sensor_log(60.0f, records);
+
+	} else if (!read_sensor_log(log_filename, records)) {
+		printf("unable to read %s\n", log_filename);
+		return 1;
+	}
+
+	const size_t stack_bytes = supported ? measure_stack(params, records) : 0;
+
+	// separate the report from any filter messages
+	printf("\n");
+	printf("num_states %u\n", Ekf::get_num_states());
+	printf("imu_buffer_length %u\n", footprint.imu_buffer_length);
+	printf("obs_buffer_length %u\n", footprint.obs_buffer_length);
+	printf("static_bytes %zu\n", footprint.static_bytes);
+	printf("heap_bytes %zu\n", footprint.heap_bytes);
+	printf("stack_high_water_bytes %zu\n", stack_bytes);
+
+	bool pass = true;
+
+	if (!supported) {
+		printf("the sensor delays need longer buffers than the filter supports\n");
+		pass = false;
+	}
+
+	if (supported && stack_bytes == 0) {
+		printf("unable to measure the stack use\n");
+		pass = false;
+	}
+
+	if (static_max > 0 && footprint.static_bytes > static_max) {
+		printf("static memory exceeds the budget of %zu bytes\n", static_max);
+		pass = false;
+	}
+
+	if (heap_max > 0 && footprint.heap_bytes > heap_max) {
+		printf("heap memory exceeds the budget of %zu bytes\n", heap_max);
+		pass = false;
+	}
+
+	if (stack_max > 0 && stack_bytes > stack_max) {
+		printf("stack high water mark exceeds the budget of %zu bytes\n", stack_max);
+		pass = false;
+	}
+
+	return pass ? 0 : 1;
+}
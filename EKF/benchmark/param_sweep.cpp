@@ -0,0 +1,446 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file param_sweep.cpp
+ * Replays one sensor log through many ekf instances with randomly perturbed noise parameters and scores
+ * each parameter set. The log is read once and shared by all runs, which are processed in parallel with
+ * one ekf instance per run.
+ *
+ * Usage: ecl_param_sweep [-j <threads>] [-n <runs>] [-s <seed>] [-r <range>] [-p <name,name,...>] [-o <csv file>] <log file>
+ *
+ * Run 0 uses the default parameters. For the other runs each selected parameter is multiplied by a factor drawn
+ * from a log-uniform distribution between 1/range and range. All tunable parameters are perturbed unless a list
+ * is given with -p. The results are written as CSV sorted by score, best first.
+ *
+ * The score is lower for a better tuned filter and is the sum of:
+ * - |ln(mean normalised innovation squared)| for each observation type that was fused, which is zero
+ *   when the innovation variances match the observed innovations
+ * - the fraction of prediction steps with a failed innovation consistency check for each observation type
+ * - the mean magnitude of the output predictor angle (rad), velocity (m/sec) and position (m) tracking errors
+ */
+
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sensor_log.h"
+
+namespace
+{
+
+struct tunable_parameter {
+	const char *name;
+	float parameters::*value;
+};
+
+const tunable_parameter tunable_parameters[] = {
+	{"gyro_noise", &parameters::gyro_noise},
+	{"accel_noise", &parameters::accel_noise},
+	{"gyro_bias_p_noise", &parameters::gyro_bias_p_noise},
+	{"accel_bias_p_noise", &parameters::accel_bias_p_noise},
+	{"mage_p_noise", &parameters::mage_p_noise},
+	{"magb_p_noise", &parameters::magb_p_noise},
+	{"wind_vel_p_noise", &parameters::wind_vel_p_noise},
+	{"gps_vel_noise", &parameters::gps_vel_noise},
+	{"gps_pos_noise", &parameters::gps_pos_noise},
+	{"baro_noise", &parameters::baro_noise},
+	{"mag_heading_noise", &parameters::mag_heading_noise},
+	{"mag_noise", &parameters::mag_noise},
+	{"eas_noise", &parameters::eas_noise},
+	{"beta_noise", &parameters::beta_noise},
+	{"range_noise", &parameters::range_noise},
+	{"flow_noise", &parameters::flow_noise},
+};
+
+const unsigned num_tunable_parameters = sizeof(tunable_parameters) / sizeof(tunable_parameters[0]);
+
+// observation types that contribute to the score
+enum observation_type {
+	OBS_VEL = 0,
+	OBS_POS,
+	OBS_HGT,
+	OBS_MAG,
+	OBS_HEADING,
+	OBS_AIRSPEED,
+	OBS_BETA,
+	OBS_FLOW,
+	OBS_HAGL,
+	OBS_NUM_TYPES
+};
+
+const char *observation_names[OBS_NUM_TYPES] = {"vel", "pos", "hgt", "mag", "heading", "airspeed", "beta", "flow", "hagl"};
+
+struct run_result {
+	float param_values[num_tunable_parameters];
+	double nis_sum[OBS_NUM_TYPES];
+	unsigned nis_count[OBS_NUM_TYPES];
+	unsigned num_rejected[OBS_NUM_TYPES];
+	double tracking_error_sum[3];
+	unsigned num_steps;
+	double score;
+};
+
+// accumulates the normalised innovation squared for one observation type, counting each fusion once
+class innovation_monitor
+{
+public:
+	void update(const float *innov, const float *innov_var, unsigned count, double &nis_sum, unsigned &nis_count)
+	{
+		bool changed = false;
+
+		for (unsigned i = 0; i < count; i++) {
+			changed = changed || innov[i] != _last_innov[i];
+			_last_innov[i] = innov[i];
+		}
+
+		if (!changed) {
+			return;
+		}
+
+		for (unsigned i = 0; i < count; i++) {
+			if (innov_var[i] > 0.0f) {
+				nis_sum += (double)innov[i] * innov[i] / innov_var[i];
+				nis_count++;
+			}
+		}
+	}
+
+private:
+	float _last_innov[3] {};
+};
+
+void run_filter(const std::vector<log_record> &records, run_result &result)
+{
+	Ekf ekf;
+	parameters *params = ekf.getParamHandle();
+
+	for (unsigned i = 0; i < num_tunable_parameters; i++) {
+		params->*tunable_parameters[i].value = result.param_values[i];
+	}
+
+	innovation_monitor monitors[OBS_NUM_TYPES];
+
+	for (size_t i = 0; i < records.size(); i++) {
+		replay_sensor_record(ekf, records[i]);
+
+		if (records[i].type != SENSOR_IMU) {
+			continue;
+		}
+
+		// the innovations are only sampled after a filter update
+		if (!ekf.update()) {
+			continue;
+		}
+
+		float innov[6], innov_var[6];
+		ekf.get_vel_pos_innov(innov);
+		ekf.get_vel_pos_innov_var(innov_var);
+		monitors[OBS_VEL].update(&innov[0], &innov_var[0], 3, result.nis_sum[OBS_VEL], result.nis_count[OBS_VEL]);
+		monitors[OBS_POS].update(&innov[3], &innov_var[3], 2, result.nis_sum[OBS_POS], result.nis_count[OBS_POS]);
+		monitors[OBS_HGT].update(&innov[5], &innov_var[5], 1, result.nis_sum[OBS_HGT], result.nis_count[OBS_HGT]);
+
+		ekf.get_mag_innov(innov);
+		ekf.get_mag_innov_var(innov_var);
+		monitors[OBS_MAG].update(innov, innov_var, 3, result.nis_sum[OBS_MAG], result.nis_count[OBS_MAG]);
+
+		ekf.get_heading_innov(innov);
+		ekf.get_heading_innov_var(innov_var);
+		monitors[OBS_HEADING].update(innov, innov_var, 1, result.nis_sum[OBS_HEADING], result.nis_count[OBS_HEADING]);
+
+		ekf.get_airspeed_innov(innov);
+		ekf.get_airspeed_innov_var(innov_var);
+		monitors[OBS_AIRSPEED].update(innov, innov_var, 1, result.nis_sum[OBS_AIRSPEED], result.nis_count[OBS_AIRSPEED]);
+
+		ekf.get_beta_innov(innov);
+		ekf.get_beta_innov_var(innov_var);
+		monitors[OBS_BETA].update(innov, innov_var, 1, result.nis_sum[OBS_BETA], result.nis_count[OBS_BETA]);
+
+		ekf.get_flow_innov(innov);
+		ekf.get_flow_innov_var(innov_var);
+		monitors[OBS_FLOW].update(innov, innov_var, 2, result.nis_sum[OBS_FLOW], result.nis_count[OBS_FLOW]);
+
+		ekf.get_hagl_innov(innov);
+		ekf.get_hagl_innov_var(innov_var);
+		monitors[OBS_HAGL].update(innov, innov_var, 1, result.nis_sum[OBS_HAGL], result.nis_count[OBS_HAGL]);
+
+		// count the failed innovation consistency checks
+		uint16_t status;
+		float mag_ratio, vel_ratio, pos_ratio, hgt_ratio, tas_ratio, hagl_ratio;
+		ekf.get_innovation_test_status(&status, &mag_ratio, &vel_ratio, &pos_ratio, &hgt_ratio, &tas_ratio, &hagl_ratio);
+		innovation_fault_status_u fail_status;
+		fail_status.value = status;
+		result.num_rejected[OBS_VEL] += fail_status.flags.reject_vel_NED;
+		result.num_rejected[OBS_POS] += fail_status.flags.reject_pos_NE;
+		result.num_rejected[OBS_HGT] += fail_status.flags.reject_pos_D;
+		result.num_rejected[OBS_MAG] += fail_status.flags.reject_mag_x || fail_status.flags.reject_mag_y
+						|| fail_status.flags.reject_mag_z;
+		result.num_rejected[OBS_HEADING] += fail_status.flags.reject_yaw;
+		result.num_rejected[OBS_AIRSPEED] += fail_status.flags.reject_airspeed;
+		result.num_rejected[OBS_BETA] += fail_status.flags.reject_sideslip;
+		result.num_rejected[OBS_FLOW] += fail_status.flags.reject_optflow_X || fail_status.flags.reject_optflow_Y;
+		result.num_rejected[OBS_HAGL] += fail_status.flags.reject_hagl;
+
+		float tracking_error[3];
+		ekf.get_output_tracking_error(tracking_error);
+
+		for (unsigned j = 0; j < 3; j++) {
+			result.tracking_error_sum[j] += tracking_error[j];
+		}
+
+		result.num_steps++;
+	}
+
+	// lower is better
+	result.score = 0.0;
+
+	for (unsigned i = 0; i < OBS_NUM_TYPES; i++) {
+		if (result.nis_count[i] > 0) {
+			result.score += fabs(log(fmax(result.nis_sum[i] / result.nis_count[i], 1e-9)));
+		}
+
+		if (result.num_steps > 0) {
+			result.score += (double)result.num_rejected[i] / result.num_steps;
+		}
+	}
+
+	for (unsigned j = 0; j < 3 && result.num_steps > 0; j++) {
+		result.score += result.tracking_error_sum[j] / result.num_steps;
+	}
+
+	// a diverged filter must never be ranked above a working one
+	if (!std::isfinite(result.score)) {
+		result.score = INFINITY;
+	}
+}
+
+// return true if the comma separated list contains the name
+bool list_contains(const char *list, const char *name)
+{
+	size_t length = strlen(name);
+
+	for (const char *item = list; item != NULL; item = strchr(item, ',')) {
+		if (*item == ',') {
+			item++;
+		}
+
+		if (strncmp(item, name, length) == 0 && (item[length] == ',' || item[length] == '\0')) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool write_results(FILE *file, const std::vector<run_result> &results, const std::vector<unsigned> &order)
+{
+	fprintf(file, "run,score");
+
+	for (unsigned i = 0; i < num_tunable_parameters; i++) {
+		fprintf(file, ",%s", tunable_parameters[i].name);
+	}
+
+	for (unsigned i = 0; i < OBS_NUM_TYPES; i++) {
+		fprintf(file, ",%s_nis,%s_reject", observation_names[i], observation_names[i]);
+	}
+
+	fprintf(file, ",ang_track_err,vel_track_err,pos_track_err\n");
+
+	for (size_t k = 0; k < order.size(); k++) {
+		const run_result &result = results[order[k]];
+		fprintf(file, "%u,%.6g", order[k], result.score);
+
+		for (unsigned i = 0; i < num_tunable_parameters; i++) {
+			fprintf(file, ",%.6g", (double)result.param_values[i]);
+		}
+
+		for (unsigned i = 0; i < OBS_NUM_TYPES; i++) {
+			double mean_nis = result.nis_count[i] > 0 ? result.nis_sum[i] / result.nis_count[i] : 0.0;
+			double reject = result.num_steps > 0 ? (double)result.num_rejected[i] / result.num_steps : 0.0;
+			fprintf(file, ",%.6g,%.6g", mean_nis, reject);
+		}
+
+		for (unsigned j = 0; j < 3; j++) {
+			fprintf(file, ",%.6g", result.num_steps > 0 ? result.tracking_error_sum[j] / result.num_steps : 0.0);
+		}
+
+		fprintf(file, "\n");
+	}
+
+	return ferror(file) == 0;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned num_threads = std::thread::hardware_concurrency();
+	unsigned num_runs = 100;
+	unsigned seed = 1;
+	float range = 2.0f;
+	const char *selected = NULL;
+	const char *output_filename = NULL;
+	const char *log_filename = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			num_threads = (unsigned)atoi(argv[++i]);
+
+		} else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			num_runs = (unsigned)atoi(argv[++i]);
+
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			seed = (unsigned)atoi(argv[++i]);
+
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			range = (float)atof(argv[++i]);
+
+		} else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+			selected = argv[++i];
+
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			output_filename = argv[++i];
+
+		} else {
+			log_filename = argv[i];
+		}
+	}
+
+	if (log_filename == NULL || num_runs == 0 || !(range >= 1.0f)) {
+		printf("usage: %s [-j <threads>] [-n <runs>] [-s <seed>] [-r <range>] [-p <name,name,...>] [-o <csv file>] <log file>\n",
+		       argv[0]);
+		return 1;
+	}
+
+	if (selected != NULL) {
+		for (const char *item = selected; item != NULL; item = strchr(item + 1, ',')) {
+			const char *name = (*item == ',') ? item + 1 : item;
+			size_t length = strcspn(name, ",");
+			bool found = false;
+
+			for (unsigned i = 0; i < num_tunable_parameters && !found; i++) {
+				found = strlen(tunable_parameters[i].name) == length && strncmp(name, tunable_parameters[i].name, length) == 0;
+			}
+
+			if (!found) {
+				printf("unknown parameter %.*s\n", (int)length, name);
+				return 1;
+			}
+		}
+	}
+
+	std::vector<log_record> records;
+
+	if (!read_sensor_log(log_filename, records)) {
+		return 1;
+	}
+
+	// draw all of the parameter sets up front so the results do not depend on the number of threads
+	const parameters default_params;
+	std::vector<run_result> results(num_runs);
+	std::mt19937 generator(seed);
+	std::uniform_real_distribution<float> log_scale(-logf(range), logf(range));
+
+	for (unsigned run = 0; run < num_runs; run++) {
+		memset(&results[run], 0, sizeof(results[run]));
+
+		for (unsigned i = 0; i < num_tunable_parameters; i++) {
+			float value = default_params.*tunable_parameters[i].value;
+
+			if (run > 0 && (selected == NULL || list_contains(selected, tunable_parameters[i].name))) {
+				value *= expf(log_scale(generator));
+			}
+
+			results[run].param_values[i] = value;
+		}
+	}
+
+	if (num_threads == 0) {
+		num_threads = 1;
+	}
+
+	if (num_threads > num_runs) {
+		num_threads = num_runs;
+	}
+
+	// workers take the next unprocessed run until all have been processed
+	std::atomic<unsigned> next_run(0);
+	std::vector<std::thread> workers;
+
+	for (unsigned i = 0; i < num_threads; i++) {
+		workers.push_back(std::thread([&]() {
+			unsigned run;
+
+			while ((run = next_run++) < num_runs) {
+				run_filter(records, results[run]);
+			}
+		}));
+	}
+
+	for (size_t i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+
+	std::vector<unsigned> order(num_runs);
+
+	for (unsigned run = 0; run < num_runs; run++) {
+		order[run] = run;
+	}
+
+	std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) { return results[a].score < results[b].score; });
+
+	printf("best run %u score %.4g, default parameters score %.4g\n", order[0], results[order[0]].score,
+	       results[0].score);
+
+	FILE *file = (output_filename != NULL) ? fopen(output_filename, "w") : stdout;
+
+	if (file == NULL) {
+		printf("unable to create %s\n", output_filename);
+		return 1;
+	}
+
+	bool ok = write_results(file, results, order);
+
+	if (file != stdout) {
+		ok = (fclose(file) == 0) && ok;
+	}
+
+	return ok ? 0 : 1;
+}
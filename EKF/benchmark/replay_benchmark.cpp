@@ -0,0 +1,253 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file replay_benchmark.cpp
+ * Replays a sensor log through the ekf as fast as possible and reports the update rate.
+ * If the library is built with ECL_EKF_TIMING, latency histograms for each processing stage are also reported.
+ *
+ * Usage: ecl_replay_benchmark <log file>
+ *        ecl_replay_benchmark --stream <log file>
+ *        ecl_replay_benchmark --synthetic <duration sec>
+ *
+ * The log formats are described in sensor_log.h. The log is read into memory before the replay starts unless
+ * --stream is given, in which case it is decoded during the replay and the time taken to decode it is included.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "sensor_log.h"
+
+namespace
+{
+
+const char *stage_names[EKF_TIMING_NUM_STAGES] = {
+	"predictState",
+	"predictCovariance",
+	"runTerrainEstimator",
+	"controlFusionModes",
+	"  controlMagFusion",
+	"  controlExternalVisionFusion",
+	"  controlOpticalFlowFusion",
+	"  controlGpsFusion",
+	"  controlBaroFusion",
+	"  controlRangeFinderFusion",
+	"  controlAirDataFusion",
+	"  controlBetaFusion",
+	"  controlDragFusion",
+	"  controlVelPosFusion",
+	"calculateOutputStates",
+	"fuseMag",
+	"fuseHeading",
+	"fuseDeclination",
+	"fuseVelPosHeight",
+	"fuseOptFlow",
+	"fuseAirspeed",
+	"fuseSideslip",
+	"fuseDrag",
+	"fuseHagl"
+};
+
+typedef std::chrono::steady_clock benchmark_clock;
+
+// records a histogram of the execution time of each processing stage using log2 spaced bins
+class HistogramTimingHook : public EkfTimingHook
+{
+public:
+	static const int num_bins = 24;	// bin i counts durations between 2^(i-1) and 2^i nsec
+
+	HistogramTimingHook()
+	{
+		memset(_count, 0, sizeof(_count));
+		memset(_total_ns, 0, sizeof(_total_ns));
+		memset(_max_ns, 0, sizeof(_max_ns));
+		memset(_bins, 0, sizeof(_bins));
+	}
+
+	void stage_start(ekf_timing_stage stage)
+	{
+		_start[stage] = benchmark_clock::now();
+	}
+
+	void stage_end(ekf_timing_stage stage)
+	{
+		uint64_t elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(benchmark_clock::now() - _start[stage]).count();
+
+		int bin = 0;
+
+		while (bin < num_bins - 1 && (1ULL << bin) < elapsed_ns) {
+			bin++;
+		}
+
+		_count[stage]++;
+		_total_ns[stage] += elapsed_ns;
+		_max_ns[stage] = elapsed_ns > _max_ns[stage] ? elapsed_ns : _max_ns[stage];
+		_bins[stage][bin]++;
+	}
+
+	uint64_t get_count(int stage) const { return _count[stage]; }
+
+	void print() const
+	{
+		printf("%-30s %10s %10s %10s %10s %10s\n", "stage", "calls", "mean(us)", "p50(us)", "p99(us)", "max(us)");
+
+		for (int stage = 0; stage < EKF_TIMING_NUM_STAGES; stage++) {
+			if (_count[stage] == 0) {
+				continue;
+			}
+
+			printf("%-30s %10llu %10.2f %10.2f %10.2f %10.2f\n", stage_names[stage], (unsigned long long)_count[stage],
+			       1e-3 * (double)_total_ns[stage] / (double)_count[stage], 1e-3 * percentile(stage, 0.5),
+			       1e-3 * percentile(stage, 0.99), 1e-3 * (double)_max_ns[stage]);
+		}
+
+		printf("\nhistograms (calls per duration bin, upper bin edge in nsec)\n");
+
+		for (int stage = 0; stage < EKF_TIMING_NUM_STAGES; stage++) {
+			if (_count[stage] == 0) {
+				continue;
+			}
+
+			printf("%s:", stage_names[stage]);
+
+			for (int bin = 0; bin < num_bins; bin++) {
+				if (_bins[stage][bin] > 0) {
+					printf(" %llu:%llu", 1ULL << bin, (unsigned long long)_bins[stage][bin]);
+				}
+			}
+
+			printf("\n");
+		}
+	}
+
+private:
+	// return the upper edge of the bin that contains the requested fraction of calls (nsec)
+	double percentile(int stage, double fraction) const
+	{
+		uint64_t target = (uint64_t)ceil(fraction * (double)_count[stage]);
+		uint64_t sum = 0;
+
+		for (int bin = 0; bin < num_bins; bin++) {
+			sum += _bins[stage][bin];
+
+			if (sum >= target) {
+				return (double)(1ULL << bin);
+			}
+		}
+
+		return (double)_max_ns[stage];
+	}
+
+	benchmark_clock::time_point _start[EKF_TIMING_NUM_STAGES];
+	uint64_t _count[EKF_TIMING_NUM_STAGES];
+	uint64_t _total_ns[EKF_TIMING_NUM_STAGES];
+	uint64_t _max_ns[EKF_TIMING_NUM_STAGES];
+	uint64_t _bins[EKF_TIMING_NUM_STAGES][num_bins];
+};
+
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<log_record> records;
+	sensor_log_reader reader;
+	bool stream = false;
+
+	if (argc == 3 && strcmp(argv[1], "--synthetic") == 0) {
+		generate_sensor_log((float)atof(argv[2]), records);
+
+	} else if (argc == 3 && strcmp(argv[1], "--stream") == 0) {
+		if (!reader.open(argv[2])) {
+			return 1;
+		}
+
+		stream = true;
+
+	} else if (argc == 2) {
+		if (!read_sensor_log(argv[1], records)) {
+			return 1;
+		}
+
+	} else {
+		printf("usage: %s <log file> | --stream <log file> | --synthetic <duration sec>\n", argv[0]);
+		return 1;
+	}
+
+	// the ekf object is large so keep it off the stack
+	static Ekf ekf;
+	HistogramTimingHook hook;
+	ekf.set_timing_hook(&hook);
+
+	uint64_t num_updates = 0;
+	uint64_t num_imu = 0;
+	uint64_t num_records = 0;
+	log_record record;
+
+	benchmark_clock::time_point start = benchmark_clock::now();
+
+	while (stream ? reader.next(record) : num_records < records.size()) {
+		const log_record &next_record = stream ? record : records[num_records];
+		replay_sensor_record(ekf, next_record);
+		num_records++;
+
+		if (next_record.type == SENSOR_IMU) {
+			ekf.update();
+			num_imu++;
+		}
+	}
+
+	double elapsed_sec = std::chrono::duration<double>(benchmark_clock::now() - start).count();
+	num_updates = hook.get_count(EKF_TIMING_PREDICT_STATE);
+
+	if (reader.failed()) {
+		return 1;
+	}
+
+	printf("replayed %llu records (%llu IMU samples) in %.3f sec\n", (unsigned long long)num_records,
+	       (unsigned long long)num_imu, elapsed_sec);
+	printf("update() calls per second: %.0f\n", (double)num_imu / elapsed_sec);
+
+#ifdef ECL_EKF_TIMING
+	printf("filter prediction steps per second: %.0f\n\n", (double)num_updates / elapsed_sec);
+	hook.print();
+#else
+	(void)num_updates;
+	printf("build with ECL_EKF_TIMING to report the latency of each processing stage\n");
+#endif
+
+	return 0;
+}
@@ -0,0 +1,789 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file rts_smoother.cpp
+ * Post-flight reprocessing of a sensor log with a fixed interval Rauch-Tung-Striebel smoother. The ekf is run
+ * forward over the log and the smoothed states and variances are then calculated backwards from the end of the
+ * log using the predicted and updated states and covariance matrices of each prediction step.
+ *
+ * Usage: ecl_rts_smoother [-c <checkpoint interval>] [-o <output file>] <log file>
+ *
+ * The forward pass only saves a copy of the filter and the log read position every checkpoint interval
+ * prediction steps. The backward pass processes the intervals between checkpoints starting with the last one,
+ * running the filter forward again from the checkpoint to regenerate the covariance matrices of that interval.
+ * Unless it is set with -c the interval is doubled, and every other checkpoint dropped, whenever there are more
+ * checkpoints than steps in an interval, so for N steps the memory used is proportional to sqrt(N) and the
+ * filter is run about twice over the log.
+ *
+ * The transition matrix of each step is calculated by numerical differentiation of the linearised state
+ * prediction the filter uses to predict the covariance matrix, so that it is consistent with the predicted
+ * covariance matrices. The smoother is restarted from the filter estimate at a step where the filter has reset
+ * a state, and where the predicted covariance matrix of the following step is not positive semi-definite.
+ *
+ * The output for <name>.<ext> is written to <name>.rts next to the log unless a file is given with -o, using the
+ * columnar layout described in batch_replay.cpp. There is a row for each prediction step with the columns:
+ *
+ * time_us              time stamp of the IMU sample on the fusion time horizon (usec)
+ * smoothed_state_<i>   smoothed state vector, in the order given by Ekf::get_state_delayed()
+ * smoothed_var_<i>     smoothed state variances
+ * state_<i>            filter state vector after the observations of the step have been fused
+ * var_<i>              filter state variances after the observations of the step have been fused
+ * linked               1 if the step was smoothed using the following steps, 0 where the smoother restarted
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "sensor_log.h"
+
+namespace
+{
+
+const unsigned max_states = 24;
+
+// filter states and covariance matrices of a single prediction step
+struct step_data {
+	imuSample imu;				// IMU sample used to predict the states to this step
+	float prior_state[max_states];		// predicted states
+	float prior_cov[max_states * max_states];	// predicted covariance matrix, row major
+	float post_state[max_states];		// states after fusion of the step observations
+	float post_cov[max_states * max_states];	// covariance matrix after fusion of the step observations
+	uint64_t reset_counters;		// state reset counters after fusion of the step observations
+};
+
+// saves the predicted states of each step and collects the updated states after the filter update
+class step_recorder : public EkfPredictionHook
+{
+public:
+	void predicted(const imuSample &imu, const float *state, const float *covariance, unsigned num_states) override
+	{
+		_step.imu = imu;
+		memcpy(_step.prior_state, state, sizeof(_step.prior_state));
+		memcpy(_step.prior_cov, covariance, num_states * num_states * sizeof(float));
+		_predicted = true;
+	}
+
+	// returns true and fills step if a prediction has been made since the last call
+	bool collect(Ekf &ekf, step_data *step)
+	{
+		if (!_predicted) {
+			return false;
+		}
+
+		_predicted = false;
+
+		if (step != nullptr) {
+			*step = _step;
+			ekf.get_state_delayed(step->post_state);
+			ekf.get_covariance_matrix(step->post_cov);
+			step->reset_counters = get_reset_counters(ekf);
+		}
+
+		return true;
+	}
+
+private:
+	step_data _step{};
+	bool _predicted{false};
+
+	static uint64_t get_reset_counters(Ekf &ekf)
+	{
+		float delta[4];
+		uint8_t counter[5];
+		ekf.get_quat_reset(delta, &counter[0]);
+		ekf.get_velNE_reset(delta, &counter[1]);
+		ekf.get_posNE_reset(delta, &counter[2]);
+		ekf.get_velD_reset(delta, &counter[3]);
+		ekf.get_posD_reset(delta, &counter[4]);
+
+		uint64_t counters = 0;
+
+		for (unsigned i = 0; i < 5; i++) {
+			counters = (counters << 8) | counter[i];
+		}
+
+		return counters;
+	}
+};
+
+// a copy of the filter after a prediction step and the log position of the following record
+struct checkpoint {
+	Ekf ekf;
+	sensor_log_position position;
+	size_t step;	// number of prediction steps made before the checkpoint
+};
+
+// pass log records to the filter until a prediction step has been made, returns false at the end of the log
+bool replay_step(Ekf &ekf, sensor_log_reader &reader, step_recorder &recorder, step_data *step)
+{
+	log_record record;
+
+	while (reader.next(record)) {
+		replay_sensor_record(ekf, record);
+
+		if (record.type == SENSOR_IMU) {
+			ekf.update();
+
+			if (recorder.collect(ekf, step)) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+// the linearised state prediction used to derive the covariance prediction in matlab/scripts/Inertial Nav EKF/GenerateNavFilterEquations.m
+void linearised_prediction(const double *state, const imuSample &imu, unsigned num_states, double *predicted)
+{
+	memcpy(predicted, state, num_states * sizeof(double));
+
+	const double dt = imu.delta_ang_dt;
+	const double delta_ang[3] = {imu.delta_ang(0) - state[10], imu.delta_ang(1) - state[11], imu.delta_ang(2) - state[12]};
+	const double delta_vel[3] = {imu.delta_vel(0) - state[13], imu.delta_vel(1) - state[14], imu.delta_vel(2) - state[15]};
+
+	// first order quaternion increment, q * dq
+	const double dq[4] = {1.0, 0.5 * delta_ang[0], 0.5 * delta_ang[1], 0.5 * delta_ang[2]};
+	const double q0 = state[0], q1 = state[1], q2 = state[2], q3 = state[3];
+	predicted[0] = q0 * dq[0] - q1 * dq[1] - q2 * dq[2] - q3 * dq[3];
+	predicted[1] = q0 * dq[1] + q1 * dq[0] + q2 * dq[3] - q3 * dq[2];
+	predicted[2] = q0 * dq[2] - q1 * dq[3] + q2 * dq[0] + q3 * dq[1];
+	predicted[3] = q0 * dq[3] + q1 * dq[2] - q2 * dq[1] + q3 * dq[0];
+
+	// the delta velocity is rotated into the earth frame using the previous quaternion
+	const double Tbn[3][3] = {
+		{q0 * q0 + q1 * q1 - q2 * q2 - q3 * q3, 2.0 * (q1 * q2 - q0 * q3), 2.0 * (q1 * q3 + q0 * q2)},
+		{2.0 * (q1 * q2 + q0 * q3), q0 * q0 - q1 * q1 + q2 * q2 - q3 * q3, 2.0 * (q2 * q3 - q0 * q1)},
+		{2.0 * (q1 * q3 - q0 * q2), 2.0 * (q2 * q3 + q0 * q1), q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3}
+	};
+
+	for (unsigned i = 0; i < 3; i++) {
+		predicted[4 + i] += Tbn[i][0] * delta_vel[0] + Tbn[i][1] * delta_vel[1] + Tbn[i][2] * delta_vel[2];
+		predicted[7 + i] += state[4 + i] * dt;
+	}
+}
+
+// in place Cholesky decomposition of the lower triangle of a size x size symmetric positive semi-definite
+// matrix. The quaternion states are constrained to unit length so the covariance matrix is close to singular
+// and a pivot that is negligible compared to its diagonal element is rounding error. Its column is set to
+// zero so that cholesky_solve() returns a generalised inverse. Returns false if a pivot is negative.
+bool cholesky_decompose(std::vector<double> &a, unsigned size)
+{
+	const double relative_pivot_min = 1e-6;
+
+	for (unsigned j = 0; j < size; j++) {
+		double diagonal = a[j * size + j];
+		const double pivot_min = relative_pivot_min * diagonal;
+
+		for (unsigned k = 0; k < j; k++) {
+			diagonal -= a[j * size + k] * a[j * size + k];
+		}
+
+		if (diagonal <= pivot_min) {
+			if (diagonal < -pivot_min) {
+				return false;
+			}
+
+			for (unsigned i = j; i < size; i++) {
+				a[i * size + j] = 0.0;
+			}
+
+			continue;
+		}
+
+		const double l_jj = sqrt(diagonal);
+		a[j * size + j] = l_jj;
+
+		for (unsigned i = j + 1; i < size; i++) {
+			double sum = a[i * size + j];
+
+			for (unsigned k = 0; k < j; k++) {
+				sum -= a[i * size + k] * a[j * size + k];
+			}
+
+			a[i * size + j] = sum / l_jj;
+		}
+	}
+
+	return true;
+}
+
+// solve L*L^T*x = b in place for a decomposition from cholesky_decompose(), the elements of x for the
+// dropped pivots are zero
+void cholesky_solve(const std::vector<double> &l, unsigned size, double *b)
+{
+	for (unsigned i = 0; i < size; i++) {
+		if (l[i * size + i] == 0.0) {
+			b[i] = 0.0;
+			continue;
+		}
+
+		for (unsigned k = 0; k < i; k++) {
+			b[i] -= l[i * size + k] * b[k];
+		}
+
+		b[i] /= l[i * size + i];
+	}
+
+	for (unsigned i = size; i-- > 0;) {
+		if (l[i * size + i] == 0.0) {
+			continue;
+		}
+
+		for (unsigned k = i + 1; k < size; k++) {
+			b[i] -= l[k * size + i] * b[k];
+		}
+
+		b[i] /= l[i * size + i];
+	}
+}
+
+// the backward recursion of the smoother from one step to the previous one
+class rts_smoother
+{
+public:
+	explicit rts_smoother(unsigned num_states) :
+		_n(num_states),
+		_state(num_states),
+		_cov(num_states * num_states),
+		_F(num_states * num_states),
+		_gain(num_states * num_states),
+		_work(num_states * num_states),
+		_chol(num_states * num_states)
+	{}
+
+	// restart the smoother from the filter estimate of a step
+	void restart(const step_data &step)
+	{
+		for (unsigned i = 0; i < _n; i++) {
+			_state[i] = step.post_state[i];
+
+			for (unsigned j = 0; j < _n; j++) {
+				_cov[i * _n + j] = step.post_cov[i * _n + j];
+			}
+		}
+	}
+
+	// smooth step using the prediction made by the following step, which has already been smoothed
+	// returns false and restarts from the filter estimate if the smoother gain cannot be calculated
+	bool smooth(const step_data &step, const step_data &next)
+	{
+		if (step.reset_counters != next.reset_counters || !calculate_gain(step, next)) {
+			restart(step);
+			return false;
+		}
+
+		const unsigned n = _n;
+
+		// x = x_post + C * (x_smoothed_next - x_prior_next)
+		std::vector<double> innovation(n);
+
+		for (unsigned i = 0; i < n; i++) {
+			innovation[i] = _state[i] - next.prior_state[i];
+		}
+
+		// the predicted variance along the predicted quaternion is only rounding error because of the unit
+		// length constraint, so remove the quaternion innovation in that direction to avoid scaling it by a
+		// very large gain
+		double along = 0.0;
+
+		for (unsigned i = 0; i < 4; i++) {
+			along += innovation[i] * next.prior_state[i];
+		}
+
+		for (unsigned i = 0; i < 4; i++) {
+			innovation[i] -= along * next.prior_state[i];
+		}
+
+		for (unsigned i = 0; i < n; i++) {
+			double correction = 0.0;
+
+			for (unsigned j = 0; j < n; j++) {
+				correction += _gain[i * n + j] * innovation[j];
+			}
+
+			_state[i] = step.post_state[i] + correction;
+		}
+
+		const double length = sqrt(_state[0] * _state[0] + _state[1] * _state[1] + _state[2] * _state[2]
+					   + _state[3] * _state[3]);
+
+		for (unsigned i = 0; i < 4; i++) {
+			_state[i] /= length;
+		}
+
+		// P = P_post + C * (P_smoothed_next - P_prior_next) * C^T
+		for (unsigned i = 0; i < n * n; i++) {
+			_cov[i] -= next.prior_cov[i];
+		}
+
+		for (unsigned i = 0; i < n; i++) {
+			for (unsigned j = 0; j < n; j++) {
+				double sum = 0.0;
+
+				for (unsigned k = 0; k < n; k++) {
+					sum += _gain[i * n + k] * _cov[k * n + j];
+				}
+
+				_work[i * n + j] = sum;
+			}
+		}
+
+		for (unsigned i = 0; i < n; i++) {
+			for (unsigned j = 0; j <= i; j++) {
+				double sum = 0.0;
+
+				for (unsigned k = 0; k < n; k++) {
+					sum += _work[i * n + k] * _gain[j * n + k];
+				}
+
+				_F[i * n + j] = sum;
+			}
+		}
+
+		for (unsigned i = 0; i < n; i++) {
+			for (unsigned j = 0; j <= i; j++) {
+				const double value = 0.5 * (step.post_cov[i * n + j] + step.post_cov[j * n + i]) + _F[i * n + j];
+				_cov[i * n + j] = value;
+				_cov[j * n + i] = value;
+			}
+		}
+
+		return true;
+	}
+
+	double state(unsigned index) const { return _state[index]; }
+	double variance(unsigned index) const { return _cov[index * _n + index]; }
+
+private:
+	const unsigned _n;
+	std::vector<double> _state;	// smoothed states of the last step processed
+	std::vector<double> _cov;	// smoothed covariance matrix of the last step processed, row major
+	std::vector<double> _F;		// state transition matrix, also used for intermediate products
+	std::vector<double> _gain;	// smoother gain C = P_post * F^T * inv(P_prior_next)
+	std::vector<double> _work;
+	std::vector<double> _chol;
+	std::vector<unsigned> _active;	// states with a non zero predicted variance
+
+	bool calculate_gain(const step_data &step, const step_data &next)
+	{
+		const unsigned n = _n;
+
+		// transition matrix by central differences of the linearised prediction, which like the filter is
+		// evaluated at the predicted states
+		std::vector<double> x(n), upper(n), lower(n);
+
+		for (unsigned i = 0; i < n; i++) {
+			x[i] = next.prior_state[i];
+		}
+
+		for (unsigned j = 0; j < n; j++) {
+			const double delta = 1e-6 * fmax(1.0, fabs(x[j]));
+			const double saved = x[j];
+			x[j] = saved + delta;
+			linearised_prediction(x.data(), next.imu, n, upper.data());
+			x[j] = saved - delta;
+			linearised_prediction(x.data(), next.imu, n, lower.data());
+			x[j] = saved;
+
+			for (unsigned i = 0; i < n; i++) {
+				_F[i * n + j] = (upper[i] - lower[i]) / (2.0 * delta);
+			}
+		}
+
+		// states that are not in use have their rows and columns of the covariance matrix set to zero
+		_active.clear();
+
+		for (unsigned i = 0; i < n; i++) {
+			if (next.prior_cov[i * n + i] > 0.0f) {
+				_active.push_back(i);
+			}
+		}
+
+		const unsigned m = _active.size();
+
+		for (unsigned i = 0; i < m; i++) {
+			for (unsigned j = 0; j < m; j++) {
+				_chol[i * m + j] = next.prior_cov[_active[i] * n + _active[j]];
+			}
+		}
+
+		if (!cholesky_decompose(_chol, m)) {
+			return false;
+		}
+
+		// the transposed gain is inv(P_prior_next) * F * P_post, solved one column at a time
+		std::vector<double> column(m);
+
+		for (unsigned i = 0; i < n * n; i++) {
+			_gain[i] = 0.0;
+		}
+
+		for (unsigned col = 0; col < n; col++) {
+			for (unsigned i = 0; i < m; i++) {
+				double sum = 0.0;
+
+				for (unsigned k = 0; k < n; k++) {
+					sum += _F[_active[i] * n + k] * step.post_cov[k * n + col];
+				}
+
+				column[i] = sum;
+			}
+
+			cholesky_solve(_chol, m, column.data());
+
+			for (unsigned i = 0; i < m; i++) {
+				_gain[col * n + _active[i]] = column[i];
+			}
+		}
+
+		return true;
+	}
+};
+
+// writes the smoother output in the columnar layout of batch_replay.cpp, rows can be written in any order
+class smoother_writer
+{
+public:
+	~smoother_writer()
+	{
+		if (_file != NULL) {
+			fclose(_file);
+		}
+	}
+
+	bool open(const char *filename, unsigned num_states, uint64_t num_rows)
+	{
+		_file = fopen(filename, "wb");
+
+		if (_file == NULL) {
+			printf("unable to create %s\n", filename);
+			return false;
+		}
+
+		_num_states = num_states;
+		_num_rows = num_rows;
+
+		const char *prefix[4] = {"smoothed_state_", "smoothed_var_", "state_", "var_"};
+		std::vector<std::string> names;
+
+		for (unsigned group = 0; group < 4; group++) {
+			for (unsigned i = 0; i < num_states; i++) {
+				names.push_back(prefix[group] + std::to_string(i));
+			}
+		}
+
+		names.push_back("linked");
+
+		const char magic[8] = {'E', 'C', 'L', 'E', 'K', 'F', '0', '1'};
+		uint32_t num_columns = names.size() + 1;
+		uint32_t reserved = 0;
+
+		bool ok = fwrite(magic, sizeof(magic), 1, _file) == 1
+			  && fwrite(&num_columns, sizeof(num_columns), 1, _file) == 1
+			  && fwrite(&reserved, sizeof(reserved), 1, _file) == 1
+			  && fwrite(&num_rows, sizeof(num_rows), 1, _file) == 1
+			  && write_descriptor("time_us", 0);
+
+		for (size_t i = 0; ok && i < names.size(); i++) {
+			ok = write_descriptor(names[i].c_str(), 1);
+		}
+
+		_data_start = ftell(_file);
+		_columns.resize(names.size());
+		return ok && _data_start > 0;
+	}
+
+	// hold the values of a row until the block of rows it is in is written
+	void set_row(size_t row, uint64_t time_us, const rts_smoother &smoother, const step_data &step, bool linked)
+	{
+		if (_time_us.empty()) {
+			_first_row = row;
+		}
+
+		_time_us.push_back(time_us);
+		unsigned column = 0;
+
+		for (unsigned i = 0; i < _num_states; i++) {
+			_columns[column++].push_back((float)smoother.state(i));
+		}
+
+		for (unsigned i = 0; i < _num_states; i++) {
+			_columns[column++].push_back((float)smoother.variance(i));
+		}
+
+		for (unsigned i = 0; i < _num_states; i++) {
+			_columns[column++].push_back(step.post_state[i]);
+		}
+
+		for (unsigned i = 0; i < _num_states; i++) {
+			_columns[column++].push_back(step.post_cov[i * _num_states + i]);
+		}
+
+		_columns[column].push_back(linked ? 1.0f : 0.0f);
+	}
+
+	// write the rows held since the last call, which must have been set in decreasing row order
+	bool write_rows()
+	{
+		const size_t count = _time_us.size();
+
+		if (count == 0) {
+			return true;
+		}
+
+		const size_t first = _first_row + 1 - count;
+		std::vector<uint64_t> times(_time_us.rbegin(), _time_us.rend());
+		bool ok = fseek(_file, _data_start + (long)(first * sizeof(uint64_t)), SEEK_SET) == 0
+			  && fwrite(times.data(), sizeof(uint64_t), count, _file) == count;
+
+		std::vector<float> values(count);
+
+		for (size_t i = 0; ok && i < _columns.size(); i++) {
+			values.assign(_columns[i].rbegin(), _columns[i].rend());
+			const long offset = _data_start + (long)(_num_rows * sizeof(uint64_t) + (i * _num_rows + first) * sizeof(float));
+			ok = fseek(_file, offset, SEEK_SET) == 0 && fwrite(values.data(), sizeof(float), count, _file) == count;
+			_columns[i].clear();
+		}
+
+		_time_us.clear();
+		return ok;
+	}
+
+	bool close()
+	{
+		const bool ok = fclose(_file) == 0;
+		_file = NULL;
+		return ok;
+	}
+
+private:
+	FILE *_file{NULL};
+	unsigned _num_states{0};
+	uint64_t _num_rows{0};
+	long _data_start{0};
+	size_t _first_row{0};		// index of the first row held, which is the last row of the block
+	std::vector<uint64_t> _time_us;
+	std::vector<std::vector<float>> _columns;
+
+	bool write_descriptor(const char *name, uint32_t type)
+	{
+		char padded_name[32] = {};
+		strncpy(padded_name, name, sizeof(padded_name) - 1);
+		uint32_t descriptor[2] = {type, 0};
+
+		return fwrite(padded_name, sizeof(padded_name), 1, _file) == 1
+		       && fwrite(descriptor, sizeof(descriptor), 1, _file) == 1;
+	}
+};
+
+// build the default output file name by replacing the extension of the log file name
+std::string output_filename(const std::string &log_filename)
+{
+	size_t name_start = log_filename.find_last_of('/');
+	name_start = (name_start == std::string::npos) ? 0 : name_start + 1;
+	size_t extension = log_filename.find_last_of('.');
+
+	if (extension == std::string::npos || extension <= name_start) {
+		return log_filename + ".rts";
+	}
+
+	return log_filename.substr(0, extension) + ".rts";
+}
+
+bool smooth_log(const char *log_filename, const std::string &output_filename, size_t fixed_interval)
+{
+	sensor_log_reader reader;
+
+	if (!reader.open(log_filename)) {
+		return false;
+	}
+
+	// forward pass, only the checkpoints are kept
+	step_recorder recorder;
+	Ekf ekf;
+	ekf.set_prediction_hook(&recorder);
+
+	size_t interval = fixed_interval > 0 ? fixed_interval : 1;
+	size_t num_steps = 0;
+	std::vector<checkpoint> checkpoints;
+	checkpoints.push_back({ekf, reader.tell(), 0});
+
+	while (replay_step(ekf, reader, recorder, nullptr)) {
+		num_steps++;
+
+		if (num_steps % interval != 0) {
+			continue;
+		}
+
+		checkpoints.push_back({ekf, reader.tell(), num_steps});
+
+		if (fixed_interval == 0 && checkpoints.size() > interval) {
+			interval *= 2;
+			size_t kept = 0;
+
+			for (size_t i = 0; i < checkpoints.size(); i++) {
+				if (checkpoints[i].step % interval == 0) {
+					checkpoints[kept++] = checkpoints[i];
+				}
+			}
+
+			checkpoints.erase(checkpoints.begin() + kept, checkpoints.end());
+		}
+	}
+
+	if (reader.failed()) {
+		return false;
+	}
+
+	if (num_steps == 0) {
+		printf("%s: no prediction steps\n", log_filename);
+		return false;
+	}
+
+	// a checkpoint at the end of the log has no steps following it
+	if (checkpoints.back().step == num_steps) {
+		checkpoints.pop_back();
+	}
+
+	smoother_writer writer;
+
+	if (!writer.open(output_filename.c_str(), Ekf::get_num_states(), num_steps)) {
+		return false;
+	}
+
+	// backward pass over the intervals between checkpoints, starting with the last
+	rts_smoother smoother(Ekf::get_num_states());
+	std::vector<step_data> segment;
+	step_data next{};
+	size_t segment_end = num_steps;
+	size_t num_restarts = 0;
+
+	for (size_t c = checkpoints.size(); c-- > 0;) {
+		const checkpoint &start = checkpoints[c];
+		Ekf segment_ekf(start.ekf);
+		segment_ekf.set_prediction_hook(&recorder);
+
+		if (!reader.seek(start.position)) {
+			printf("%s: unable to return to the checkpoint at step %llu\n", log_filename, (unsigned long long)start.step);
+			return false;
+		}
+
+		segment.resize(segment_end - start.step);
+
+		for (size_t i = 0; i < segment.size(); i++) {
+			if (!replay_step(segment_ekf, reader, recorder, &segment[i])) {
+				printf("%s: the log ended while repeating the steps from %llu\n", log_filename, (unsigned long long)start.step);
+				return false;
+			}
+		}
+
+		// the repeated steps must arrive at the state saved by the following checkpoint
+		if (c + 1 < checkpoints.size()) {
+			float saved_state[max_states];
+			checkpoints[c + 1].ekf.get_state_delayed(saved_state);
+
+			if (memcmp(saved_state, segment.back().post_state, sizeof(saved_state)) != 0) {
+				printf("%s: the steps from %llu did not repeat\n", log_filename, (unsigned long long)start.step);
+				return false;
+			}
+		}
+
+		for (size_t i = segment.size(); i-- > 0;) {
+			const size_t step = start.step + i;
+			bool linked = false;
+
+			if (step + 1 == num_steps) {
+				smoother.restart(segment[i]);
+
+			} else {
+				linked = smoother.smooth(segment[i], (i + 1 < segment.size()) ? segment[i + 1] : next);
+				num_restarts += linked ? 0 : 1;
+			}
+
+			writer.set_row(step, segment[i].imu.time_us, smoother, segment[i], linked);
+		}
+
+		if (!writer.write_rows()) {
+			printf("error writing %s\n", output_filename.c_str());
+			return false;
+		}
+
+		next = segment[0];
+		segment_end = start.step;
+	}
+
+	if (!writer.close()) {
+		printf("error writing %s\n", output_filename.c_str());
+		return false;
+	}
+
+	printf("%s: %llu steps smoothed with %llu checkpoints every %llu steps, %llu restarts, written to %s\n",
+	       log_filename, (unsigned long long)num_steps, (unsigned long long)checkpoints.size(),
+	       (unsigned long long)interval, (unsigned long long)num_restarts, output_filename.c_str());
+	return true;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	size_t fixed_interval = 0;
+	const char *output = NULL;
+	const char *log_filename = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			fixed_interval = (size_t)atol(argv[++i]);
+
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			output = argv[++i];
+
+		} else {
+			log_filename = argv[i];
+		}
+	}
+
+	if (log_filename == NULL) {
+		printf("usage: %s [-c <checkpoint interval>] [-o <output file>] <log file>\n", argv[0]);
+		return 1;
+	}
+
+	return smooth_log(log_filename, output != NULL ? std::string(output) : output_filename(log_filename),
+			  fixed_interval) ? 0 : 1;
+}
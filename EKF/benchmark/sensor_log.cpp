@@ -0,0 +1,324 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file sensor_log.cpp
+ * Sensor log reading and replay shared by the ekf replay tools.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "sensor_log.h"
+#include "ulog_reader.h"
+
+sensor_log_reader::~sensor_log_reader()
+{
+	close();
+}
+
+bool sensor_log_reader::open(const char *filename)
+{
+	close();
+
+	if (ulog_reader::is_ulog_file(filename)) {
+		_ulog = new ulog_reader();
+		return _ulog->open(filename);
+	}
+
+	_file = fopen(filename, "r");
+
+	if (_file == NULL) {
+		printf("unable to open %s\n", filename);
+		return false;
+	}
+
+	return true;
+}
+
+void sensor_log_reader::close()
+{
+	if (_file != NULL) {
+		fclose(_file);
+		_file = NULL;
+	}
+
+	delete _ulog;
+	_ulog = nullptr;
+	_line_number = 0;
+	_failed = false;
+}
+
+bool sensor_log_reader::failed() const
+{
+	return _failed || (_ulog != nullptr && _ulog->failed());
+}
+
+sensor_log_position sensor_log_reader::tell() const
+{
+	sensor_log_position position;
+
+	if (_ulog != nullptr) {
+		position.ulog = _ulog->tell();
+
+	} else if (_file != NULL) {
+		position.file_offset = ftell(_file);
+		position.line_number = _line_number;
+	}
+
+	return position;
+}
+
+bool sensor_log_reader::seek(const sensor_log_position &position)
+{
+	if (_ulog != nullptr) {
+		if (!position.ulog) {
+			return false;
+		}
+
+		_ulog->seek(*position.ulog);
+		return true;
+	}
+
+	if (_file == NULL || _failed || position.file_offset < 0 || fseek(_file, position.file_offset, SEEK_SET) != 0) {
+		return false;
+	}
+
+	_line_number = position.line_number;
+	return true;
+}
+
+bool sensor_log_reader::next(log_record &record)
+{
+	if (_ulog != nullptr) {
+		return _ulog->next(record);
+	}
+
+	if (_file == NULL || _failed) {
+		return false;
+	}
+
+	char line[512];
+
+	while (fgets(line, sizeof(line), _file) != NULL) {
+		_line_number++;
+
+		if (line[0] == '#' || line[0] == '\n') {
+			continue;
+		}
+
+		record = {};
+		char name[16];
+		unsigned long long time_us;
+		double *d = record.data;
+		int expected = 0;
+		int fields = sscanf(line, "%15s %llu %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf", name, &time_us,
+				    &d[0], &d[1], &d[2], &d[3], &d[4], &d[5], &d[6], &d[7], &d[8], &d[9], &d[10], &d[11], &d[12]);
+
+		if (strcmp(name, "imu") == 0) {
+			record.type = SENSOR_IMU;
+			expected = 8;
+
+		} else if (strcmp(name, "mag") == 0) {
+			record.type = SENSOR_MAG;
+			expected = 3;
+
+		} else if (strcmp(name, "baro") == 0) {
+			record.type = SENSOR_BARO;
+			expected = 1;
+
+		} else if (strcmp(name, "gps") == 0) {
+			record.type = SENSOR_GPS;
+			expected = 12;
+
+		} else if (strcmp(name, "airspeed") == 0) {
+			record.type = SENSOR_AIRSPEED;
+			expected = 2;
+
+		} else if (strcmp(name, "range") == 0) {
+			record.type = SENSOR_RANGE;
+			expected = 1;
+
+		} else {
+			printf("unknown sensor type on line %u\n", _line_number);
+			_failed = true;
+			return false;
+		}
+
+		if (fields < expected + 2) {
+			printf("too few fields on line %u\n", _line_number);
+			_failed = true;
+			return false;
+		}
+
+		record.time_us = time_us;
+		return true;
+	}
+
+	return false;
+}
+
+bool read_sensor_log(const char *filename, std::vector<log_record> &records)
+{
+	sensor_log_reader reader;
+
+	if (!reader.open(filename)) {
+		return false;
+	}
+
+	log_record record;
+
+	while (reader.next(record)) {
+		records.push_back(record);
+	}
+
+	return !reader.failed();
+}
+
+void generate_sensor_log(float duration_sec, std::vector<log_record> &records)
+{
+	const uint64_t imu_interval_us = 4000;
+	uint64_t end_time_us = 1000000 + (uint64_t)(duration_sec * 1e6f);
+	uint32_t seed = 1;
+
+	for (uint64_t time_us = 1000000; time_us < end_time_us; time_us += imu_interval_us) {
+		// linear congruential generator so the noise is identical on every platform
+		double noise[9];
+
+		for (int i = 0; i < 9; i++) {
+			seed = seed * 1664525u + 1013904223u;
+			noise[i] = (double)seed / 4294967296.0 - 0.5;
+		}
+
+		log_record imu = {};
+		imu.type = SENSOR_IMU;
+		imu.time_us = time_us;
+		imu.data[0] = imu.data[1] = imu_interval_us;
+		imu.data[2] = 1e-5 * noise[0];
+		imu.data[3] = 1e-5 * noise[1];
+		imu.data[4] = 1e-5 * noise[2];
+		imu.data[5] = 1e-3 * noise[3];
+		imu.data[6] = 1e-3 * noise[4];
+		imu.data[7] = -9.80665 * 1e-6 * imu_interval_us + 1e-3 * noise[5];
+		records.push_back(imu);
+
+		if (time_us % 20000 == 0) {
+			log_record mag = {};
+			mag.type = SENSOR_MAG;
+			mag.time_us = time_us;
+			mag.data[0] = 0.2 + 1e-3 * noise[6];
+			mag.data[1] = 1e-3 * noise[7];
+			mag.data[2] = 0.4 + 1e-3 * noise[8];
+			records.push_back(mag);
+
+			log_record baro = {};
+			baro.type = SENSOR_BARO;
+			baro.time_us = time_us;
+			baro.data[0] = 100.0 + 0.1 * noise[0];
+			records.push_back(baro);
+		}
+
+		if (time_us % 200000 == 0) {
+			log_record gps = {};
+			gps.type = SENSOR_GPS;
+			gps.time_us = time_us;
+			gps.data[0] = 473977418.0 + 10.0 * noise[1];
+			gps.data[1] = 85455938.0 + 10.0 * noise[2];
+			gps.data[2] = 100000.0 + 100.0 * noise[3];
+			gps.data[3] = 3;
+			gps.data[4] = 0.8;
+			gps.data[5] = 1.2;
+			gps.data[6] = 0.3;
+			gps.data[7] = 0.05 * noise[4];
+			gps.data[8] = 0.05 * noise[5];
+			gps.data[9] = 0.05 * noise[6];
+			gps.data[10] = 12;
+			gps.data[11] = 1.0;
+			records.push_back(gps);
+		}
+	}
+}
+
+void replay_sensor_record(Ekf &ekf, const log_record &record)
+{
+	const double *d = record.data;
+
+	switch (record.type) {
+	case SENSOR_IMU: {
+			float delta_ang[3] = {(float)d[2], (float)d[3], (float)d[4]};
+			float delta_vel[3] = {(float)d[5], (float)d[6], (float)d[7]};
+			ekf.setIMUData(record.time_us, (uint64_t)d[0], (uint64_t)d[1], delta_ang, delta_vel);
+			break;
+		}
+
+	case SENSOR_MAG: {
+			float mag[3] = {(float)d[0], (float)d[1], (float)d[2]};
+			ekf.setMagData(record.time_us, mag);
+			break;
+		}
+
+	case SENSOR_BARO:
+		ekf.setBaroData(record.time_us, (float)d[0]);
+		break;
+
+	case SENSOR_GPS: {
+			gps_message gps = {};
+			gps.time_usec = record.time_us;
+			gps.lat = (int32_t)d[0];
+			gps.lon = (int32_t)d[1];
+			gps.alt = (int32_t)d[2];
+			gps.fix_type = (uint8_t)d[3];
+			gps.eph = (float)d[4];
+			gps.epv = (float)d[5];
+			gps.sacc = (float)d[6];
+			gps.vel_ned[0] = (float)d[7];
+			gps.vel_ned[1] = (float)d[8];
+			gps.vel_ned[2] = (float)d[9];
+			gps.vel_m_s = sqrtf(gps.vel_ned[0] * gps.vel_ned[0] + gps.vel_ned[1] * gps.vel_ned[1]);
+			gps.vel_ned_valid = true;
+			gps.nsats = (uint8_t)d[10];
+			gps.gdop = (float)d[11];
+			ekf.setGpsData(record.time_us, &gps);
+			break;
+		}
+
+	case SENSOR_AIRSPEED:
+		ekf.setAirspeedData(record.time_us, (float)d[0], (float)d[1]);
+		break;
+
+	case SENSOR_RANGE:
+		ekf.setRangeData(record.time_us, (float)d[0]);
+		break;
+	}
+}
@@ -0,0 +1,124 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file sensor_log.h
+ * Sensor log reading and replay shared by the ekf replay tools.
+ *
+ * The log is a text file with one sensor sample per line. Lines starting with # are ignored.
+ * imu <time_us> <delta_ang_dt_us> <delta_vel_dt_us> <dang_x> <dang_y> <dang_z> <dvel_x> <dvel_y> <dvel_z>
+ * mag <time_us> <x> <y> <z>
+ * baro <time_us> <height_m>
+ * gps <time_us> <lat_1e7> <lon_1e7> <alt_mm> <fix_type> <eph> <epv> <sacc> <vel_n> <vel_e> <vel_d> <nsats> <gdop>
+ * airspeed <time_us> <true_airspeed> <eas2tas>
+ * range <time_us> <range_m>
+ *
+ * PX4 ULog files can also be replayed, see ulog_reader.h.
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "../ekf.h"
+
+enum sensor_type {
+	SENSOR_IMU = 0,
+	SENSOR_MAG,
+	SENSOR_BARO,
+	SENSOR_GPS,
+	SENSOR_AIRSPEED,
+	SENSOR_RANGE
+};
+
+struct log_record {
+	sensor_type type;
+	uint64_t time_us;
+	double data[13];
+};
+
+class ulog_reader;
+struct ulog_position;
+
+// a saved read position of a sensor_log_reader
+struct sensor_log_position {
+	long file_offset{0};
+	unsigned line_number{0};
+	std::shared_ptr<const ulog_position> ulog;
+};
+
+// reads a sensor log one record at a time so the memory used does not depend on the length of the log
+// files starting with the ULog header are decoded by ulog_reader, others are read as the text format above
+class sensor_log_reader
+{
+public:
+	sensor_log_reader() = default;
+	~sensor_log_reader();
+
+	sensor_log_reader(const sensor_log_reader &) = delete;
+	sensor_log_reader &operator=(const sensor_log_reader &) = delete;
+
+	// returns false if the file cannot be opened
+	bool open(const char *filename);
+
+	// get the next record, returns false at the end of the log or on an error
+	bool next(log_record &record);
+
+	// true if reading stopped because the log contains an invalid line or message
+	bool failed() const;
+
+	// save the read position so that the records following it can be read again
+	sensor_log_position tell() const;
+
+	// continue reading from a position returned by tell() for the same file, returns false on an error
+	bool seek(const sensor_log_position &position);
+
+private:
+	FILE *_file{nullptr};
+	ulog_reader *_ulog{nullptr};
+	unsigned _line_number{0};
+	bool _failed{false};
+
+	void close();
+};
+
+// read a whole sensor log, returns false if the file cannot be opened or contains an invalid line
+bool read_sensor_log(const char *filename, std::vector<log_record> &records);
+
+// generate a repeatable log for a stationary vehicle with small sensor noise
+void generate_sensor_log(float duration_sec, std::vector<log_record> &records);
+
+// pass a single logged sensor sample to the ekf
+void replay_sensor_record(Ekf &ekf, const log_record &record);
@@ -0,0 +1,625 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file ulog_reader.cpp
+ * Streaming reader for PX4 ULog files.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ulog_reader.h"
+
+namespace
+{
+
+const uint8_t ulog_magic[7] = {'U', 'L', 'o', 'g', 0x01, 0x12, 0x35};
+const size_t ulog_header_size = 16;
+const size_t message_header_size = 3;
+
+// the fields used from each decoded topic, fields after the required ones may be missing from the log
+struct topic_definition {
+	const char *name;
+	sensor_type type;
+	unsigned num_required;
+	const char *fields[12];
+};
+
+const topic_definition topics[] = {
+	{"sensor_combined", SENSOR_IMU, 5, {"timestamp", "gyro_rad", "gyro_integral_dt", "accelerometer_m_s2", "accelerometer_integral_dt"}},
+	{"vehicle_magnetometer", SENSOR_MAG, 2, {"timestamp", "magnetometer_ga"}},
+	{"vehicle_air_data", SENSOR_BARO, 2, {"timestamp", "baro_alt_meter"}},
+	{"vehicle_gps_position", SENSOR_GPS, 12, {"timestamp", "lat", "lon", "alt", "fix_type", "eph", "epv", "s_variance_m_s", "vel_n_m_s", "vel_e_m_s", "vel_d_m_s", "satellites_used"}},
+	{"airspeed", SENSOR_AIRSPEED, 3, {"timestamp", "true_airspeed_m_s", "indicated_airspeed_m_s"}},
+	{"distance_sensor", SENSOR_RANGE, 2, {"timestamp", "current_distance", "orientation"}},
+};
+
+const uint8_t distance_sensor_downward_facing = 25;
+
+struct format_field {
+	std::string type;
+	std::string name;
+	unsigned length;
+};
+
+// parse the field definition at start and move start to the next one, returns false if the definition is invalid
+bool parse_format_field(const std::string &text, size_t &start, format_field &result)
+{
+	size_t end = text.find(';', start);
+
+	if (end == std::string::npos) {
+		end = text.size();
+	}
+
+	size_t space = text.find(' ', start);
+
+	if (space == std::string::npos || space >= end || space == start) {
+		return false;
+	}
+
+	result.type = text.substr(start, space - start);
+	result.name = text.substr(space + 1, end - space - 1);
+	result.length = 1;
+	size_t bracket = result.type.find('[');
+
+	if (bracket != std::string::npos) {
+		result.length = (unsigned)atoi(result.type.c_str() + bracket + 1);
+		result.type.erase(bracket);
+	}
+
+	start = end + 1;
+	return result.length > 0;
+}
+
+}
+
+ulog_reader::~ulog_reader()
+{
+	close();
+}
+
+bool ulog_reader::is_ulog_file(const char *filename)
+{
+	FILE *file = fopen(filename, "rb");
+
+	if (file == NULL) {
+		return false;
+	}
+
+	uint8_t magic[sizeof(ulog_magic)];
+	bool is_ulog = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, ulog_magic, sizeof(magic)) == 0;
+	fclose(file);
+	return is_ulog;
+}
+
+bool ulog_reader::open(const char *filename)
+{
+	close();
+
+	int fd = ::open(filename, O_RDONLY);
+
+	if (fd < 0) {
+		printf("unable to open %s\n", filename);
+		return false;
+	}
+
+	struct stat file_stat;
+
+	if (fstat(fd, &file_stat) != 0 || file_stat.st_size < (off_t)ulog_header_size) {
+		printf("%s is not a ULog file\n", filename);
+		::close(fd);
+		return false;
+	}
+
+	void *data = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	// the mapping remains valid after the file is closed
+	::close(fd);
+
+	if (data == MAP_FAILED) {
+		printf("unable to map %s\n", filename);
+		return false;
+	}
+
+	_data = (const uint8_t *)data;
+	_size = (size_t)file_stat.st_size;
+	madvise(data, _size, MADV_SEQUENTIAL);
+
+	if (memcmp(_data, ulog_magic, sizeof(ulog_magic)) != 0) {
+		printf("%s is not a ULog file\n", filename);
+		close();
+		return false;
+	}
+
+	_position = ulog_header_size;
+	return true;
+}
+
+void ulog_reader::close()
+{
+	if (_data != nullptr) {
+		munmap((void *)_data, _size);
+	}
+
+	_data = nullptr;
+	_size = 0;
+	_position = 0;
+	_released = 0;
+	_failed = false;
+	_formats.clear();
+	_subscriptions.clear();
+	_pending = pending_queue();
+	_newest_time_us = 0;
+}
+
+std::shared_ptr<const ulog_position> ulog_reader::tell() const
+{
+	std::shared_ptr<ulog_position> position = std::make_shared<ulog_position>();
+	position->position = _position;
+	position->newest_time_us = _newest_time_us;
+	position->subscriptions = _subscriptions;
+	position->pending = _pending;
+	return position;
+}
+
+void ulog_reader::seek(const ulog_position &position)
+{
+	_position = position.position;
+	_newest_time_us = position.newest_time_us;
+	_subscriptions = position.subscriptions;
+	_pending = position.pending;
+
+	// pages before the new position that were released are mapped again when they are read
+	const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+	const size_t position_page = _position & ~(page_size - 1);
+
+	if (_released > position_page) {
+		_released = position_page;
+	}
+}
+
+bool ulog_reader::next(log_record &record)
+{
+	// read until the oldest held record can no longer be preceded by one still to be read
+	while (_pending.empty() || (_pending.top().record.time_us + reorder_window_us > _newest_time_us
+				    && _pending.size() < reorder_max_records)) {
+		if (!read_message()) {
+			break;
+		}
+	}
+
+	if (_pending.empty() || _failed) {
+		return false;
+	}
+
+	record = _pending.top().record;
+	_pending.pop();
+	return true;
+}
+
+bool ulog_reader::read_message()
+{
+	if (_data == nullptr || _failed || _position + message_header_size > _size) {
+		return false;
+	}
+
+	// pages that have been decoded are not needed again so stop them counting towards the resident memory
+	if (_position - _released >= release_interval_bytes) {
+		const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+		size_t release_end = _position & ~(page_size - 1);
+		madvise((void *)(_data + _released), release_end - _released, MADV_DONTNEED);
+		_released = release_end;
+	}
+
+	uint16_t msg_size;
+	memcpy(&msg_size, &_data[_position], sizeof(msg_size));
+	const char msg_type = (char)_data[_position + 2];
+	const uint8_t *payload = &_data[_position + message_header_size];
+
+	// a log that ends part way through a message is treated as having ended at the previous message
+	if (_position + message_header_size + msg_size > _size) {
+		_position = _size;
+		return false;
+	}
+
+	_position += message_header_size + msg_size;
+
+	switch (msg_type) {
+	case 'F':
+		if (!add_format((const char *)payload, msg_size)) {
+			printf("invalid ULog format definition at offset %llu\n",
+			       (unsigned long long)(_position - msg_size - message_header_size));
+			_failed = true;
+			return false;
+		}
+
+		break;
+
+	case 'A':
+		if (msg_size > 3) {
+			uint16_t msg_id;
+			memcpy(&msg_id, &payload[1], sizeof(msg_id));
+			add_subscription(payload[0], msg_id, std::string((const char *)&payload[3], msg_size - 3));
+		}
+
+		break;
+
+	case 'R':
+		if (msg_size >= 2) {
+			uint16_t msg_id;
+			memcpy(&msg_id, payload, sizeof(msg_id));
+			_subscriptions.erase(msg_id);
+		}
+
+		break;
+
+	case 'D':
+		if (msg_size >= 2) {
+			uint16_t msg_id;
+			memcpy(&msg_id, payload, sizeof(msg_id));
+			std::map<uint16_t, subscription>::const_iterator sub = _subscriptions.find(msg_id);
+			pending_record pending = {};
+			pending.offset = _position - msg_size - message_header_size;
+
+			if (sub != _subscriptions.end() && decode_data(sub->second, &payload[2], msg_size - 2, pending.record)) {
+				_pending.push(pending);
+
+				if (pending.record.time_us > _newest_time_us) {
+					_newest_time_us = pending.record.time_us;
+				}
+			}
+		}
+
+		break;
+
+	default:
+		// information, parameter, logging and synchronisation messages are not needed by the estimator
+		break;
+	}
+
+	return true;
+}
+
+bool ulog_reader::add_format(const char *text, size_t length)
+{
+	const char *separator = (const char *)memchr(text, ':', length);
+
+	if (separator == NULL || separator == text) {
+		return false;
+	}
+
+	std::string name(text, separator - text);
+	_formats[name] = std::string(separator + 1, length - (separator + 1 - text));
+	return true;
+}
+
+void ulog_reader::add_subscription(uint8_t multi_id, uint16_t msg_id, const std::string &name)
+{
+	// only the primary instance is used, as the flight code does
+	if (multi_id != 0) {
+		return;
+	}
+
+	for (unsigned i = 0; i < sizeof(topics) / sizeof(topics[0]); i++) {
+		if (name != topics[i].name) {
+			continue;
+		}
+
+		subscription sub;
+		sub.type = topics[i].type;
+
+		for (unsigned j = 0; j < NUM_FIELDS && topics[i].fields[j] != NULL; j++) {
+			field &f = sub.fields[j];
+
+			if (!find_field(name, topics[i].fields[j], f)) {
+				if (j < topics[i].num_required) {
+					printf("ULog topic %s has no field %s and will not be used\n", name.c_str(), topics[i].fields[j]);
+					return;
+				}
+
+				continue;
+			}
+
+			// data messages must be long enough to contain every field that is used
+			if (f.offset + f.size * f.length > sub.size) {
+				sub.size = f.offset + f.size * f.length;
+			}
+		}
+
+		_subscriptions[msg_id] = sub;
+		return;
+	}
+}
+
+bool ulog_reader::find_field(const std::string &format, const char *name, field &result)
+{
+	std::map<std::string, std::string>::const_iterator definition = _formats.find(format);
+
+	if (definition == _formats.end()) {
+		return false;
+	}
+
+	// the fields are packed in definition order as "type[length] name;"
+	const std::string &text = definition->second;
+	unsigned offset = 0;
+	size_t start = 0;
+	format_field definition_field;
+
+	while (start < text.size()) {
+		if (!parse_format_field(text, start, definition_field)) {
+			return false;
+		}
+
+		field_type basic_type = FIELD_INVALID;
+		unsigned size = type_size(definition_field.type, &basic_type);
+
+		if (size == 0) {
+			return false;
+		}
+
+		if (definition_field.name == name) {
+			// nested types cannot be read as a single value
+			if (basic_type == FIELD_INVALID) {
+				return false;
+			}
+
+			result.offset = offset;
+			result.type = basic_type;
+			result.size = size;
+			result.length = definition_field.length;
+			return true;
+		}
+
+		offset += size * definition_field.length;
+	}
+
+	return false;
+}
+
+unsigned ulog_reader::type_size(const std::string &type, field_type *basic_type)
+{
+	static const struct {
+		const char *name;
+		field_type type;
+		unsigned size;
+	} basic_types[] = {
+		{"int8_t", FIELD_INT8, 1},
+		{"uint8_t", FIELD_UINT8, 1},
+		{"bool", FIELD_UINT8, 1},
+		{"char", FIELD_INT8, 1},
+		{"int16_t", FIELD_INT16, 2},
+		{"uint16_t", FIELD_UINT16, 2},
+		{"int32_t", FIELD_INT32, 4},
+		{"uint32_t", FIELD_UINT32, 4},
+		{"int64_t", FIELD_INT64, 8},
+		{"uint64_t", FIELD_UINT64, 8},
+		{"float", FIELD_FLOAT, 4},
+		{"double", FIELD_DOUBLE, 8},
+	};
+
+	for (unsigned i = 0; i < sizeof(basic_types) / sizeof(basic_types[0]); i++) {
+		if (type == basic_types[i].name) {
+			if (basic_type != NULL) {
+				*basic_type = basic_types[i].type;
+			}
+
+			return basic_types[i].size;
+		}
+	}
+
+	if (basic_type != NULL) {
+		*basic_type = FIELD_INVALID;
+	}
+
+	// a nested message is the sum of the sizes of its fields
+	std::map<std::string, std::string>::const_iterator definition = _formats.find(type);
+
+	if (definition == _formats.end()) {
+		return 0;
+	}
+
+	const std::string &text = definition->second;
+	unsigned size = 0;
+	size_t start = 0;
+	format_field definition_field;
+
+	while (start < text.size()) {
+		if (!parse_format_field(text, start, definition_field)) {
+			return 0;
+		}
+
+		// a format that refers to itself would never terminate
+		unsigned field_size = (definition_field.type == type) ? 0 : type_size(definition_field.type, NULL);
+
+		if (field_size == 0) {
+			return 0;
+		}
+
+		size += field_size * definition_field.length;
+	}
+
+	return size;
+}
+
+double ulog_reader::read_field(const uint8_t *data, const field &f, unsigned index) const
+{
+	const uint8_t *value = data + f.offset;
+
+	switch (f.type) {
+	case FIELD_INT8:
+		return (double)(int8_t)value[index];
+
+	case FIELD_UINT8:
+		return (double)value[index];
+
+	case FIELD_INT16: {
+			int16_t v;
+			memcpy(&v, value + index * sizeof(v), sizeof(v));
+			return (double)v;
+		}
+
+	case FIELD_UINT16: {
+			uint16_t v;
+			memcpy(&v, value + index * sizeof(v), sizeof(v));
+			return (double)v;
+		}
+
+	case FIELD_INT32: {
+			int32_t v;
+			memcpy(&v, value + index * sizeof(v), sizeof(v));
+			return (double)v;
+		}
+
+	case FIELD_UINT32: {
+			uint32_t v;
+			memcpy(&v, value + index * sizeof(v), sizeof(v));
+			return (double)v;
+		}
+
+	case FIELD_INT64: {
+			int64_t v;
+			memcpy(&v, value + index * sizeof(v), sizeof(v));
+			return (double)v;
+		}
+
+	case FIELD_UINT64: {
+			uint64_t v;
+			memcpy(&v, value + index * sizeof(v), sizeof(v));
+			return (double)v;
+		}
+
+	case FIELD_FLOAT: {
+			float v;
+			memcpy(&v, value + index * sizeof(v), sizeof(v));
+			return (double)v;
+		}
+
+	case FIELD_DOUBLE: {
+			double v;
+			memcpy(&v, value + index * sizeof(v), sizeof(v));
+			return v;
+		}
+
+	default:
+		return 0.0;
+	}
+}
+
+bool ulog_reader::decode_data(const subscription &sub, const uint8_t *data, size_t length, log_record &record)
+{
+	// truncated messages are ignored
+	if (length < sub.size || sub.fields[0].type != FIELD_UINT64) {
+		return false;
+	}
+
+	uint64_t time_us;
+	memcpy(&time_us, data + sub.fields[0].offset, sizeof(time_us));
+
+	if (time_us == 0) {
+		return false;
+	}
+
+	record.type = sub.type;
+	record.time_us = time_us;
+	double *d = record.data;
+	const field *f = sub.fields;
+
+	switch (sub.type) {
+	case SENSOR_IMU: {
+			if (f[1].length < 3 || f[3].length < 3) {
+				return false;
+			}
+
+			// the logged rates and accelerations are the integrals divided by the integration time
+			const double gyro_dt_us = read_field(data, f[2], 0);
+			const double accel_dt_us = read_field(data, f[4], 0);
+			d[0] = gyro_dt_us;
+			d[1] = accel_dt_us;
+
+			for (unsigned i = 0; i < 3; i++) {
+				d[2 + i] = read_field(data, f[1], i) * gyro_dt_us * 1e-6;
+				d[5 + i] = read_field(data, f[3], i) * accel_dt_us * 1e-6;
+			}
+
+			return gyro_dt_us > 0.0 && accel_dt_us > 0.0;
+		}
+
+	case SENSOR_MAG:
+		if (f[1].length < 3) {
+			return false;
+		}
+
+		for (unsigned i = 0; i < 3; i++) {
+			d[i] = read_field(data, f[1], i);
+		}
+
+		return true;
+
+	case SENSOR_BARO:
+		d[0] = read_field(data, f[1], 0);
+		return true;
+
+	case SENSOR_GPS:
+		for (unsigned i = 0; i < 11; i++) {
+			d[i] = read_field(data, f[1 + i], 0);
+		}
+
+		// the flight code does not provide a geometric dilution of precision
+		d[11] = 0.0;
+		return true;
+
+	case SENSOR_AIRSPEED: {
+			d[0] = read_field(data, f[1], 0);
+			const double indicated_airspeed = read_field(data, f[2], 0);
+			d[1] = (indicated_airspeed > 0.1) ? d[0] / indicated_airspeed : 1.0;
+			return true;
+		}
+
+	case SENSOR_RANGE:
+		if (f[2].type != FIELD_INVALID && read_field(data, f[2], 0) != distance_sensor_downward_facing) {
+			return false;
+		}
+
+		d[0] = read_field(data, f[1], 0);
+		return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,180 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file ulog_reader.h
+ * Streaming reader for PX4 ULog files that produces the sensor records used by the ekf replay tools.
+ *
+ * The file is memory mapped and decoded one message at a time, so the memory used does not depend on the
+ * length of the log. Only the primary instance of the topics needed by the estimator interface is decoded:
+ *
+ * sensor_combined       imu
+ * vehicle_magnetometer  mag
+ * vehicle_air_data      baro
+ * vehicle_gps_position  gps
+ * airspeed              airspeed
+ * distance_sensor       range, downward facing sensors only
+ *
+ * Messages are written to a ULog file in the order they were received by the logger, which can differ slightly
+ * from the order of their time stamps, so records are held in a small reordering window before being returned.
+ * Records with the same time stamp are returned in the order they were logged.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "sensor_log.h"
+
+class ulog_reader
+{
+public:
+	ulog_reader() = default;
+	~ulog_reader();
+
+	ulog_reader(const ulog_reader &) = delete;
+	ulog_reader &operator=(const ulog_reader &) = delete;
+
+	// map the file and check the header, returns false if the file cannot be opened or is not a ULog file
+	bool open(const char *filename);
+
+	// get the next record in time stamp order, returns false at the end of the log or on an error
+	bool next(log_record &record);
+
+	// true if reading stopped because the log is corrupt
+	bool failed() const { return _failed; }
+
+	// returns true if the file starts with the ULog header
+	static bool is_ulog_file(const char *filename);
+
+	// save the read position, which includes the records held for reordering and so uses a bounded amount of memory
+	std::shared_ptr<const ulog_position> tell() const;
+
+	// continue reading from a position returned by tell() for the same file
+	void seek(const ulog_position &position);
+
+private:
+	friend struct ulog_position;
+
+	enum field_type {
+		FIELD_INVALID = 0,
+		FIELD_INT8,
+		FIELD_UINT8,
+		FIELD_INT16,
+		FIELD_UINT16,
+		FIELD_INT32,
+		FIELD_UINT32,
+		FIELD_INT64,
+		FIELD_UINT64,
+		FIELD_FLOAT,
+		FIELD_DOUBLE
+	};
+
+	// location of a single field within a logged message
+	struct field {
+		unsigned offset{0};
+		field_type type{FIELD_INVALID};
+		unsigned size{0};	// size of one element in bytes
+		unsigned length{0};	// number of array elements
+	};
+
+	enum { NUM_FIELDS = 12 };
+
+	// a logged topic that is decoded into sensor records
+	struct subscription {
+		sensor_type type{SENSOR_IMU};
+		unsigned size{0};		// minimum length of the message data in bytes
+		field fields[NUM_FIELDS];
+	};
+
+	// a record held for reordering and the offset of the message it was decoded from
+	struct pending_record {
+		log_record record;
+		size_t offset;
+	};
+
+	// orders records by time stamp with the oldest first and those with the same time stamp in file order
+	struct record_later {
+		bool operator()(const pending_record &a, const pending_record &b) const
+		{
+			return a.record.time_us > b.record.time_us || (a.record.time_us == b.record.time_us && a.offset > b.offset);
+		}
+	};
+
+	typedef std::priority_queue<pending_record, std::vector<pending_record>, record_later> pending_queue;
+
+	static const uint64_t reorder_window_us = 500000;	// records are held until a record this much newer has been read
+	static const size_t reorder_max_records = 4096;	// maximum number of records held for reordering
+	static const size_t release_interval_bytes = 16 << 20;	// mapped pages already decoded are released in blocks of this size
+
+	const uint8_t *_data{nullptr};	// start of the mapped file
+	size_t _size{0};		// length of the mapped file in bytes
+	size_t _position{0};		// offset of the next message to be decoded
+	size_t _released{0};		// length of the start of the mapping that has been released
+	bool _failed{false};
+
+	std::map<std::string, std::string> _formats;	// message format definitions indexed by the message name
+	std::map<uint16_t, subscription> _subscriptions;	// decoded topics indexed by the message id
+
+	pending_queue _pending;
+	uint64_t _newest_time_us{0};
+
+	void close();
+
+	// decode the next message, returns false at the end of the log or on an error
+	bool read_message();
+
+	bool add_format(const char *text, size_t length);
+	void add_subscription(uint8_t multi_id, uint16_t msg_id, const std::string &name);
+
+	// find a field of a message format, nested formats are searched by recursion
+	bool find_field(const std::string &format, const char *name, field &result);
+
+	// size of a basic or nested type in bytes, returns 0 if the type is unknown
+	unsigned type_size(const std::string &type, field_type *basic_type);
+
+	bool decode_data(const subscription &sub, const uint8_t *data, size_t length, log_record &record);
+	double read_field(const uint8_t *data, const field &f, unsigned index) const;
+};
+
+// the decoder state needed to continue reading a ULog file from a saved position
+struct ulog_position {
+	size_t position;
+	uint64_t newest_time_us;
+	std::map<uint16_t, ulog_reader::subscription> subscriptions;
+	ulog_reader::pending_queue pending;
+};
@@ -40,6 +40,8 @@
  *
  */
 
+#pragma once
+
 namespace estimator
 {
 struct gps_message {
@@ -84,6 +86,97 @@ struct outputSample {
 	uint64_t 	time_us;	// timestamp in microseconds
 };
 
+// velocity, position, height and yaw reset information
+struct stateResetStatus {
+	uint8_t velNE_counter;	// number of horizontal position reset events (allow to wrap if count exceeds 255)
+	uint8_t velD_counter;	// number of vertical velocity reset events (allow to wrap if count exceeds 255)
+	uint8_t posNE_counter;	// number of horizontal position reset events (allow to wrap if count exceeds 255)
+	uint8_t posD_counter;	// number of vertical position reset events (allow to wrap if count exceeds 255)
+	uint8_t quat_counter;	// number of quaternion reset events (allow to wrap if count exceeds 255)
+	Vector2f velNE_change;  // North East velocity change due to last reset (m)
+	float velD_change;	// Down velocity change due to last reset (m/s)
+	Vector2f posNE_change;	// North, East position change due to last reset (m)
+	float posD_change;	// Down position change due to last reset (m)
+	Quaternion quat_change;	// quaternion delta due to last reset - multiply pre-reset quaternion by this to get post-reset quaternion
+};
+
+// EKF states on the delayed fusion time horizon used to correct an output predictor running on a separate thread
+struct outputCorrection {
+	Quaternion  quat_nominal;	// quaternion defining the rotation from NED to XYZ frame
+	Vector3f    vel;	// NED velocity in earth frame in m/s
+	Vector3f    pos;	// NED position in earth frame in m
+	Vector3f    gyro_bias;	// delta angle bias estimate in rad
+	Vector3f    accel_bias;	// delta velocity bias estimate in m/s
+	float       dt_ekf_avg;	// average EKF prediction period in s
+	float       vel_Tau;	// velocity state correction time constant (1/sec)
+	float       pos_Tau;	// postion state correction time constant (1/sec)
+	Vector3f    imu_pos_body;	// xyz position of IMU in body frame (m)
+	stateResetStatus reset_status;	// reset events applied to the EKF states
+	uint8_t     align_counter;	// number of times the output states have been aligned to the EKF states (allow to wrap if count exceeds 255)
+	uint64_t    time_us;	// timestamp of the delayed fusion time horizon in microseconds
+};
+
+// consistent set of estimator outputs published at the end of each update for readers on other threads
+struct estimatorSnapshot {
+	uint64_t    time_us;		// timestamp of the newest IMU sample used by the filter in microseconds
+	uint64_t    time_delayed_us;	// timestamp of the delayed fusion time horizon in microseconds
+	float       quat[4];		// output predictor quaternion defining the rotation from NED to XYZ frame
+	float       vel[3];		// velocity of the body frame origin in local NED earth frame (m/s)
+	float       pos[3];		// position of the body frame origin in local NED earth frame (m)
+	float       states[24];		// state vector at the delayed time horizon
+	float       covariances[24];	// diagonal elements of the covariance matrix
+	float       gyro_bias[3];	// gyroscope bias (rad/s)
+	float       accel_bias[3];	// accelerometer bias (m/s**2)
+	float       vel_pos_innov[6];	// velocity and position innovations: 0-2 vel, 3-5 pos
+	float       vel_pos_innov_var[6];	// velocity and position innovation variances: 0-2 vel, 3-5 pos
+	float       mag_innov[3];	// earth magnetic field innovations
+	float       mag_innov_var[3];	// earth magnetic field innovation variances
+	float       heading_innov;	// heading innovation (rad)
+	float       heading_innov_var;	// heading innovation variance (rad**2)
+	float       airspeed_innov;	// true airspeed innovation (m/s)
+	float       airspeed_innov_var;	// true airspeed innovation variance (m**2/s**2)
+	float       beta_innov;		// synthetic sideslip innovation (rad)
+	float       beta_innov_var;	// synthetic sideslip innovation variance (rad**2)
+	float       flow_innov[2];	// optical flow innovations (rad/s)
+	float       flow_innov_var[2];	// optical flow innovation variances (rad**2/s**2)
+	float       drag_innov[2];	// drag specific force innovations (m/s**2)
+	float       drag_innov_var[2];	// drag specific force innovation variances (m**2/s**4)
+	float       hagl_innov;		// height above ground innovation (m)
+	float       hagl_innov_var;	// height above ground innovation variance (m**2)
+	float       mag_test_ratio;	// largest magnetometer innovation test ratio
+	float       vel_test_ratio;	// largest velocity innovation test ratio
+	float       pos_test_ratio;	// largest horizontal position innovation test ratio
+	float       hgt_test_ratio;	// vertical position innovation test ratio
+	float       tas_test_ratio;	// airspeed innovation test ratio
+	float       hagl_test_ratio;	// height above ground innovation test ratio
+	float       output_tracking_error[3];	// output predictor angle, velocity and position tracking errors (rad, m/s, m)
+	float       vibe[3];		// IMU vibration metrics, see Ekf::get_imu_vibe_metrics()
+	float       pos_horiz_accuracy;	// 1-sigma horizontal local position uncertainty (m)
+	float       pos_vert_accuracy;	// 1-sigma vertical local position uncertainty (m)
+	float       vel_horiz_accuracy;	// 1-sigma horizontal velocity uncertainty (m/s)
+	float       vel_vert_accuracy;	// 1-sigma vertical velocity uncertainty (m/s)
+	float       terrain_vert_pos;	// vertical position of the terrain in local NED earth frame (m)
+	float       posD_reset_delta;	// change in vertical position due to the last reset (m)
+	float       velD_reset_delta;	// change in vertical velocity due to the last reset (m/s)
+	float       posNE_reset_delta[2];	// change in horizontal position due to the last reset (m)
+	float       velNE_reset_delta[2];	// change in horizontal velocity due to the last reset (m/s)
+	float       quat_reset_delta[4];	// quaternion delta due to the last reset
+	uint16_t    control_mode;	// filter control status bitmask, see filter_control_status_u
+	uint16_t    fault_status;	// filter fault status bitmask, see fault_status_u
+	uint16_t    innov_check_status;	// innovation consistency check failure bitmask, see innovation_fault_status_u
+	uint16_t    gps_check_status;	// GPS quality check failure bitmask, see gps_check_fail_status_u
+	uint16_t    soln_status;	// solution validity bitmask, see ekf_solution_status
+	uint8_t     posD_reset_counter;	// number of vertical position resets
+	uint8_t     velD_reset_counter;	// number of vertical velocity resets
+	uint8_t     posNE_reset_counter;	// number of horizontal position resets
+	uint8_t     velNE_reset_counter;	// number of horizontal velocity resets
+	uint8_t     quat_reset_counter;	// number of quaternion resets
+	bool        dead_reckoning;	// true when the position estimate is not constrained by aiding
+	bool        terrain_valid;	// true when terrain_vert_pos is valid
+	bool        local_position_valid;	// true when the local position estimate is valid
+	bool        global_position_valid;	// true when the global position estimate is valid
+};
+
 struct imuSample {
 	Vector3f    delta_ang;	// delta angle in body frame (integrated gyro measurements)
 	Vector3f    delta_vel;	// delta velocity in body frame (integrated accelerometer measurements)
@@ -231,6 +324,7 @@ struct parameters {
 	float mag_innov_gate;		// magnetometer fusion innovation consistency gate size (STD)
 	int mag_declination_source;	// bitmask used to control the handling of declination data
 	int mag_fusion_type;		// integer used to specify the type of magnetometer fusion used
+	int mag_fuse_batch;		// set to 1 to fuse the 3-axis magnetometer components as a single vector observation instead of sequentially
 
 	// airspeed fusion
 	float tas_innov_gate;		// True Airspeed Innovation consistency gate size in standard deciation
@@ -296,6 +390,24 @@ struct parameters {
 	float bcoef_x;			// ballistic coefficient along the X-axis (kg/m**2)
 	float bcoef_y;			// ballistic coefficient along the Y-axis (kg/m**2)
 
+	// fusion load scheduling
+	float fusion_frame_budget;	// maximum number of scalar observation updates per filter update before deferrable
+					// measurements are moved to the following update, zero disables the scheduler
+	unsigned fusion_max_defer;	// maximum number of consecutive filter updates a measurement can be deferred
+
+	// prediction rate
+	int filter_update_period_ms;	// nominal time between filter prediction steps (msec)
+	int filter_update_adaptive;	// set to 1 to adapt the prediction period to the flight condition and CPU load
+	int filter_update_period_min_ms;	// prediction period used by the adaptive mode during aggressive flight (msec)
+	int filter_update_period_max_ms;	// prediction period used by the adaptive mode when on ground, stationary or CPU bound (msec)
+	float filter_update_agile_rate;	// angular rate above which the adaptive mode uses the shortest prediction period (rad/sec)
+	float filter_update_rest_rate;	// angular rate below which the adaptive mode treats the vehicle as stationary (rad/sec)
+	float filter_update_cpu_load_max;	// CPU load fraction above which the adaptive mode lengthens the prediction period
+
+	// warm start
+	float warm_start_mag_tol;	// maximum difference between the saved earth field and the first magnetometer samples
+					// for a warm start record to be used (Gauss)
+
 	// Initialize parameter values.  Initialization must be accomplished in the constructor to allow C99 compiler compatibility.
 	parameters()
 	{
@@ -349,6 +461,7 @@ struct parameters {
 		mag_innov_gate = 3.0f;
 		mag_declination_source = 7;
 		mag_fusion_type = 0;
+		mag_fuse_batch = 0;
 
 		// airspeed fusion
 		tas_innov_gate = 5.0f;
@@ -412,6 +525,22 @@ struct parameters {
 		bcoef_x = 25.0f;
 		bcoef_y = 25.0f;
 
+		// fusion load scheduling
+		fusion_frame_budget = 0.0f;
+		fusion_max_defer = 1;
+
+		// prediction rate
+		filter_update_period_ms = 12;
+		filter_update_adaptive = 0;
+		filter_update_period_min_ms = 4;
+		filter_update_period_max_ms = 24;
+		filter_update_agile_rate = 3.0f;
+		filter_update_rest_rate = 0.05f;
+		filter_update_cpu_load_max = 0.8f;
+
+		// warm start
+		warm_start_mag_tol = 0.05f;
+
 	}
 };
 
@@ -527,4 +656,89 @@ union ekf_solution_status {
     uint16_t value;
 };
 
+// processing stages of Ekf::update that are reported to a timing hook when the library is built with ECL_EKF_TIMING
+enum ekf_timing_stage {
+	EKF_TIMING_PREDICT_STATE = 0,
+	EKF_TIMING_PREDICT_COVARIANCE,
+	EKF_TIMING_TERRAIN_ESTIMATOR,
+	EKF_TIMING_CONTROL_FUSION_MODES,	// includes all of the control*Fusion stages below
+	EKF_TIMING_CONTROL_MAG_FUSION,
+	EKF_TIMING_CONTROL_EV_FUSION,
+	EKF_TIMING_CONTROL_FLOW_FUSION,
+	EKF_TIMING_CONTROL_GPS_FUSION,
+	EKF_TIMING_CONTROL_BARO_FUSION,
+	EKF_TIMING_CONTROL_RANGE_FUSION,
+	EKF_TIMING_CONTROL_AIR_DATA_FUSION,
+	EKF_TIMING_CONTROL_BETA_FUSION,
+	EKF_TIMING_CONTROL_DRAG_FUSION,
+	EKF_TIMING_CONTROL_VEL_POS_FUSION,
+	EKF_TIMING_CALCULATE_OUTPUT_STATES,
+	EKF_TIMING_FUSE_MAG,
+	EKF_TIMING_FUSE_HEADING,
+	EKF_TIMING_FUSE_DECLINATION,
+	EKF_TIMING_FUSE_VEL_POS_HEIGHT,
+	EKF_TIMING_FUSE_OPT_FLOW,
+	EKF_TIMING_FUSE_AIRSPEED,
+	EKF_TIMING_FUSE_SIDESLIP,
+	EKF_TIMING_FUSE_DRAG,
+	EKF_TIMING_FUSE_HAGL,
+	EKF_TIMING_NUM_STAGES
+};
+
+// measurement sources that the fusion load scheduler can defer to the following filter update
+enum fusion_source {
+	FUSION_SOURCE_MAG = 0,
+	FUSION_SOURCE_EV,
+	FUSION_SOURCE_FLOW,
+	FUSION_SOURCE_RANGE,
+	FUSION_SOURCE_AIRSPEED,
+	FUSION_SOURCE_NUM
+};
+
+// fusion load scheduler statistics
+struct fusion_schedule_stats {
+	uint32_t deferred[FUSION_SOURCE_NUM];	// number of times a measurement was moved to the following update
+	uint32_t superseded[FUSION_SOURCE_NUM];	// number of deferred measurements replaced by a newer one before fusion
+	uint32_t frames;			// number of filter updates scheduled
+	uint32_t frames_over_budget;		// number of updates whose cost exceeded the budget after deferral
+	float last_frame_cost;			// scalar observation updates scheduled in the last filter update
+	float max_frame_cost;			// largest number of scalar observation updates scheduled in a filter update
+};
+
+// execution time statistics for a processing stage
+struct ekf_timing_stats {
+	uint32_t count;		// number of times the stage has run
+	float min_us;		// minimum execution time (usec)
+	float mean_us;		// mean execution time (usec)
+	float max_us;		// maximum execution time (usec)
+};
+
+// memory needed by one filter instance for a parameter configuration, see Ekf::get_memory_footprint()
+struct ekf_memory_footprint {
+	size_t static_bytes;		// size of the filter object, which holds the data buffers if built with ECL_BUFFER_MAX_DELAY_MS (bytes)
+	size_t heap_bytes;		// heap allocated for the data buffers, excluding the allocator overhead (bytes)
+	uint8_t imu_buffer_length;	// length of the IMU and output predictor buffers
+	uint8_t obs_buffer_length;	// length of each observation buffer
+};
+
+// interface that is called at the start and end of each timed processing stage
+class EkfTimingHook
+{
+public:
+	virtual ~EkfTimingHook() = default;
+
+	virtual void stage_start(ekf_timing_stage stage) = 0;
+	virtual void stage_end(ekf_timing_stage stage) = 0;
+};
+
+// interface that is called after each state and covariance prediction, before any observation is fused
+// state uses the layout of Ekf::get_state_delayed() and covariance is the row major num_states x num_states matrix
+class EkfPredictionHook
+{
+public:
+	virtual ~EkfPredictionHook() = default;
+
+	virtual void predicted(const imuSample &imu, const float *state, const float *covariance, unsigned num_states) = 0;
+};
+
 }
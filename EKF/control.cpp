@@ -43,6 +43,34 @@
 #include "ekf.h"
 #include "mathlib.h"
 
+bool Ekf::scheduleFusion(fusion_source source, bool new_sample, float cost)
+{
+	if (new_sample) {
+		if (_fusion_held[source]) {
+			// the deferred sample has been replaced by a newer one
+			_fusion_stats.superseded[source]++;
+		}
+
+	} else if (!_fusion_held[source]) {
+		return false;
+	}
+
+	_fusion_held[source] = false;
+
+	// defer the sample if it would exceed the budget, but not for longer than the delayed horizon tolerates
+	if (_params.fusion_frame_budget > 0.0f && (_fusion_frame_cost + cost) > _params.fusion_frame_budget
+	    && _fusion_defer_count[source] < _params.fusion_max_defer) {
+		_fusion_held[source] = true;
+		_fusion_defer_count[source]++;
+		_fusion_stats.deferred[source]++;
+		return false;
+	}
+
+	_fusion_defer_count[source] = 0;
+	_fusion_frame_cost += cost;
+	return true;
+}
+
 void Ekf::controlFusionModes()
 {
 	// Store the status to enable change detection
@@ -81,36 +109,71 @@ void Ekf::controlFusionModes()
 
 	// check for arrival of new sensor data at the fusion time horizon
 	_gps_data_ready = _gps_buffer.pop_first_older_than(_imu_sample_delayed.time_us, &_gps_sample_delayed);
-	_mag_data_ready = _mag_buffer.pop_first_older_than(_imu_sample_delayed.time_us, &_mag_sample_delayed);
 	_baro_data_ready = _baro_buffer.pop_first_older_than(_imu_sample_delayed.time_us, &_baro_sample_delayed);
 
+	// GPS and baro data are always fused when ready. The remaining sources are fused in order of priority and
+	// are deferred to the following update if they would take the frame over the fusion budget
+	_fusion_frame_cost = (_gps_data_ready ? 5.0f : 0.0f) + (_baro_data_ready ? 1.0f : 0.0f);
+
+	_mag_data_ready = scheduleFusion(FUSION_SOURCE_MAG,
+					 _mag_buffer.pop_first_older_than(_imu_sample_delayed.time_us, &_mag_sample_delayed),
+					 _control_status.flags.mag_3D ? 3.0f : 1.0f);
+
+	_ev_data_ready = scheduleFusion(FUSION_SOURCE_EV,
+					_ext_vision_buffer.pop_first_older_than(_imu_sample_delayed.time_us, &_ev_sample_delayed), 3.0f);
+
+	// the flow and range samples are only accepted when the sensor tilt is within limits. A rejected sample
+	// must not replace a sample that is being held by the scheduler.
+	flowSample flow_sample;
+	const bool flow_sample_ready = _flow_buffer.pop_first_older_than(_imu_sample_delayed.time_us, &flow_sample)
+				       && (_R_to_earth(2, 2) > 0.7071f);
+
+	if (flow_sample_ready) {
+		_flow_sample_delayed = flow_sample;
+	}
+
+	_flow_data_ready = scheduleFusion(FUSION_SOURCE_FLOW, flow_sample_ready, 2.0f);
+
 	// calculate 2,2 element of rotation matrix from sensor frame to earth frame
 	_R_rng_to_earth_2_2 = _R_to_earth(2, 0) * _sin_tilt_rng + _R_to_earth(2, 2) * _cos_tilt_rng;
-	_range_data_ready = _range_buffer.pop_first_older_than(_imu_sample_delayed.time_us, &_range_sample_delayed)
-			&& (_R_rng_to_earth_2_2 > 0.7071f);
+	rangeSample range_sample;
+	const bool range_sample_ready = _range_buffer.pop_first_older_than(_imu_sample_delayed.time_us, &range_sample)
+					&& (_R_rng_to_earth_2_2 > 0.7071f);
+
+	if (range_sample_ready) {
+		_range_sample_delayed = range_sample;
+	}
+
+	_range_data_ready = scheduleFusion(FUSION_SOURCE_RANGE, range_sample_ready, 1.0f);
+
+	_tas_data_ready = scheduleFusion(FUSION_SOURCE_AIRSPEED,
+					 _airspeed_buffer.pop_first_older_than(_imu_sample_delayed.time_us, &_airspeed_sample_delayed), 1.0f);
 
-	_flow_data_ready = _flow_buffer.pop_first_older_than(_imu_sample_delayed.time_us, &_flow_sample_delayed)
-			&&  (_R_to_earth(2, 2) > 0.7071f);
-	_ev_data_ready = _ext_vision_buffer.pop_first_older_than(_imu_sample_delayed.time_us, &_ev_sample_delayed);
-	_tas_data_ready = _airspeed_buffer.pop_first_older_than(_imu_sample_delayed.time_us, &_airspeed_sample_delayed);
+	_fusion_stats.frames++;
+	_fusion_stats.last_frame_cost = _fusion_frame_cost;
+	_fusion_stats.max_frame_cost = math::max(_fusion_stats.max_frame_cost, _fusion_frame_cost);
+
+	if (_params.fusion_frame_budget > 0.0f && _fusion_frame_cost > _params.fusion_frame_budget) {
+		_fusion_stats.frames_over_budget++;
+	}
 
 	// check for height sensor timeouts and reset and change sensor if necessary
 	controlHeightSensorTimeouts();
 
 	// control use of observations for aiding
-	controlMagFusion();
-	controlExternalVisionFusion();
-	controlOpticalFlowFusion();
-	controlGpsFusion();
-	controlBaroFusion();
-	controlRangeFinderFusion();
-	controlAirDataFusion();
-	controlBetaFusion();
-	controlDragFusion();
+	EKF_TIMED_STAGE(EKF_TIMING_CONTROL_MAG_FUSION, controlMagFusion());
+	EKF_TIMED_STAGE(EKF_TIMING_CONTROL_EV_FUSION, controlExternalVisionFusion());
+	EKF_TIMED_STAGE(EKF_TIMING_CONTROL_FLOW_FUSION, controlOpticalFlowFusion());
+	EKF_TIMED_STAGE(EKF_TIMING_CONTROL_GPS_FUSION, controlGpsFusion());
+	EKF_TIMED_STAGE(EKF_TIMING_CONTROL_BARO_FUSION, controlBaroFusion());
+	EKF_TIMED_STAGE(EKF_TIMING_CONTROL_RANGE_FUSION, controlRangeFinderFusion());
+	EKF_TIMED_STAGE(EKF_TIMING_CONTROL_AIR_DATA_FUSION, controlAirDataFusion());
+	EKF_TIMED_STAGE(EKF_TIMING_CONTROL_BETA_FUSION, controlBetaFusion());
+	EKF_TIMED_STAGE(EKF_TIMING_CONTROL_DRAG_FUSION, controlDragFusion());
 
 	// for efficiency, fusion of direct state observations for position and velocity is performed sequentially
 	// in a single function using sensor data from multiple sources (GPS, external vision, baro, range finder, etc)
-	controlVelPosFusion();
+	EKF_TIMED_STAGE(EKF_TIMING_CONTROL_VEL_POS_FUSION, controlVelPosFusion());
 
 	// report dead reckoning if we are no longer fusing measurements that constrain velocity drift
 	_is_dead_reckoning = (_time_last_imu - _time_last_pos_fuse > _params.no_aid_timeout_max)
@@ -153,7 +216,7 @@ void Ekf::controlExternalVisionFusion()
 				matrix::Euler<float> euler_init(q_init);
 
 				// get initial yaw from the observation quaternion
-				extVisionSample ev_newest = _ext_vision_buffer.get_newest();
+				const extVisionSample &ev_newest = _ext_vision_buffer.get_newest();
 				matrix::Quaternion<float> q_obs(ev_newest.quat(0), ev_newest.quat(1), ev_newest.quat(2), ev_newest.quat(3));
 				matrix::Euler<float> euler_obs(q_obs);
 				euler_init(2) = euler_obs(2);
@@ -167,18 +230,9 @@ void Ekf::controlExternalVisionFusion()
 				// calculate the amount that the quaternion has changed by
 				_state_reset_status.quat_change = _state.quat_nominal * quat_before_reset.inversed();
 
-				// add the reset amount to the output observer buffered data
-				outputSample output_states;
-				unsigned output_length = _output_buffer.get_length();
-				for (unsigned i=0; i < output_length; i++) {
-					output_states = _output_buffer.get_from_index(i);
-					output_states.quat_nominal *= _state_reset_status.quat_change;
-					_output_buffer.push_to_index(i,output_states);
-				}
-
-				// apply the change in attitude quaternion to our newest quaternion estimate
+				// add the reset amount to the output observer buffered data and to our newest quaternion estimate
 				// which was already taken out from the output buffer
-				_output_new.quat_nominal *= _state_reset_status.quat_change;
+				rotateOutputHistory(_state_reset_status.quat_change);
 
 				// capture the reset event
 				_state_reset_status.quat_counter++;
@@ -278,8 +332,7 @@ void Ekf::controlOpticalFlowFusion()
 					}
 
 					// reset the velocity covariance terms
-					zeroRows(P,4,5);
-					zeroCols(P,4,5);
+					P.zeroRowsCols(4, 5);
 
 					// reset the horizontal velocity variance using the optical flow noise variance
 					P[5][5] = P[4][4] = sq(range) * calcOptFlowMeasVar();
@@ -298,8 +351,7 @@ void Ekf::controlOpticalFlowFusion()
 
 					// reset the corresponding covariances
 					// we are by definition at the origin at commencement so variances are also zeroed
-					zeroRows(P,7,8);
-					zeroCols(P,7,8);
+					P.zeroRowsCols(7, 8);
 
 					// align the output observer to the EKF states
 					alignOutputFilter();
@@ -495,10 +547,10 @@ void Ekf::controlHeightSensorTimeouts()
 		// handle the case where we are using baro for height
 		if (_control_status.flags.baro_hgt) {
 			// check if GPS height is available
-			gpsSample gps_init = _gps_buffer.get_newest();
+			const gpsSample &gps_init = _gps_buffer.get_newest();
 			bool gps_hgt_available = ((_time_last_imu - gps_init.time_us) < 2 * GPS_MAX_INTERVAL);
 			bool gps_hgt_accurate = (gps_init.vacc < _params.req_vacc);
-			baroSample baro_init = _baro_buffer.get_newest();
+			const baroSample &baro_init = _baro_buffer.get_newest();
 			bool baro_hgt_available = ((_time_last_imu - baro_init.time_us) < 2 * BARO_MAX_INTERVAL);
 
 			// check for inertial sensing errors in the last 10 seconds
@@ -556,12 +608,12 @@ void Ekf::controlHeightSensorTimeouts()
 		// handle the case we are using GPS for height
 		if (_control_status.flags.gps_hgt) {
 			// check if GPS height is available
-			gpsSample gps_init = _gps_buffer.get_newest();
+			const gpsSample &gps_init = _gps_buffer.get_newest();
 			bool gps_hgt_available = ((_time_last_imu - gps_init.time_us) < 2 * GPS_MAX_INTERVAL);
 			bool gps_hgt_accurate = (gps_init.vacc < _params.req_vacc);
 
 			// check the baro height source for consistency and freshness
-			baroSample baro_init = _baro_buffer.get_newest();
+			const baroSample &baro_init = _baro_buffer.get_newest();
 			bool baro_data_fresh = ((_time_last_imu - baro_init.time_us) < 2 * BARO_MAX_INTERVAL);
 			float baro_innov = _state.pos(2) - (_hgt_sensor_offset - baro_init.hgt + _baro_hgt_offset);
 			bool baro_data_consistent = fabsf(baro_innov) < (sq(_params.baro_noise) + P[8][8]) * sq(_params.baro_innov_gate);
@@ -614,11 +666,11 @@ void Ekf::controlHeightSensorTimeouts()
 		// handle the case we are using range finder for height
 		if (_control_status.flags.rng_hgt) {
 			// check if range finder data is available
-			rangeSample rng_init = _range_buffer.get_newest();
+			const rangeSample &rng_init = _range_buffer.get_newest();
 			bool rng_data_available = ((_time_last_imu - rng_init.time_us) < 2 * RNG_MAX_INTERVAL);
 
 			// check if baro data is available
-			baroSample baro_init = _baro_buffer.get_newest();
+			const baroSample &baro_init = _baro_buffer.get_newest();
 			bool baro_data_available = ((_time_last_imu - baro_init.time_us) < 2 * BARO_MAX_INTERVAL);
 
 			// reset to baro if we have no range data and baro data is available
@@ -666,11 +718,11 @@ void Ekf::controlHeightSensorTimeouts()
 		// handle the case where we are using external vision data for height
 		if (_control_status.flags.ev_hgt) {
 			// check if vision data is available
-			extVisionSample ev_init = _ext_vision_buffer.get_newest();
+			const extVisionSample &ev_init = _ext_vision_buffer.get_newest();
 			bool ev_data_available = ((_time_last_imu - ev_init.time_us) < 2 * EV_MAX_INTERVAL);
 
 			// check if baro data is available
-			baroSample baro_init = _baro_buffer.get_newest();
+			const baroSample &baro_init = _baro_buffer.get_newest();
 			bool baro_data_available = ((_time_last_imu - baro_init.time_us) < 2 * BARO_MAX_INTERVAL);
 
 			// reset to baro if we have no vision data and baro data is available
@@ -789,6 +841,7 @@ void Ekf::controlRangeFinderFusion()
 
 void Ekf::controlAirDataFusion()
 {
+#ifndef ECL_EKF_NO_WIND_STATES
         // control activation and initialisation/reset of wind states required for airspeed fusion
 
         // If both airspeed and sideslip fusion have timed out then we no longer have valid wind estimates
@@ -816,13 +869,16 @@ void Ekf::controlAirDataFusion()
 
 		}
 
-		fuseAirspeed();
+		// airspeed fusion is performed with the synthetic sideslip fusion by controlBetaFusion()
+		_fuse_airspeed = true;
 
 	}
+#endif
 }
 
 void Ekf::controlBetaFusion()
 {
+#ifndef ECL_EKF_NO_WIND_STATES
         // control activation and initialisation/reset of wind states required for synthetic sideslip fusion fusion
 
         // If both airspeed and sideslip fusion have timed out then we no longer have valid wind estimates
@@ -854,15 +910,18 @@ void Ekf::controlBetaFusion()
 			resetWindCovariance();
 		}
 
-                fuseSideslip();
+                _fuse_sideslip = true;
  	}
 
- 	
+	// fuse the airspeed and sideslip observations due this update using shared relative wind terms
+	fuseAirData();
 
+#endif
 }
 
 void Ekf::controlDragFusion()
 {
+#ifndef ECL_EKF_NO_WIND_STATES
 	if (_params.fusion_mode & MASK_USE_DRAG && _control_status.flags.in_air) {
 		if (!_control_status.flags.wind) {
 			// reset the wind states and covariances when starting drag accel fusion
@@ -877,6 +936,7 @@ void Ekf::controlDragFusion()
 	} else {
 		_control_status.flags.wind = false;
 	}
+#endif
 }
 
 void Ekf::controlMagFusion()
@@ -895,6 +955,14 @@ void Ekf::controlMagFusion()
 	// checs for new magnetometer data tath has fallen beind the fusion time horizon
 	if (_mag_data_ready) {
 
+#ifdef ECL_EKF_NO_MAG_STATES
+		// the magnetic field states have been compiled out so heading fusion is used for all magnetometer fusion types
+		_control_status.flags.mag_hdg = _params.mag_fusion_type == MAG_FUSE_TYPE_AUTO
+						 || _params.mag_fusion_type == MAG_FUSE_TYPE_HEADING
+						 || _params.mag_fusion_type == MAG_FUSE_TYPE_3D;
+		_control_status.flags.mag_3D = false;
+
+#else
 		// Determine if we should use simple magnetic heading fusion which works better when there are large external disturbances
 		// or the more accurate 3-axis fusion
 		if (_params.mag_fusion_type == MAG_FUSE_TYPE_AUTO) {
@@ -941,6 +1009,8 @@ void Ekf::controlMagFusion()
 			_control_status.flags.mag_3D = false;
 		}
 
+#endif
+
 		// if we are using 3-axis magnetometer fusion, but without external aiding, then the declination must be fused as an observation to prevent long term heading drift
 		// fusing declination when gps aiding is available is optional, but recommneded to prevent problem if the vehicle is static for extended periods of time
 		if (_control_status.flags.mag_3D && (!_control_status.flags.gps || (_params.mag_declination_source & MASK_FUSE_DECL))) {
@@ -951,6 +1021,7 @@ void Ekf::controlMagFusion()
 		}
 
 		// fuse magnetometer data using the selected methods
+#ifndef ECL_EKF_NO_MAG_STATES
 		if (_control_status.flags.mag_3D && _control_status.flags.yaw_align) {
 			fuseMag();
 
@@ -958,7 +1029,9 @@ void Ekf::controlMagFusion()
 				fuseDeclination();
 			}
 
-		} else if (_control_status.flags.mag_hdg && _control_status.flags.yaw_align) {
+		} else
+#endif
+		if (_control_status.flags.mag_hdg && _control_status.flags.yaw_align) {
 			// fusion of an Euler yaw angle from either a 321 or 312 rotation sequence
 			fuseHeading();
 
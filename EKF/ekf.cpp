@@ -42,6 +42,7 @@
 #include "../ecl.h"
 #include "ekf.h"
 #include "mathlib.h"
+#include "fast_math.h"
 
 #ifndef __PX4_QURT
 #if defined(__cplusplus) && !defined(__PX4_NUTTX)
@@ -57,6 +58,11 @@
 #define ISFINITE(x) __builtin_isfinite(x)
 #endif
 
+// fail the build if a filter instance is larger than the static memory budget of the target (bytes)
+#ifdef ECL_EKF_STATIC_BYTES_MAX
+static_assert(sizeof(Ekf) <= ECL_EKF_STATIC_BYTES_MAX, "Ekf object exceeds ECL_EKF_STATIC_BYTES_MAX");
+#endif
+
 
 const float Ekf::_k_earth_rate = 0.000072921f;
 const float Ekf::_gravity_mss = 9.80665f;
@@ -94,12 +100,6 @@ Ekf::Ekf():
 	_heading_innov_var(0.0f),
 	_delta_time_of(0.0f),
 	_mag_declination(0.0f),
-	_gpsDriftVelN(0.0f),
-	_gpsDriftVelE(0.0f),
-	_gps_drift_velD(0.0f),
-	_gps_velD_diff_filt(0.0f),
-	_gps_velN_filt(0.0f),
-	_gps_velE_filt(0.0f),
 	_last_gps_fail_us(0),
 	_last_gps_origin_time_us(0),
 	_gps_alt_ref(0.0f),
@@ -139,8 +139,6 @@ Ekf::Ekf():
 	memset(_flow_innov_var, 0, sizeof(_flow_innov_var));
 	_delta_angle_corr.setZero();
 	_last_known_posNE.setZero();
-	_imu_down_sampled = {};
-	_q_down_sampled.setZero();
 	_vel_err_integ.setZero();
 	_pos_err_integ.setZero();
 	_mag_filt_state = {};
@@ -149,7 +147,7 @@ Ekf::Ekf():
 	_imu_del_ang_of = {};
 	_gps_check_fail_status.value = 0;
 	_state_reset_status = {};
-	_dt_ekf_avg = 0.001f * (float)(FILTER_UPDATE_PERIOD_MS);
+	_dt_ekf_avg = 0.001f * (float)(_filter_update_period_ms);
 	memset(_drag_innov, 0, sizeof(_drag_innov));
 	memset(_drag_innov_var, 0, sizeof(_drag_innov_var));
 }
@@ -172,16 +170,7 @@ bool Ekf::init(uint64_t timestamp)
 	_output_new.quat_nominal = matrix::Quaternion<float>();
 
 	_delta_angle_corr.setZero();
-	_imu_down_sampled.delta_ang.setZero();
-	_imu_down_sampled.delta_vel.setZero();
-	_imu_down_sampled.delta_ang_dt = 0.0f;
-	_imu_down_sampled.delta_vel_dt = 0.0f;
-	_imu_down_sampled.time_us = timestamp;
-
-	_q_down_sampled(0) = 1.0f;
-	_q_down_sampled(1) = 0.0f;
-	_q_down_sampled(2) = 0.0f;
-	_q_down_sampled(3) = 0.0f;
+	_imu_down_sampler.reset();
 
 	_imu_updated = false;
 	_NED_origin_initialised = false;
@@ -195,7 +184,7 @@ bool Ekf::init(uint64_t timestamp)
 	_control_status.value = 0;
 	_control_status_prev.value = 0;
 
-	_dt_ekf_avg = 0.001f * (float)(FILTER_UPDATE_PERIOD_MS);
+	_dt_ekf_avg = 0.001f * (float)(_filter_update_period_ms);
 
 	_fault_status.value = 0;
 	_innov_check_fail_status.value = 0;
@@ -218,23 +207,34 @@ bool Ekf::update()
 		}
 	}
 
-	// Only run the filter if IMU data in the buffer has been updated
-	if (_imu_updated) {
+	// Only run the filter if IMU data in the buffer has been updated and the fusion time horizon has moved
+	if (_imu_updated && !_horizon_held) {
 
 		// perform state and covariance prediction for the main filter
-		predictState();
-		predictCovariance();
+		EKF_TIMED_STAGE(EKF_TIMING_PREDICT_STATE, predictState());
+		EKF_TIMED_STAGE(EKF_TIMING_PREDICT_COVARIANCE, predictCovariance());
+
+		if (_prediction_hook != nullptr) {
+			callPredictionHook();
+		}
 
 		// run a separate filter for terrain estimation
-		runTerrainEstimator();
+		EKF_TIMED_STAGE(EKF_TIMING_TERRAIN_ESTIMATOR, runTerrainEstimator());
 
 		// control fusion of observation data
-		controlFusionModes();
+		EKF_TIMED_STAGE(EKF_TIMING_CONTROL_FUSION_MODES, controlFusionModes());
+
+#ifdef ECL_EKF_FLIGHT_RECORDER
+		recordFilterState();
+#endif
 
 	}
 
 	// the output observer always runs
-	calculateOutputStates();
+	EKF_TIMED_STAGE(EKF_TIMING_CALCULATE_OUTPUT_STATES, calculateOutputStates());
+
+	// publish a consistent set of outputs for readers on other threads
+	publishSnapshot();
 
 	// check for NaN or inf on attitude states
 	if (!ISFINITE(_state.quat_nominal(0)) || !ISFINITE(_output_new.quat_nominal(0))) {
@@ -250,7 +250,7 @@ bool Ekf::initialiseFilter()
 	// Keep accumulating measurements until we have a minimum of 10 samples for the required sensors
 
 	// Sum the IMU delta angle measurements
-	imuSample imu_init = _imu_buffer.get_newest();
+	const imuSample &imu_init = _imu_buffer.get_newest();
 	_delVel_sum += imu_init.delta_vel;
 
 	// Sum the magnetometer measurements
@@ -358,7 +358,7 @@ bool Ekf::initialiseFilter()
 
 	} else {
 		// reset variables that are shared with post alignment GPS checks
-		_gps_drift_velD = 0.0f;
+		_gps_monitor.reset_vertical_drift();
 		_gps_alt_ref = 0.0f;
 
 		// Zero all of the states
@@ -389,7 +389,7 @@ bool Ekf::initialiseFilter()
 		_output_new.quat_nominal = _state.quat_nominal;
 
 		// update transformation matrix from body to world frame
-		_R_to_earth = quat_to_invrotmat(_state.quat_nominal);
+		_R_to_earth = stateToEarth();
 
 		// calculate the averaged magnetometer reading
 		Vector3f mag_init = _mag_filt_state;
@@ -400,7 +400,7 @@ bool Ekf::initialiseFilter()
 		if (_control_status.flags.rng_hgt) {
 			// if we are using the range finder as the primary source, then calculate the baro height at origin so  we can use baro as a backup
 			// so it can be used as a backup ad set the initial height using the range finder
-			baroSample baro_newest = _baro_buffer.get_newest();
+			const baroSample &baro_newest = _baro_buffer.get_newest();
 			_baro_hgt_offset = baro_newest.hgt;
 			_state.pos(2) = -math::max(_rng_filt_state * _R_rng_to_earth_2_2,_params.rng_gnd_clearance);
 			ECL_INFO("EKF using range finder height - commencing alignment");
@@ -417,6 +417,9 @@ bool Ekf::initialiseFilter()
 		// try to initialise the terrain estimator
 		_terrain_initialised = initHagl();
 
+		// resume from the saved states if they are consistent with the sensors
+		_warm_started = applyWarmStart(mag_init);
+
 		// reset the essential fusion timeout counters
 		_time_last_hgt_fuse = _time_last_imu;
 		_time_last_pos_fuse = _time_last_imu;
@@ -449,19 +452,19 @@ void Ekf::predictState()
 
 	// convert the delta angle to a delta quaternion
 	Quaternion dq;
-	dq.from_axis_angle(corrected_delta_ang);
+	ecl::quat_from_rotation_vector(dq, corrected_delta_ang);
 
 	// rotate the previous quaternion by the delta quaternion using a quaternion multiplication
 	_state.quat_nominal = dq * _state.quat_nominal;
 
 	// quaternions must be normalised whenever they are modified
-	_state.quat_nominal.normalize();
+	ecl::normalize_quat(_state.quat_nominal);
 
 	// save the previous value of velocity so we can use trapzoidal integration
 	Vector3f vel_last = _state.vel;
 
 	// update transformation matrix from body to world frame
-	_R_to_earth = quat_to_invrotmat(_state.quat_nominal);
+	_R_to_earth = stateToEarth();
 
 	// calculate the increment in velocity using the current orientation
 	_state.vel += _R_to_earth * corrected_delta_vel;
@@ -477,14 +480,14 @@ void Ekf::predictState()
 	// calculate an average filter update time
 	float input = 0.5f*(_imu_sample_delayed.delta_vel_dt + _imu_sample_delayed.delta_ang_dt);
 
-	// filter and limit input between -50% and +100% of nominal value
-	input = math::constrain(input,0.0005f * (float)(FILTER_UPDATE_PERIOD_MS),0.002f * (float)(FILTER_UPDATE_PERIOD_MS));
+	// filter and limit input between -50% of the shortest and +100% of the longest prediction period in use
+	input = math::constrain(input,0.0005f * (float)(minFilterUpdatePeriod()),0.002f * (float)(maxFilterUpdatePeriod()));
 	_dt_ekf_avg = 0.99f * _dt_ekf_avg + 0.01f * input;
 }
 
 bool Ekf::collect_imu(imuSample &imu)
 {
-	// accumulate and downsample IMU data across a period FILTER_UPDATE_PERIOD_MS long
+	// accumulate and downsample IMU data across a period _filter_update_period_ms long
 
 	// copy imu data to local variables
 	_imu_sample_new.delta_ang	= imu.delta_ang;
@@ -493,52 +496,76 @@ bool Ekf::collect_imu(imuSample &imu)
 	_imu_sample_new.delta_vel_dt	= imu.delta_vel_dt;
 	_imu_sample_new.time_us		= imu.time_us;
 
-	// accumulate the time deltas
-	_imu_down_sampled.delta_ang_dt += imu.delta_ang_dt;
-	_imu_down_sampled.delta_vel_dt += imu.delta_vel_dt;
-
-	// use a quaternion to accumulate delta angle data
-	// this quaternion represents the rotation from the start to end of the accumulation period
-	Quaternion delta_q;
-	delta_q.rotate(imu.delta_ang);
-	_q_down_sampled =  _q_down_sampled * delta_q;
-	_q_down_sampled.normalize();
-
-	// rotate the accumulated delta velocity data forward each time so it is always in the updated rotation frame
-	matrix::Dcm<float> delta_R(delta_q.inversed());
-	_imu_down_sampled.delta_vel = delta_R * _imu_down_sampled.delta_vel;
-
-	// accumulate the most recent delta velocity data at the updated rotation frame
-	// assume effective sample time is halfway between the previous and current rotation frame
-	_imu_down_sampled.delta_vel += (_imu_sample_new.delta_vel + delta_R * _imu_sample_new.delta_vel) * 0.5f;
+	// accumulate the delta angle and delta velocity data with coning and sculling corrections
+	_imu_down_sampler.accumulate(imu);
 
 	// if the target time delta between filter prediction steps has been exceeded
 	// write the accumulated IMU data to the ring buffer
-	float target_dt = (float)(FILTER_UPDATE_PERIOD_MS) / 1000;
-	if (_imu_down_sampled.delta_ang_dt >= target_dt - _imu_collection_time_adj) {
+	float target_dt = (float)(_filter_update_period_ms) / 1000;
+	float delta_ang_dt = _imu_down_sampler.get_delta_ang_dt();
+	if (delta_ang_dt >= target_dt - _imu_collection_time_adj) {
 
 		// accumulate the amount of time to advance the IMU collection time so that we meet the
 		// average EKF update rate requirement
-		_imu_collection_time_adj += 0.01f * (_imu_down_sampled.delta_ang_dt - target_dt);
+		_imu_collection_time_adj += 0.01f * (delta_ang_dt - target_dt);
 		_imu_collection_time_adj = math::constrain(_imu_collection_time_adj, -0.5f * target_dt, 0.5f * target_dt);
 
-		imu.delta_ang     = _q_down_sampled.to_axis_angle();
-		imu.delta_vel     = _imu_down_sampled.delta_vel;
-		imu.delta_ang_dt  = _imu_down_sampled.delta_ang_dt;
-		imu.delta_vel_dt  = _imu_down_sampled.delta_vel_dt;
-
-		_imu_down_sampled.delta_ang.setZero();
-		_imu_down_sampled.delta_vel.setZero();
-		_imu_down_sampled.delta_ang_dt = 0.0f;
-		_imu_down_sampled.delta_vel_dt = 0.0f;
-		_q_down_sampled(0) = 1.0f;
-		_q_down_sampled(1) = _q_down_sampled(2) = _q_down_sampled(3) = 0.0f;
+		_imu_down_sampler.getDownSampled(imu);
+		_imu_down_sampler.reset();
+
+		selectFilterUpdatePeriod(imu);
+
 		return true;
 	}
 
 	return false;
 }
 
+void Ekf::selectFilterUpdatePeriod(const imuSample &imu)
+{
+	const unsigned nominal_ms = constrainFilterUpdatePeriod(_params.filter_update_period_ms);
+	unsigned period_ms = nominal_ms;
+
+	if (_params.filter_update_adaptive == 1) {
+		const float ang_rate = imu.delta_ang.norm() / math::max(imu.delta_ang_dt, 1e-4f);
+		const float accel = imu.delta_vel.norm() / math::max(imu.delta_vel_dt, 1e-4f);
+		const bool aggressive = ang_rate > _params.filter_update_agile_rate;
+		const bool stationary = (ang_rate < _params.filter_update_rest_rate) && (fabsf(accel - _gravity_mss) < 1.0f);
+		const bool cpu_bound = _cpu_load > _params.filter_update_cpu_load_max;
+
+		if (aggressive) {
+			// don't run faster than the nominal rate if the processor is already overloaded
+			period_ms = cpu_bound ? nominal_ms : minFilterUpdatePeriod();
+
+		} else if (cpu_bound || stationary || !_control_status.flags.in_air) {
+			period_ms = maxFilterUpdatePeriod();
+		}
+	}
+
+	// shorten the period immediately, but only lengthen it once the faster rate has not been required for 1 second
+	// to prevent the rate switching during intermittent manoeuvres
+	if (period_ms <= _filter_update_period_ms || _params.filter_update_adaptive != 1) {
+		_time_last_fast_period_us = imu.time_us;
+
+	} else if (imu.time_us - _time_last_fast_period_us < (uint64_t)1e6) {
+		return;
+	}
+
+	if (period_ms != _filter_update_period_ms) {
+		const unsigned previous_ms = _filter_update_period_ms;
+		_filter_update_period_ms = period_ms;
+
+		// the IMU and output buffers must span the same sensor delay at the new period, stay at the
+		// previous period if they can't be resized
+		if (!resize_buffers()) {
+			_filter_update_period_ms = previous_ms;
+			return;
+		}
+
+		_imu_collection_time_adj = 0.0f;
+	}
+}
+
 /*
  * Implement a strapdown INS algorithm using the latest IMU data at the current time horizon.
  * Buffer the INS states and calculate the difference with the EKF states at the delayed fusion time horizon.
@@ -552,7 +579,7 @@ bool Ekf::collect_imu(imuSample &imu)
 void Ekf::calculateOutputStates()
 {
 	// use latest IMU data
-	imuSample imu_new = _imu_sample_new;
+	const imuSample &imu_new = _imu_sample_new;
 
 	// correct delta angles for bias offsets and scale factors
 	Vector3f delta_angle;
@@ -569,14 +596,14 @@ void Ekf::calculateOutputStates()
 
 	// convert the delta angle to an equivalent delta quaternions
 	Quaternion dq;
-	dq.from_axis_angle(delta_angle);
+	ecl::quat_from_rotation_vector(dq, delta_angle);
 
 	// rotate the previous INS quaternion by the delta quaternions
 	_output_new.time_us = imu_new.time_us;
 	_output_new.quat_nominal = dq * _output_new.quat_nominal;
 
 	// the quaternions must always be normalised afer modification
-	_output_new.quat_nominal.normalize();
+	ecl::normalize_quat(_output_new.quat_nominal);
 
 	// calculate the rotation matrix from body to earth frame
 	_R_to_earth_now = quat_to_invrotmat(_output_new.quat_nominal);
@@ -598,17 +625,17 @@ void Ekf::calculateOutputStates()
 
 	// store INS states in a ring buffer that with the same length and time coordinates as the IMU data buffer
 	if (_imu_updated) {
-		_output_buffer.push(_output_new);
+		pushOutputSample(_output_new);
 		_imu_updated = false;
 
 		// get the oldest INS state data from the ring buffer
 		// this data will be at the EKF fusion time horizon
-		_output_sample_delayed = _output_buffer.get_oldest();
+		_output_sample_delayed = getOldestOutputSample();
 
 		// calculate the quaternion delta between the INS and EKF quaternions at the EKF fusion time horizon
 		Quaternion quat_inv = _state.quat_nominal.inversed();
 		Quaternion q_error =  _output_sample_delayed.quat_nominal * quat_inv;
-		q_error.normalize();
+		ecl::normalize_quat(q_error);
 
 		// convert the quaternion delta to a delta angle
 		Vector3f delta_ang_error;
@@ -652,28 +679,10 @@ void Ekf::calculateOutputStates()
 		_pos_err_integ += pos_err;
 		Vector3f pos_correction = pos_err * pos_gain + _pos_err_integ * sq(pos_gain) * 0.1f;
 
-		// loop through the output filter state history and apply the corrections to the velocity and position states
-		// this method is too expensive to use for the attitude states due to the quaternion operations required
-		// but does not introduce a time delay in the 'correction loop' and allows smaller tracking time constants
-		// to be used
-		outputSample output_states;
-		unsigned max_index = _output_buffer.get_length() - 1;
-		for (unsigned index=0; index <= max_index; index++) {
-			output_states = _output_buffer.get_from_index(index);
-
-			// a constant  velocity correction is applied
-			output_states.vel += vel_correction;
-
-			// a constant position correction is applied
-			output_states.pos += pos_correction;
-
-			// push the updated data to the buffer
-			_output_buffer.push_to_index(index,output_states);
-
-		}
-
-		// update output state to corrected values
-		_output_new = _output_buffer.get_newest();
+		// apply the corrections to the velocity and position states of the complete output filter state history
+		// and of the newest output states. This does not introduce a time delay in the 'correction loop' and
+		// allows smaller tracking time constants to be used
+		correctOutputHistory(vel_correction, pos_correction);
 
 	}
 }
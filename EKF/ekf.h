@@ -40,10 +40,54 @@
  *
  */
 
+#pragma once
+
 #include "estimator_interface.h"
+#include "flight_recorder.h"
 #include "geo.h"
-
-class Ekf : public EstimatorInterface
+#include "geo_mag_lookup.h"
+#include "gps_quality.h"
+#include "SymmetricMatrix.h"
+
+#if defined(ECL_EKF_PIPELINED_COVARIANCE)
+#include "WorkerThread.h"
+#endif
+
+// record the execution time of the enclosing scope or of a single statement as a processing stage
+#ifdef ECL_EKF_TIMING
+#define EKF_TIMED_SCOPE(stage) StageTimer stage_timer(*this, stage)
+#define EKF_TIMED_STAGE(stage, statement) do { EKF_TIMED_SCOPE(stage); statement; } while (0)
+#else
+#define EKF_TIMED_SCOPE(stage)
+#define EKF_TIMED_STAGE(stage, statement) statement
+#endif
+
+// record the innovation consistency check of an observation in the flight recorder
+#ifdef ECL_EKF_FLIGHT_RECORDER
+#define EKF_RECORD_FUSION(observation, innov, innov_var, test_ratio, rejected) \
+	recordFusion(observation, innov, innov_var, test_ratio, rejected)
+#else
+#define EKF_RECORD_FUSION(observation, innov, innov_var, test_ratio, rejected)
+#endif
+
+// the wind velocity states follow the magnetic field states so cannot be retained on their own
+#if defined(ECL_EKF_NO_MAG_STATES) && !defined(ECL_EKF_NO_WIND_STATES)
+#error "ECL_EKF_NO_MAG_STATES requires ECL_EKF_NO_WIND_STATES"
+#endif
+
+// type used to accumulate the ill conditioned sums of the covariance prediction and update. With
+// ECL_EKF_MIXED_PRECISION the covariance matrix is still stored in single precision but these sums are
+// evaluated in double precision and rounded once when stored.
+#if defined(ECL_EKF_MIXED_PRECISION)
+typedef double cov_accum_t;
+#else
+typedef float cov_accum_t;
+#endif
+
+// Ekf is the only implementation of EstimatorInterface and is final, so calls made through an Ekf object,
+// reference or pointer are resolved at compile time and the small accessors defined here can be inlined.
+// Integrations that hold an EstimatorInterface pointer still use the virtual interface.
+class Ekf final : public EstimatorInterface
 {
 public:
 
@@ -58,63 +102,93 @@ public:
 
 	// gets the innovations of velocity and position measurements
 	// 0-2 vel, 3-5 pos
-	void get_vel_pos_innov(float vel_pos_innov[6]);
+	void get_vel_pos_innov(float vel_pos_innov[6]) { memcpy(vel_pos_innov, _vel_pos_innov, sizeof(float) * 6); }
 
 	// gets the innovations of the earth magnetic field measurements
-	void get_mag_innov(float mag_innov[3]);
+	void get_mag_innov(float mag_innov[3]) { memcpy(mag_innov, _mag_innov, 3 * sizeof(float)); }
 
 	// gets the innovations of the heading measurement
-	void get_heading_innov(float *heading_innov);
+	void get_heading_innov(float *heading_innov) { memcpy(heading_innov, &_heading_innov, sizeof(float)); }
 
 	// gets the innovation variances of velocity and position measurements
 	// 0-2 vel, 3-5 pos
-	void get_vel_pos_innov_var(float vel_pos_innov_var[6]);
+	void get_vel_pos_innov_var(float vel_pos_innov_var[6]) { memcpy(vel_pos_innov_var, _vel_pos_innov_var, sizeof(float) * 6); }
 
 	// gets the innovation variances of the earth magnetic field measurements
-	void get_mag_innov_var(float mag_innov_var[3]);
+	void get_mag_innov_var(float mag_innov_var[3]) { memcpy(mag_innov_var, _mag_innov_var, sizeof(float) * 3); }
 
 	// gets the innovations of airspeed measurement
-	void get_airspeed_innov(float *airspeed_innov);
+	void get_airspeed_innov(float *airspeed_innov) { memcpy(airspeed_innov,&_airspeed_innov, sizeof(float)); }
 
 	// gets the innovation variance of the airspeed measurement
-	void get_airspeed_innov_var(float *airspeed_innov_var);
+	void get_airspeed_innov_var(float *airspeed_innov_var) { memcpy(airspeed_innov_var, &_airspeed_innov_var, sizeof(float)); }
 
 	// gets the innovations of synthetic sideslip measurement
- 	void get_beta_innov(float *beta_innov);
+ 	void get_beta_innov(float *beta_innov) { memcpy(beta_innov,&_beta_innov, sizeof(float)); }
 
  	// gets the innovation variance of the synthetic sideslip measurement
- 	void get_beta_innov_var(float *beta_innov_var);
+ 	void get_beta_innov_var(float *beta_innov_var) { memcpy(beta_innov_var, &_beta_innov_var, sizeof(float)); }
 
 	// gets the innovation variance of the heading measurement
-	void get_heading_innov_var(float *heading_innov_var);
+	void get_heading_innov_var(float *heading_innov_var) { memcpy(heading_innov_var, &_heading_innov_var, sizeof(float)); }
 
 	// gets the innovation variance of the flow measurement
-	void get_flow_innov_var(float flow_innov_var[2]);
+	void get_flow_innov_var(float flow_innov_var[2]) { memcpy(flow_innov_var, _flow_innov_var, sizeof(_flow_innov_var)); }
 
 	// gets the innovation of the flow measurement
-	void get_flow_innov(float flow_innov[2]);
+	void get_flow_innov(float flow_innov[2]) { memcpy(flow_innov, _flow_innov, sizeof(_flow_innov)); }
 
 	// gets the innovation variance of the drag specific force measurement
-	void get_drag_innov_var(float drag_innov_var[2]);
+	void get_drag_innov_var(float drag_innov_var[2]) { memcpy(drag_innov_var, _drag_innov_var, sizeof(_drag_innov_var)); }
 
 	// gets the innovation of the drag specific force measurement
-	void get_drag_innov(float drag_innov[2]);
+	void get_drag_innov(float drag_innov[2]) { memcpy(drag_innov, _drag_innov, sizeof(_drag_innov)); }
 
 	// gets the innovation variance of the HAGL measurement
-	void get_hagl_innov_var(float *hagl_innov_var);
+	void get_hagl_innov_var(float *hagl_innov_var) { memcpy(hagl_innov_var, &_hagl_innov_var, sizeof(_hagl_innov_var)); }
 
 	// gets the innovation of the HAGL measurement
-	void get_hagl_innov(float *hagl_innov);
+	void get_hagl_innov(float *hagl_innov) { memcpy(hagl_innov, &_hagl_innov, sizeof(_hagl_innov)); }
 
 	// get the state vector at the delayed time horizon
 	void get_state_delayed(float *state);
 
 	// get the wind velocity in m/s
-	void get_wind_velocity(float *wind);
+	void get_wind_velocity(float *wind)
+	{
+		wind[0] = _state.wind_vel(0);
+		wind[1] = _state.wind_vel(1);
+	}
 
 	// get the diagonal elements of the covariance matrix
 	void get_covariances(float *covariances);
 
+	// get the complete covariance matrix as get_num_states() x get_num_states() row major elements
+	void get_covariance_matrix(float *covariance);
+
+	// get the number of states in the covariance matrix
+	static unsigned get_num_states() { return _k_num_states; }
+
+	// get the static and heap memory used by a filter initialised with the given parameters
+	// returns false if the sensor delays need longer buffers than the filter supports
+	static bool get_memory_footprint(const parameters &params, ekf_memory_footprint *footprint);
+
+	// write the converged bias, magnetic field, wind and terrain states, their covariances and the reset counters
+	// to buffer as a versioned binary record. Returns the number of bytes written, or zero if the filter has not
+	// aligned or the buffer is smaller than get_warm_start_size()
+	size_t get_warm_start(uint8_t *buffer, size_t buffer_size);
+
+	// provide a record written by get_warm_start() before the filter starts. It is checked against the
+	// magnetometer when the filter aligns and used instead of the default initial states if consistent.
+	// Returns false if the record is not valid for this filter or the filter is already running.
+	bool set_warm_start(const uint8_t *buffer, size_t size);
+
+	// size of a warm start record in bytes
+	static size_t get_warm_start_size();
+
+	// true if the filter was initialised from a warm start record
+	bool warm_started() const { return _warm_started; }
+
 	// ask estimator for sensor data collection decision and do any preprocessing if required, returns true if not defined
 	bool collect_gps(uint64_t time_usec, struct gps_message *gps);
 	bool collect_imu(imuSample &imu);
@@ -132,13 +206,33 @@ public:
 	// get the 1-sigma horizontal and vertical velocity uncertainty
 	void get_ekf_vel_accuracy(float *ekf_evh, float *ekf_evv, bool *dead_reckoning);
 
-	void get_vel_var(Vector3f &vel_var);
+	void get_vel_var(Vector3f &vel_var)
+	{
+		vel_var(0) = P[4][4];
+		vel_var(1) = P[5][5];
+		vel_var(2) = P[6][6];
+	}
 
-	void get_pos_var(Vector3f &pos_var);
+	void get_pos_var(Vector3f &pos_var)
+	{
+		pos_var(0) = P[7][7];
+		pos_var(1) = P[8][8];
+		pos_var(2) = P[9][9];
+	}
 
 	// return an array containing the output predictor angular, velocity and position tracking
 	// error magnitudes (rad), (m/s), (m)
-	void get_output_tracking_error(float error[3]);
+	void get_output_tracking_error(float error[3]) { memcpy(error, _output_tracking_error, 3 * sizeof(float)); }
+
+	// get the EKF states on the delayed fusion time horizon to correct an OutputPredictor running on a separate thread
+	// returns false if the filter is not aligned or has not been updated since the last call
+	bool get_output_correction(outputCorrection *correction);
+
+	// return the IMU integration time still required to complete the down-sampled IMU sample in progress (sec)
+	float get_imu_collection_remaining_dt() const
+	{
+		return (float)_filter_update_period_ms / 1000 - _imu_collection_time_adj - _imu_down_sampler.get_delta_ang_dt();
+	}
 
 	/*
 	Returns  following IMU vibration metrics in the following array locations
@@ -148,6 +242,43 @@ public:
 	*/
 	void get_imu_vibe_metrics(float vibe[3]);
 
+	// set the hook that is called at the start and end of each processing stage
+	// the hook is only called if the library is built with ECL_EKF_TIMING defined
+	void set_timing_hook(EkfTimingHook *hook) { _timing_hook = hook; }
+
+	// set the hook that is called with the predicted states and covariance matrix after each prediction
+	void set_prediction_hook(EkfPredictionHook *hook) { _prediction_hook = hook; }
+
+	// get the execution time statistics for each processing stage
+	// returns false if the library has not been built with ECL_EKF_TIMING defined
+	bool get_timing_stats(ekf_timing_stats stats[EKF_TIMING_NUM_STAGES]);
+
+	// reset the execution time statistics
+	void reset_timing_stats();
+
+	// copy the flight recorder contents to a buffer in the layout described in flight_recorder.h
+	// returns the number of bytes written, or 0 if the buffer is smaller than get_flight_recorder_size()
+	// or the library has not been built with ECL_EKF_FLIGHT_RECORDER defined
+	size_t get_flight_recorder_dump(uint8_t *buffer, size_t size);
+
+	// number of bytes needed to dump the flight recorder
+	size_t get_flight_recorder_size();
+
+	// returns true if the flight recorder has stopped recording after a fault or innovation check failure
+	bool flight_recorder_frozen();
+
+	// discard the flight recorder contents and restart recording
+	void reset_flight_recorder();
+
+	// select the bits of the fault and innovation check status that stop the flight recorder when they are set
+	void set_flight_recorder_trigger(uint16_t fault_mask, uint16_t innov_fail_mask);
+
+	// get the statistics of the fusion load scheduler
+	void get_fusion_schedule_stats(fusion_schedule_stats *stats) { *stats = _fusion_stats; }
+
+	// get the number of state variances that had to be constrained by the covariance health checks
+	uint32_t get_covariance_correction_count() const { return _cov_correction_count; }
+
 	// return true if the global position estimate is valid
 	bool global_position_is_valid();
 
@@ -165,7 +296,7 @@ public:
 	void get_gyro_bias(float bias[3]);
 
 	// get GPS check status
-	void get_gps_check_status(uint16_t *_gps_check_fail_status);
+	void get_gps_check_status(uint16_t *val) { *val = _gps_check_fail_status.value; }
 
 	// return the amount the local vertical position changed in the last reset and the number of reset events
 	void get_posD_reset(float *delta, uint8_t *counter) {*delta = _state_reset_status.posD_change; *counter = _state_reset_status.posD_counter;}
@@ -203,25 +334,52 @@ public:
 	void get_ekf_soln_status(uint16_t *status);
 
 private:
-
+	// the kernel microbenchmarks call the prediction and fusion steps directly
+	friend class EkfKernelAccess;
+
+	// the batch filter copies the states and status of an instance and shares the covariance limits
+	friend class EkfBatch;
+
+	// The optional magnetic field (16-21) and wind velocity (22-23) states are at the end of the state vector
+	// so they can be compiled out to shrink the covariance matrix and the cost of the prediction and fusion steps.
+	// ECL_EKF_NO_WIND_STATES gives a 22 state filter and ECL_EKF_NO_MAG_STATES a 16 state filter.
+#if defined(ECL_EKF_NO_MAG_STATES)
+	static const uint8_t _k_num_states = 16;
+#elif defined(ECL_EKF_NO_WIND_STATES)
+	static const uint8_t _k_num_states = 22;
+#else
 	static const uint8_t _k_num_states = 24;
+#endif
+	// the warm start record holds the covariances of the states from the gyro bias onwards
+	static const uint8_t _k_warm_start_num_states = _k_num_states - 10;
+	static const uint8_t _k_warm_start_cov_size = _k_warm_start_num_states * (_k_warm_start_num_states + 1) / 2;
+
 	static const float _k_earth_rate;
 	static const float _gravity_mss;
 
+	// intermediate terms of the covariance prediction used by the magnetic field and wind state blocks
+	struct covariancePredictionTerms {
+		float (*nextP)[_k_num_states];
+		const float *SF;
+		const float *SPP;
+		const float *process_noise;
+		float q0;
+		float dt;
+	};
+
+	// relative wind terms shared by the airspeed and synthetic sideslip observations
+	struct airDataTerms {
+		float q0, q1, q2, q3;	// quaternion states the observations are linearised about
+		float vn, ve, vd;	// NED velocity states the observations are linearised about (m/sec)
+		float vwn, vwe;		// NE wind velocity states the observations are linearised about (m/sec)
+		float tas_pred;		// predicted true airspeed (m/sec)
+		Vector3f rel_wind_body;	// velocity relative to the air resolved in body axes (m/sec)
+		float state_delta[9];	// change in the quaternion, velocity and wind states made by a preceding airspeed update
+	};
+
 	// reset event monitoring
 	// structure containing velocity, position, height and yaw reset information
-	struct {
-		uint8_t velNE_counter;	// number of horizontal position reset events (allow to wrap if count exceeds 255)
-		uint8_t velD_counter;	// number of vertical velocity reset events (allow to wrap if count exceeds 255)
-		uint8_t posNE_counter;	// number of horizontal position reset events (allow to wrap if count exceeds 255)
-		uint8_t posD_counter;	// number of vertical position reset events (allow to wrap if count exceeds 255)
-		uint8_t quat_counter;	// number of quaternion reset events (allow to wrap if count exceeds 255)
-		Vector2f velNE_change;  // North East velocity change due to last reset (m)
-		float velD_change;	// Down velocity change due to last reset (m/s)
-		Vector2f posNE_change;	// North, East position change due to last reset (m)
-		float posD_change;	// Down position change due to last reset (m)
-		Quaternion quat_change;	// quaternion delta due to last reset - multiply pre-reset quaternion by this to get post-reset quaternion
-	} _state_reset_status;
+	stateResetStatus _state_reset_status;
 
 	float _dt_ekf_avg;		// average update rate of the ekf
 	float _dt_update;		// delta time since last ekf update. This time can be used for filters
@@ -236,6 +394,8 @@ private:
 	bool _fuse_pos;			// gps position data should be fused
 	bool _fuse_hor_vel;		// gps horizontal velocity measurement should be fused
 	bool _fuse_vert_vel;		// gps vertical velocity measurement should be fused
+	bool _fuse_airspeed{false};	// airspeed data should be fused
+	bool _fuse_sideslip{false};	// synthetic sideslip measurement should be fused
 
 	// booleans true when fresh sensor data is available at the fusion time horizon
 	bool _gps_data_ready;
@@ -246,6 +406,27 @@ private:
 	bool _ev_data_ready;
 	bool _tas_data_ready;
 
+	// fusion load scheduler, see scheduleFusion()
+	bool _fusion_held[FUSION_SOURCE_NUM] {};	// true when the delayed sample of a source was deferred and waits to be fused
+	unsigned _fusion_defer_count[FUSION_SOURCE_NUM] {};	// number of consecutive updates a source has been deferred
+	float _fusion_frame_cost{0.0f};		// scalar observation updates scheduled in the current filter update
+	fusion_schedule_stats _fusion_stats{};	// fusion load scheduler statistics
+
+	// saved state used to warm start the filter, see set_warm_start()
+	struct {
+		Vector3f gyro_bias;
+		Vector3f accel_bias;
+		Vector3f mag_I;
+		Vector3f mag_B;
+		Vector2f wind_vel;
+		float terrain_hagl;
+		float terrain_var;
+		float cov[_k_warm_start_cov_size];
+		uint8_t reset_counters[5];
+	} _warm_start{};
+	bool _warm_start_pending{false};	// true when a warm start record is waiting for the filter to align
+	bool _warm_started{false};		// true when the filter was initialised from a warm start record
+
 	uint64_t _time_last_fake_gps;	// last time in us at which we have faked gps measurement for static mode
 
 	uint64_t _time_last_pos_fuse;   // time the last fusion of horizontal position measurements was performed (usec)
@@ -256,7 +437,8 @@ private:
 	uint64_t _time_last_beta_fuse;	// time the last fusion of synthetic sideslip measurements were performed (usec)
 	Vector2f _last_known_posNE;     // last known local NE position vector (m)
 	float _last_disarmed_posD;      // vertical position recorded at arming (m)
-	float _imu_collection_time_adj;	// the amount of time the IMU collection needs to be advanced to meet the target set by FILTER_UPDATE_PERIOD_MS (sec)
+	float _imu_collection_time_adj;	// the amount of time the IMU collection needs to be advanced to meet the target set by _filter_update_period_ms (sec)
+	uint64_t _time_last_fast_period_us{0};	// last time the adaptive prediction rate required a period no longer than the one in use (usec)
 
 	uint64_t _time_acc_bias_check;	// last time the  accel bias check passed (usec)
 
@@ -264,7 +446,69 @@ private:
 
 	matrix::Dcm<float> _R_to_earth;	// transformation matrix from body frame to earth frame from last EKF predition
 
-	float P[_k_num_states][_k_num_states]{};	// state covariance matrix
+	// rotation matrices for the quaternion state, recalculated by updateStateRotation() only when the quaternion changes
+	matrix::Dcm<float> _R_state_to_earth;	// transformation matrix from body frame to earth frame
+	matrix::Dcm<float> _R_state_to_body;	// transformation matrix from earth frame to body frame
+	Quaternion _R_state_quat;		// quaternion state the rotation matrices were calculated from
+
+	EkfTimingHook *_timing_hook{nullptr};	// hook called at the start and end of each processing stage
+	EkfPredictionHook *_prediction_hook{nullptr};	// hook called with the predicted states and covariance matrix
+
+#ifdef ECL_EKF_TIMING
+	// execution time accumulators for each processing stage
+	struct {
+		uint64_t total_ns;	// sum of the execution times (nsec)
+		uint64_t min_ns;	// minimum execution time (nsec)
+		uint64_t max_ns;	// maximum execution time (nsec)
+		uint32_t count;		// number of times the stage has run
+	} _timing[EKF_TIMING_NUM_STAGES] {};
+
+	// records the execution time of a processing stage from construction until it goes out of scope
+	class StageTimer
+	{
+	public:
+		StageTimer(Ekf &ekf, ekf_timing_stage stage) : _ekf(ekf), _stage(stage), _start_ns(ekf.timingStageStart(stage)) {}
+		~StageTimer() { _ekf.timingStageEnd(_stage, _start_ns); }
+
+	private:
+		Ekf &_ekf;
+		ekf_timing_stage _stage;
+		uint64_t _start_ns;
+	};
+
+	// notify the timing hook that a stage has started and return the start time (nsec)
+	uint64_t timingStageStart(ekf_timing_stage stage);
+
+	// update the execution time statistics and notify the timing hook that a stage has ended
+	void timingStageEnd(ekf_timing_stage stage, uint64_t start_ns);
+#endif
+
+#ifdef ECL_EKF_FLIGHT_RECORDER
+	FlightRecorder _flight_recorder;
+	uint16_t _recorder_fault_mask{0xFFFF};		// fault status bits that trigger the flight recorder
+	uint16_t _recorder_innov_fail_mask{0xFFFF};	// innovation check status bits that trigger the flight recorder
+	uint16_t _recorded_control_status{0};		// control status in the last flight recorder status record
+	uint16_t _recorded_fault_status{0};		// fault status in the last flight recorder status record
+	uint16_t _recorded_innov_fail_status{0};	// innovation check status in the last flight recorder status record
+
+	void recordFusion(uint8_t observation, float innov, float innov_var, float test_ratio, bool rejected)
+	{
+		_flight_recorder.recordFusion(_imu_sample_delayed.time_us, observation, innov, innov_var, test_ratio, rejected);
+	}
+
+	// record the covariance diagonal and any status change after a filter update and check the trigger
+	void recordFilterState();
+#endif
+
+	SymmetricMatrix<float, _k_num_states> P;	// state covariance matrix stored as a packed upper triangle
+
+	uint32_t _cov_touched_states{0};	// bitmask of states with covariance rows changed by fusion since the last check
+
+	covariancePredictionTerms _cov_pred_terms{};	// terms shared with the magnetic field and wind covariance prediction
+#if defined(ECL_EKF_PIPELINED_COVARIANCE)
+	WorkerThread _cov_worker;	// predicts the magnetic field and wind state covariances in parallel
+#endif
+	uint32_t _cov_correction_count{0};	// number of state variances constrained by the covariance health checks
 
 	float _vel_pos_innov[6]{};	// innovations: 0-2 vel,  3-5 pos
 	float _vel_pos_innov_var[6]{};	// innovation variances: 0-2 vel, 3-5 pos
@@ -292,22 +536,19 @@ private:
 	float _delta_time_of;		// time in sec that _imu_del_ang_of was accumulated over
 
 	float _mag_declination;		// magnetic declination used by reset and fusion functions (rad)
+	GeoMagLookup _geo_mag_lookup;	// magnetic declination lookup from the WGS-84 position
 
 	// output predictor states
 	Vector3f _delta_angle_corr;	// delta angle correction vector
-	imuSample _imu_down_sampled;	// down sampled imu data (sensor rate -> filter update rate)
-	Quaternion _q_down_sampled;	// down sampled quaternion (tracking delta angles between ekf update steps)
+	ImuDownSampler _imu_down_sampler;	// down samples the imu data (sensor rate -> filter update rate)
 	Vector3f _vel_err_integ;	// integral of velocity tracking error
 	Vector3f _pos_err_integ;	// integral of position tracking error
 	float _output_tracking_error[3]{};// contains the magnitude of the angle, velocity and position track errors (rad, m/s, m)
+	uint8_t _output_align_counter{0};	// number of times the output predictor states have been aligned to the EKF states
+	uint64_t _time_last_output_correction{0};	// delayed fusion time horizon of the last output predictor correction (uSec)
 
 	// variables used for the GPS quality checks
-	float _gpsDriftVelN;		// GPS north position derivative (m/s)
-	float _gpsDriftVelE;		// GPS east position derivative (m/s)
-	float _gps_drift_velD;		// GPS down position derivative (m/s)
-	float _gps_velD_diff_filt;	// GPS filtered Down velocity (m/s)
-	float _gps_velN_filt;		// GPS filtered North velocity (m/s)
-	float _gps_velE_filt;		// GPS filtered East velocity (m/s)
+	GpsQualityMonitor _gps_monitor;	// incremental GPS drift and speed statistics used by the GPS checks
 	uint64_t _last_gps_fail_us;	// last system time in usec that the GPS failed it's checks
 
 	// Variables used to publish the WGS-84 location of the EKF local NED origin
@@ -337,8 +578,16 @@ private:
 	Vector3f _prev_dvel_bias_var;	// saved delta velocity XYZ bias variances (m/sec)**2
 
 	// Terrain height state estimation
+	// A small bank of terrain hypotheses is kept so that range finder returns from a different surface, eg vegetation
+	// canopy or an obstacle, start a competing hypothesis rather than being discarded. Each hypothesis is weighted by
+	// the likelihood of the measurements and _terrain_vpos and _terrain_var hold the selected hypothesis.
+	static const uint8_t _k_num_terrain_hyp = 3;
 	float _terrain_vpos;		// estimated vertical position of the terrain underneath the vehicle in local NED frame (m)
 	float _terrain_var;		// variance of terrain position estimate (m^2)
+	float _terrain_hyp_vpos[_k_num_terrain_hyp] {};	// vertical position of each terrain hypothesis (m)
+	float _terrain_hyp_var[_k_num_terrain_hyp] {};	// variance of each terrain hypothesis (m^2)
+	float _terrain_hyp_weight[_k_num_terrain_hyp] {};	// normalised probability of each hypothesis, zero when not in use
+	uint8_t _terrain_hyp_index{0};	// index of the selected terrain hypothesis
 	float _hagl_innov;		// innovation of the last height above terrain measurement (m)
 	float _hagl_innov_var;		// innovation variance for the last height above terrain measurement (m^2)
 	uint64_t _time_last_hagl_fuse;	// last system time in usec that the hagl measurement failed it's checks
@@ -371,26 +620,42 @@ private:
 	// initialise ekf covariance matrix
 	void initialiseCovariance();
 
+	// select the prediction period used for the next IMU down-sampling interval
+	void selectFilterUpdatePeriod(const imuSample &imu);
+
 	// predict ekf state
 	void predictState();
 
 	// predict ekf covariance
 	void predictCovariance();
 
+	// copy the predicted states and covariance matrix to the prediction hook
+	void callPredictionHook();
+
 	// ekf sequential fusion of magnetometer measurements
 	void fuseMag();
 
+	// fuse the three magnetometer axes as a single vector observation using the jacobians calculated by fuseMag()
+	void fuseMagBatched(const float (&H_MAG)[3][_k_num_states], const uint8_t (&H_index)[10]);
+
 	// fuse the first euler angle from either a 321 or 312 rotation sequence as the observation (currently measures yaw using the magnetometer)
 	void fuseHeading();
 
 	// fuse magnetometer declination measurement
 	void fuseDeclination();
 
+	// calculate the relative wind terms used by the airspeed and synthetic sideslip observations
+	void calcAirDataTerms(airDataTerms &terms);
+
+	// fuse the airspeed and synthetic zero sideslip measurements requested by the control logic, sharing the relative
+	// wind terms and processing both observations in the same update when both are due
+	void fuseAirData();
+
 	// fuse airspeed measurement
-	void fuseAirspeed();
+	void fuseAirspeed(const airDataTerms &terms);
 
 	// fuse synthetic zero sideslip measurement
- 	void fuseSideslip();
+ 	void fuseSideslip(const airDataTerms &terms);
 
 	// fuse body frame drag specific forces for multi-rotor wind estimation
 	void fuseDrag();
@@ -407,6 +672,10 @@ private:
 	// calculate optical flow bias errors
 	void calcOptFlowBias();
 
+	// check the saved warm start record against the averaged magnetometer reading and use it to initialise
+	// the bias, magnetic field, wind and terrain states, returns true if the record was used
+	bool applyWarmStart(const Vector3f &mag_init);
+
 	// initialise the terrain vertical position estimator
 	// return true if the initialisation is successful
 	bool initHagl();
@@ -417,6 +686,12 @@ private:
 	// update the terrain vertical position estimate using a height above ground measurement from the range finder
 	void fuseHagl();
 
+	// reset the terrain hypotheses to a single hypothesis at the current terrain estimate
+	void resetTerrainHypotheses();
+
+	// prune and merge the terrain hypotheses and select the most likely one
+	void selectTerrainHypothesis();
+
 	// reset the heading and magnetic field states using the declination and magnetometer measurements
 	// return true if successful
 	bool resetMagHeading(Vector3f &mag_init);
@@ -433,11 +708,36 @@ private:
 	// modify output filter to match the the EKF state at the fusion time horizon
 	void alignOutputFilter();
 
-	// limit the diagonal of the covariance matrix
+	// limit the diagonal of the covariance matrix and zero the rows and columns of unused states
 	void fixCovarianceErrors();
 
-	// make ekf covariance matrix symmetric between a nominated state indexe range
-	void makeSymmetrical(float (&cov_mat)[_k_num_states][_k_num_states], uint8_t first, uint8_t last);
+	// limit the variances of the states recorded by markCovarianceTouched() since the last check
+	void fixTouchedCovarianceErrors();
+
+	// record the states with a non-zero Kalman gain, their covariance rows are changed by the correction
+	void markCovarianceTouched(const float *K);
+
+	// maximum variance of a state. States which belong to the same group (e.g. vel_x, vel_y, vel_z) use the same value
+	static float maxStateVariance(uint8_t index);
+
+	// limit the variance of a single state and count the correction
+	void constrainStateVariance(uint8_t index);
+
+	// hand the magnetic field and wind state covariance prediction to the worker thread if the library is
+	// built with ECL_EKF_PIPELINED_COVARIANCE, returns true if it will be calculated by the worker
+	bool startAuxCovariancePrediction();
+
+	// wait for the worker to finish, or predict the magnetic field and wind state covariances on this thread
+	void finishAuxCovariancePrediction(bool pipelined);
+
+	// predict the covariances of the magnetic field and wind states, these only depend on P and the
+	// intermediate terms so do not have to wait for the prediction of the other states
+	void predictAuxCovariance(const covariancePredictionTerms &terms);
+	static void predictAuxCovarianceJob(void *ekf);
+
+	// copy the upper triangle of the columns between the nominated state indexes from the predicted
+	// covariance matrix into the state covariance matrix
+	void copyUpperCovarianceBlock(const float (&cov_mat)[_k_num_states][_k_num_states], uint8_t first, uint8_t last);
 
 	// constrain the ekf states
 	void constrainStates();
@@ -446,6 +746,17 @@ private:
 	// and a scalar innovation value
 	void fuse(float *K, float innovation);
 
+	// apply the covariance correction P = P - K*H*P for a scalar observation given the kalman gain K and
+	// the observation jacobian H. Only the H_length elements of H listed in H_index are used.
+	// If the correction would make a variance negative, the rows and columns of that state are zeroed,
+	// the covariance correction is not applied and false is returned.
+	bool updateCovariance(const float *K, const float *H, const uint8_t *H_index, uint8_t H_length);
+
+	// calculate the Kalman gain K and apply the covariance correction for a direct observation of the state
+	// with index state_index, ie H is a unit row. The update is made with row and column operations on P
+	// and has the same failure behaviour as updateCovariance().
+	bool updateCovarianceDirect(uint8_t state_index, float innov_var, float *K);
+
 	// calculate the earth rotation vector from a given latitude
 	void calcEarthRateNED(Vector3f &omega, double lat_rad) const;
 
@@ -506,6 +817,21 @@ private:
 	// rotate quaternion covariances into variances for an equivalent rotation vector
 	Vector3f calcRotVecVariances();
 
+	// decide if a measurement ready at the fusion time horizon is fused in this update or deferred to the next one
+	// new_sample is true if a sample was taken from the buffer in this update and cost is the number of scalar
+	// observation updates it needs. Returns true if the sample held in the delayed sample struct should be fused.
+	bool scheduleFusion(fusion_source source, bool new_sample, float cost);
+
+	// copy the estimator outputs into the snapshot read by get_snapshot()
+	void publishSnapshot();
+
+	// recalculate the cached rotation matrices if the quaternion state has changed since they were calculated
+	void updateStateRotation();
+
+	// transformation matrices between body and earth frame for the current quaternion state
+	const matrix::Dcm<float> &stateToEarth() { updateStateRotation(); return _R_state_to_earth; }
+	const matrix::Dcm<float> &stateToBody() { updateStateRotation(); return _R_state_to_body; }
+
 	// initialise the quaternion covariances using rotation vector variances
 	void initialiseQuatCovariances(Vector3f &rot_vec_var);
 
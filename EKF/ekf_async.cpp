@@ -0,0 +1,152 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file ekf_async.cpp
+ * Runs the EKF prediction and fusion on an estimator thread that is only woken when a down-sampled IMU sample
+ * is ready, while the output predictor is updated inline on the thread that provides the IMU data.
+ *
+ */
+
+#include "../ecl.h"
+#include "ekf_async.h"
+#include "mathlib.h"
+
+bool EkfAsync::init(uint16_t history_ms, uint16_t imu_interval_us, frame_ready_callback callback, void *callback_arg)
+{
+	if (callback == nullptr || !_output_predictor.init(history_ms, imu_interval_us)) {
+		return false;
+	}
+
+	if (!_imu_queue.allocate((unsigned)history_ms * 1000 / imu_interval_us + 1)) {
+		ECL_ERR("EKF IMU queue allocation failed!");
+		return false;
+	}
+
+	_callback = callback;
+	_callback_arg = callback_arg;
+
+	_queued_dt_sum_us = 0;
+	_processed_dt_sum_us = 0;
+	_frame_due_dt_sum_us.store(0, std::memory_order_relaxed);
+	_imu_queue_overruns.store(0, std::memory_order_relaxed);
+
+	// notify on the first sample so that the estimator thread initialises the filter
+	_notified_process_count = _process_count.load(std::memory_order_relaxed) - 1;
+
+	return true;
+}
+
+void EkfAsync::setIMUData(uint64_t time_usec, uint64_t delta_ang_dt, uint64_t delta_vel_dt, float (&delta_ang)[3],
+			  float (&delta_vel)[3])
+{
+	_output_predictor.setIMUData(time_usec, delta_ang_dt, delta_vel_dt, delta_ang, delta_vel);
+
+	queuedImuSample queued = {};
+	memcpy(&queued.imu.delta_ang._data[0], &delta_ang[0], sizeof(queued.imu.delta_ang._data));
+	memcpy(&queued.imu.delta_vel._data[0], &delta_vel[0], sizeof(queued.imu.delta_vel._data));
+
+	// convert time from us to secs
+	queued.imu.delta_ang_dt = delta_ang_dt / 1e6f;
+	queued.imu.delta_vel_dt = delta_vel_dt / 1e6f;
+	queued.imu.time_us = time_usec;
+	queued.delta_ang_dt_sum_us = _queued_dt_sum_us + delta_ang_dt;
+
+	if (!_imu_queue.push(queued)) {
+		_imu_queue_overruns.store(_imu_queue_overruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		return;
+	}
+
+	_queued_dt_sum_us = queued.delta_ang_dt_sum_us;
+
+	// Wake the estimator thread once the queued data completes the down-sampled sample that the last call to
+	// process() was waiting for. The estimator thread is not woken again until it has run, so a notification
+	// that comes too early because of rounding is followed by another one after process() has moved the due time.
+	const unsigned process_count = _process_count.load(std::memory_order_acquire);
+
+	if (process_count != _notified_process_count
+	    && _queued_dt_sum_us >= _frame_due_dt_sum_us.load(std::memory_order_relaxed)) {
+		_notified_process_count = process_count;
+		_callback(_callback_arg);
+	}
+}
+
+unsigned EkfAsync::process()
+{
+	imuSample samples[PROCESS_BATCH_LENGTH];
+	unsigned num_samples = 0;
+	unsigned first = 0;
+	unsigned updates = 0;
+
+	for (;;) {
+		if (first == num_samples) {
+			queuedImuSample queued;
+			num_samples = 0;
+			first = 0;
+
+			while (num_samples < PROCESS_BATCH_LENGTH && _imu_queue.pop_oldest(&queued)) {
+				samples[num_samples++] = queued.imu;
+				_processed_dt_sum_us = queued.delta_ang_dt_sum_us;
+			}
+
+			if (num_samples == 0) {
+				break;
+			}
+		}
+
+		// the EKF consumes the samples up to the one that completes a down-sampled sample
+		first += _ekf.setIMUData(&samples[first], num_samples - first);
+
+		imuSample imu_sample_down_sampled;
+		const bool down_sampled_ready = _ekf.get_imu_sample_down_sampled(imu_sample_down_sampled);
+
+		_ekf.update();
+
+		if (down_sampled_ready) {
+			updates++;
+
+			outputCorrection correction;
+
+			if (_ekf.get_output_correction(&correction)) {
+				_output_predictor.setCorrection(correction);
+			}
+		}
+	}
+
+	// publish when the next down-sampled sample will be completed
+	const float remaining_dt = math::max(_ekf.get_imu_collection_remaining_dt(), 0.0f);
+	_frame_due_dt_sum_us.store(_processed_dt_sum_us + (uint64_t)(remaining_dt * 1e6f + 0.5f), std::memory_order_relaxed);
+	_process_count.store(_process_count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+
+	return updates;
+}
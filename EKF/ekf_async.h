@@ -0,0 +1,112 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file ekf_async.h
+ * Runs the EKF prediction and fusion on an estimator thread that is only woken when a down-sampled IMU sample
+ * is ready, while the output predictor is updated inline on the thread that provides the IMU data.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include "ekf.h"
+#include "output_predictor.h"
+
+class EkfAsync
+{
+public:
+	// called on the IMU thread when enough IMU data has been set to complete a down-sampled IMU sample.
+	// This should only wake the estimator thread, which then calls process().
+	typedef void (*frame_ready_callback)(void *arg);
+
+	EkfAsync() = default;
+	~EkfAsync() = default;
+
+	EkfAsync(const EkfAsync &) = delete;
+	EkfAsync &operator=(const EkfAsync &) = delete;
+
+	// allocate the output predictor history and the queue of IMU samples waiting for the estimator thread.
+	// Both must span the delay to the EKF fusion time horizon plus the worst case latency of the estimator thread.
+	// This must be called before either thread uses the estimator.
+	bool init(uint16_t history_ms, uint16_t imu_interval_us, frame_ready_callback callback, void *callback_arg);
+
+	// the following functions must be called from the IMU thread
+
+	// update the output predictor with a new IMU sample and queue the sample for the estimator thread
+	void setIMUData(uint64_t time_usec, uint64_t delta_ang_dt, uint64_t delta_vel_dt, float (&delta_ang)[3],
+			float (&delta_vel)[3]);
+
+	// output states at the time of the newest IMU sample
+	OutputPredictor &get_output_predictor() { return _output_predictor; }
+
+	// the following functions must be called from the estimator thread
+
+	// pass the queued IMU samples to the EKF, run a filter update for each completed down-sampled IMU sample
+	// and send the corrections to the output predictor
+	// returns the number of down-sampled IMU samples processed
+	unsigned process();
+
+	// set the parameters and the non-IMU sensor data and read the states on the delayed fusion time horizon
+	Ekf &get_ekf() { return _ekf; }
+
+	// number of IMU samples discarded because the estimator thread did not empty the queue in time
+	uint32_t get_imu_queue_overruns() const { return _imu_queue_overruns.load(std::memory_order_relaxed); }
+
+private:
+	struct queuedImuSample {
+		imuSample imu;
+		uint64_t delta_ang_dt_sum_us;	// sum of the delta angle integration periods of all queued samples (usec)
+	};
+
+	static const unsigned PROCESS_BATCH_LENGTH = 16;	// number of queued IMU samples passed to the EKF at once
+
+	Ekf _ekf;
+	OutputPredictor _output_predictor;
+	SpscRingBuffer<queuedImuSample> _imu_queue;
+
+	frame_ready_callback _callback{nullptr};
+	void *_callback_arg{nullptr};
+
+	// written by the IMU thread
+	uint64_t _queued_dt_sum_us{0};		// delta angle integration period sum of the queued samples (usec)
+	unsigned _notified_process_count{0};	// value of _process_count when the callback was last called
+	std::atomic<uint32_t> _imu_queue_overruns{0};
+
+	// written by the estimator thread
+	uint64_t _processed_dt_sum_us{0};		// delta angle integration period sum of the processed samples (usec)
+	std::atomic<uint64_t> _frame_due_dt_sum_us{0};	// queued sum at which the next down-sampled sample completes (usec)
+	std::atomic<unsigned> _process_count{0};	// number of calls to process()
+
+};
@@ -0,0 +1,170 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file ekf_bank.cpp
+ * Bank of ekf instances that share the pre-processing of a common IMU.
+ *
+ */
+
+#include "ekf_bank.h"
+
+EkfBank::EkfBank(uint8_t num_instances):
+	_num_instances(num_instances)
+{
+	if (_num_instances < 1) {
+		_num_instances = 1;
+
+	} else if (_num_instances > max_instances) {
+		_num_instances = max_instances;
+	}
+}
+
+void EkfBank::setParameters(const parameters &params)
+{
+	for (uint8_t i = 0; i < _num_instances; i++) {
+		*_ekf[i].getParamHandle() = params;
+	}
+}
+
+void EkfBank::setIMUData(uint64_t time_usec, uint64_t delta_ang_dt, uint64_t delta_vel_dt, float (&delta_ang)[3],
+			 float (&delta_vel)[3])
+{
+	// the first instance does the pre-processing
+	_ekf[0].setIMUData(time_usec, delta_ang_dt, delta_vel_dt, delta_ang, delta_vel);
+
+	if (_num_instances < 2) {
+		return;
+	}
+
+	shareIMUData();
+}
+
+unsigned EkfBank::setIMUData(const imuSample *imu_samples, unsigned num_samples)
+{
+	// the first instance does the pre-processing
+	unsigned count = _ekf[0].setIMUData(imu_samples, num_samples);
+
+	if (_num_instances < 2 || count == 0) {
+		return count;
+	}
+
+	shareIMUData();
+
+	return count;
+}
+
+void EkfBank::shareIMUData()
+{
+	imuSample imu_sample_down_sampled = {};
+	bool down_sampled_ready = _ekf[0].get_imu_sample_down_sampled(imu_sample_down_sampled);
+
+	float vibe_metrics[3];
+	_ekf[0].get_imu_vibe_metrics(vibe_metrics);
+
+	// pass the result and the prediction period it was down-sampled to, which the adaptive mode may have changed, to
+	// the remaining instances
+	const unsigned filter_update_period_ms = _ekf[0].get_filter_update_period_ms();
+
+	for (uint8_t i = 1; i < _num_instances; i++) {
+		_ekf[i].setIMUSample(_ekf[0].get_imu_sample_newest(), imu_sample_down_sampled, down_sampled_ready, vibe_metrics,
+				     filter_update_period_ms);
+	}
+}
+
+bool EkfBank::update(uint8_t index)
+{
+	if (index >= _num_instances) {
+		return false;
+	}
+
+	return _ekf[index].update();
+}
+
+uint8_t EkfBank::update()
+{
+	uint8_t updated = 0;
+
+	for (uint8_t i = 0; i < _num_instances; i++) {
+		if (_ekf[i].update()) {
+			updated |= (1 << i);
+		}
+	}
+
+	return updated;
+}
+
+uint8_t EkfBank::update_parallel()
+{
+#if defined(ECL_EKF_BANK_THREADS)
+	bool posted[max_instances - 1] {};
+
+	for (uint8_t i = 1; i < _num_instances; i++) {
+		updateJob &job = _jobs[i - 1];
+		job.ekf = &_ekf[i];
+		job.updated = false;
+
+		WorkerThread &worker = _workers[i - 1];
+		posted[i - 1] = worker.start() && worker.post(&EkfBank::runUpdateJob, &job);
+	}
+
+	uint8_t updated = _ekf[0].update() ? 1 : 0;
+
+	for (uint8_t i = 1; i < _num_instances; i++) {
+		updateJob &job = _jobs[i - 1];
+
+		if (posted[i - 1]) {
+			_workers[i - 1].wait();
+
+		} else {
+			runUpdateJob(&job);
+		}
+
+		if (job.updated) {
+			updated |= (1 << i);
+		}
+	}
+
+	return updated;
+#else
+	return update();
+#endif
+}
+
+#if defined(ECL_EKF_BANK_THREADS)
+void EkfBank::runUpdateJob(void *arg)
+{
+	updateJob *job = static_cast<updateJob *>(arg);
+	job->updated = job->ekf->update();
+}
+#endif
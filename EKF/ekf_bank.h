@@ -0,0 +1,110 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file ekf_bank.h
+ * Bank of ekf instances that share the pre-processing of a common IMU.
+ *
+ */
+
+#pragma once
+
+#include "ekf.h"
+
+#if defined(ECL_EKF_BANK_THREADS)
+#include "WorkerThread.h"
+#endif
+
+class EkfBank
+{
+public:
+	static const uint8_t max_instances = 4;	// maximum number of ekf instances in the bank
+
+	explicit EkfBank(uint8_t num_instances);
+	~EkfBank() = default;
+
+	// return the number of active instances
+	uint8_t get_num_instances() const { return _num_instances; }
+
+	// return a reference to an instance so that the non-IMU sensor data can be set and the outputs read
+	Ekf &get_instance(uint8_t index) { return _ekf[index]; }
+
+	// copy a common set of parameters to every instance
+	void setParameters(const parameters &params);
+
+	// set delta angle imu data for all instances
+	// the vibration metrics, down-sampling and adaptive prediction period are calculated once by the first instance
+	// and the result is passed to the other instances
+	void setIMUData(uint64_t time_usec, uint64_t delta_ang_dt, uint64_t delta_vel_dt, float (&delta_ang)[3], float (&delta_vel)[3]);
+
+	// set a batch of imu samples for all instances, see EstimatorInterface::setIMUData()
+	// returns the number of samples consumed
+	unsigned setIMUData(const imuSample *imu_samples, unsigned num_samples);
+
+	// run the filter update for one instance and return true if it was updated
+	// the instances do not share any mutable data, so the updates for different instances can be run
+	// concurrently from separate threads once setIMUData has returned
+	bool update(uint8_t index);
+
+	// run the filter update for all instances in sequence
+	// returns a bitmask with the bit set for each instance that was updated
+	uint8_t update();
+
+	// run the filter update for all instances in parallel and wait for them to complete, the result is the same as
+	// that of update(). When built with ECL_EKF_BANK_THREADS the first instance is updated on the calling thread and
+	// each of the others on a worker thread of its own, which is created on the first call. Otherwise, or if a
+	// worker could not be created, the instances are updated on the calling thread in sequence.
+	// returns a bitmask with the bit set for each instance that was updated
+	uint8_t update_parallel();
+
+private:
+	Ekf _ekf[max_instances];
+	uint8_t _num_instances;
+
+	// pass the IMU data pre-processed by the first instance to the remaining instances
+	void shareIMUData();
+
+#if defined(ECL_EKF_BANK_THREADS)
+	// update of one instance run by a worker thread
+	struct updateJob {
+		Ekf *ekf;
+		bool updated;
+	};
+
+	WorkerThread _workers[max_instances - 1];	// update the instances after the first one
+	updateJob _jobs[max_instances - 1] {};
+
+	static void runUpdateJob(void *arg);
+#endif
+
+};
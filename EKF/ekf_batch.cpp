@@ -0,0 +1,955 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file ekf_batch.cpp
+ * State and covariance prediction and direct velocity and position fusion for many ekf instances in one pass.
+ *
+ */
+
+#include "../ecl.h"
+#include "ekf_batch.h"
+#include "covariance_prediction.h"
+#include "fast_math.h"
+#include "mathlib.h"
+
+bool EkfBatch::allocate(unsigned num_instances)
+{
+	delete[] _blocks;
+	_blocks = nullptr;
+	_num_blocks = 0;
+	_num_instances = 0;
+
+	if (num_instances == 0) {
+		return true;
+	}
+
+	const unsigned num_blocks = (num_instances + lane_width - 1) / lane_width;
+	_blocks = new block[num_blocks];
+
+	if (_blocks == nullptr) {
+		ECL_ERR("EKF batch allocation failed");
+		return false;
+	}
+
+	_num_blocks = num_blocks;
+	_num_instances = num_instances;
+
+	for (unsigned b = 0; b < _num_blocks; b++) {
+		resetBlock(_blocks[b]);
+	}
+
+	return true;
+}
+
+void EkfBatch::resetBlock(block &blk)
+{
+	for (unsigned i = 0; i < _k_state_vector_length; i++) {
+		blk.state[i] = 0.0f;
+	}
+
+	blk.state[0] = 1.0f;
+	blk.P.setZero();
+
+	for (unsigned i = 0; i < 3; i++) {
+		for (unsigned j = 0; j < 3; j++) {
+			blk.R_to_earth[i][j] = (i == j) ? 1.0f : 0.0f;
+		}
+
+		blk.earth_rate_NED[i] = 0.0f;
+		blk.prev_dvel_bias_var[i] = 0.0f;
+	}
+
+	blk.dt_ekf_avg = 0.001f * (float)Ekf::constrainFilterUpdatePeriod(_params.filter_update_period_ms);
+	blk.ang_rate_mag_filt = 0.0f;
+	blk.accel_mag_filt = 0.0f;
+
+	for (unsigned i = 0; i < 6; i++) {
+		blk.vel_pos_innov[i] = 0.0f;
+		blk.vel_pos_innov_var[i] = 0.0f;
+		blk.vel_pos_test_ratio[i] = 0.0f;
+	}
+
+	for (unsigned lane = 0; lane < lane_width; lane++) {
+		blk.time_acc_bias_check[lane] = 0;
+		blk.cov_touched_states[lane] = 0;
+		blk.accel_bias_inhibit[lane] = false;
+		blk.bad_vert_accel_detected[lane] = false;
+		blk.control_status[lane].value = 0;
+		blk.control_status_prev[lane].value = 0;
+		blk.fault_status[lane].value = 0;
+		blk.innov_check_fail_status[lane].value = 0;
+	}
+}
+
+unsigned EkfBatch::blockCount(unsigned block_index) const
+{
+	const unsigned first = block_index * lane_width;
+
+	return (_num_instances - first < lane_width) ? _num_instances - first : lane_width;
+}
+
+void EkfBatch::setParameters(const parameters &params)
+{
+	_params = params;
+}
+
+void EkfBatch::set_instance(unsigned index, const Ekf &ekf)
+{
+	if (index >= _num_instances) {
+		return;
+	}
+
+	block &blk = _blocks[index / lane_width];
+	const unsigned lane = index % lane_width;
+	const stateSample &state = ekf._state;
+
+	for (unsigned i = 0; i < 4; i++) {
+		blk.state[i][lane] = state.quat_nominal(i);
+	}
+
+	for (unsigned i = 0; i < 3; i++) {
+		blk.state[i + 4][lane] = state.vel(i);
+		blk.state[i + 7][lane] = state.pos(i);
+		blk.state[i + 10][lane] = state.gyro_bias(i);
+		blk.state[i + 13][lane] = state.accel_bias(i);
+		blk.state[i + 16][lane] = state.mag_I(i);
+		blk.state[i + 19][lane] = state.mag_B(i);
+	}
+
+	for (unsigned i = 0; i < 2; i++) {
+		blk.state[i + 22][lane] = state.wind_vel(i);
+	}
+
+	for (uint8_t row = 0; row < _k_num_states; row++) {
+		for (uint8_t column = row; column < _k_num_states; column++) {
+			blk.P(row, column)[lane] = ekf.P(row, column);
+		}
+	}
+
+	for (unsigned i = 0; i < 3; i++) {
+		for (unsigned j = 0; j < 3; j++) {
+			blk.R_to_earth[i][j][lane] = ekf._R_to_earth(i, j);
+		}
+
+		blk.earth_rate_NED[i][lane] = ekf._earth_rate_NED(i);
+		blk.prev_dvel_bias_var[i][lane] = ekf._prev_dvel_bias_var(i);
+	}
+
+	blk.dt_ekf_avg[lane] = ekf._dt_ekf_avg;
+	blk.ang_rate_mag_filt[lane] = ekf._ang_rate_mag_filt;
+	blk.accel_mag_filt[lane] = ekf._accel_mag_filt;
+
+	for (unsigned i = 0; i < 6; i++) {
+		blk.vel_pos_innov[i][lane] = ekf._vel_pos_innov[i];
+		blk.vel_pos_innov_var[i][lane] = ekf._vel_pos_innov_var[i];
+		blk.vel_pos_test_ratio[i][lane] = ekf._vel_pos_test_ratio[i];
+	}
+
+	blk.time_acc_bias_check[lane] = ekf._time_acc_bias_check;
+	blk.cov_touched_states[lane] = 0;
+	blk.accel_bias_inhibit[lane] = ekf._accel_bias_inhibit;
+	blk.bad_vert_accel_detected[lane] = ekf._bad_vert_accel_detected;
+	blk.control_status[lane] = ekf._control_status;
+	blk.control_status_prev[lane] = ekf._control_status_prev;
+	blk.fault_status[lane] = ekf._fault_status;
+	blk.innov_check_fail_status[lane] = ekf._innov_check_fail_status;
+}
+
+void EkfBatch::predict(const ekf_batch_imu &imu)
+{
+	_time_last_imu = imu.time_us;
+
+	for (unsigned b = 0; b < _num_blocks; b++) {
+		block &blk = _blocks[b];
+		const unsigned first = b * lane_width;
+		const unsigned count = blockCount(b);
+
+		// the unused lanes of the last block repeat the data of its first instance
+		lane_f delta_ang[3];
+		lane_f delta_vel[3];
+		lane_f delta_ang_dt;
+		lane_f delta_vel_dt;
+
+		for (unsigned lane = 0; lane < lane_width; lane++) {
+			const unsigned n = first + (lane < count ? lane : 0);
+
+			for (unsigned i = 0; i < 3; i++) {
+				delta_ang[i][lane] = imu.delta_ang[i][n];
+				delta_vel[i][lane] = imu.delta_vel[i][n];
+			}
+
+			delta_ang_dt[lane] = imu.delta_ang_dt[n];
+			delta_vel_dt[lane] = imu.delta_vel_dt[n];
+		}
+
+		predictState(blk, delta_ang, delta_vel, delta_ang_dt, delta_vel_dt);
+		predictCovariance(blk, delta_ang, delta_vel, delta_ang_dt);
+	}
+}
+
+void EkfBatch::predictState(block &blk, const lane_f (&delta_ang)[3], const lane_f (&delta_vel)[3],
+			    const lane_f &delta_ang_dt, const lane_f &delta_vel_dt)
+{
+	const float dt_min = 0.0005f * (float)(Ekf::minFilterUpdatePeriod(_params));
+	const float dt_max = 0.002f * (float)(Ekf::maxFilterUpdatePeriod(_params));
+
+	// the quaternion operations have data dependent branches, so the states of each instance are predicted with
+	// the same operations as Ekf::predictState()
+	for (unsigned lane = 0; lane < lane_width; lane++) {
+		Quaternion quat;
+		Vector3f vel;
+		Vector3f pos;
+		Vector3f gyro_bias;
+		Vector3f accel_bias;
+		Vector3f imu_delta_ang;
+		Vector3f imu_delta_vel;
+		Vector3f earth_rate_NED;
+		matrix::Dcm<float> R_to_earth;
+
+		for (unsigned i = 0; i < 4; i++) {
+			quat(i) = blk.state[i][lane];
+		}
+
+		for (unsigned i = 0; i < 3; i++) {
+			vel(i) = blk.state[i + 4][lane];
+			pos(i) = blk.state[i + 7][lane];
+			gyro_bias(i) = blk.state[i + 10][lane];
+			accel_bias(i) = blk.state[i + 13][lane];
+			imu_delta_ang(i) = delta_ang[i][lane];
+			imu_delta_vel(i) = delta_vel[i][lane];
+			earth_rate_NED(i) = blk.earth_rate_NED[i][lane];
+
+			for (unsigned j = 0; j < 3; j++) {
+				R_to_earth(i, j) = blk.R_to_earth[i][j][lane];
+			}
+		}
+
+		// apply imu bias corrections
+		Vector3f corrected_delta_ang = imu_delta_ang - gyro_bias;
+		Vector3f corrected_delta_vel = imu_delta_vel - accel_bias;
+
+		// correct delta angles for earth rotation rate
+		corrected_delta_ang -= -R_to_earth.transpose() * earth_rate_NED * delta_ang_dt[lane];
+
+		// rotate the previous quaternion by the delta quaternion and normalise
+		Quaternion dq;
+		ecl::quat_from_rotation_vector(dq, corrected_delta_ang);
+		quat = dq * quat;
+		ecl::normalize_quat(quat);
+
+		// save the previous value of velocity so we can use trapzoidal integration
+		Vector3f vel_last = vel;
+
+		// update transformation matrix from body to world frame
+		R_to_earth = Ekf::quat_to_invrotmat(quat);
+
+		// calculate the increment in velocity using the current orientation and compensate for gravity
+		vel += R_to_earth * corrected_delta_vel;
+		vel(2) += Ekf::_gravity_mss * delta_vel_dt[lane];
+
+		// predict position states via trapezoidal integration of velocity
+		pos += (vel_last + vel) * delta_vel_dt[lane] * 0.5f;
+
+		for (unsigned i = 0; i < 4; i++) {
+			blk.state[i][lane] = quat(i);
+		}
+
+		for (unsigned i = 0; i < 3; i++) {
+			blk.state[i + 4][lane] = vel(i);
+			blk.state[i + 7][lane] = pos(i);
+
+			for (unsigned j = 0; j < 3; j++) {
+				blk.R_to_earth[i][j][lane] = R_to_earth(i, j);
+			}
+		}
+
+		// state limits of Ekf::constrainStates()
+		const float dt_ekf_avg = blk.dt_ekf_avg[lane];
+
+		for (unsigned i = 0; i < 4; i++) {
+			blk.state[i][lane] = math::constrain(blk.state[i][lane], -1.0f, 1.0f);
+		}
+
+		for (unsigned i = 0; i < 3; i++) {
+			blk.state[i + 4][lane] = math::constrain(blk.state[i + 4][lane], -1000.0f, 1000.0f);
+			blk.state[i + 7][lane] = math::constrain(blk.state[i + 7][lane], -1.e6f, 1.e6f);
+			blk.state[i + 10][lane] = math::constrain(blk.state[i + 10][lane], -0.349066f * dt_ekf_avg, 0.349066f * dt_ekf_avg);
+			blk.state[i + 13][lane] = math::constrain(blk.state[i + 13][lane], -_params.acc_bias_lim * dt_ekf_avg,
+						  _params.acc_bias_lim * dt_ekf_avg);
+			blk.state[i + 16][lane] = math::constrain(blk.state[i + 16][lane], -1.0f, 1.0f);
+			blk.state[i + 19][lane] = math::constrain(blk.state[i + 19][lane], -0.5f, 0.5f);
+		}
+
+		for (unsigned i = 0; i < 2; i++) {
+			blk.state[i + 22][lane] = math::constrain(blk.state[i + 22][lane], -100.0f, 100.0f);
+		}
+
+		// calculate an average filter update time
+		float input = 0.5f * (delta_vel_dt[lane] + delta_ang_dt[lane]);
+		input = math::constrain(input, dt_min, dt_max);
+		blk.dt_ekf_avg[lane] = 0.99f * dt_ekf_avg + 0.01f * input;
+	}
+}
+
+void EkfBatch::predictCovariance(block &blk, const lane_f (&delta_ang)[3], const lane_f (&delta_vel)[3],
+				 const lane_f &delta_ang_dt)
+{
+	SymmetricMatrix<lane_f, _k_num_states> &P = blk.P;
+	SymmetricMatrix<lane_f, _k_num_states> &nextP = _nextP;
+
+	const float dt_min = 0.0005f * Ekf::minFilterUpdatePeriod(_params);
+	const float dt_max = 0.002f * Ekf::maxFilterUpdatePeriod(_params);
+
+	lane_f dt;
+	lane_f process_noise[_k_num_states] = {};
+	covariance::predictionInputs<lane_f> inputs;
+	bool predict_accel_bias[lane_width];
+
+	// the noise scaling and bias learning inhibition of Ekf::predictCovariance() for each instance
+	for (unsigned lane = 0; lane < lane_width; lane++) {
+		const float lane_dt = math::constrain(delta_ang_dt[lane], dt_min, dt_max);
+		dt[lane] = lane_dt;
+
+		// convert rate of change of rate gyro bias (rad/s**2) as specified by the parameter to an expected change in delta angle (rad) since the last update
+		float d_ang_bias_sig = lane_dt * lane_dt * math::constrain(_params.gyro_bias_p_noise, 0.0f, 1.0f);
+
+		// convert rate of change of accelerometer bias (m/s**3) as specified by the parameter to an expected change in delta velocity (m/s) since the last update
+		float d_vel_bias_sig = lane_dt * lane_dt * math::constrain(_params.accel_bias_p_noise, 0.0f, 1.0f);
+
+		// inhibit learning of imu acccel bias if the manoeuvre levels are too high
+		Vector3f imu_delta_ang;
+		Vector3f imu_delta_vel;
+
+		for (unsigned i = 0; i < 3; i++) {
+			imu_delta_ang(i) = delta_ang[i][lane];
+			imu_delta_vel(i) = delta_vel[i][lane];
+		}
+
+		float alpha = 1.0f - math::constrain((lane_dt / _params.acc_bias_learn_tc), 0.0f, 1.0f);
+		blk.ang_rate_mag_filt[lane] = fmaxf(imu_delta_ang.norm(), alpha * blk.ang_rate_mag_filt[lane]);
+		blk.accel_mag_filt[lane] = fmaxf(imu_delta_vel.norm(), alpha * blk.accel_mag_filt[lane]);
+
+		if (blk.ang_rate_mag_filt[lane] > lane_dt * _params.acc_bias_learn_gyr_lim
+		    || blk.accel_mag_filt[lane] > lane_dt * _params.acc_bias_learn_acc_lim
+		    || blk.bad_vert_accel_detected[lane]) {
+			// store the bias state variances to be reinstated later
+			if (!blk.accel_bias_inhibit[lane]) {
+				for (uint8_t i = 0; i < 3; i++) {
+					blk.prev_dvel_bias_var[i][lane] = P(13 + i, 13 + i)[lane];
+				}
+			}
+
+			blk.accel_bias_inhibit[lane] = true;
+
+		} else {
+			for (uint8_t i = 0; i < 3; i++) {
+				if (blk.accel_bias_inhibit[lane]) {
+					// reinstate the bias state variances
+					P(13 + i, 13 + i)[lane] = blk.prev_dvel_bias_var[i][lane];
+
+				} else {
+					// store the bias state variances to be reinstated later
+					blk.prev_dvel_bias_var[i][lane] = P(13 + i, 13 + i)[lane];
+				}
+			}
+
+			blk.accel_bias_inhibit[lane] = false;
+		}
+
+		predict_accel_bias[lane] = !(_params.fusion_mode & MASK_INHIBIT_ACC_BIAS) && !blk.accel_bias_inhibit[lane];
+
+		// delta angle and delta velocity bias states
+		for (uint8_t i = 10; i <= 12; i++) {
+			process_noise[i][lane] = covariance::sq(d_ang_bias_sig);
+			process_noise[i + 3][lane] = covariance::sq(d_vel_bias_sig);
+		}
+
+#ifndef ECL_EKF_NO_MAG_STATES
+		// don't continue to grow the magnetic field variances if they are becoming too large or 3-axis fusion is not used
+		const bool mag_3D = blk.control_status[lane].flags.mag_3D;
+		float mag_I_sig = 0.0f;
+		float mag_B_sig = 0.0f;
+
+		if (mag_3D && (P(16, 16)[lane] + P(17, 17)[lane] + P(18, 18)[lane]) < 0.1f) {
+			mag_I_sig = lane_dt * math::constrain(_params.mage_p_noise, 0.0f, 1.0f);
+		}
+
+		if (mag_3D && (P(19, 19)[lane] + P(20, 20)[lane] + P(21, 21)[lane]) < 0.1f) {
+			mag_B_sig = lane_dt * math::constrain(_params.magb_p_noise, 0.0f, 1.0f);
+		}
+
+		for (uint8_t i = 16; i <= 18; i++) {
+			process_noise[i][lane] = covariance::sq(mag_I_sig);
+			process_noise[i + 3][lane] = covariance::sq(mag_B_sig);
+		}
+
+		// set the state variances on the transition into 3-axis fusion
+		if (mag_3D && !blk.control_status_prev[lane].flags.mag_3D) {
+			for (uint8_t index = 16; index <= 21; index++) {
+				P(index, index)[lane] = covariance::sq(fmaxf(_params.mag_noise, 0.001f));
+			}
+		}
+
+#endif
+
+#ifndef ECL_EKF_NO_WIND_STATES
+		// don't continue to grow the wind velocity variances if they are becoming too large or the states are not used
+		float wind_vel_sig = 0.0f;
+
+		if (blk.control_status[lane].flags.wind && (P(22, 22)[lane] + P(23, 23)[lane]) < 2.0f) {
+			wind_vel_sig = lane_dt * math::constrain(_params.wind_vel_p_noise, 0.0f, 1.0f);
+		}
+
+		process_noise[22][lane] = process_noise[23][lane] = covariance::sq(wind_vel_sig);
+#endif
+
+		// IMU noise variances
+		float gyro_noise = math::constrain(_params.gyro_noise, 0.0f, 1.0f);
+		inputs.daxVar[lane] = inputs.dayVar[lane] = inputs.dazVar[lane] = covariance::sq(lane_dt * gyro_noise);
+		float accel_noise = math::constrain(_params.accel_noise, 0.0f, 1.0f);
+
+		if (blk.bad_vert_accel_detected[lane]) {
+			accel_noise = BADACC_BIAS_PNOISE;
+		}
+
+		inputs.dvxVar[lane] = inputs.dvyVar[lane] = inputs.dvzVar[lane] = covariance::sq(lane_dt * accel_noise);
+	}
+
+	inputs.q0 = blk.state[0];
+	inputs.q1 = blk.state[1];
+	inputs.q2 = blk.state[2];
+	inputs.q3 = blk.state[3];
+	inputs.dax = delta_ang[0];
+	inputs.day = delta_ang[1];
+	inputs.daz = delta_ang[2];
+	inputs.dvx = delta_vel[0];
+	inputs.dvy = delta_vel[1];
+	inputs.dvz = delta_vel[2];
+	inputs.dax_b = blk.state[10];
+	inputs.day_b = blk.state[11];
+	inputs.daz_b = blk.state[12];
+	inputs.dvx_b = blk.state[13];
+	inputs.dvy_b = blk.state[14];
+	inputs.dvz_b = blk.state[15];
+	inputs.dt = dt;
+
+	// intermediate calculations
+	lane_f SF[21];
+	lane_f SG[8];
+	lane_f SQ[11];
+	lane_f SPP[11];
+	covariance::calcPredictionTerms(inputs, SF, SG, SQ, SPP);
+
+#if defined(ECL_EKF_MIXED_PRECISION)
+	lane_acc SF_acc[21];
+	lane_acc SQ_acc[11];
+	lane_acc SPP_acc[11];
+
+	for (unsigned i = 0; i < 21; i++) {
+		SF_acc[i] = SF[i];
+	}
+
+	for (unsigned i = 0; i < 11; i++) {
+		SQ_acc[i] = SQ[i];
+		SPP_acc[i] = SPP[i];
+	}
+
+#else
+	const lane_f *SF_acc = SF;
+	const lane_f *SQ_acc = SQ;
+	const lane_f *SPP_acc = SPP;
+#endif
+	const lane_acc q0_acc = inputs.q0;
+
+	// all covariance blocks are predicted for every instance and the blocks of states that are not used by an
+	// instance are discarded afterwards, so the same operations are applied to every lane
+	covariance::predictKinematicCovariances(P, nextP, inputs, SF, SG, SQ, SPP, SF_acc, SQ_acc, SPP_acc, q0_acc);
+	covariance::predictDeltaVelBiasCovariances(P, nextP, SF, SPP, inputs.q0, dt);
+
+	for (uint8_t i = 0; i <= 15; i++) {
+		nextP(i, i) += process_noise[i];
+	}
+
+#ifndef ECL_EKF_NO_MAG_STATES
+	covariance::predictMagFieldCovariances(P, nextP, SF, SPP, inputs.q0, dt);
+
+	for (uint8_t i = 16; i <= 21; i++) {
+		nextP(i, i) += process_noise[i];
+	}
+
+#endif
+
+#ifndef ECL_EKF_NO_WIND_STATES
+	covariance::predictWindCovariances(P, nextP, SF, SPP, inputs.q0, dt);
+
+	for (uint8_t i = 22; i <= 23; i++) {
+		nextP(i, i) += process_noise[i];
+	}
+
+#endif
+
+	bool copy_mag[lane_width];
+	bool copy_wind[lane_width];
+
+	for (unsigned lane = 0; lane < lane_width; lane++) {
+		// inhibit delta velocity bias learning by zeroing the covariance terms
+		if (!predict_accel_bias[lane]) {
+			for (uint8_t column = 13; column <= 15; column++) {
+				for (uint8_t row = 0; row <= column; row++) {
+					nextP(row, column)[lane] = 0.0f;
+				}
+			}
+		}
+
+		// stop position covariance growth if our total position variance reaches 100m
+		if ((P(7, 7)[lane] + P(8, 8)[lane]) > 1e4f) {
+			for (uint8_t i = 7; i <= 8; i++) {
+				for (uint8_t j = 0; j < _k_num_states; j++) {
+					nextP(i, j)[lane] = P(i, j)[lane];
+				}
+			}
+		}
+
+		copy_mag[lane] = blk.control_status[lane].flags.mag_3D;
+		copy_wind[lane] = blk.control_status[lane].flags.wind;
+	}
+
+	// copy the upper triangle of the predicted blocks, see Ekf::copyUpperCovarianceBlock()
+	for (uint8_t column = 0; column < _k_num_states; column++) {
+		const bool *copy = (column <= 21) ? copy_mag : copy_wind;
+
+		for (uint8_t row = 0; row <= column; row++) {
+			lane_f &dst = P(row, column);
+			const lane_f &src = nextP(row, column);
+
+			for (unsigned lane = 0; lane < lane_width; lane++) {
+				dst[lane] = (column <= 15 || copy[lane]) ? src[lane] : dst[lane];
+			}
+		}
+	}
+
+	// fix gross errors in the covariance matrix and ensure rows and columns for un-used states are zero
+	for (unsigned lane = 0; lane < lane_width; lane++) {
+		fixCovarianceErrors(blk, lane);
+		blk.control_status_prev[lane] = blk.control_status[lane];
+	}
+}
+
+void EkfBatch::constrainStateVariance(block &blk, unsigned lane, uint8_t index)
+{
+	float &var = blk.P(index, index)[lane];
+	const float max_var = Ekf::maxStateVariance(index);
+
+	if (!(var >= 0.0f && var <= max_var)) {
+		var = math::constrain(var, 0.0f, max_var);
+	}
+}
+
+void EkfBatch::zeroRowCol(SymmetricMatrix<lane_f, _k_num_states> &P, unsigned lane, uint8_t index)
+{
+	for (uint8_t column = 0; column < _k_num_states; column++) {
+		P(index, column)[lane] = 0.0f;
+	}
+}
+
+void EkfBatch::fixCovarianceErrors(block &blk, unsigned lane)
+{
+	SymmetricMatrix<lane_f, _k_num_states> &P = blk.P;
+	blk.cov_touched_states[lane] = 0;
+
+	// quaternion, velocity, position and gyro bias states
+	for (uint8_t i = 0; i <= 12; i++) {
+		constrainStateVariance(blk, lane, i);
+	}
+
+	// accelerometer bias states
+	if ((_params.fusion_mode & MASK_INHIBIT_ACC_BIAS) || blk.accel_bias_inhibit[lane]) {
+		for (uint8_t i = 13; i <= 15; i++) {
+			zeroRowCol(P, lane, i);
+		}
+
+	} else {
+		for (uint8_t i = 13; i <= 15; i++) {
+			constrainStateVariance(blk, lane, i);
+		}
+
+		// check that the vertical componenent of accel bias is consistent with both the vertical position and velocity innovation
+		float dVel_bias_lim = 0.9f * _params.acc_bias_lim * blk.dt_ekf_avg[lane];
+		float down_dvel_bias = 0.0f;
+
+		for (uint8_t axis_index = 0; axis_index < 3; axis_index++) {
+			down_dvel_bias += blk.state[13 + axis_index][lane] * blk.R_to_earth[2][axis_index][lane];
+		}
+
+		bool bad_acc_bias = (fabsf(down_dvel_bias) > dVel_bias_lim
+				     && down_dvel_bias * blk.vel_pos_innov[2][lane] < 0.0f
+				     && down_dvel_bias * blk.vel_pos_innov[5][lane] < 0.0f);
+
+		if (!bad_acc_bias) {
+			blk.fault_status[lane].flags.bad_acc_bias = false;
+			blk.time_acc_bias_check[lane] = _time_last_imu;
+
+		} else {
+			blk.fault_status[lane].flags.bad_acc_bias = true;
+		}
+
+		// if we have failed for 7 seconds continuously, reset the accel bias covariances but preserve the variances
+		if (_time_last_imu - blk.time_acc_bias_check[lane] > 7E6) {
+			float var[3];
+
+			for (uint8_t i = 0; i < 3; i++) {
+				var[i] = P(13 + i, 13 + i)[lane];
+			}
+
+			for (uint8_t i = 0; i < 3; i++) {
+				zeroRowCol(P, lane, 13 + i);
+			}
+
+			for (uint8_t i = 0; i < 3; i++) {
+				P(13 + i, 13 + i)[lane] = var[i];
+			}
+
+			blk.time_acc_bias_check[lane] = _time_last_imu;
+			blk.fault_status[lane].flags.bad_acc_bias = false;
+		}
+	}
+
+#ifndef ECL_EKF_NO_MAG_STATES
+	// magnetic field states
+	for (uint8_t i = 16; i <= 21; i++) {
+		if (!blk.control_status[lane].flags.mag_3D) {
+			zeroRowCol(P, lane, i);
+
+		} else {
+			constrainStateVariance(blk, lane, i);
+		}
+	}
+
+#endif
+
+#ifndef ECL_EKF_NO_WIND_STATES
+	// wind velocity states
+	for (uint8_t i = 22; i <= 23; i++) {
+		if (!blk.control_status[lane].flags.wind) {
+			zeroRowCol(P, lane, i);
+
+		} else {
+			constrainStateVariance(blk, lane, i);
+		}
+	}
+
+#endif
+}
+
+void EkfBatch::fuseVelPos(const ekf_batch_vel_pos &obs)
+{
+	for (unsigned b = 0; b < _num_blocks; b++) {
+		block &blk = _blocks[b];
+		const unsigned first = b * lane_width;
+		const unsigned count = blockCount(b);
+
+		bool fuse_map[6][lane_width] = {};
+		bool observed[lane_width] = {};
+
+		// calculate the innovations, innovation variances and innovation test ratios
+		for (unsigned obs_index = 0; obs_index < 6; obs_index++) {
+			if (obs.obs[obs_index] == nullptr) {
+				continue;
+			}
+
+			const unsigned state_index = obs_index + 4;
+			const float gate_size = obs.gate[(obs_index < 3) ? 0 : ((obs_index < 5) ? 1 : 2)];
+
+			for (unsigned lane = 0; lane < count; lane++) {
+				const unsigned n = first + lane;
+
+				if (obs.fuse_mask != nullptr && !(obs.fuse_mask[n] & (1 << obs_index))) {
+					continue;
+				}
+
+				fuse_map[obs_index][lane] = true;
+				observed[lane] = true;
+
+				const float innov = blk.state[state_index][lane] - obs.obs[obs_index][n];
+				const float innov_var = blk.P(state_index, state_index)[lane] + obs.obs_var[obs_index][n];
+				blk.vel_pos_innov[obs_index][lane] = innov;
+				blk.vel_pos_innov_var[obs_index][lane] = innov_var;
+				blk.vel_pos_test_ratio[obs_index][lane] = covariance::sq(innov) / (covariance::sq(gate_size) * innov_var);
+			}
+		}
+
+		// treat 3D velocity, 2D position and height as separate sensors
+		// always pass position and height checks if yet to complete tilt alignment
+		bool innov_check_pass_map[6][lane_width] = {};
+
+		for (unsigned lane = 0; lane < count; lane++) {
+			if (!observed[lane]) {
+				continue;
+			}
+
+			const lane_f *ratio = blk.vel_pos_test_ratio;
+			const bool tilt_align = blk.control_status[lane].flags.tilt_align;
+			const bool vel_check_pass = (ratio[0][lane] <= 1.0f) && (ratio[1][lane] <= 1.0f) && (ratio[2][lane] <= 1.0f);
+			const bool pos_check_pass = ((ratio[3][lane] <= 1.0f) && (ratio[4][lane] <= 1.0f)) || !tilt_align;
+			const bool hgt_check_pass = (ratio[5][lane] <= 1.0f) || !tilt_align;
+			innov_check_pass_map[2][lane] = innov_check_pass_map[1][lane] = innov_check_pass_map[0][lane] = vel_check_pass;
+			innov_check_pass_map[4][lane] = innov_check_pass_map[3][lane] = pos_check_pass;
+			innov_check_pass_map[5][lane] = hgt_check_pass;
+
+			innovation_fault_status_u &status = blk.innov_check_fail_status[lane];
+
+			if (vel_check_pass && (fuse_map[0][lane] || fuse_map[1][lane])) {
+				status.flags.reject_vel_NED = false;
+
+			} else if (!vel_check_pass) {
+				status.flags.reject_vel_NED = true;
+			}
+
+			if (pos_check_pass && (fuse_map[3][lane] || fuse_map[4][lane])) {
+				status.flags.reject_pos_NE = false;
+
+			} else if (!pos_check_pass) {
+				status.flags.reject_pos_NE = true;
+			}
+
+			if (hgt_check_pass && fuse_map[5][lane]) {
+				status.flags.reject_pos_D = false;
+
+			} else if (!hgt_check_pass) {
+				status.flags.reject_pos_D = true;
+			}
+		}
+
+		bool fused_any[lane_width] = {};
+
+		for (unsigned obs_index = 0; obs_index < 6; obs_index++) {
+			// skip fusion for instances where it is not requested or the checks have failed
+			bool active[lane_width] = {};
+			bool any_active = false;
+
+			for (unsigned lane = 0; lane < count; lane++) {
+				active[lane] = fuse_map[obs_index][lane] && innov_check_pass_map[obs_index][lane];
+				any_active |= active[lane];
+			}
+
+			if (!any_active) {
+				continue;
+			}
+
+			bool healthy[lane_width];
+			fuseDirect(blk, obs_index + 4, blk.vel_pos_innov[obs_index], blk.vel_pos_innov_var[obs_index], active, healthy);
+
+			for (unsigned lane = 0; lane < count; lane++) {
+				if (!active[lane]) {
+					continue;
+				}
+
+				fault_status_u &fault = blk.fault_status[lane];
+
+				if (obs_index == 0) {
+					fault.flags.bad_vel_N = !healthy[lane];
+
+				} else if (obs_index == 1) {
+					fault.flags.bad_vel_E = !healthy[lane];
+
+				} else if (obs_index == 2) {
+					fault.flags.bad_vel_D = !healthy[lane];
+
+				} else if (obs_index == 3) {
+					fault.flags.bad_pos_N = !healthy[lane];
+
+				} else if (obs_index == 4) {
+					fault.flags.bad_pos_E = !healthy[lane];
+
+				} else {
+					fault.flags.bad_pos_D = !healthy[lane];
+				}
+
+				fused_any[lane] |= healthy[lane];
+			}
+		}
+
+		// correct the covariance matrix for gross errors once for all of the fused observations
+		for (unsigned lane = 0; lane < count; lane++) {
+			if (!fused_any[lane]) {
+				continue;
+			}
+
+			uint32_t touched = blk.cov_touched_states[lane];
+			blk.cov_touched_states[lane] = 0;
+
+			for (uint8_t i = 0; touched != 0; i++, touched >>= 1) {
+				if (touched & 1UL) {
+					constrainStateVariance(blk, lane, i);
+				}
+			}
+		}
+	}
+}
+
+void EkfBatch::fuseDirect(block &blk, uint8_t state_index, const lane_f &innov, const lane_f &innov_var,
+			  const bool *active, bool *healthy)
+{
+	SymmetricMatrix<lane_f, _k_num_states> &P = blk.P;
+
+	// H*P is the row of P for the observed state, which is copied because P is updated in place
+	lane_f HP[_k_num_states];
+	lane_f K[_k_num_states];
+	const lane_f innov_var_inv = 1.0f / innov_var;
+
+	for (uint8_t column = 0; column < _k_num_states; column++) {
+		HP[column] = P(state_index, column);
+		K[column] = HP[column] * innov_var_inv;
+	}
+
+	// if the covariance correction will result in a negative variance, then
+	// the covariance marix is unhealthy and must be corrected
+	for (unsigned lane = 0; lane < lane_width; lane++) {
+		healthy[lane] = true;
+	}
+
+	for (uint8_t i = 0; i < _k_num_states; i++) {
+		for (unsigned lane = 0; lane < lane_width; lane++) {
+			if (active[lane] && P(i, i)[lane] < K[i][lane] * HP[i][lane]) {
+				zeroRowCol(P, lane, i);
+				healthy[lane] = false;
+			}
+		}
+	}
+
+	// the gains of the instances that are not updated are set to zero so the correction is applied to all lanes
+	bool apply[lane_width];
+	lane_f K_apply[_k_num_states];
+
+	for (unsigned lane = 0; lane < lane_width; lane++) {
+		apply[lane] = active[lane] && healthy[lane];
+
+		for (uint8_t i = 0; i < _k_num_states; i++) {
+			K_apply[i][lane] = apply[lane] ? K[i][lane] : 0.0f;
+		}
+	}
+
+	// apply the covariance corrections to the upper triangle of the symmetric covariance matrix
+	P.subtractUpperProduct<lane_acc>(K_apply, HP);
+
+	for (unsigned lane = 0; lane < lane_width; lane++) {
+		if (!apply[lane]) {
+			continue;
+		}
+
+		// record the states whose variances were changed
+		for (uint8_t i = 0; i < _k_num_states; i++) {
+			if (K[i][lane] != 0.0f) {
+				blk.cov_touched_states[lane] |= (1UL << i);
+			}
+		}
+
+		// apply the state corrections, see Ekf::fuse()
+		Quaternion quat;
+
+		for (unsigned i = 0; i < 4; i++) {
+			quat(i) = blk.state[i][lane] - K[i][lane] * innov[lane];
+		}
+
+		quat.normalize();
+
+		for (unsigned i = 0; i < 4; i++) {
+			blk.state[i][lane] = quat(i);
+		}
+
+		for (uint8_t i = 4; i < _k_num_states; i++) {
+			blk.state[i][lane] = blk.state[i][lane] - K[i][lane] * innov[lane];
+		}
+	}
+}
+
+void EkfBatch::get_state_delayed(unsigned index, float *state) const
+{
+	const block &blk = _blocks[index / lane_width];
+	const unsigned lane = index % lane_width;
+
+	for (unsigned i = 0; i < _k_state_vector_length; i++) {
+		state[i] = blk.state[i][lane];
+	}
+}
+
+void EkfBatch::get_covariances(unsigned index, float *covariances) const
+{
+	const block &blk = _blocks[index / lane_width];
+	const unsigned lane = index % lane_width;
+
+	for (uint8_t i = 0; i < _k_num_states; i++) {
+		covariances[i] = blk.P(i, i)[lane];
+	}
+}
+
+void EkfBatch::get_covariance_matrix(unsigned index, float *covariance) const
+{
+	const block &blk = _blocks[index / lane_width];
+	const unsigned lane = index % lane_width;
+
+	for (uint8_t row = 0; row < _k_num_states; row++) {
+		for (uint8_t column = 0; column < _k_num_states; column++) {
+			covariance[row * _k_num_states + column] = blk.P(row, column)[lane];
+		}
+	}
+}
+
+void EkfBatch::get_vel_pos_innov(unsigned index, float vel_pos_innov[6]) const
+{
+	const block &blk = _blocks[index / lane_width];
+
+	for (unsigned i = 0; i < 6; i++) {
+		vel_pos_innov[i] = blk.vel_pos_innov[i][index % lane_width];
+	}
+}
+
+void EkfBatch::get_vel_pos_innov_var(unsigned index, float vel_pos_innov_var[6]) const
+{
+	const block &blk = _blocks[index / lane_width];
+
+	for (unsigned i = 0; i < 6; i++) {
+		vel_pos_innov_var[i] = blk.vel_pos_innov_var[i][index % lane_width];
+	}
+}
+
+void EkfBatch::get_filter_fault_status(unsigned index, uint16_t *val) const
+{
+	*val = _blocks[index / lane_width].fault_status[index % lane_width].value;
+}
+
+void EkfBatch::get_innovation_check_status(unsigned index, uint16_t *val) const
+{
+	*val = _blocks[index / lane_width].innov_check_fail_status[index % lane_width].value;
+}
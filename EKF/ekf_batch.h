@@ -0,0 +1,191 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file ekf_batch.h
+ * State and covariance prediction and direct velocity and position fusion for many ekf instances in one pass.
+ *
+ * The instances are stored in blocks of lane_width instances with one BatchLane for each state and covariance
+ * element, so the values of an element for all instances of a block are contiguous and each operation of the
+ * covariance prediction and fusion is applied to the whole block. The covariance prediction uses the same auto
+ * coded equations as Ekf and the state prediction and fusion use the same order of operations, so an instance
+ * copied from an Ekf follows that Ekf exactly when given the same data.
+ *
+ * There are no sensor buffers or aiding source selection. The data is expected at the fusion time horizon and
+ * the magnetic field, wind and tilt alignment status and the earth rotation rate of each instance are kept from
+ * the Ekf it was copied from, which suits large scale simulation where many vehicles or parameter sets are
+ * propagated with known aiding.
+ * Accelerometer bias learning inhibition and the covariance health checks run for each instance as in Ekf.
+ *
+ */
+
+#pragma once
+
+#include "ekf.h"
+#include "BatchLane.h"
+
+// number of instances in a block that are processed together
+#ifndef ECL_EKF_BATCH_WIDTH
+#define ECL_EKF_BATCH_WIDTH 8
+#endif
+
+// IMU data for all instances of a batch, each array has one entry per instance
+struct ekf_batch_imu {
+	uint64_t time_us;		// timestamp of the measurement (uSec)
+	const float *delta_ang[3];	// delta angle in body frame (integrated gyro measurements) (rad)
+	const float *delta_vel[3];	// delta velocity in body frame (integrated accelerometer measurements) (m/sec)
+	const float *delta_ang_dt;	// delta angle integration period (sec)
+	const float *delta_vel_dt;	// delta velocity integration period (sec)
+};
+
+// velocity and position observations for all instances of a batch, each array has one entry per instance
+// the observations are in the order VN, VE, VD (m/sec), PN, PE, PD (m) with height as a negative down position
+struct ekf_batch_vel_pos {
+	const float *obs[6];		// observations, nullptr if not observed by any instance
+	const float *obs_var[6];	// observation variances, required for each observation that is not nullptr
+	const uint8_t *fuse_mask;	// bit n is set if observation n is valid for the instance, nullptr if all are valid
+	float gate[3];			// velocity, horizontal position and height innovation gates (STD)
+};
+
+class EkfBatch
+{
+public:
+	static const unsigned lane_width = ECL_EKF_BATCH_WIDTH;
+
+	EkfBatch() = default;
+	~EkfBatch() { delete[] _blocks; }
+
+	EkfBatch(const EkfBatch &) = delete;
+	EkfBatch &operator=(const EkfBatch &) = delete;
+
+	// allocate the storage for a number of instances and set default states
+	// returns false if the storage could not be allocated
+	bool allocate(unsigned num_instances);
+
+	// return the number of instances
+	unsigned get_num_instances() const { return _num_instances; }
+
+	// set the parameters used by all instances
+	void setParameters(const parameters &params);
+
+	// copy the states, covariance matrix and status of an ekf to an instance
+	void set_instance(unsigned index, const Ekf &ekf);
+
+	// predict the states and covariance matrices of all instances using one IMU sample each
+	void predict(const ekf_batch_imu &imu);
+
+	// fuse velocity and position observations, the innovation consistency checks and the sequential fusion
+	// order are those of Ekf::fuseVelPosHeight()
+	void fuseVelPos(const ekf_batch_vel_pos &obs);
+
+	// state vector of an instance in the order of Ekf::get_state_delayed()
+	void get_state_delayed(unsigned index, float *state) const;
+
+	// diagonal elements and complete row major covariance matrix of an instance
+	void get_covariances(unsigned index, float *covariances) const;
+	void get_covariance_matrix(unsigned index, float *covariance) const;
+
+	// velocity and position innovations and innovation variances of the last fusion of an instance
+	void get_vel_pos_innov(unsigned index, float vel_pos_innov[6]) const;
+	void get_vel_pos_innov_var(unsigned index, float vel_pos_innov_var[6]) const;
+
+	// fault and innovation check status of an instance, see fault_status_u and innovation_fault_status_u
+	void get_filter_fault_status(unsigned index, uint16_t *val) const;
+	void get_innovation_check_status(unsigned index, uint16_t *val) const;
+
+	// number of states in the covariance matrix
+	static unsigned get_num_states() { return _k_num_states; }
+
+private:
+	static const uint8_t _k_num_states = Ekf::_k_num_states;
+	static const uint8_t _k_state_vector_length = 24;	// length of the state vector returned by get_state_delayed()
+
+	typedef BatchLane<float, lane_width> lane_f;
+	typedef BatchLane<cov_accum_t, lane_width> lane_acc;
+
+	// states and status of lane_width instances
+	struct block {
+		lane_f state[_k_state_vector_length];		// state vector, see get_state_delayed()
+		SymmetricMatrix<lane_f, _k_num_states> P;	// state covariance matrix
+		lane_f R_to_earth[3][3];			// transformation matrix from body frame to earth frame from the last prediction
+		lane_f earth_rate_NED[3];			// earth rotation vector (NED) in rad/s
+		lane_f dt_ekf_avg;				// average update rate of the ekf (sec)
+		lane_f ang_rate_mag_filt;			// angular rate magnitude after application of a decaying envelope filter (rad/sec)
+		lane_f accel_mag_filt;				// acceleration magnitude after application of a decaying envelope filter (rad/sec)
+		lane_f prev_dvel_bias_var[3];			// saved delta velocity XYZ bias variances (m/sec)**2
+		lane_f vel_pos_innov[6];			// innovations: 0-2 vel,  3-5 pos
+		lane_f vel_pos_innov_var[6];			// innovation variances: 0-2 vel, 3-5 pos
+		lane_f vel_pos_test_ratio[6];			// velocity and position innovation consistency check ratios
+		uint64_t time_acc_bias_check[lane_width];	// last time the  accel bias check passed (usec)
+		uint32_t cov_touched_states[lane_width];	// bit mask of the states whose variances were changed by fusion
+		bool accel_bias_inhibit[lane_width];		// true when the accel bias learning is being inhibited
+		bool bad_vert_accel_detected[lane_width];	// true when bad vertical accelerometer data has been detected
+		filter_control_status_u control_status[lane_width];
+		filter_control_status_u control_status_prev[lane_width];
+		fault_status_u fault_status[lane_width];
+		innovation_fault_status_u innov_check_fail_status[lane_width];
+	};
+
+	parameters _params{};
+	block *_blocks{nullptr};
+	unsigned _num_blocks{0};
+	unsigned _num_instances{0};
+	uint64_t _time_last_imu{0};	// timestamp of the last IMU sample (uSec)
+
+	SymmetricMatrix<lane_f, _k_num_states> _nextP;	// predicted covariance matrix of the block being predicted
+
+	// set the default states and status of a block
+	void resetBlock(block &blk);
+
+	// number of instances in a block that hold data
+	unsigned blockCount(unsigned block_index) const;
+
+	void predictState(block &blk, const lane_f (&delta_ang)[3], const lane_f (&delta_vel)[3], const lane_f &delta_ang_dt,
+			  const lane_f &delta_vel_dt);
+	void predictCovariance(block &blk, const lane_f (&delta_ang)[3], const lane_f (&delta_vel)[3], const lane_f &delta_ang_dt);
+
+	// Ekf::fixCovarianceErrors() for one instance of a block
+	void fixCovarianceErrors(block &blk, unsigned lane);
+
+	// Ekf::constrainStateVariance() for one instance of a block
+	void constrainStateVariance(block &blk, unsigned lane, uint8_t index);
+
+	// fuse a direct observation of a state with the innovation and innovation variance of each instance
+	// Kalman gain and covariance update of Ekf::updateCovarianceDirect() and state update of Ekf::fuse() for the
+	// instances with active set, returns the health of the covariance update for each instance in healthy
+	void fuseDirect(block &blk, uint8_t state_index, const lane_f &innov, const lane_f &innov_var, const bool *active,
+			bool *healthy);
+
+	// zero row and column index of the covariance matrix of one instance of a block
+	static void zeroRowCol(SymmetricMatrix<lane_f, _k_num_states> &P, unsigned lane, uint8_t index);
+};
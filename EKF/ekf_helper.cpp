@@ -39,10 +39,15 @@
  *
  */
 
+#include "../ecl.h"
 #include "ekf.h"
 #include "mathlib.h"
 #include <cstdlib>
 
+#ifdef ECL_EKF_TIMING
+#include <chrono>
+#endif
+
 // Reset the velocity states. If we have a recent and valid
 // gps measurement then use for velocity initialisation
 bool Ekf::resetVelocity()
@@ -64,19 +69,9 @@ bool Ekf::resetVelocity()
 	}
 
 	// calculate the change in velocity and apply to the output predictor state history
+	// and to our newest velocity estimate which was already taken out from the output buffer
 	Vector3f velocity_change = _state.vel - vel_before_reset;
-	outputSample output_states;
-	unsigned max_index = _output_buffer.get_length() - 1;
-	for (unsigned index=0; index <= max_index; index++) {
-		output_states = _output_buffer.get_from_index(index);
-		output_states.vel += velocity_change;
-		_output_buffer.push_to_index(index,output_states);
-
-	}
-
-	// apply the change in velocity to our newest velocity estimate
-	// which was already taken out from the output buffer
-	_output_new.vel += velocity_change;
+	correctOutputHistory(velocity_change, Vector3f());
 
 	// capture the reset event
 	_state_reset_status.velNE_change(0) = velocity_change(0);
@@ -119,19 +114,12 @@ bool Ekf::resetPosition()
 	Vector2f posNE_change;
 	posNE_change(0) = _state.pos(0) - posNE_before_reset(0);
 	posNE_change(1) = _state.pos(1) - posNE_before_reset(1);
-	outputSample output_states;
-	unsigned max_index = _output_buffer.get_length() - 1;
-	for (unsigned index=0; index <= max_index; index++) {
-		output_states = _output_buffer.get_from_index(index);
-		output_states.pos(0) += posNE_change(0);
-		output_states.pos(1) += posNE_change(1);
-		_output_buffer.push_to_index(index,output_states);
-	}
 
-	// apply the change in position to our newest position estimate
-	// which was already taken out from the output buffer
-	_output_new.pos(0) += posNE_change(0);
-	_output_new.pos(1) += posNE_change(1);
+	// and to our newest position estimate which was already taken out from the output buffer
+	Vector3f pos_change;
+	pos_change(0) = posNE_change(0);
+	pos_change(1) = posNE_change(1);
+	correctOutputHistory(Vector3f(), pos_change);
 
 	// capture the reset event
 	_state_reset_status.posNE_change = posNE_change;
@@ -144,7 +132,7 @@ bool Ekf::resetPosition()
 void Ekf::resetHeight()
 {
 	// Get the most recent GPS data
-	gpsSample gps_newest = _gps_buffer.get_newest();
+	const gpsSample &gps_newest = _gps_buffer.get_newest();
 
 	// store the current vertical position and velocity for reference so we can calculate and publish the reset amount
 	float old_vert_pos = _state.pos(2);
@@ -154,7 +142,7 @@ void Ekf::resetHeight()
 
 	// reset the vertical position
 	if (_control_status.flags.rng_hgt) {
-		rangeSample range_newest = _range_buffer.get_newest();
+		const rangeSample &range_newest = _range_buffer.get_newest();
 
 		if (_time_last_imu - range_newest.time_us < 2 * RNG_MAX_INTERVAL) {
 			// calculate the new vertical position using range sensor
@@ -164,8 +152,7 @@ void Ekf::resetHeight()
 			_state.pos(2) = new_pos_down;
 
 			// reset the associated covariance values
-			zeroRows(P, 9, 9);
-			zeroCols(P, 9, 9);
+			P.zeroRowsCols(9, 9);
 
 			// the state variance is the same as the observation
 			P[9][9] = sq(_params.range_noise);
@@ -173,7 +160,7 @@ void Ekf::resetHeight()
 			vert_pos_reset = true;
 
 			// reset the baro offset which is subtracted from the baro reading if we need to use it as a backup
-			baroSample baro_newest = _baro_buffer.get_newest();
+			const baroSample &baro_newest = _baro_buffer.get_newest();
 			_baro_hgt_offset = baro_newest.hgt + _state.pos(2);
 
 		} else {
@@ -183,14 +170,13 @@ void Ekf::resetHeight()
 
 	} else if (_control_status.flags.baro_hgt) {
 		// initialize vertical position with newest baro measurement
-		baroSample baro_newest = _baro_buffer.get_newest();
+		const baroSample &baro_newest = _baro_buffer.get_newest();
 
 		if (_time_last_imu - baro_newest.time_us < 2 * BARO_MAX_INTERVAL) {
 			_state.pos(2) = _hgt_sensor_offset - baro_newest.hgt + _baro_hgt_offset;
 
 			// reset the associated covariance values
-			zeroRows(P, 9, 9);
-			zeroCols(P, 9, 9);
+			P.zeroRowsCols(9, 9);
 
 			// the state variance is the same as the observation
 			P[9][9] = sq(_params.baro_noise);
@@ -207,8 +193,7 @@ void Ekf::resetHeight()
 			_state.pos(2) = _hgt_sensor_offset - gps_newest.hgt + _gps_alt_ref;
 
 			// reset the associated covarince values
-			zeroRows(P, 9, 9);
-			zeroCols(P, 9, 9);
+			P.zeroRowsCols(9, 9);
 
 			// the state variance is the same as the observation
 			P[9][9] = sq(gps_newest.hacc);
@@ -216,7 +201,7 @@ void Ekf::resetHeight()
 			vert_pos_reset = true;
 
 			// reset the baro offset which is subtracted from the baro reading if we need to use it as a backup
-			baroSample baro_newest = _baro_buffer.get_newest();
+			const baroSample &baro_newest = _baro_buffer.get_newest();
 			_baro_hgt_offset = baro_newest.hgt + _state.pos(2);
 
 		} else {
@@ -225,7 +210,7 @@ void Ekf::resetHeight()
 
 	} else if (_control_status.flags.ev_hgt) {
 		// initialize vertical position with newest measurement
-		extVisionSample ev_newest = _ext_vision_buffer.get_newest();
+		const extVisionSample &ev_newest = _ext_vision_buffer.get_newest();
 
 		// use the most recent data if it's time offset from the fusion time horizon is smaller
 		int32_t dt_newest = ev_newest.time_us - _imu_sample_delayed.time_us;
@@ -239,8 +224,7 @@ void Ekf::resetHeight()
 	}
 
 	// reset the vertical velocity covariance values
-	zeroRows(P, 6, 6);
-	zeroCols(P, 6, 6);
+	P.zeroRowsCols(6, 6);
 
 	// reset the vertical velocity state
 	if (_control_status.flags.gps && (_time_last_imu - gps_newest.time_us < 2 * GPS_MAX_INTERVAL)) {
@@ -272,33 +256,20 @@ void Ekf::resetHeight()
 		_state_reset_status.velD_counter++;
 	}
 
-	// apply the change in height / height rate to our newest height / height rate estimate
-	// which have already been taken out from the output buffer
+	// add the reset amount to the output observer buffered data and to our newest height / height rate
+	// estimate which have already been taken out from the output buffer
+	Vector3f vel_change;
+	Vector3f pos_change;
+
 	if (vert_pos_reset) {
-		_output_new.pos(2) += _state_reset_status.posD_change;
+		pos_change(2) = _state_reset_status.posD_change;
 	}
 
 	if (vert_vel_reset) {
-		_output_new.vel(2) += _state_reset_status.velD_change;
+		vel_change(2) = _state_reset_status.velD_change;
 	}
 
-	// add the reset amount to the output observer buffered data
-	outputSample output_states;
-	unsigned output_length = _output_buffer.get_length();
-	for (unsigned i=0; i < output_length; i++) {
-		output_states = _output_buffer.get_from_index(i);
-
-		if (vert_pos_reset) {
-			output_states.pos(2) += _state_reset_status.posD_change;
-		}
-
-		if (vert_vel_reset) {
-			output_states.vel(2) += _state_reset_status.velD_change;
-		}
-
-		_output_buffer.push_to_index(i,output_states);
-
-	}
+	correctOutputHistory(vel_change, pos_change);
 }
 
 // align output filter states to match EKF states at the fusion time horizon
@@ -313,17 +284,14 @@ void Ekf::alignOutputFilter()
 	Vector3f vel_delta = _state.vel - _output_sample_delayed.vel;
 	Vector3f pos_delta = _state.pos - _output_sample_delayed.pos;
 
-	// loop through the output filter state history and add the deltas
-	outputSample output_states;
-	unsigned output_length = _output_buffer.get_length();
-	for (unsigned i=0; i < output_length; i++) {
-		output_states = _output_buffer.get_from_index(i);
-		output_states.quat_nominal *= q_delta;
-		output_states.quat_nominal.normalize();
-		output_states.vel += vel_delta;
-		output_states.pos += pos_delta;
-		_output_buffer.push_to_index(i,output_states);
-	}
+	// add the deltas to the output filter state history
+	_output_quat_offset = _output_quat_offset * q_delta;
+	_output_quat_offset.normalize();
+	_output_vel_offset += vel_delta;
+	_output_pos_offset += pos_delta;
+
+	// signal the alignment to any decoupled output predictor
+	_output_align_counter++;
 }
 
 // Reset heading and magnetic field states
@@ -337,7 +305,7 @@ bool Ekf::resetMagHeading(Vector3f &mag_init)
 	Vector3f angle_err_var_vec = calcRotVecVariances();
 
 	// update transformation matrix from body to world frame using the current estimate
-	_R_to_earth = quat_to_invrotmat(_state.quat_nominal);
+	_R_to_earth = stateToEarth();
 
 	// calculate the initial quaternion
 	// determine if a 321 or 312 Euler sequence is best
@@ -438,7 +406,7 @@ bool Ekf::resetMagHeading(Vector3f &mag_init)
 	}
 
 	// update transformation matrix from body to world frame using the current estimate
-	_R_to_earth = quat_to_invrotmat(_state.quat_nominal);
+	_R_to_earth = stateToEarth();
 
 	// update the yaw angle variance using the variance of the measurement
 	if (_params.fusion_mode & MASK_USE_EVYAW) {
@@ -455,29 +423,21 @@ bool Ekf::resetMagHeading(Vector3f &mag_init)
 	// calculate initial earth magnetic field states
 	_state.mag_I = _R_to_earth * mag_init;
 
+#ifndef ECL_EKF_NO_MAG_STATES
 	// reset the corresponding rows and columns in the covariance matrix and set the variances on the magnetic field states to the measurement variance
-	zeroRows(P, 16, 21);
-	zeroCols(P, 16, 21);
+	P.zeroRowsCols(16, 21);
 
 	for (uint8_t index = 16; index <= 21; index ++) {
 		P[index][index] = sq(_params.mag_noise);
 	}
+#endif
 
 	// calculate the amount that the quaternion has changed by
 	_state_reset_status.quat_change = _state.quat_nominal * quat_before_reset.inversed();
 
-	// add the reset amount to the output observer buffered data
-	outputSample output_states;
-	unsigned output_length = _output_buffer.get_length();
-	for (unsigned i=0; i < output_length; i++) {
-		output_states = _output_buffer.get_from_index(i);
-		output_states.quat_nominal *= _state_reset_status.quat_change;
-		_output_buffer.push_to_index(i,output_states);
-	}
-
-	// apply the change in attitude quaternion to our newest quaternion estimate
+	// add the reset amount to the output observer buffered data and to our newest quaternion estimate
 	// which was already taken out from the output buffer
-	_output_new.quat_nominal *= _state_reset_status.quat_change;
+	rotateOutputHistory(_state_reset_status.quat_change);
 
 	// capture the reset event
 	_state_reset_status.quat_counter++;
@@ -508,14 +468,14 @@ void Ekf::calcMagDeclination()
 }
 
 // This function forces the covariance matrix to be symmetric
-void Ekf::makeSymmetrical(float (&cov_mat)[_k_num_states][_k_num_states], uint8_t first, uint8_t last)
+void Ekf::copyUpperCovarianceBlock(const float (&cov_mat)[_k_num_states][_k_num_states], uint8_t first, uint8_t last)
 {
-	for (unsigned row = first; row <= last; row++) {
-		for (unsigned column = 0; column < row; column++) {
-			float tmp = (cov_mat[row][column] + cov_mat[column][row]) / 2;
-			cov_mat[row][column] = tmp;
-			cov_mat[column][row] = tmp;
+	for (unsigned column = first; column <= last; column++) {
+		for (unsigned row = 0; row < column; row++) {
+			P[row][column] = cov_mat[row][column];
 		}
+
+		P[column][column] = cov_mat[column][column];
 	}
 }
 
@@ -562,74 +522,6 @@ void Ekf::calcEarthRateNED(Vector3f &omega, double lat_rad) const
 	omega(2) = -_k_earth_rate * sinf((float)lat_rad);
 }
 
-// gets the innovations of velocity and position measurements
-// 0-2 vel, 3-5 pos
-void Ekf::get_vel_pos_innov(float vel_pos_innov[6])
-{
-	memcpy(vel_pos_innov, _vel_pos_innov, sizeof(float) * 6);
-}
-
-// writes the innovations of the earth magnetic field measurements
-void Ekf::get_mag_innov(float mag_innov[3])
-{
-	memcpy(mag_innov, _mag_innov, 3 * sizeof(float));
-}
-
-// gets the innovations of the airspeed measnurement
-void Ekf::get_airspeed_innov(float *airspeed_innov)
-{
-	memcpy(airspeed_innov,&_airspeed_innov, sizeof(float));
-}
-
-// gets the innovations of the synthetic sideslip measurements
-void Ekf::get_beta_innov(float *beta_innov)
-{
-	memcpy(beta_innov,&_beta_innov, sizeof(float));
-}
-
-// gets the innovations of the heading measurement
-void Ekf::get_heading_innov(float *heading_innov)
-{
-	memcpy(heading_innov, &_heading_innov, sizeof(float));
-}
-
-// gets the innovation variances of velocity and position measurements
-// 0-2 vel, 3-5 pos
-void Ekf::get_vel_pos_innov_var(float vel_pos_innov_var[6])
-{
-	memcpy(vel_pos_innov_var, _vel_pos_innov_var, sizeof(float) * 6);
-}
-
-// gets the innovation variances of the earth magnetic field measurements
-void Ekf::get_mag_innov_var(float mag_innov_var[3])
-{
-	memcpy(mag_innov_var, _mag_innov_var, sizeof(float) * 3);
-}
-
-// gest the innovation variance of the airspeed measurement
-void Ekf::get_airspeed_innov_var(float *airspeed_innov_var)
-{
-	memcpy(airspeed_innov_var, &_airspeed_innov_var, sizeof(float));
-}
-
-// gets the innovation variance of the synthetic sideslip measurement
-void Ekf::get_beta_innov_var(float *beta_innov_var)
-{
-	memcpy(beta_innov_var, &_beta_innov_var, sizeof(float));
-}
-
-// gets the innovation variance of the heading measurement
-void Ekf::get_heading_innov_var(float *heading_innov_var)
-{
-	memcpy(heading_innov_var, &_heading_innov_var, sizeof(float));
-}
-
-// get GPS check status
-void Ekf::get_gps_check_status(uint16_t *val)
-{
-	*val = _gps_check_fail_status.value;
-}
-
 // get the state vector at the delayed time horizon
 void Ekf::get_state_delayed(float *state)
 {
@@ -694,6 +586,50 @@ void Ekf::get_covariances(float *covariances)
 	}
 }
 
+// get the complete covariance matrix
+void Ekf::get_covariance_matrix(float *covariance)
+{
+	for (unsigned row = 0; row < _k_num_states; row++) {
+		for (unsigned column = 0; column < _k_num_states; column++) {
+			covariance[row * _k_num_states + column] = P[row][column];
+		}
+	}
+}
+
+bool Ekf::get_memory_footprint(const parameters &params, ekf_memory_footprint *footprint)
+{
+	uint8_t imu_length;
+	uint8_t obs_length;
+	// the buffers are largest at the shortest prediction period
+	const bool supported = calculate_buffer_lengths(params, minFilterUpdatePeriod(params), &imu_length, &obs_length);
+
+	footprint->static_bytes = sizeof(Ekf);
+	footprint->heap_bytes = RingBuffer<imuSample, BUFFER_MAX_LENGTH>::heap_bytes(imu_length)
+				+ RingBuffer<outputSample, BUFFER_MAX_LENGTH>::heap_bytes(imu_length)
+				+ RingBuffer<gpsSample, BUFFER_MAX_LENGTH>::heap_bytes(obs_length)
+				+ RingBuffer<magSample, BUFFER_MAX_LENGTH>::heap_bytes(obs_length)
+				+ RingBuffer<baroSample, BUFFER_MAX_LENGTH>::heap_bytes(obs_length)
+				+ RingBuffer<rangeSample, BUFFER_MAX_LENGTH>::heap_bytes(obs_length)
+				+ RingBuffer<airspeedSample, BUFFER_MAX_LENGTH>::heap_bytes(obs_length)
+				+ RingBuffer<flowSample, BUFFER_MAX_LENGTH>::heap_bytes(obs_length)
+				+ RingBuffer<extVisionSample, BUFFER_MAX_LENGTH>::heap_bytes(obs_length)
+				+ RingBuffer<dragSample, BUFFER_MAX_LENGTH>::heap_bytes(obs_length);
+	footprint->imu_buffer_length = imu_length;
+	footprint->obs_buffer_length = obs_length;
+
+	return supported;
+}
+
+void Ekf::callPredictionHook()
+{
+	// the copies are made here so that update() does not hold this stack space while the prediction and fusion steps run
+	float state[24];
+	float covariance[_k_num_states * _k_num_states];
+	get_state_delayed(state);
+	get_covariance_matrix(covariance);
+	_prediction_hook->predicted(_imu_sample_delayed, state, covariance, _k_num_states);
+}
+
 // get the position and height of the ekf origin in WGS-84 coordinates and time the origin was set
 // return true if the origin is valid
 bool Ekf::get_ekf_origin(uint64_t *origin_time, map_projection_reference_s *origin_pos, float *origin_alt)
@@ -704,11 +640,87 @@ bool Ekf::get_ekf_origin(uint64_t *origin_time, map_projection_reference_s *orig
 	return _NED_origin_initialised;
 }
 
-// return an array containing the output predictor angular, velocity and position tracking
-// error magnitudes (rad), (m/s), (m)
-void Ekf::get_output_tracking_error(float error[3])
+// get the EKF states on the delayed fusion time horizon to correct an OutputPredictor running on a separate thread
+bool Ekf::get_output_correction(outputCorrection *correction)
 {
-	memcpy(error, _output_tracking_error, 3 * sizeof(float));
+	if (!(_control_status.flags.tilt_align && _control_status.flags.yaw_align)
+	    || _imu_sample_delayed.time_us == _time_last_output_correction) {
+		return false;
+	}
+
+	_time_last_output_correction = _imu_sample_delayed.time_us;
+
+	correction->quat_nominal = _state.quat_nominal;
+	correction->vel = _state.vel;
+	correction->pos = _state.pos;
+	correction->gyro_bias = _state.gyro_bias;
+	correction->accel_bias = _state.accel_bias;
+	correction->dt_ekf_avg = _dt_ekf_avg;
+	correction->vel_Tau = _params.vel_Tau;
+	correction->pos_Tau = _params.pos_Tau;
+	correction->imu_pos_body = _params.imu_pos_body;
+	correction->reset_status = _state_reset_status;
+	correction->align_counter = _output_align_counter;
+	correction->time_us = _imu_sample_delayed.time_us;
+
+	return true;
+}
+
+void Ekf::publishSnapshot()
+{
+	estimatorSnapshot snapshot{};
+
+	snapshot.time_us = _time_last_imu;
+	snapshot.time_delayed_us = _imu_sample_delayed.time_us;
+	copy_quaternion(snapshot.quat);
+	get_velocity(snapshot.vel);
+	get_position(snapshot.pos);
+	get_state_delayed(snapshot.states);
+	get_covariances(snapshot.covariances);
+	get_gyro_bias(snapshot.gyro_bias);
+	get_accel_bias(snapshot.accel_bias);
+
+	memcpy(snapshot.vel_pos_innov, _vel_pos_innov, sizeof(snapshot.vel_pos_innov));
+	memcpy(snapshot.vel_pos_innov_var, _vel_pos_innov_var, sizeof(snapshot.vel_pos_innov_var));
+	memcpy(snapshot.mag_innov, _mag_innov, sizeof(snapshot.mag_innov));
+	memcpy(snapshot.mag_innov_var, _mag_innov_var, sizeof(snapshot.mag_innov_var));
+	snapshot.heading_innov = _heading_innov;
+	snapshot.heading_innov_var = _heading_innov_var;
+	snapshot.airspeed_innov = _airspeed_innov;
+	snapshot.airspeed_innov_var = _airspeed_innov_var;
+	snapshot.beta_innov = _beta_innov;
+	snapshot.beta_innov_var = _beta_innov_var;
+	memcpy(snapshot.flow_innov, _flow_innov, sizeof(snapshot.flow_innov));
+	memcpy(snapshot.flow_innov_var, _flow_innov_var, sizeof(snapshot.flow_innov_var));
+	memcpy(snapshot.drag_innov, _drag_innov, sizeof(snapshot.drag_innov));
+	memcpy(snapshot.drag_innov_var, _drag_innov_var, sizeof(snapshot.drag_innov_var));
+	snapshot.hagl_innov = _hagl_innov;
+	snapshot.hagl_innov_var = _hagl_innov_var;
+
+	get_innovation_test_status(&snapshot.innov_check_status, &snapshot.mag_test_ratio, &snapshot.vel_test_ratio,
+				   &snapshot.pos_test_ratio, &snapshot.hgt_test_ratio, &snapshot.tas_test_ratio,
+				   &snapshot.hagl_test_ratio);
+	memcpy(snapshot.output_tracking_error, _output_tracking_error, sizeof(snapshot.output_tracking_error));
+	get_imu_vibe_metrics(snapshot.vibe);
+	get_ekf_lpos_accuracy(&snapshot.pos_horiz_accuracy, &snapshot.pos_vert_accuracy, &snapshot.dead_reckoning);
+	bool vel_dead_reckoning;
+	get_ekf_vel_accuracy(&snapshot.vel_horiz_accuracy, &snapshot.vel_vert_accuracy, &vel_dead_reckoning);
+	snapshot.terrain_valid = get_terrain_vert_pos(&snapshot.terrain_vert_pos);
+
+	get_posD_reset(&snapshot.posD_reset_delta, &snapshot.posD_reset_counter);
+	get_velD_reset(&snapshot.velD_reset_delta, &snapshot.velD_reset_counter);
+	get_posNE_reset(snapshot.posNE_reset_delta, &snapshot.posNE_reset_counter);
+	get_velNE_reset(snapshot.velNE_reset_delta, &snapshot.velNE_reset_counter);
+	get_quat_reset(snapshot.quat_reset_delta, &snapshot.quat_reset_counter);
+
+	snapshot.control_mode = _control_status.value;
+	snapshot.fault_status = _fault_status.value;
+	snapshot.gps_check_status = _gps_check_fail_status.value;
+	get_ekf_soln_status(&snapshot.soln_status);
+	snapshot.local_position_valid = local_position_is_valid();
+	snapshot.global_position_valid = global_position_is_valid();
+
+	_snapshot.write(snapshot);
 }
 
 /*
@@ -722,6 +734,150 @@ void Ekf::get_imu_vibe_metrics(float vibe[3])
 	memcpy(vibe, _vibe_metrics, 3 * sizeof(float));
 }
 
+bool Ekf::get_timing_stats(ekf_timing_stats stats[EKF_TIMING_NUM_STAGES])
+{
+	memset(stats, 0, EKF_TIMING_NUM_STAGES * sizeof(ekf_timing_stats));
+
+#ifdef ECL_EKF_TIMING
+	for (unsigned stage = 0; stage < EKF_TIMING_NUM_STAGES; stage++) {
+		if (_timing[stage].count > 0) {
+			stats[stage].count = _timing[stage].count;
+			stats[stage].min_us = 1e-3f * (float)_timing[stage].min_ns;
+			stats[stage].mean_us = 1e-3f * (float)_timing[stage].total_ns / (float)_timing[stage].count;
+			stats[stage].max_us = 1e-3f * (float)_timing[stage].max_ns;
+		}
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+void Ekf::reset_timing_stats()
+{
+#ifdef ECL_EKF_TIMING
+	memset(_timing, 0, sizeof(_timing));
+#endif
+}
+
+size_t Ekf::get_flight_recorder_dump(uint8_t *buffer, size_t size)
+{
+#ifdef ECL_EKF_FLIGHT_RECORDER
+	return _flight_recorder.dump(buffer, size);
+#else
+	return 0;
+#endif
+}
+
+size_t Ekf::get_flight_recorder_size()
+{
+#ifdef ECL_EKF_FLIGHT_RECORDER
+	return _flight_recorder.dumpSize();
+#else
+	return 0;
+#endif
+}
+
+bool Ekf::flight_recorder_frozen()
+{
+#ifdef ECL_EKF_FLIGHT_RECORDER
+	return _flight_recorder.frozen();
+#else
+	return false;
+#endif
+}
+
+void Ekf::reset_flight_recorder()
+{
+#ifdef ECL_EKF_FLIGHT_RECORDER
+	_flight_recorder.reset();
+
+	// the first status record after a reset holds the current status
+	_recorded_control_status = 0;
+	_recorded_fault_status = 0;
+	_recorded_innov_fail_status = 0;
+#endif
+}
+
+void Ekf::set_flight_recorder_trigger(uint16_t fault_mask, uint16_t innov_fail_mask)
+{
+#ifdef ECL_EKF_FLIGHT_RECORDER
+	_recorder_fault_mask = fault_mask;
+	_recorder_innov_fail_mask = innov_fail_mask;
+#endif
+}
+
+#ifdef ECL_EKF_FLIGHT_RECORDER
+void Ekf::recordFilterState()
+{
+	const uint64_t time_us = _imu_sample_delayed.time_us;
+	float variance[_k_num_states];
+
+	for (unsigned index = 0; index < _k_num_states; index++) {
+		variance[index] = P[index][index];
+	}
+
+	_flight_recorder.recordCovariance(time_us, variance, _k_num_states);
+
+	if (_control_status.value != _recorded_control_status || _fault_status.value != _recorded_fault_status
+	    || _innov_check_fail_status.value != _recorded_innov_fail_status) {
+		// status bits that have become set since the last record stop the recorder
+		const uint16_t new_faults = _fault_status.value & ~_recorded_fault_status & _recorder_fault_mask;
+		const uint16_t new_innov_fails = _innov_check_fail_status.value & ~_recorded_innov_fail_status
+						 & _recorder_innov_fail_mask;
+
+		_flight_recorder.recordStatus(time_us, _control_status.value, _fault_status.value, _innov_check_fail_status.value);
+		_recorded_control_status = _control_status.value;
+		_recorded_fault_status = _fault_status.value;
+		_recorded_innov_fail_status = _innov_check_fail_status.value;
+
+		if (new_faults != 0 || new_innov_fails != 0) {
+			_flight_recorder.trigger();
+		}
+	}
+}
+#endif
+
+#ifdef ECL_EKF_TIMING
+uint64_t Ekf::timingStageStart(ekf_timing_stage stage)
+{
+	if (_timing_hook != nullptr) {
+		_timing_hook->stage_start(stage);
+	}
+
+#if defined(__PX4_POSIX) || defined(__PX4_NUTTX)
+	return ecl_absolute_time() * 1000;
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void Ekf::timingStageEnd(ekf_timing_stage stage, uint64_t start_ns)
+{
+#if defined(__PX4_POSIX) || defined(__PX4_NUTTX)
+	uint64_t elapsed_ns = ecl_absolute_time() * 1000 - start_ns;
+#else
+	uint64_t elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() - start_ns;
+#endif
+
+	if (_timing[stage].count == 0 || elapsed_ns < _timing[stage].min_ns) {
+		_timing[stage].min_ns = elapsed_ns;
+	}
+
+	if (elapsed_ns > _timing[stage].max_ns) {
+		_timing[stage].max_ns = elapsed_ns;
+	}
+
+	_timing[stage].total_ns += elapsed_ns;
+	_timing[stage].count++;
+
+	if (_timing_hook != nullptr) {
+		_timing_hook->stage_end(stage);
+	}
+}
+#endif
+
 // get the 1-sigma horizontal and vertical position uncertainty of the ekf WGS-84 position
 void Ekf::get_ekf_gpos_accuracy(float *ekf_eph, float *ekf_epv, bool *dead_reckoning)
 {
@@ -890,6 +1046,7 @@ void Ekf::fuse(float *K, float innovation)
 		_state.accel_bias(i) = _state.accel_bias(i) - K[i + 13] * innovation;
 	}
 
+#ifndef ECL_EKF_NO_MAG_STATES
 	for (unsigned i = 0; i < 3; i++) {
 		_state.mag_I(i) = _state.mag_I(i) - K[i + 16] * innovation;
 	}
@@ -897,10 +1054,86 @@ void Ekf::fuse(float *K, float innovation)
 	for (unsigned i = 0; i < 3; i++) {
 		_state.mag_B(i) = _state.mag_B(i) - K[i + 19] * innovation;
 	}
+#endif
 
+#ifndef ECL_EKF_NO_WIND_STATES
 	for (unsigned i = 0; i < 2; i++) {
 		_state.wind_vel(i) = _state.wind_vel(i) - K[i + 22] * innovation;
 	}
+#endif
+}
+
+bool Ekf::updateCovariance(const float *K, const float *H, const uint8_t *H_index, uint8_t H_length)
+{
+	// KHP = K*(H*P) is the outer product of K with the row vector HP, so calculate
+	// HP once using only the non-zero elements of H instead of forming KHP
+	float HP[_k_num_states];
+
+	for (unsigned column = 0; column < _k_num_states; column++) {
+		cov_accum_t tmp = 0.0f;
+
+		for (uint8_t i = 0; i < H_length; i++) {
+			tmp += (cov_accum_t)H[H_index[i]] * P[H_index[i]][column];
+		}
+
+		HP[column] = (float)tmp;
+	}
+
+	// if the covariance correction will result in a negative variance, then
+	// the covariance marix is unhealthy and must be corrected
+	bool healthy = true;
+
+	for (uint8_t i = 0; i < _k_num_states; i++) {
+		if (P[i][i] < K[i] * HP[i]) {
+			// zero rows and columns
+			P.zeroRowsCols(i, i);
+
+			//flag as unhealthy
+			healthy = false;
+		}
+	}
+
+	// apply the covariance corrections to the upper triangle of the symmetric covariance matrix
+	if (healthy) {
+		P.subtractUpperProduct<cov_accum_t>(K, HP);
+		markCovarianceTouched(K);
+	}
+
+	return healthy;
+}
+
+bool Ekf::updateCovarianceDirect(uint8_t state_index, float innov_var, float *K)
+{
+	// H*P is the row of P for the observed state, which is copied because P is updated in place
+	float HP[_k_num_states];
+	const float innov_var_inv = 1.0f / innov_var;
+
+	for (unsigned column = 0; column < _k_num_states; column++) {
+		HP[column] = P[state_index][column];
+		K[column] = HP[column] * innov_var_inv;
+	}
+
+	// if the covariance correction will result in a negative variance, then
+	// the covariance marix is unhealthy and must be corrected
+	bool healthy = true;
+
+	for (uint8_t i = 0; i < _k_num_states; i++) {
+		if (P[i][i] < K[i] * HP[i]) {
+			// zero rows and columns
+			P.zeroRowsCols(i, i);
+
+			//flag as unhealthy
+			healthy = false;
+		}
+	}
+
+	// apply the covariance corrections to the upper triangle of the symmetric covariance matrix
+	if (healthy) {
+		P.subtractUpperProduct<cov_accum_t>(K, HP);
+		markCovarianceTouched(K);
+	}
+
+	return healthy;
 }
 
 // zero specified range of rows in the state covariance matrix
@@ -909,7 +1142,7 @@ void Ekf::zeroRows(float (&cov_mat)[_k_num_states][_k_num_states], uint8_t first
 	uint8_t row;
 
 	for (row = first; row <= last; row++) {
-		memset(&cov_mat[row][0], 0, sizeof(cov_mat[0][0]) * 24);
+		memset(&cov_mat[row][0], 0, sizeof(cov_mat[0][0]) * _k_num_states);
 	}
 }
 
@@ -918,7 +1151,7 @@ void Ekf::zeroCols(float (&cov_mat)[_k_num_states][_k_num_states], uint8_t first
 {
 	uint8_t row;
 
-	for (row = 0; row <= 23; row++) {
+	for (row = 0; row < _k_num_states; row++) {
 		memset(&cov_mat[row][first], 0, sizeof(cov_mat[0][0]) * (1 + last - first));
 	}
 }
@@ -978,6 +1211,17 @@ Matrix3f EstimatorInterface::quat_to_invrotmat(const Quaternion& quat)
 	return dcm;
 }
 
+void Ekf::updateStateRotation()
+{
+	const Quaternion &q = _state.quat_nominal;
+
+	if (q(0) != _R_state_quat(0) || q(1) != _R_state_quat(1) || q(2) != _R_state_quat(2) || q(3) != _R_state_quat(3)) {
+		_R_state_quat = q;
+		_R_state_to_earth = quat_to_invrotmat(q);
+		_R_state_to_body = _R_state_to_earth.transpose();
+	}
+}
+
 // calculate the variances for the rotation vector equivalent
 Vector3f Ekf::calcRotVecVariances()
 {
@@ -1092,8 +1336,7 @@ void Ekf::initialiseQuatCovariances(Vector3f &rot_vec_var)
 		float t44 = t17-t36;
 
 		// zero all the quaternion covariances
-		zeroRows(P,0,3);
-		zeroCols(P,0,3);
+		P.zeroRowsCols(0, 3);
 
 		// Update the quaternion internal covariances using auto-code generated using matlab symbolic toolbox
 		P[0][0] = rot_vec_var(0)*t2*t9*t10*0.25f+rot_vec_var(1)*t4*t9*t10*0.25f+rot_vec_var(2)*t5*t9*t10*0.25f;
@@ -44,6 +44,8 @@
 #include <math.h>
 #include "../ecl.h"
 #include "estimator_interface.h"
+#include "fast_math.h"
+#include "imu_down_sampler.h"
 #include "mathlib.h"
 
 
@@ -72,8 +74,6 @@ EstimatorInterface::EstimatorInterface():
 	_gps_origin_eph(0.0f),
 	_gps_origin_epv(0.0f),
 	_pos_ref{},
-	_gps_pos_prev{},
-	_gps_alt_prev(0.0f),
 	_yaw_test_ratio(0.0f),
 	_mag_test_ratio{},
 	_vel_pos_test_ratio{},
@@ -102,20 +102,7 @@ EstimatorInterface::EstimatorInterface():
 void EstimatorInterface::setIMUData(uint64_t time_usec, uint64_t delta_ang_dt, uint64_t delta_vel_dt, float (&delta_ang)[3],
 				    float (&delta_vel)[3])
 {
-	if (!_initialised) {
-		init(time_usec);
-		_initialised = true;
-	}
-
-	float dt = (float)(time_usec - _time_last_imu) / 1000 / 1000;
-	dt = math::max(dt, 1.0e-4f);
-	dt = math::min(dt, 0.02f);
-
-	_time_last_imu = time_usec;
-
-	if (_time_last_imu > 0) {
-		_dt_imu_avg = 0.8f * _dt_imu_avg + 0.2f * dt;
-	}
+	updateIMUTiming(time_usec);
 
 	// copy data
 	imuSample imu_sample_new = {};
@@ -128,6 +115,51 @@ void EstimatorInterface::setIMUData(uint64_t time_usec, uint64_t delta_ang_dt, u
 	imu_sample_new.time_us = time_usec;
 	_imu_ticks++;
 
+	updateVibrationMetrics(imu_sample_new);
+
+	// accumulate and down-sample imu data and push to the buffer when new downsampled data becomes available
+	bool down_sampled_ready = collect_imu(imu_sample_new);
+	storeIMUSample(imu_sample_new, down_sampled_ready);
+}
+
+unsigned EstimatorInterface::setIMUData(const imuSample *imu_samples, unsigned num_samples)
+{
+	if (num_samples == 0) {
+		return 0;
+	}
+
+	if (!_initialised) {
+		init(imu_samples[0].time_us);
+		_initialised = true;
+	}
+
+	// accumulate and down-sample imu data until new downsampled data becomes available
+	imuSample imu_sample_down_sampled = {};
+	bool down_sampled_ready = false;
+	unsigned count = 0;
+	_imu_batch.reset();
+
+	while (count < num_samples && !down_sampled_ready) {
+		const imuSample &imu_sample_new = imu_samples[count++];
+		updateVibrationMetrics(imu_sample_new);
+		_imu_batch.accumulate(imu_sample_new);
+		imu_sample_down_sampled = imu_sample_new;
+		down_sampled_ready = collect_imu(imu_sample_down_sampled);
+	}
+
+	updateIMUTiming(imu_samples[count - 1].time_us);
+
+	// the output predictor integrates the newest imu data once for each update so it uses the combined samples
+	_imu_batch.getDownSampled(_imu_sample_new);
+	_imu_ticks += count;
+
+	storeIMUSample(imu_sample_down_sampled, down_sampled_ready);
+
+	return count;
+}
+
+void EstimatorInterface::updateVibrationMetrics(const imuSample &imu_sample_new)
+{
 	// calculate a metric which indicates the amount of coning vibration
 	Vector3f temp = cross_product(imu_sample_new.delta_ang , _delta_ang_prev);
 	_vibe_metrics[0] = 0.99f * _vibe_metrics[0] + 0.01f * temp.norm();
@@ -141,10 +173,59 @@ void EstimatorInterface::setIMUData(uint64_t time_usec, uint64_t delta_ang_dt, u
 	temp = imu_sample_new.delta_vel - _delta_vel_prev;
 	_delta_vel_prev = imu_sample_new.delta_vel;
 	_vibe_metrics[2] = 0.99f * _vibe_metrics[2] + 0.01f * temp.norm();
+}
 
-	// accumulate and down-sample imu data and push to the buffer when new downsampled data becomes available
-	if (collect_imu(imu_sample_new)) {
-		_imu_buffer.push(imu_sample_new);
+void EstimatorInterface::setIMUSample(const imuSample &imu_sample_new, const imuSample &imu_sample_down_sampled,
+				      bool down_sampled_ready, const float (&vibe_metrics)[3], unsigned filter_update_period_ms)
+{
+	updateIMUTiming(imu_sample_new.time_us);
+
+	_imu_sample_new = imu_sample_new;
+	_imu_ticks++;
+	memcpy(_vibe_metrics, vibe_metrics, sizeof(_vibe_metrics));
+
+	// follow an adaptive period change so that the buffers span the same sensor delays as those of the other instance
+	if (filter_update_period_ms != _filter_update_period_ms) {
+		_filter_update_period_ms = filter_update_period_ms;
+		resize_buffers();
+	}
+
+	storeIMUSample(imu_sample_down_sampled, down_sampled_ready);
+}
+
+bool EstimatorInterface::get_imu_sample_down_sampled(imuSample &imu_sample)
+{
+	if (_imu_updated) {
+		imu_sample = _imu_buffer.get_newest();
+	}
+
+	return _imu_updated;
+}
+
+void EstimatorInterface::updateIMUTiming(uint64_t time_usec)
+{
+	if (!_initialised) {
+		init(time_usec);
+		_initialised = true;
+	}
+
+	float dt = (float)(time_usec - _time_last_imu) / 1000 / 1000;
+	dt = math::max(dt, 1.0e-4f);
+	dt = math::min(dt, 0.02f);
+
+	_time_last_imu = time_usec;
+
+	if (_time_last_imu > 0) {
+		_dt_imu_avg = 0.8f * _dt_imu_avg + 0.2f * dt;
+	}
+}
+
+void EstimatorInterface::storeIMUSample(const imuSample &imu_sample_down_sampled, bool down_sampled_ready)
+{
+	if (down_sampled_ready) {
+		// the oldest sample is not overwritten until an IMU buffer lengthened by resize_buffers() has filled
+		_horizon_held = _imu_buffer.get_count() < _imu_buffer.get_length();
+		_imu_buffer.push(imu_sample_down_sampled);
 		_imu_ticks = 0;
 		_imu_updated = true;
 
@@ -153,10 +234,10 @@ void EstimatorInterface::setIMUData(uint64_t time_usec, uint64_t delta_ang_dt, u
 		if (_params.fusion_mode & MASK_USE_DRAG) {
 			_drag_sample_count ++;
 			// note acceleration is accumulated as a delta velocity
-			_drag_down_sampled.accelXY(0) += imu_sample_new.delta_vel(0);
-			_drag_down_sampled.accelXY(1) += imu_sample_new.delta_vel(1);
-			_drag_down_sampled.time_us += imu_sample_new.time_us;
-			_drag_sample_time_dt += imu_sample_new.delta_vel_dt;
+			_drag_down_sampled.accelXY(0) += imu_sample_down_sampled.delta_vel(0);
+			_drag_down_sampled.accelXY(1) += imu_sample_down_sampled.delta_vel(1);
+			_drag_down_sampled.time_us += imu_sample_down_sampled.time_us;
+			_drag_sample_time_dt += imu_sample_down_sampled.delta_vel_dt;
 
 			// calculate the downsample ratio for drag specific force data
 			uint8_t min_sample_ratio = (uint8_t) ceilf((float)_imu_buffer_length / _obs_buffer_length);
@@ -199,19 +280,43 @@ void EstimatorInterface::setIMUData(uint64_t time_usec, uint64_t delta_ang_dt, u
 
 void EstimatorInterface::setMagData(uint64_t time_usec, float (&data)[3])
 {
-	// limit data rate to prevent data being lost
-	if (time_usec - _time_last_mag > _min_obs_interval_us) {
+	magSample mag_sample_new;
+	memcpy(&mag_sample_new.mag._data[0], data, sizeof(mag_sample_new.mag._data));
+	mag_sample_new.time_us = time_usec;
 
-		magSample mag_sample_new = {};
-		mag_sample_new.time_us = time_usec  - _params.mag_delay_ms * 1000;
+	setMagData(&mag_sample_new, 1);
+}
 
-		mag_sample_new.time_us -= FILTER_UPDATE_PERIOD_MS * 1000 / 2;
-		_time_last_mag = time_usec;
+void EstimatorInterface::setMagData(const magSample *mag_samples, unsigned num_samples)
+{
+	// correct the measurement time for the sensor delay and the average IMU down-sampling delay
+	const uint64_t delay_us = _params.mag_delay_ms * 1000 + _filter_update_period_ms * 1000 / 2;
+
+	for (unsigned i = 0; i < num_samples; i++) {
+		const uint64_t time_usec = mag_samples[i].time_us;
+
+		// accumulate the samples arriving between buffer entries
+		if (_mag_sum_count == 0) {
+			_mag_sum.setZero();
+			_mag_sum_time_us = time_usec;
+		}
 
+		_mag_sum += mag_samples[i].mag;
+		_mag_sum_count++;
 
-		memcpy(&mag_sample_new.mag._data[0], data, sizeof(mag_sample_new.mag._data));
+		// limit data rate to prevent data being lost
+		if (time_usec - _time_last_mag > _min_obs_interval_us) {
+			_time_last_mag = time_usec;
 
-		_mag_buffer.push(mag_sample_new);
+			magSample mag_sample_new;
+			mag_sample_new.mag = _mag_sum / (float)_mag_sum_count;
+			// the mean represents the middle of the time span of the samples
+			mag_sample_new.time_us = _mag_sum_time_us + (time_usec - _mag_sum_time_us) / 2 - delay_us;
+
+			_mag_buffer.push(mag_sample_new);
+
+			_mag_sum_count = 0;
+		}
 	}
 }
 
@@ -227,7 +332,7 @@ void EstimatorInterface::setGpsData(uint64_t time_usec, struct gps_message *gps)
 		gpsSample gps_sample_new = {};
 		gps_sample_new.time_us = gps->time_usec - _params.gps_delay_ms * 1000;
 
-		gps_sample_new.time_us -= FILTER_UPDATE_PERIOD_MS * 1000 / 2;
+		gps_sample_new.time_us -= _filter_update_period_ms * 1000 / 2;
 		_time_last_gps = time_usec;
 
 		gps_sample_new.time_us = math::max(gps_sample_new.time_us, _imu_sample_delayed.time_us);
@@ -258,63 +363,173 @@ void EstimatorInterface::setGpsData(uint64_t time_usec, struct gps_message *gps)
 	}
 }
 
+void EstimatorInterface::setGpsData(uint64_t time_usec, struct gps_message *gps, uint8_t instance)
+{
+	if (!_initialised) {
+		return;
+	}
+
+	if (_gps_blender.update(instance, *gps, time_usec)) {
+		gps_message blended = _gps_blender.get_blended();
+		setGpsData(_gps_blender.get_blended_receive_time(), &blended);
+	}
+}
+
 void EstimatorInterface::setBaroData(uint64_t time_usec, float data)
+{
+	baroSample baro_sample_new;
+	baro_sample_new.hgt = data;
+	baro_sample_new.time_us = time_usec;
+
+	setBaroData(&baro_sample_new, 1);
+}
+
+void EstimatorInterface::setBaroData(const baroSample *baro_samples, unsigned num_samples)
 {
 	if (!_initialised) {
 		return;
 	}
 
-	// limit data rate to prevent data being lost
-	if (time_usec - _time_last_baro > _min_obs_interval_us) {
+	// correct the measurement time for the sensor delay and the average IMU down-sampling delay
+	const uint64_t delay_us = _params.baro_delay_ms * 1000 + _filter_update_period_ms * 1000 / 2;
 
-		baroSample baro_sample_new{};
-		baro_sample_new.hgt = data;
-		baro_sample_new.time_us = time_usec - _params.baro_delay_ms * 1000;
+	for (unsigned i = 0; i < num_samples; i++) {
+		const uint64_t time_usec = baro_samples[i].time_us;
 
-		baro_sample_new.time_us -= FILTER_UPDATE_PERIOD_MS * 1000 / 2;
-		_time_last_baro = time_usec;
+		// accumulate the samples arriving between buffer entries
+		if (_baro_sum_count == 0) {
+			_baro_sum = 0.0f;
+			_baro_sum_time_us = time_usec;
+		}
+
+		_baro_sum += baro_samples[i].hgt;
+		_baro_sum_count++;
+
+		// limit data rate to prevent data being lost
+		if (time_usec - _time_last_baro > _min_obs_interval_us) {
+			_time_last_baro = time_usec;
 
-		baro_sample_new.time_us = math::max(baro_sample_new.time_us, _imu_sample_delayed.time_us);
+			baroSample baro_sample_new;
+			baro_sample_new.hgt = _baro_sum / (float)_baro_sum_count;
+			// the mean represents the middle of the time span of the samples
+			const uint64_t mean_time_us = _baro_sum_time_us + (time_usec - _baro_sum_time_us) / 2;
+			baro_sample_new.time_us = math::max(mean_time_us - delay_us, _imu_sample_delayed.time_us);
 
-		_baro_buffer.push(baro_sample_new);
+			_baro_buffer.push(baro_sample_new);
+
+			_baro_sum_count = 0;
+		}
 	}
 }
 
 void EstimatorInterface::setAirspeedData(uint64_t time_usec, float true_airspeed, float eas2tas)
+{
+	airspeedSample airspeed_sample_new;
+	airspeed_sample_new.true_airspeed = true_airspeed;
+	airspeed_sample_new.eas2tas = eas2tas;
+	airspeed_sample_new.time_us = time_usec;
+
+	setAirspeedData(&airspeed_sample_new, 1);
+}
+
+void EstimatorInterface::setAirspeedData(const airspeedSample *airspeed_samples, unsigned num_samples)
 {
 	if (!_initialised) {
 		return;
 	}
 
-	// limit data rate to prevent data being lost
-	if (time_usec - _time_last_airspeed > _min_obs_interval_us) {
-		airspeedSample airspeed_sample_new{};
-		airspeed_sample_new.true_airspeed = true_airspeed;
-		airspeed_sample_new.eas2tas = eas2tas;
-		airspeed_sample_new.time_us = time_usec - _params.airspeed_delay_ms * 1000;
-		airspeed_sample_new.time_us -= FILTER_UPDATE_PERIOD_MS * 1000 / 2; //typo PeRRiod
-		_time_last_airspeed = time_usec;
+	// correct the measurement time for the sensor delay and the average IMU down-sampling delay
+	const uint64_t delay_us = _params.airspeed_delay_ms * 1000 + _filter_update_period_ms * 1000 / 2;
+
+	for (unsigned i = 0; i < num_samples; i++) {
+		const uint64_t time_usec = airspeed_samples[i].time_us;
+
+		// limit data rate to prevent data being lost
+		if (time_usec - _time_last_airspeed > _min_obs_interval_us) {
+			_time_last_airspeed = time_usec;
+
+			airspeedSample airspeed_sample_new = airspeed_samples[i];
+			airspeed_sample_new.time_us = time_usec - delay_us;
 
-		_airspeed_buffer.push(airspeed_sample_new);
+			_airspeed_buffer.push(airspeed_sample_new);
+		}
 	}
 }
-static float rng;
 // set range data
 void EstimatorInterface::setRangeData(uint64_t time_usec, float data)
+{
+	rangeSample range_sample_new;
+	range_sample_new.rng = data;
+	range_sample_new.time_us = time_usec;
+
+	setRangeData(&range_sample_new, 1);
+}
+
+void EstimatorInterface::setRangeData(const rangeSample *range_samples, unsigned num_samples)
 {
 	if (!_initialised) {
 		return;
 	}
 
-	// limit data rate to prevent data being lost
-	if (time_usec - _time_last_range > _min_obs_interval_us) {
-		rangeSample range_sample_new = {};
-		range_sample_new.rng = data;
-		rng = data;
-		range_sample_new.time_us = time_usec - _params.range_delay_ms * 1000;
-		_time_last_range = time_usec;
+	// correct the measurement time for the sensor delay
+	const uint64_t delay_us = _params.range_delay_ms * 1000;
 
-		_range_buffer.push(range_sample_new);
+	for (unsigned i = 0; i < num_samples; i++) {
+		const uint64_t time_usec = range_samples[i].time_us;
+
+		// collect the samples arriving between buffer entries, the newest samples are kept if the batch is full
+		if (_range_batch_count == 0) {
+			_range_batch_time_us = time_usec;
+		}
+
+		// the batch is written circularly so that the oldest sample is overwritten when it is full
+		_range_batch[_range_batch_index] = range_samples[i].rng;
+		_range_batch_index = (_range_batch_index + 1) % RANGE_BATCH_LENGTH;
+
+		if (_range_batch_count < RANGE_BATCH_LENGTH) {
+			_range_batch_count++;
+		}
+
+		// limit data rate to prevent data being lost
+		if (time_usec - _time_last_range > _min_obs_interval_us) {
+			_time_last_range = time_usec;
+
+			rangeSample range_sample_new;
+			range_sample_new.rng = rangeBatchMedian();
+			// the median represents the middle of the batch time span
+			range_sample_new.time_us = _range_batch_time_us + (time_usec - _range_batch_time_us) / 2 - delay_us;
+
+			_range_buffer.push(range_sample_new);
+
+			_range_batch_count = 0;
+			_range_batch_index = 0;
+		}
+	}
+}
+
+float EstimatorInterface::rangeBatchMedian()
+{
+	const uint8_t count = _range_batch_count;
+
+	// insertion sort of a copy, the batch is short
+	float sorted[RANGE_BATCH_LENGTH];
+
+	for (uint8_t i = 0; i < count; i++) {
+		float value = _range_batch[i];
+		uint8_t j = i;
+
+		for (; j > 0 && sorted[j - 1] > value; j--) {
+			sorted[j] = sorted[j - 1];
+		}
+
+		sorted[j] = value;
+	}
+
+	if (count % 2 == 1) {
+		return sorted[count / 2];
+
+	} else {
+		return 0.5f * (sorted[count / 2 - 1] + sorted[count / 2]);
 	}
 }
 
@@ -381,44 +596,133 @@ void EstimatorInterface::setExtVisionData(uint64_t time_usec, ext_vision_message
 		return;
 	}
 
+	// accumulate the samples arriving between buffer entries
+	if (_ev_sum_count == 0) {
+		_ev_pos_sum.setZero();
+		_ev_quat_sum.setZero();
+		_ev_sum_time_us = time_usec;
+	}
+
+	_ev_pos_sum += evdata->posNED;
+
+	// q and -q are the same rotation, so sum the quaternions in the same hemisphere
+	if (_ev_quat_sum.dot(evdata->quat) < 0.0f) {
+		_ev_quat_sum -= evdata->quat;
+
+	} else {
+		_ev_quat_sum += evdata->quat;
+	}
+
+	_ev_sum_count++;
+
 	// limit data rate to prevent data being lost
 	if (time_usec - _time_last_ext_vision > _min_obs_interval_us) {
 		extVisionSample ev_sample_new;
-		// calculate the system time-stamp for the mid point of the integration period
-		ev_sample_new.time_us = time_usec - _params.ev_delay_ms * 1000;
-		// copy required data
+		// calculate the system time-stamp for the middle of the time span of the samples
+		ev_sample_new.time_us = _ev_sum_time_us + (time_usec - _ev_sum_time_us) / 2 - _params.ev_delay_ms * 1000;
+		// the reported errors are kept because the errors of successive samples are usually correlated
 		ev_sample_new.angErr = evdata->angErr;
 		ev_sample_new.posErr = evdata->posErr;
-		ev_sample_new.quat = evdata->quat;
-		ev_sample_new.posNED = evdata->posNED;
+		ev_sample_new.posNED = _ev_pos_sum / (float)_ev_sum_count;
+
+		if (_ev_sum_count == 1) {
+			ev_sample_new.quat = evdata->quat;
+
+		} else {
+			// the normalised mean is a close approximation for the small rotations between the samples
+			ev_sample_new.quat = _ev_quat_sum;
+			ev_sample_new.quat.normalize();
+		}
+
 		// record time for comparison next measurement
 		_time_last_ext_vision = time_usec;
 		// push to buffer
 		_ext_vision_buffer.push(ev_sample_new);
+
+		_ev_sum_count = 0;
 	}
 }
 
-bool EstimatorInterface::initialise_interface(uint64_t timestamp)
+unsigned EstimatorInterface::constrainFilterUpdatePeriod(int period_ms)
+{
+	if (period_ms < (int)FILTER_UPDATE_PERIOD_MIN_MS) {
+		return FILTER_UPDATE_PERIOD_MIN_MS;
+
+	} else if (period_ms > (int)FILTER_UPDATE_PERIOD_MAX_MS) {
+		return FILTER_UPDATE_PERIOD_MAX_MS;
+	}
+
+	return (unsigned)period_ms;
+}
+
+unsigned EstimatorInterface::minFilterUpdatePeriod(const parameters &params)
+{
+	const unsigned nominal_ms = constrainFilterUpdatePeriod(params.filter_update_period_ms);
+
+	if (params.filter_update_adaptive != 1) {
+		return nominal_ms;
+	}
+
+	const unsigned adaptive_ms = constrainFilterUpdatePeriod(params.filter_update_period_min_ms);
+
+	return adaptive_ms < nominal_ms ? adaptive_ms : nominal_ms;
+}
+
+unsigned EstimatorInterface::maxFilterUpdatePeriod(const parameters &params)
+{
+	const unsigned nominal_ms = constrainFilterUpdatePeriod(params.filter_update_period_ms);
+
+	if (params.filter_update_adaptive != 1) {
+		return nominal_ms;
+	}
+
+	const unsigned adaptive_ms = constrainFilterUpdatePeriod(params.filter_update_period_max_ms);
+
+	return adaptive_ms > nominal_ms ? adaptive_ms : nominal_ms;
+}
+
+bool EstimatorInterface::calculate_buffer_lengths(const parameters &params, unsigned period_ms,
+		uint8_t *imu_buffer_length, uint8_t *obs_buffer_length)
 {
 	// find the maximum time delay required to compensate for
-	uint16_t max_time_delay_ms = math::max(_params.mag_delay_ms,
-					 math::max(_params.range_delay_ms,
-					     math::max(_params.gps_delay_ms,
-						 math::max(_params.flow_delay_ms,
-						     math::max(_params.ev_delay_ms,
-							 math::max(_params.airspeed_delay_ms, _params.baro_delay_ms))))));
+	uint16_t max_time_delay_ms = math::max(params.mag_delay_ms,
+					 math::max(params.range_delay_ms,
+					     math::max(params.gps_delay_ms,
+						 math::max(params.flow_delay_ms,
+						     math::max(params.ev_delay_ms,
+							 math::max(params.airspeed_delay_ms, params.baro_delay_ms))))));
 
 	// calculate the IMU buffer length required to accomodate the maximum delay with some allowance for jitter
-	_imu_buffer_length = (max_time_delay_ms / FILTER_UPDATE_PERIOD_MS) + 1;
+	// so that the oldest sample is at the maximum delay for the prediction period in use
+	unsigned imu_length = (max_time_delay_ms / math::max(period_ms, 1u)) + 1;
+
+	// the filter can switch to the shortest prediction period at any time so that length must also be supported
+	const unsigned imu_length_max = (max_time_delay_ms / minFilterUpdatePeriod(params)) + 1;
 
 	// set the observaton buffer length to handle the minimum time of arrival between observations in combination
 	// with the worst case delay from current time to ekf fusion time
 	// allow for worst case 50% extension of the ekf fusion time horizon delay due to timing jitter
 	uint16_t ekf_delay_ms = max_time_delay_ms + (int)(ceilf((float)max_time_delay_ms * 0.5f));
-	_obs_buffer_length = (ekf_delay_ms / _params.sensor_interval_min_ms) + 1;
+	unsigned obs_length = (ekf_delay_ms / math::max(params.sensor_interval_min_ms, 1)) + 1;
 
 	// limit to be no longer than the IMU buffer (we can't process data faster than the EKF prediction rate)
-	_obs_buffer_length = math::min(_obs_buffer_length,_imu_buffer_length);
+	obs_length = math::min(obs_length, imu_length);
+
+	*imu_buffer_length = (uint8_t)math::min(imu_length, 255u);
+	*obs_buffer_length = (uint8_t)math::min(obs_length, 255u);
+
+	return imu_length_max <= 255 && !(BUFFER_MAX_LENGTH > 0 && imu_length_max > BUFFER_MAX_LENGTH);
+}
+
+bool EstimatorInterface::initialise_interface(uint64_t timestamp)
+{
+	// start at the nominal prediction rate
+	_filter_update_period_ms = constrainFilterUpdatePeriod(_params.filter_update_period_ms);
+
+	if (!calculate_buffer_lengths(_params, _filter_update_period_ms, &_imu_buffer_length, &_obs_buffer_length)) {
+		ECL_ERR("EKF sensor delay exceeds the maximum buffer length");
+		return false;
+	}
 
 	if (!(_imu_buffer.allocate(_imu_buffer_length) &&
 	      _gps_buffer.allocate(_obs_buffer_length) &&
@@ -456,6 +760,10 @@ bool EstimatorInterface::initialise_interface(uint64_t timestamp)
 	}
 
 	// zero the data in the imu data and output observer state buffers
+	_output_quat_offset = Quaternion();
+	_output_vel_offset.setZero();
+	_output_pos_offset.setZero();
+
 	for (int index=0; index < _imu_buffer_length; index++) {
 		imuSample imu_sample_init = {};
 		_imu_buffer.push(imu_sample_init);
@@ -472,14 +780,21 @@ bool EstimatorInterface::initialise_interface(uint64_t timestamp)
 	_imu_sample_delayed.time_us = timestamp;
 
 	_imu_ticks = 0;
+	_horizon_held = false;
 
 	_initialised = false;
 
 	_time_last_imu = 0;
 	_time_last_gps = 0;
+	_gps_blender.reset();
 	_time_last_mag = 0;
 	_time_last_baro = 0;
+	_mag_sum_count = 0;
+	_baro_sum_count = 0;
+	_ev_sum_count = 0;
 	_time_last_range = 0;
+	_range_batch_count = 0;
+	_range_batch_index = 0;
 	_time_last_airspeed = 0;
 	_time_last_optflow = 0;
 	_fault_status.value = 0;
@@ -487,6 +802,104 @@ bool EstimatorInterface::initialise_interface(uint64_t timestamp)
 	return true;
 }
 
+bool EstimatorInterface::resize_buffers()
+{
+	uint8_t imu_buffer_length;
+	uint8_t obs_buffer_length;
+
+	if (!calculate_buffer_lengths(_params, _filter_update_period_ms, &imu_buffer_length, &obs_buffer_length)) {
+		ECL_ERR("EKF sensor delay exceeds the maximum buffer length");
+		return false;
+	}
+
+	// the buffers are allocated with the new lengths by initialise_interface()
+	if (_imu_buffer.get_length() == 0) {
+		return true;
+	}
+
+	if (imu_buffer_length != _imu_buffer_length) {
+		// The oldest IMU sample is at the fusion time horizon and has already been used by the prediction. When the
+		// buffer is shortened, the samples after it that would be dropped are merged into the first sample that is
+		// kept so that the next prediction spans the same time.
+		const unsigned count = _imu_buffer.get_count();
+
+		if (imu_buffer_length >= 2 && count > imu_buffer_length) {
+			const unsigned last = count - imu_buffer_length + 1;
+			ImuDownSampler down_sampler;
+
+			for (unsigned offset = 1; offset <= last; offset++) {
+				down_sampler.accumulate(_imu_buffer.get_from_oldest(offset));
+			}
+
+			down_sampler.getDownSampled(_imu_buffer.get_from_oldest(last));
+		}
+
+		// the output observer states have the same time coordinates as the IMU data
+		if (!(_imu_buffer.resize(imu_buffer_length) && _output_buffer.resize(imu_buffer_length))) {
+			ECL_ERR("EKF buffer allocation failed!");
+			return false;
+		}
+
+		_imu_buffer_length = imu_buffer_length;
+	}
+
+	if (obs_buffer_length != _obs_buffer_length) {
+		if (!(_gps_buffer.resize(obs_buffer_length) &&
+		      _mag_buffer.resize(obs_buffer_length) &&
+		      _baro_buffer.resize(obs_buffer_length) &&
+		      _range_buffer.resize(obs_buffer_length) &&
+		      _airspeed_buffer.resize(obs_buffer_length) &&
+		      _flow_buffer.resize(obs_buffer_length) &&
+		      _ext_vision_buffer.resize(obs_buffer_length) &&
+		      _drag_buffer.resize(obs_buffer_length))) {
+			ECL_ERR("EKF buffer allocation failed!");
+			return false;
+		}
+
+		_obs_buffer_length = obs_buffer_length;
+	}
+
+	// the fusion time horizon moves to the oldest sample in the buffer with the next prediction
+	_min_obs_interval_us = (_imu_sample_new.time_us - _imu_buffer.get_oldest().time_us)/(_obs_buffer_length - 1);
+
+	return true;
+}
+
+void EstimatorInterface::pushOutputSample(const outputSample &output)
+{
+	outputSample output_stored;
+	output_stored.quat_nominal = output.quat_nominal * _output_quat_offset.inversed();
+	output_stored.vel = output.vel - _output_vel_offset;
+	output_stored.pos = output.pos - _output_pos_offset;
+	output_stored.time_us = output.time_us;
+	_output_buffer.push(output_stored);
+}
+
+outputSample EstimatorInterface::getOldestOutputSample()
+{
+	outputSample output = _output_buffer.get_oldest();
+	output.quat_nominal = output.quat_nominal * _output_quat_offset;
+	ecl::normalize_quat(output.quat_nominal);
+	output.vel += _output_vel_offset;
+	output.pos += _output_pos_offset;
+	return output;
+}
+
+void EstimatorInterface::correctOutputHistory(const Vector3f &vel_change, const Vector3f &pos_change)
+{
+	_output_vel_offset += vel_change;
+	_output_pos_offset += pos_change;
+	_output_new.vel += vel_change;
+	_output_new.pos += pos_change;
+}
+
+void EstimatorInterface::rotateOutputHistory(const Quaternion &quat_change)
+{
+	_output_quat_offset = _output_quat_offset * quat_change;
+	ecl::normalize_quat(_output_quat_offset);
+	_output_new.quat_nominal = _output_new.quat_nominal * quat_change;
+}
+
 void EstimatorInterface::unallocate_buffers()
 {
 	_imu_buffer.unallocate();
@@ -498,6 +911,7 @@ void EstimatorInterface::unallocate_buffers()
 	_flow_buffer.unallocate();
 	_ext_vision_buffer.unallocate();
 	_output_buffer.unallocate();
+	_drag_buffer.unallocate();
 
 }
 
@@ -42,6 +42,9 @@
 #include <stdint.h>
 #include <matrix/matrix/math.hpp>
 #include "RingBuffer.h"
+#include "SeqLock.h"
+#include "imu_down_sampler.h"
+#include "gps_blending.h"
 #include "geo.h"
 #include "common.h"
 #include "mathlib.h"
@@ -153,21 +156,70 @@ public:
 	// set delta angle imu data
 	void setIMUData(uint64_t time_usec, uint64_t delta_ang_dt, uint64_t delta_vel_dt, float (&delta_ang)[3], float (&delta_vel)[3]);
 
+	// set a batch of imu samples in time order. Samples are consumed up to and including the sample that completes the
+	// down-sampling to the EKF prediction rate so that update() can be called before the remaining samples are set.
+	// The consumed samples are combined into a single newest sample for the output predictor.
+	// returns the number of samples consumed
+	unsigned setIMUData(const imuSample *imu_samples, unsigned num_samples);
+
+	// set imu data that has already been pre-processed and down-sampled by another estimator instance using the same IMU
+	// imu_sample_down_sampled is only used if down_sampled_ready is true
+	// filter_update_period_ms is the prediction period the other instance down-sampled to and is adopted by this one
+	void setIMUSample(const imuSample &imu_sample_new, const imuSample &imu_sample_down_sampled, bool down_sampled_ready,
+			  const float (&vibe_metrics)[3], unsigned filter_update_period_ms);
+
+	// return the newest IMU sample
+	const imuSample &get_imu_sample_newest() { return _imu_sample_new; }
+
+	// return the IMU sample at the delayed fusion time horizon
+	const imuSample &get_imu_sample_delayed() { return _imu_sample_delayed; }
+
+	// get the IMU data down-sampled to the EKF prediction rate by the last call to setIMUData
+	// returns false if no new down-sampled data is available
+	bool get_imu_sample_down_sampled(imuSample &imu_sample);
+
 	// set magnetometer data
 	void setMagData(uint64_t time_usec, float (&data)[3]);
 
+	// set a batch of magnetometer samples in time order, the sample time_us is the measurement time
+	void setMagData(const magSample *mag_samples, unsigned num_samples);
+
 	// set gps data
 	void setGpsData(uint64_t time_usec, struct gps_message *gps);
 
+	// set gps data from one of several receivers, instance is the receiver index (0 to ECL_GPS_MAX_RECEIVERS - 1)
+	// a single blended message is passed to the filter once every active receiver has reported
+	void setGpsData(uint64_t time_usec, struct gps_message *gps, uint8_t instance);
+
+	// return the weight given to a receiver by the last blended horizontal position
+	float get_gps_blend_weight(uint8_t instance) const { return _gps_blender.get_weight(instance); }
+
+	// copy the estimator outputs published at the end of the last update
+	// this can be called from any thread and returns false if no consistent copy could be taken
+	bool get_snapshot(estimatorSnapshot *snapshot) const { return _snapshot.read(*snapshot); }
+
 	// set baro data
 	void setBaroData(uint64_t time_usec, float data);
 
+	// set a batch of baro samples in time order, the sample time_us is the measurement time
+	void setBaroData(const baroSample *baro_samples, unsigned num_samples);
+
 	// set airspeed data
 	void setAirspeedData(uint64_t time_usec, float true_airspeed, float eas2tas);
 
+	// set a batch of airspeed samples in time order, the sample time_us is the measurement time
+	void setAirspeedData(const airspeedSample *airspeed_samples, unsigned num_samples);
+
 	// set range data
 	void setRangeData(uint64_t time_usec, float data);
 
+	// set a batch of range finder samples in time order, the sample time_us is the measurement time
+	void setRangeData(const rangeSample *range_samples, unsigned num_samples);
+
+	// return the newest range finder sample in the observation buffer, the median of the samples set since the
+	// previous buffer entry
+	const rangeSample &get_range_sample_newest() { return _range_buffer.get_newest(); }
+
 	// set optical flow data
 	void setOpticalFlowData(uint64_t time_usec, flow_message *flow);
 
@@ -187,6 +239,12 @@ public:
 	// set air density used by the multi-rotor specific drag force fusion
 	void set_air_density(float air_density) {_air_density = air_density;}
 
+	// set the fraction of the available CPU time in use, used by the adaptive prediction rate
+	void set_cpu_load(float cpu_load) {_cpu_load = cpu_load;}
+
+	// return the time between filter prediction steps currently in use (msec)
+	unsigned get_filter_update_period_ms() {return _filter_update_period_ms;}
+
 	// return true if the global position estimate is valid
 	virtual bool global_position_is_valid() = 0;
 
@@ -287,6 +345,21 @@ public:
 	// return a bitmask integer that describes which state estimates can be used for flight control
 	virtual void get_ekf_soln_status(uint16_t *status) = 0;
 
+	// calculate the IMU and observation buffer lengths that span the sensor delays when predicting at period_ms.
+	// Returns false if the IMU buffer needed at the shortest prediction period the parameters allow would exceed the
+	// static buffer length or 255 samples.
+	static bool calculate_buffer_lengths(const parameters &params, unsigned period_ms, uint8_t *imu_buffer_length,
+					     uint8_t *obs_buffer_length);
+
+	// resize the data buffers for the current sensor delay parameters and prediction period without discarding the
+	// buffered data or restarting the filter, call after update() when a delay parameter has been changed. This is
+	// also done by the filter when the adaptive prediction period changes so the fusion time horizon stays at the
+	// maximum sensor delay.
+	// Lengthening the IMU buffer holds the fusion time horizon until the buffer has filled and shortening it merges
+	// the IMU samples that are dropped into the next sample to be predicted, so the states stay continuous.
+	// Returns false if a buffer could not be resized, the filter must then be restarted with init().
+	bool resize_buffers();
+
 protected:
 
 	parameters _params;		// filter parameters
@@ -295,21 +368,65 @@ protected:
 	 OBS_BUFFER_LENGTH defines how many observations (non-IMU measurements) we can buffer
 	 which sets the maximum frequency at which we can process non-IMU measurements. Measurements that
 	 arrive too soon after the previous measurement will not be processed.
-	 max freq (Hz) = (OBS_BUFFER_LENGTH - 1) / (IMU_BUFFER_LENGTH * FILTER_UPDATE_PERIOD_MS * 0.001)
+	 max freq (Hz) = (OBS_BUFFER_LENGTH - 1) / (IMU_BUFFER_LENGTH * filter update period (msec) * 0.001)
 	 This can be adjusted to match the max sensor data rate plus some margin for jitter.
 	*/
 	uint8_t _obs_buffer_length;
 	/*
 	IMU_BUFFER_LENGTH defines how many IMU samples we buffer which sets the time delay from current time to the
 	EKF fusion time horizon and therefore the maximum sensor time offset relative to the IMU that we can compensate for.
-	max sensor time offet (msec) =  IMU_BUFFER_LENGTH * FILTER_UPDATE_PERIOD_MS
-	This can be adjusted to a value that is FILTER_UPDATE_PERIOD_MS longer than the maximum observation time delay.
+	max sensor time offet (msec) =  IMU_BUFFER_LENGTH * filter update period (msec)
+	The length is set using the shortest prediction period the filter can use so that the maximum observation time
+	delay is covered at every prediction rate the adaptive mode can select.
 	*/
 	uint8_t _imu_buffer_length;
-	static const unsigned FILTER_UPDATE_PERIOD_MS = 12;	// ekf prediction period in milliseconds - this should ideally be an integer multiple of the IMU time delta
+
+	/*
+	The ekf prediction period is set by the filter_update_period_ms parameter and should ideally be an integer multiple
+	of the IMU time delta. When filter_update_adaptive is set, the period is shortened during aggressive flight and
+	lengthened on ground, when stationary or when the CPU load is high. All periods are limited to the supported range.
+	*/
+	static const unsigned FILTER_UPDATE_PERIOD_MIN_MS = 4;	// shortest supported ekf prediction period (msec) - 250 Hz
+	static const unsigned FILTER_UPDATE_PERIOD_MAX_MS = 40;	// longest supported ekf prediction period (msec) - 25 Hz
+	unsigned _filter_update_period_ms{12};	// ekf prediction period currently in use (msec)
+	float _cpu_load{0.0f};			// fraction of the available CPU time in use
+
+	/*
+	If ECL_BUFFER_MAX_DELAY_MS is defined at build time, the data buffers are held in static memory sized for the
+	specified maximum observation time delay and no heap allocation is performed. Otherwise the buffers are allocated
+	on the heap with the length required by the delay parameters. The observation buffers are never longer than the
+	IMU buffer so the same maximum length is used for all buffers.
+	*/
+#ifdef ECL_BUFFER_MAX_DELAY_MS
+	static const unsigned BUFFER_MAX_LENGTH = (ECL_BUFFER_MAX_DELAY_MS / FILTER_UPDATE_PERIOD_MIN_MS) + 1;
+#else
+	static const unsigned BUFFER_MAX_LENGTH = 0;
+#endif
 
 	unsigned _min_obs_interval_us; // minimum time interval between observations that will guarantee data is not lost (usec)
 
+	// Range finder samples arriving faster than the buffer can accept them are collected and pushed as a single
+	// sample holding the median of the batch, so high rate sensors are not decimated and outliers are rejected.
+	static const uint8_t RANGE_BATCH_LENGTH = 8;	// maximum number of range samples combined into one buffer entry
+	float _range_batch[RANGE_BATCH_LENGTH] {};	// range measurements received since the last buffer push (m)
+	uint64_t _range_batch_time_us{0};	// timestamp of the first sample in the batch (usec)
+	uint8_t _range_batch_count{0};	// number of samples in the batch, limited to RANGE_BATCH_LENGTH
+	uint8_t _range_batch_index{0};	// index in _range_batch the next sample is written to
+
+	// Magnetometer, barometer and external vision samples arriving faster than the buffer can accept them are
+	// accumulated and pushed as a single sample holding the mean, so the samples that would otherwise be
+	// dropped reduce the noise of the observation instead.
+	Vector3f _mag_sum{};			// sum of the magnetometer samples since the last buffer push (Gauss)
+	uint64_t _mag_sum_time_us{0};		// timestamp of the first magnetometer sample in the sum (usec)
+	uint16_t _mag_sum_count{0};		// number of magnetometer samples in the sum
+	float _baro_sum{0.0f};			// sum of the barometer samples since the last buffer push (m)
+	uint64_t _baro_sum_time_us{0};		// timestamp of the first barometer sample in the sum (usec)
+	uint16_t _baro_sum_count{0};		// number of barometer samples in the sum
+	Vector3f _ev_pos_sum{};			// sum of the external vision positions since the last buffer push (m)
+	Quaternion _ev_quat_sum{};		// sum of the external vision quaternions, taken in the same hemisphere
+	uint64_t _ev_sum_time_us{0};		// timestamp of the first external vision sample in the sum (usec)
+	uint16_t _ev_sum_count{0};		// number of external vision samples in the sum
+
 	float _dt_imu_avg;	// average imu update period in s
 
 	imuSample _imu_sample_delayed;	// captures the imu sample on the delayed time horizon
@@ -333,11 +450,15 @@ protected:
 	outputSample _output_sample_delayed;	// filter output on the delayed time horizon
 	outputSample _output_new;	// filter output on the non-delayed time horizon
 	imuSample _imu_sample_new;	// imu sample capturing the newest imu data
+	GpsBlender _gps_blender;	// combines the messages of several GPS receivers
+	SeqLock<estimatorSnapshot> _snapshot;	// estimator outputs published for readers on other threads
+	ImuDownSampler _imu_batch;	// combines a batch of imu samples into the newest imu sample
 	Matrix3f _R_to_earth_now; // rotation matrix from body to earth frame at current time
 
 	uint64_t _imu_ticks;	// counter for imu updates
 
 	bool _imu_updated;      // true if the ekf should update (completed downsampling process)
+	bool _horizon_held{false};	// true if the fusion time horizon did not move with the last IMU sample because a lengthened IMU buffer is filling
 	bool _initialised;      // true if the ekf interface instance (data buffering) is initialized
 
 	bool _NED_origin_initialised;
@@ -345,8 +466,6 @@ protected:
 	float _gps_origin_eph; // horizontal position uncertainty of the GPS origin
 	float _gps_origin_epv; // vertical position uncertainty of the GPS origin
 	struct map_projection_reference_s _pos_ref;    // Contains WGS-84 position latitude and longitude (radians) of the EKF origin
-	struct map_projection_reference_s _gps_pos_prev;    // Contains WGS-84 position latitude and longitude (radians) of the previous GPS message
-	float _gps_alt_prev;	// height from the previous GPS message (m)
 
 	// innovation consistency check monitoring ratios
 	float _yaw_test_ratio;          // yaw innovation consistency check ratio
@@ -369,16 +488,23 @@ protected:
 					// [2] high frequency vibration level in the IMU delta velocity data (m/s)
 
 	// data buffer instances
-	RingBuffer<imuSample> _imu_buffer;
-	RingBuffer<gpsSample> _gps_buffer;
-	RingBuffer<magSample> _mag_buffer;
-	RingBuffer<baroSample> _baro_buffer;
-	RingBuffer<rangeSample> _range_buffer;
-	RingBuffer<airspeedSample> _airspeed_buffer;
-	RingBuffer<flowSample> 	_flow_buffer;
-	RingBuffer<extVisionSample> _ext_vision_buffer;
-	RingBuffer<outputSample> _output_buffer;
-	RingBuffer<dragSample> _drag_buffer;
+	RingBuffer<imuSample, BUFFER_MAX_LENGTH> _imu_buffer;
+	RingBuffer<gpsSample, BUFFER_MAX_LENGTH> _gps_buffer;
+	RingBuffer<magSample, BUFFER_MAX_LENGTH> _mag_buffer;
+	RingBuffer<baroSample, BUFFER_MAX_LENGTH> _baro_buffer;
+	RingBuffer<rangeSample, BUFFER_MAX_LENGTH> _range_buffer;
+	RingBuffer<airspeedSample, BUFFER_MAX_LENGTH> _airspeed_buffer;
+	RingBuffer<flowSample, BUFFER_MAX_LENGTH> 	_flow_buffer;
+	RingBuffer<extVisionSample, BUFFER_MAX_LENGTH> _ext_vision_buffer;
+	RingBuffer<outputSample, BUFFER_MAX_LENGTH> _output_buffer;
+	RingBuffer<dragSample, BUFFER_MAX_LENGTH> _drag_buffer;
+
+	// The output state history is stored relative to the accumulated corrections so that a correction can be
+	// applied to the complete history in constant time. The corrected value of a stored sample is given by
+	// quat_nominal * _output_quat_offset, vel + _output_vel_offset and pos + _output_pos_offset.
+	Quaternion _output_quat_offset;	// accumulated quaternion correction applied to the output state history
+	Vector3f _output_vel_offset;	// accumulated velocity correction applied to the output state history (m/s)
+	Vector3f _output_pos_offset;	// accumulated position correction applied to the output state history (m)
 
 	uint64_t _time_last_imu;	// timestamp of last imu sample in microseconds
 	uint64_t _time_last_gps;	// timestamp of last gps measurement in microseconds
@@ -397,6 +523,39 @@ protected:
 	// free buffer memory
 	void unallocate_buffers();
 
+	// update the IMU timing statistics and initialise the estimator on the first IMU sample
+	void updateIMUTiming(uint64_t time_usec);
+
+	// update the IMU vibration metrics using a new IMU sample
+	void updateVibrationMetrics(const imuSample &imu_sample_new);
+
+	// limit a prediction period to the supported range (msec)
+	static unsigned constrainFilterUpdatePeriod(int period_ms);
+
+	// return the shortest and longest prediction periods the filter can use with the given parameters (msec)
+	static unsigned minFilterUpdatePeriod(const parameters &params);
+	static unsigned maxFilterUpdatePeriod(const parameters &params);
+
+	// return the shortest and longest prediction periods the filter can use with the current parameters (msec)
+	unsigned minFilterUpdatePeriod() const { return minFilterUpdatePeriod(_params); }
+	unsigned maxFilterUpdatePeriod() const { return maxFilterUpdatePeriod(_params); }
+
+	// store the output states in the output state history relative to the accumulated corrections
+	void pushOutputSample(const outputSample &output);
+
+	// return the corrected output states of the oldest sample in the output state history
+	outputSample getOldestOutputSample();
+
+	// apply a correction to the complete output state history in constant time
+	void correctOutputHistory(const Vector3f &vel_change, const Vector3f &pos_change);
+	void rotateOutputHistory(const Quaternion &quat_change);
+
+	// store IMU data that has been down-sampled to the EKF prediction rate
+	void storeIMUSample(const imuSample &imu_sample_down_sampled, bool down_sampled_ready);
+
+	// return the median of the range finder samples collected since the last buffer push
+	float rangeBatchMedian();
+
 	float _mag_declination_gps;         // magnetic declination returned by the geo library using the last valid GPS position (rad)
 	float _mag_declination_to_save_deg; // magnetic declination to save to EKF2_MAG_DECL (deg)
 
@@ -410,6 +569,6 @@ protected:
 	Vector3f cross_product(const Vector3f &vecIn1, const Vector3f &vecIn2);
 
 	// calculate the inverse rotation matrix from a quaternion rotation
-	Matrix3f quat_to_invrotmat(const Quaternion& quat);
+	static Matrix3f quat_to_invrotmat(const Quaternion& quat);
 
 };
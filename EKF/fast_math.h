@@ -0,0 +1,237 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file fast_math.h
+ * Scalar math functions used in the EKF prediction, fusion and output predictor loops.
+ *
+ * By default these call the C library. When the library is built with ECL_FAST_MATH they are replaced
+ * by approximations with a bounded error that avoid the divide, square root and library calls. The
+ * SSE or NEON reciprocal square root estimate is used where available. The error bounds below are
+ * checked against double precision reference functions by benchmark/math_benchmark.cpp.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(ECL_FAST_MATH)
+#if defined(__SSE__) || defined(__x86_64__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define ECL_FAST_MATH_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ECL_FAST_MATH_NEON
+#endif
+#endif
+
+namespace ecl
+{
+
+// maximum relative error of inv_sqrt() and sqrt() for normal positive arguments
+static constexpr float inv_sqrt_max_rel_error = 5e-6f;
+
+// maximum absolute error of sin_cos() for arguments within +-sin_cos_max_arg (rad)
+static constexpr float sin_cos_max_abs_error = 2e-7f;
+static constexpr float sin_cos_max_arg = 1000.0f;
+
+// maximum absolute error of atan2() (rad)
+static constexpr float atan2_max_abs_error = 5e-7f;
+
+#if defined(ECL_FAST_MATH)
+// a if condition is true else b, using a bit mask because branches on random data are mispredicted
+inline float select(bool condition, float a, float b)
+{
+	uint32_t a_bits;
+	uint32_t b_bits;
+	memcpy(&a_bits, &a, sizeof(a_bits));
+	memcpy(&b_bits, &b, sizeof(b_bits));
+	const uint32_t mask = 0u - static_cast<uint32_t>(condition);
+	const uint32_t bits = (a_bits & mask) | (b_bits & ~mask);
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+#endif
+
+// 1 / sqrt(x) for x > 0
+inline float inv_sqrt(float x)
+{
+#if defined(ECL_FAST_MATH_SSE)
+	// the 12 bit estimate is refined with a single Newton-Raphson step
+	const float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+	return y * (1.5f - 0.5f * x * y * y);
+
+#elif defined(ECL_FAST_MATH_NEON)
+	// the 8 bit estimate is refined with two Newton-Raphson steps
+	float32x2_t v = vdup_n_f32(x);
+	float32x2_t y = vrsqrte_f32(v);
+	y = vmul_f32(y, vrsqrts_f32(vmul_f32(v, y), y));
+	y = vmul_f32(y, vrsqrts_f32(vmul_f32(v, y), y));
+	return vget_lane_f32(y, 0);
+
+#elif defined(ECL_FAST_MATH)
+	// initial estimate from the exponent bits followed by two Newton-Raphson steps
+	uint32_t bits;
+	memcpy(&bits, &x, sizeof(bits));
+	bits = 0x5f375a86u - (bits >> 1);
+	float y;
+	memcpy(&y, &bits, sizeof(y));
+	y = y * (1.5f - 0.5f * x * y * y);
+	return y * (1.5f - 0.5f * x * y * y);
+
+#else
+	return 1.0f / sqrtf(x);
+#endif
+}
+
+// sqrt(x) for x >= 0
+inline float sqrt(float x)
+{
+#if defined(ECL_FAST_MATH)
+	return (x > 0.0f) ? x * inv_sqrt(x) : 0.0f;
+#else
+	return sqrtf(x);
+#endif
+}
+
+// sine and cosine of x (rad)
+inline void sin_cos(float x, float &sin_x, float &cos_x)
+{
+#if defined(ECL_FAST_MATH)
+	// reduce the argument to +-pi/4 using a three part split of pi/2 to keep the remainder exact
+	const int32_t quadrant = static_cast<int32_t>(x * 0.636619772f + copysignf(0.5f, x));
+	const float k = static_cast<float>(quadrant);
+	float r = x - k * 1.5703125f;
+	r -= k * 4.83751297e-4f;
+	r -= k * 7.54978995e-8f;
+
+	// minimax polynomials on +-pi/4
+	const float r2 = r * r;
+	const float s = r + r * r2 * (-1.6666654611e-1f + r2 * (8.3321608736e-3f + r2 * -1.9515295891e-4f));
+	const float c = 1.0f - 0.5f * r2 + r2 * r2 * (4.166664568298827e-2f + r2 * (-1.388731625493765e-3f + r2 * 2.443315711809948e-5f));
+
+	// map the quadrant onto the result
+	const bool odd = (quadrant & 1) != 0;
+	sin_x = select(odd, c, s);
+	cos_x = select(odd, s, c);
+	sin_x = select((quadrant & 2) != 0, -sin_x, sin_x);
+	cos_x = select(((quadrant + 1) & 2) != 0, -cos_x, cos_x);
+
+#else
+	sin_x = sinf(x);
+	cos_x = cosf(x);
+#endif
+}
+
+// four quadrant arc tangent of y / x (rad)
+inline float atan2(float y, float x)
+{
+#if defined(ECL_FAST_MATH)
+	const float abs_x = fabsf(x);
+	const float abs_y = fabsf(y);
+	const bool swap = abs_y > abs_x;
+	const float max_xy = select(swap, abs_y, abs_x);
+
+	if (max_xy == 0.0f) {
+		return 0.0f;
+	}
+
+	// reduce to an argument in [0, 1] then to +-tan(pi/8). Both reductions are calculated and selected
+	// so there are no data dependent branches.
+	const float ratio = select(swap, abs_x, abs_y) / max_xy;
+	const bool reduce = ratio > 0.414213562f;
+	const float z = select(reduce, (ratio - 1.0f) / (ratio + 1.0f), ratio);
+
+	const float z2 = z * z;
+	float angle = select(reduce, 0.785398163f, 0.0f)
+		      + z + z * z2 * (-3.33329491539e-1f + z2 * (1.99777106478e-1f + z2 * (-1.38776856032e-1f + z2 * 8.05374449538e-2f)));
+
+	// undo the reductions
+	angle = select(swap, 1.57079633f - angle, angle);
+	angle = select(x < 0.0f, 3.14159265f - angle, angle);
+	return copysignf(angle, y);
+
+#else
+	return atan2f(y, x);
+#endif
+}
+
+// normalise a quaternion to unit length
+template <typename quat_type>
+inline void normalize_quat(quat_type &q)
+{
+#if defined(ECL_FAST_MATH)
+	const float scale = inv_sqrt(q(0) * q(0) + q(1) * q(1) + q(2) * q(2) + q(3) * q(3));
+	q(0) *= scale;
+	q(1) *= scale;
+	q(2) *= scale;
+	q(3) *= scale;
+#else
+	q.normalize();
+#endif
+}
+
+// quaternion for a rotation of |v| (rad) about the axis v
+template <typename quat_type, typename vector_type>
+inline void quat_from_rotation_vector(quat_type &q, const vector_type &v)
+{
+#if defined(ECL_FAST_MATH)
+	const float theta_sq = v(0) * v(0) + v(1) * v(1) + v(2) * v(2);
+	float cos_half;
+	float sin_half_by_theta;
+
+	if (theta_sq < 0.01f) {
+		// the series truncation error is below 1e-10 for the small rotations of a single IMU sample
+		cos_half = 1.0f - theta_sq * (0.125f - theta_sq * 2.60416667e-3f);
+		sin_half_by_theta = 0.5f - theta_sq * (2.08333333e-2f - theta_sq * 2.60416667e-4f);
+
+	} else {
+		const float inv_theta = inv_sqrt(theta_sq);
+		float sin_half;
+		sin_cos(0.5f * theta_sq * inv_theta, sin_half, cos_half);
+		sin_half_by_theta = sin_half * inv_theta;
+	}
+
+	q(0) = cos_half;
+	q(1) = v(0) * sin_half_by_theta;
+	q(2) = v(1) * sin_half_by_theta;
+	q(3) = v(2) * sin_half_by_theta;
+#else
+	q.from_axis_angle(v);
+#endif
+}
+
+}
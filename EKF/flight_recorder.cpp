@@ -0,0 +1,449 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file flight_recorder.cpp
+ * Fixed memory recorder of the estimator internals.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "flight_recorder.h"
+
+namespace
+{
+
+const int16_t VARIANCE_NOT_POSITIVE = -32768;	// quantised value of a zero or negative variance
+const size_t DUMP_STATUS_OFFSET = sizeof(uint64_t);
+const size_t DUMP_NUM_STATES_OFFSET = DUMP_STATUS_OFFSET + 3 * sizeof(uint16_t);
+const size_t DUMP_HEADER_SIZE = DUMP_NUM_STATES_OFFSET + 1 + FlightRecorder::MAX_STATES * sizeof(int16_t);
+
+uint8_t writeVarint(uint8_t *data, uint64_t value)
+{
+	uint8_t length = 0;
+
+	do {
+		uint8_t byte = value & 0x7F;
+		value >>= 7;
+		data[length++] = byte | ((value != 0) ? 0x80 : 0);
+	} while (value != 0);
+
+	return length;
+}
+
+bool readVarint(const uint8_t *data, size_t length, size_t &position, uint64_t &value)
+{
+	value = 0;
+
+	for (unsigned shift = 0; shift < 64 && position < length; shift += 7) {
+		uint8_t byte = data[position++];
+		value |= (uint64_t)(byte & 0x7F) << shift;
+
+		if ((byte & 0x80) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+uint32_t zigzagEncode(int32_t value)
+{
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+int32_t zigzagDecode(uint32_t value)
+{
+	return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+// apply the changes in a covariance record payload to the quantised variances
+bool applyCovariance(const uint8_t *data, size_t length, size_t position, int16_t *variance, uint8_t &num_states)
+{
+	if (position + 4 > length || data[position] > FlightRecorder::MAX_STATES) {
+		return false;
+	}
+
+	num_states = data[position];
+	const uint32_t changed = data[position + 1] | (data[position + 2] << 8) | (data[position + 3] << 16);
+	position += 4;
+
+	for (uint8_t index = 0; index < num_states; index++) {
+		if (changed & (1UL << index)) {
+			uint64_t delta;
+
+			if (!readVarint(data, length, position, delta)) {
+				return false;
+			}
+
+			variance[index] = (int16_t)(variance[index] + zigzagDecode((uint32_t)delta));
+		}
+	}
+
+	return true;
+}
+
+}
+
+void FlightRecorder::reset()
+{
+	_head = 0;
+	_tail = 0;
+	_used = 0;
+	_tail_time_us = 0;
+	_head_time_us = 0;
+	memset(_tail_status, 0, sizeof(_tail_status));
+	memset(_tail_variance, 0, sizeof(_tail_variance));
+	memset(_head_variance, 0, sizeof(_head_variance));
+	_triggered = false;
+	_frozen = false;
+	_post_trigger_bytes = 0;
+}
+
+uint8_t FlightRecorder::quantiseLog(float value)
+{
+	if (!(value > 0.0f)) {
+		return 0;
+	}
+
+	float q = roundf(8.0f * log2f(value)) + 128.0f;
+	return (uint8_t)((q < 1.0f) ? 1.0f : ((q > 255.0f) ? 255.0f : q));
+}
+
+float FlightRecorder::dequantiseLog(uint8_t value)
+{
+	return (value == 0) ? 0.0f : exp2f(((float)value - 128.0f) * 0.125f);
+}
+
+int16_t FlightRecorder::quantiseVariance(float variance)
+{
+	if (!(variance > 0.0f)) {
+		return VARIANCE_NOT_POSITIVE;
+	}
+
+	float q = roundf(16.0f * log2f(variance));
+	return (int16_t)((q < -32767.0f) ? -32767.0f : ((q > 32767.0f) ? 32767.0f : q));
+}
+
+float FlightRecorder::dequantiseVariance(int16_t value)
+{
+	return (value == VARIANCE_NOT_POSITIVE) ? 0.0f : exp2f((float)value * 0.0625f);
+}
+
+uint8_t FlightRecorder::beginRecord(uint8_t *record, flight_recorder_record_type type, uint64_t time_us)
+{
+	// time stamps that go backwards are recorded as no time elapsed
+	uint64_t dt_us = (time_us > _head_time_us) ? time_us - _head_time_us : 0;
+	record[1] = (uint8_t)type;
+	return 2 + writeVarint(&record[2], dt_us);
+}
+
+void FlightRecorder::recordFusion(uint64_t time_us, uint8_t observation, float innov, float innov_var,
+				  float test_ratio, bool rejected)
+{
+	if (_frozen) {
+		return;
+	}
+
+	uint8_t record[MAX_RECORD_LENGTH];
+	uint8_t length = beginRecord(record, FLIGHT_RECORDER_FUSION, time_us);
+
+	// the innovation is stored relative to its quantised standard deviation and saturates at 8 standard deviations
+	const uint8_t innov_var_q = quantiseLog(innov_var);
+	const float innov_std = sqrtf(dequantiseLog(innov_var_q));
+	float innov_q = (innov_std > 0.0f) ? roundf(16.0f * innov / innov_std) : 0.0f;
+	innov_q = (innov_q < -127.0f) ? -127.0f : ((innov_q > 127.0f) ? 127.0f : innov_q);
+
+	// a NaN innovation is recorded as zero
+	if (!(innov_q == innov_q)) {
+		innov_q = 0.0f;
+	}
+
+	record[length++] = (observation & 0x7F) | (rejected ? 0x80 : 0);
+	record[length++] = (uint8_t)(int8_t)innov_q;
+	record[length++] = innov_var_q;
+	record[length++] = quantiseLog(test_ratio);
+	record[0] = length;
+	write(record, length);
+
+	if (time_us > _head_time_us) {
+		_head_time_us = time_us;
+	}
+}
+
+void FlightRecorder::recordCovariance(uint64_t time_us, const float *variance, uint8_t num_states)
+{
+	if (_frozen) {
+		return;
+	}
+
+	if (num_states > MAX_STATES) {
+		num_states = MAX_STATES;
+	}
+
+	uint8_t record[MAX_RECORD_LENGTH];
+	uint8_t length = beginRecord(record, FLIGHT_RECORDER_COVARIANCE, time_us);
+	const uint8_t mask_position = length + 1;
+	record[length] = num_states;
+	length += 4;
+
+	// only the elements that have changed by at least one quantisation step are stored
+	uint32_t changed = 0;
+	int16_t quantised[MAX_STATES];
+
+	for (uint8_t index = 0; index < num_states; index++) {
+		quantised[index] = quantiseVariance(variance[index]);
+		int32_t delta = (int32_t)quantised[index] - (int32_t)_head_variance[index];
+
+		if (delta != 0) {
+			changed |= 1UL << index;
+			length += writeVarint(&record[length], zigzagEncode(delta));
+		}
+	}
+
+	record[mask_position] = changed & 0xFF;
+	record[mask_position + 1] = (changed >> 8) & 0xFF;
+	record[mask_position + 2] = (changed >> 16) & 0xFF;
+	record[0] = length;
+	write(record, length);
+
+	memcpy(_head_variance, quantised, num_states * sizeof(int16_t));
+
+	if (time_us > _head_time_us) {
+		_head_time_us = time_us;
+	}
+}
+
+void FlightRecorder::recordStatus(uint64_t time_us, uint16_t control_status, uint16_t fault_status,
+				  uint16_t innov_check_fail_status)
+{
+	if (_frozen) {
+		return;
+	}
+
+	uint8_t record[MAX_RECORD_LENGTH];
+	uint8_t length = beginRecord(record, FLIGHT_RECORDER_STATUS, time_us);
+	memcpy(&record[length], &control_status, sizeof(uint16_t));
+	memcpy(&record[length + 2], &fault_status, sizeof(uint16_t));
+	memcpy(&record[length + 4], &innov_check_fail_status, sizeof(uint16_t));
+	length += 6;
+	record[0] = length;
+	write(record, length);
+
+	if (time_us > _head_time_us) {
+		_head_time_us = time_us;
+	}
+}
+
+void FlightRecorder::trigger()
+{
+	if (!_triggered) {
+		_triggered = true;
+		_post_trigger_bytes = CAPACITY / 2;
+	}
+}
+
+void FlightRecorder::write(const uint8_t *record, uint8_t length)
+{
+	while (CAPACITY - _used < length) {
+		dropOldest();
+	}
+
+	const size_t first = (length < CAPACITY - _head) ? length : CAPACITY - _head;
+	memcpy(&_buffer[_head], record, first);
+	memcpy(&_buffer[0], &record[first], length - first);
+	_head = (_head + length) % CAPACITY;
+	_used += length;
+
+	if (_triggered) {
+		if (length >= _post_trigger_bytes) {
+			_post_trigger_bytes = 0;
+			_frozen = true;
+
+		} else {
+			_post_trigger_bytes -= length;
+		}
+	}
+}
+
+void FlightRecorder::dropOldest()
+{
+	uint8_t record[MAX_RECORD_LENGTH];
+	const uint8_t length = _buffer[_tail];
+	const size_t first = (length < CAPACITY - _tail) ? length : CAPACITY - _tail;
+	memcpy(record, &_buffer[_tail], first);
+	memcpy(&record[first], &_buffer[0], length - first);
+	_tail = (_tail + length) % CAPACITY;
+	_used -= length;
+
+	// the records were written by this class so cannot fail to decode
+	size_t position = 2;
+	uint64_t dt_us;
+	readVarint(record, length, position, dt_us);
+	_tail_time_us += dt_us;
+
+	if (record[1] == FLIGHT_RECORDER_COVARIANCE) {
+		uint8_t num_states;
+		applyCovariance(record, length, position, _tail_variance, num_states);
+
+	} else if (record[1] == FLIGHT_RECORDER_STATUS) {
+		memcpy(_tail_status, &record[position], sizeof(_tail_status));
+	}
+}
+
+size_t FlightRecorder::dumpSize() const
+{
+	return DUMP_HEADER_SIZE + _used;
+}
+
+size_t FlightRecorder::dump(uint8_t *buffer, size_t size) const
+{
+	if (size < dumpSize()) {
+		return 0;
+	}
+
+	memcpy(buffer, &_tail_time_us, sizeof(uint64_t));
+	memcpy(&buffer[DUMP_STATUS_OFFSET], _tail_status, sizeof(_tail_status));
+	buffer[DUMP_NUM_STATES_OFFSET] = MAX_STATES;
+	memcpy(&buffer[DUMP_NUM_STATES_OFFSET + 1], _tail_variance, sizeof(_tail_variance));
+
+	const size_t first = (_used < CAPACITY - _tail) ? _used : CAPACITY - _tail;
+	memcpy(&buffer[DUMP_HEADER_SIZE], &_buffer[_tail], first);
+	memcpy(&buffer[DUMP_HEADER_SIZE + first], &_buffer[0], _used - first);
+
+	return dumpSize();
+}
+
+FlightRecorderReader::FlightRecorderReader(const uint8_t *dump, size_t length) :
+	_data(dump),
+	_length(length),
+	_position(DUMP_HEADER_SIZE),
+	_time_us(0),
+	_status{},
+	_num_states(0),
+	_variance{},
+	_valid(length >= DUMP_HEADER_SIZE && dump[DUMP_NUM_STATES_OFFSET] == FlightRecorder::MAX_STATES),
+	_status_returned(false)
+{
+	if (_valid) {
+		memcpy(&_time_us, dump, sizeof(uint64_t));
+		memcpy(_status, &dump[DUMP_STATUS_OFFSET], sizeof(_status));
+		memcpy(_variance, &dump[DUMP_NUM_STATES_OFFSET + 1], sizeof(_variance));
+	}
+}
+
+bool FlightRecorderReader::next(flight_recorder_record &record)
+{
+	if (!_valid) {
+		return false;
+	}
+
+	if (!_status_returned) {
+		memset(&record, 0, sizeof(record));
+		record.type = FLIGHT_RECORDER_STATUS;
+		record.time_us = _time_us;
+		record.control_status = _status[0];
+		record.fault_status = _status[1];
+		record.innov_check_fail_status = _status[2];
+		_status_returned = true;
+		return true;
+	}
+
+	if (_position >= _length) {
+		return false;
+	}
+
+	const uint8_t length = _data[_position];
+
+	if (length < 3 || _position + length > _length) {
+		_valid = false;
+		return false;
+	}
+
+	const uint8_t *data = &_data[_position];
+	_position += length;
+
+	size_t position = 2;
+	uint64_t dt_us;
+
+	if (!readVarint(data, length, position, dt_us)) {
+		_valid = false;
+		return false;
+	}
+
+	_time_us += dt_us;
+	memset(&record, 0, sizeof(record));
+	record.type = (flight_recorder_record_type)data[1];
+	record.time_us = _time_us;
+
+	switch (data[1]) {
+	case FLIGHT_RECORDER_FUSION:
+		if (position + 4 > length) {
+			break;
+		}
+
+		record.observation = data[position] & 0x7F;
+		record.rejected = (data[position] & 0x80) != 0;
+		record.innov_var = FlightRecorder::dequantiseLog(data[position + 2]);
+		record.innov = (float)(int8_t)data[position + 1] * 0.0625f * sqrtf(record.innov_var);
+		record.test_ratio = FlightRecorder::dequantiseLog(data[position + 3]);
+		return true;
+
+	case FLIGHT_RECORDER_COVARIANCE:
+		if (!applyCovariance(data, length, position, _variance, _num_states)) {
+			break;
+		}
+
+		record.num_states = _num_states;
+
+		for (uint8_t index = 0; index < _num_states; index++) {
+			record.variance[index] = FlightRecorder::dequantiseVariance(_variance[index]);
+		}
+
+		return true;
+
+	case FLIGHT_RECORDER_STATUS:
+		if (position + 6 > length) {
+			break;
+		}
+
+		memcpy(&record.control_status, &data[position], sizeof(uint16_t));
+		memcpy(&record.fault_status, &data[position + 2], sizeof(uint16_t));
+		memcpy(&record.innov_check_fail_status, &data[position + 4], sizeof(uint16_t));
+		return true;
+	}
+
+	_valid = false;
+	return false;
+}
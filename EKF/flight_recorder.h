@@ -0,0 +1,213 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file flight_recorder.h
+ * Fixed memory recorder of the estimator internals for post incident analysis.
+ *
+ * Each observation fusion, each change of the status words and the covariance matrix diagonal after each
+ * filter update are stored in a byte ring buffer of fixed size, with the oldest records overwritten first.
+ * Values are quantised and time stamps and variances are delta encoded so a typical record uses a few bytes,
+ * which allows the records to be written at the full filter rate.
+ *
+ * When triggered, recording continues until half of the buffer has been written and then stops, so the frozen
+ * contents hold the history both before and after the trigger. The contents are copied out with dump() and
+ * decoded on the ground with FlightRecorderReader, which returns the status before the first record as an
+ * initial status record.
+ *
+ * Dump layout, little endian:
+ * uint64 time_us              time stamp the first record is relative to
+ * uint16 status[3]            control, fault and innovation check status before the first record
+ * uint8  num_states           number of covariance diagonal elements
+ * int16  variance[num_states] quantised variances the first covariance record is relative to
+ * records, oldest first, each starting with a uint8 length in bytes that includes the length byte
+ *
+ * Record layout, after the length byte:
+ * uint8  type                 flight_recorder_record_type
+ * varint dt_us                time since the previous record
+ * FLIGHT_RECORDER_FUSION      uint8 observation | rejected << 7, int8 innovation / standard deviation * 16,
+ *                             uint8 log innovation variance, uint8 log test ratio
+ * FLIGHT_RECORDER_COVARIANCE  uint8 num_states, uint8 changed[3] bit mask, zigzag varint change of each
+ *                             changed quantised variance
+ * FLIGHT_RECORDER_STATUS      uint16 control status, uint16 fault status, uint16 innovation check status
+ *
+ * Varints are unsigned LEB128. The log quantisation uses 8 steps per octave.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// memory used for the records in bytes
+#ifndef ECL_FLIGHT_RECORDER_BYTES
+#define ECL_FLIGHT_RECORDER_BYTES 8192
+#endif
+
+enum flight_recorder_record_type {
+	FLIGHT_RECORDER_FUSION = 1,	// innovation consistency check of a single observation
+	FLIGHT_RECORDER_COVARIANCE,	// covariance matrix diagonal after a filter update
+	FLIGHT_RECORDER_STATUS		// new value of the control, fault or innovation check status
+};
+
+// observations that are recorded by the fusion records
+enum flight_recorder_observation {
+	FLIGHT_RECORDER_VEL_N = 0,
+	FLIGHT_RECORDER_VEL_E,
+	FLIGHT_RECORDER_VEL_D,
+	FLIGHT_RECORDER_POS_N,
+	FLIGHT_RECORDER_POS_E,
+	FLIGHT_RECORDER_HGT,
+	FLIGHT_RECORDER_MAG_X,
+	FLIGHT_RECORDER_MAG_Y,
+	FLIGHT_RECORDER_MAG_Z,
+	FLIGHT_RECORDER_HEADING,
+	FLIGHT_RECORDER_AIRSPEED,
+	FLIGHT_RECORDER_SIDESLIP,
+	FLIGHT_RECORDER_DRAG_X,
+	FLIGHT_RECORDER_DRAG_Y,
+	FLIGHT_RECORDER_FLOW_X,
+	FLIGHT_RECORDER_FLOW_Y,
+	FLIGHT_RECORDER_HAGL,
+	FLIGHT_RECORDER_NUM_OBSERVATIONS
+};
+
+// a decoded record, only the fields for the record type are set
+struct flight_recorder_record {
+	flight_recorder_record_type type;
+	uint64_t time_us;
+
+	// FLIGHT_RECORDER_FUSION
+	uint8_t observation;		// flight_recorder_observation
+	bool rejected;			// true if the observation failed the innovation consistency check
+	float innov;			// innovation, resolution 1/16 of the innovation standard deviation
+	float innov_var;		// innovation variance, resolution 9%
+	float test_ratio;		// innovation test ratio, resolution 9%
+
+	// FLIGHT_RECORDER_COVARIANCE
+	uint8_t num_states;
+	float variance[24];		// covariance matrix diagonal, resolution 4.4%
+
+	// FLIGHT_RECORDER_STATUS
+	uint16_t control_status;
+	uint16_t fault_status;
+	uint16_t innov_check_fail_status;
+};
+
+class FlightRecorder
+{
+public:
+	static const size_t CAPACITY = ECL_FLIGHT_RECORDER_BYTES;
+	static const uint8_t MAX_STATES = 24;
+
+	FlightRecorder() { reset(); }
+
+	// discard all records and restart recording
+	void reset();
+
+	void recordFusion(uint64_t time_us, uint8_t observation, float innov, float innov_var, float test_ratio,
+			  bool rejected);
+	void recordCovariance(uint64_t time_us, const float *variance, uint8_t num_states);
+	void recordStatus(uint64_t time_us, uint16_t control_status, uint16_t fault_status,
+			  uint16_t innov_check_fail_status);
+
+	// stop recording after half of the buffer has been written, does nothing if already triggered
+	void trigger();
+
+	bool triggered() const { return _triggered; }
+	bool frozen() const { return _frozen; }
+
+	// number of bytes needed by dump()
+	size_t dumpSize() const;
+
+	// copy the records to a buffer in the layout described above, returns the number of bytes written
+	// or 0 if the buffer is too small
+	size_t dump(uint8_t *buffer, size_t size) const;
+
+	// quantisation used by the records
+	static uint8_t quantiseLog(float value);
+	static float dequantiseLog(uint8_t value);
+	static int16_t quantiseVariance(float variance);
+	static float dequantiseVariance(int16_t value);
+
+private:
+	static const uint8_t MAX_RECORD_LENGTH = 128;
+
+	uint8_t _buffer[CAPACITY];
+	size_t _head;			// index the next record is written to
+	size_t _tail;			// index of the oldest record
+	size_t _used;			// number of bytes used by records
+
+	// state the oldest record is relative to
+	uint64_t _tail_time_us;
+	uint16_t _tail_status[3];
+	int16_t _tail_variance[MAX_STATES];
+
+	// state the next record is relative to
+	uint64_t _head_time_us;
+	int16_t _head_variance[MAX_STATES];
+
+	bool _triggered;
+	bool _frozen;
+	size_t _post_trigger_bytes;	// bytes still to be written before recording stops
+
+	// start a record of the given type, returns the position after the time stamp
+	uint8_t beginRecord(uint8_t *record, flight_recorder_record_type type, uint64_t time_us);
+
+	// add a record to the ring, removing the oldest records to make space
+	void write(const uint8_t *record, uint8_t length);
+
+	// remove the oldest record and apply it to the tail state
+	void dropOldest();
+};
+
+// decodes the records of a flight recorder dump in time order
+class FlightRecorderReader
+{
+public:
+	FlightRecorderReader(const uint8_t *dump, size_t length);
+
+	// decode the next record, returns false at the end of the dump or if the dump is corrupt
+	bool next(flight_recorder_record &record);
+
+private:
+	const uint8_t *_data;
+	size_t _length;
+	size_t _position;
+	uint64_t _time_us;
+	uint16_t _status[3];
+	uint8_t _num_states;
+	int16_t _variance[FlightRecorder::MAX_STATES];
+	bool _valid;
+	bool _status_returned;	// true when the initial status has been returned
+};
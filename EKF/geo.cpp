@@ -197,12 +197,11 @@ float get_lookup_table_val(unsigned lat_index, unsigned lon_index)
  * formulas according to: http://mathworld.wolfram.com/AzimuthalEquidistantProjection.html
  */
 
-static struct map_projection_reference_s mp_ref = {0.0, 0.0, 0.0, 0.0, false, 0};
-static struct globallocal_converter_reference_s gl_ref = {0.0f, false};
+static MapProjection global_projection;
 
 bool map_projection_global_initialized()
 {
-	return map_projection_initialized(&mp_ref);
+	return global_projection.initialized();
 }
 
 bool map_projection_initialized(const struct map_projection_reference_s *ref)
@@ -212,7 +211,7 @@ bool map_projection_initialized(const struct map_projection_reference_s *ref)
 
 uint64_t map_projection_global_timestamp()
 {
-	return map_projection_timestamp(&mp_ref);
+	return global_projection.timestamp();
 }
 
 uint64_t map_projection_timestamp(const struct map_projection_reference_s *ref)
@@ -223,7 +222,7 @@ uint64_t map_projection_timestamp(const struct map_projection_reference_s *ref)
 int map_projection_global_init(double lat_0, double lon_0,
 			       uint64_t timestamp) //lat_0, lon_0 are expected to be in correct format: -> 47.1234567 and not 471234567
 {
-	return map_projection_init_timestamped(&mp_ref, lat_0, lon_0, timestamp);
+	return global_projection.init(lat_0, lon_0, timestamp);
 }
 
 int map_projection_init_timestamped(struct map_projection_reference_s *ref, double lat_0, double lon_0,
@@ -243,7 +242,7 @@ int map_projection_init_timestamped(struct map_projection_reference_s *ref, doub
 
 int map_projection_global_reference(double *ref_lat_rad, double *ref_lon_rad)
 {
-	return map_projection_reference(&mp_ref, ref_lat_rad, ref_lon_rad);
+	return global_projection.reference(ref_lat_rad, ref_lon_rad);
 }
 
 int map_projection_reference(const struct map_projection_reference_s *ref, double *ref_lat_rad,
@@ -261,7 +260,7 @@ int map_projection_reference(const struct map_projection_reference_s *ref, doubl
 
 int map_projection_global_project(double lat, double lon, float *x, float *y)
 {
-	return map_projection_project(&mp_ref, lat, lon, x, y);
+	return global_projection.project(lat, lon, x, y);
 
 }
 
@@ -299,7 +298,7 @@ int map_projection_project(const struct map_projection_reference_s *ref, double
 
 int map_projection_global_reproject(float x, float y, double *lat, double *lon)
 {
-	return map_projection_reproject(&mp_ref, x, y, lat, lon);
+	return global_projection.reproject(x, y, lat, lon);
 }
 
 int map_projection_reproject(const struct map_projection_reference_s *ref, float x, float y, double *lat,
@@ -333,78 +332,233 @@ int map_projection_reproject(const struct map_projection_reference_s *ref, float
 	return 0;
 }
 
-int map_projection_global_getref(double *lat_0, double *lon_0)
+int map_projection_project_array(const struct map_projection_reference_s *ref, const double *lat, const double *lon,
+				 float *x, float *y, unsigned count)
 {
-	if (!map_projection_global_initialized()) {
+	if (!map_projection_initialized(ref)) {
 		return -1;
 	}
 
-	if (lat_0 != nullptr) {
-		*lat_0 = M_RAD_TO_DEG * mp_ref.lat_rad;
-	}
+	const double ref_lon_rad = ref->lon_rad;
+	const double ref_sin_lat = ref->sin_lat;
+	const double ref_cos_lat = ref->cos_lat;
 
-	if (lon_0 != nullptr) {
-		*lon_0 = M_RAD_TO_DEG * mp_ref.lon_rad;
+	for (unsigned i = 0; i < count; i++) {
+		double lat_rad = lat[i] * M_DEG_TO_RAD;
+		double d_lon = lon[i] * M_DEG_TO_RAD - ref_lon_rad;
+
+		double sin_lat = sin(lat_rad);
+		double cos_lat = cos(lat_rad);
+		double cos_d_lon = cos(d_lon);
+
+		double arg = fmin(fmax(ref_sin_lat * sin_lat + ref_cos_lat * cos_lat * cos_d_lon, -1.0), 1.0);
+
+		double c = acos(arg);
+		double k = (fabs(c) < DBL_EPSILON) ? 1.0 : (c / sin(c));
+
+		x[i] = k * (ref_cos_lat * sin_lat - ref_sin_lat * cos_lat * cos_d_lon) * CONSTANTS_RADIUS_OF_EARTH;
+		y[i] = k * cos_lat * sin(d_lon) * CONSTANTS_RADIUS_OF_EARTH;
 	}
 
 	return 0;
+}
+
+int map_projection_reproject_array(const struct map_projection_reference_s *ref, const float *x, const float *y,
+				   double *lat, double *lon, unsigned count)
+{
+	if (!map_projection_initialized(ref)) {
+		return -1;
+	}
+
+	const double ref_lat_rad = ref->lat_rad;
+	const double ref_lon_rad = ref->lon_rad;
+	const double ref_sin_lat = ref->sin_lat;
+	const double ref_cos_lat = ref->cos_lat;
+
+	for (unsigned i = 0; i < count; i++) {
+		double x_rad = x[i] / CONSTANTS_RADIUS_OF_EARTH;
+		double y_rad = y[i] / CONSTANTS_RADIUS_OF_EARTH;
+		double c = sqrtf(x_rad * x_rad + y_rad * y_rad);
+		double sin_c = sin(c);
+		double cos_c = cos(c);
+
+		double lat_rad = ref_lat_rad;
+		double lon_rad = ref_lon_rad;
+
+		if (fabs(c) > DBL_EPSILON) {
+			lat_rad = asin(cos_c * ref_sin_lat + (x_rad * sin_c * ref_cos_lat) / c);
+			lon_rad = (ref_lon_rad + atan2(y_rad * sin_c, c * ref_cos_lat * cos_c - x_rad * ref_sin_lat * sin_c));
+		}
 
+		lat[i] = lat_rad * 180.0 / M_PI;
+		lon[i] = lon_rad * 180.0 / M_PI;
+	}
+
+	return 0;
 }
-int globallocalconverter_init(double lat_0, double lon_0, float alt_0, uint64_t timestamp)
+
+int map_projection_project_array_fast(const struct map_projection_reference_s *ref, const double *lat,
+				      const double *lon, float *x, float *y, unsigned count)
 {
-	gl_ref.alt = alt_0;
+	if (!map_projection_initialized(ref)) {
+		return -1;
+	}
 
-	if (!map_projection_global_init(lat_0, lon_0, timestamp)) {
-		gl_ref.init_done = true;
-		return 0;
+	// the offsets from the reference are formed in double precision before conversion to float, using
+	// the same angle conversion as map_projection_project()
+	const double ref_lat_rad = ref->lat_rad;
+	const double ref_lon_rad = ref->lon_rad;
+	const float ref_sin_lat = (float)ref->sin_lat;
+	const float ref_cos_lat = (float)ref->cos_lat;
+	const float two_pi = 2.0f * M_PI_F;
 
-	} else {
-		gl_ref.init_done = false;
+	for (unsigned i = 0; i < count; i++) {
+		const float d_lat = (float)(lat[i] * M_DEG_TO_RAD - ref_lat_rad);
+		float d_lon = (float)(lon[i] * M_DEG_TO_RAD - ref_lon_rad);
+
+		// wrap the longitude offset across the 180 deg meridian
+		d_lon -= two_pi * floorf(d_lon / two_pi + 0.5f);
+
+		// first order expansion of the cosine of the point latitude
+		const float cos_lat = ref_cos_lat - ref_sin_lat * d_lat;
+
+		// the north position includes the second order convergence of the meridians
+		x[i] = CONSTANTS_RADIUS_OF_EARTH * (d_lat + 0.5f * ref_sin_lat * ref_cos_lat * d_lon * d_lon);
+		y[i] = CONSTANTS_RADIUS_OF_EARTH * d_lon * cos_lat;
+	}
+
+	return 0;
+}
+
+int map_projection_reproject_array_fast(const struct map_projection_reference_s *ref, const float *x,
+					const float *y, double *lat, double *lon, unsigned count)
+{
+	if (!map_projection_initialized(ref)) {
 		return -1;
 	}
+
+	const double ref_lat_rad = ref->lat_rad;
+	const double ref_lon_rad = ref->lon_rad;
+	const float ref_sin_lat = (float)ref->sin_lat;
+	const float ref_cos_lat = (float)ref->cos_lat;
+	const float inv_radius = 1.0f / CONSTANTS_RADIUS_OF_EARTH;
+
+	for (unsigned i = 0; i < count; i++) {
+		// the longitude offset is calculated using the uncorrected latitude offset, which is then corrected
+		// for the convergence of the meridians
+		const float x_rad = x[i] * inv_radius;
+		const float d_lon = y[i] * inv_radius / (ref_cos_lat - ref_sin_lat * x_rad);
+		const float d_lat = x_rad - 0.5f * ref_sin_lat * ref_cos_lat * d_lon * d_lon;
+
+		lat[i] = (ref_lat_rad + (double)d_lat) * 180.0 / M_PI;
+		lon[i] = (ref_lon_rad + (double)d_lon) * 180.0 / M_PI;
+	}
+
+	return 0;
+}
+
+int map_projection_global_getref(double *lat_0, double *lon_0)
+{
+	return global_projection.getref(lat_0, lon_0);
+}
+
+int globallocalconverter_init(double lat_0, double lon_0, float alt_0, uint64_t timestamp)
+{
+	return global_projection.init_globallocal(lat_0, lon_0, alt_0, timestamp);
 }
 
 bool globallocalconverter_initialized()
 {
-	return gl_ref.init_done && map_projection_global_initialized();
+	return global_projection.globallocal_initialized();
 }
 
 int globallocalconverter_tolocal(double lat, double lon, float alt, float *x, float *y, float *z)
 {
-	if (!map_projection_global_initialized()) {
+	return global_projection.tolocal(lat, lon, alt, x, y, z);
+}
+
+int globallocalconverter_toglobal(float x, float y, float z,  double *lat, double *lon, float *alt)
+{
+	return global_projection.toglobal(x, y, z, lat, lon, alt);
+}
+
+int globallocalconverter_getref(double *lat_0, double *lon_0, float *alt_0)
+{
+	return global_projection.getref(lat_0, lon_0, alt_0);
+}
+
+int MapProjection::init(double lat_0, double lon_0, uint64_t timestamp)
+{
+	return map_projection_init_timestamped(&_ref, lat_0, lon_0, timestamp);
+}
+
+int MapProjection::getref(double *lat_0, double *lon_0) const
+{
+	if (!initialized()) {
 		return -1;
 	}
 
-	map_projection_global_project(lat, lon, x, y);
-	*z = gl_ref.alt - alt;
+	if (lat_0 != nullptr) {
+		*lat_0 = M_RAD_TO_DEG * _ref.lat_rad;
+	}
+
+	if (lon_0 != nullptr) {
+		*lon_0 = M_RAD_TO_DEG * _ref.lon_rad;
+	}
 
 	return 0;
 }
 
-int globallocalconverter_toglobal(float x, float y, float z,  double *lat, double *lon, float *alt)
+int MapProjection::init_globallocal(double lat_0, double lon_0, float alt_0, uint64_t timestamp)
 {
-	if (!map_projection_global_initialized()) {
+	_gl_ref.alt = alt_0;
+
+	if (!init(lat_0, lon_0, timestamp)) {
+		_gl_ref.init_done = true;
+		return 0;
+
+	} else {
+		_gl_ref.init_done = false;
 		return -1;
 	}
+}
 
-	map_projection_global_reproject(x, y, lat, lon);
-	*alt = gl_ref.alt - z;
+int MapProjection::tolocal(double lat, double lon, float alt, float *x, float *y, float *z) const
+{
+	if (!initialized()) {
+		return -1;
+	}
+
+	project(lat, lon, x, y);
+	*z = _gl_ref.alt - alt;
 
 	return 0;
 }
 
-int globallocalconverter_getref(double *lat_0, double *lon_0, float *alt_0)
+int MapProjection::toglobal(float x, float y, float z,  double *lat, double *lon, float *alt) const
 {
-	if (!map_projection_global_initialized()) {
+	if (!initialized()) {
 		return -1;
 	}
 
-	if (map_projection_global_getref(lat_0, lon_0)) {
+	reproject(x, y, lat, lon);
+	*alt = _gl_ref.alt - z;
+
+	return 0;
+}
+
+int MapProjection::getref(double *lat_0, double *lon_0, float *alt_0) const
+{
+	if (!initialized()) {
+		return -1;
+	}
+
+	if (getref(lat_0, lon_0)) {
 		return -1;
 	}
 
 	if (alt_0 != nullptr) {
-		*alt_0 = gl_ref.alt;
+		*alt_0 = _gl_ref.alt;
 	}
 
 	return 0;
@@ -428,6 +582,27 @@ float get_distance_to_next_waypoint(double lat_now, double lon_now, double lat_n
 	return CONSTANTS_RADIUS_OF_EARTH * c;
 }
 
+void get_distance_to_next_waypoint_array(double lat_now, double lon_now, const double *lat_next,
+		const double *lon_next, float *dist, unsigned count)
+{
+	double lat_now_rad = lat_now / (double)180.0 * M_PI;
+	double lon_now_rad = lon_now / (double)180.0 * M_PI;
+	double cos_lat_now = cos(lat_now_rad);
+
+	for (unsigned i = 0; i < count; i++) {
+		double lat_next_rad = lat_next[i] / (double)180.0 * M_PI;
+		double lon_next_rad = lon_next[i] / (double)180.0 * M_PI;
+
+		double sin_half_d_lat = sin((lat_next_rad - lat_now_rad) / (double)2.0);
+		double sin_half_d_lon = sin((lon_next_rad - lon_now_rad) / (double)2.0);
+
+		double a = sin_half_d_lat * sin_half_d_lat + sin_half_d_lon * sin_half_d_lon * cos_lat_now * cos(lat_next_rad);
+		double c = (double)2.0 * atan2(sqrt(a), sqrt((double)1.0 - a));
+
+		dist[i] = CONSTANTS_RADIUS_OF_EARTH * c;
+	}
+}
+
 void create_waypoint_from_line_and_dist(double lat_A, double lon_A, double lat_B, double lon_B, float dist,
 					double *lat_target, double *lon_target)
 {
@@ -188,6 +188,57 @@ int map_projection_global_reproject(float x, float y, double *lat, double *lon);
 int map_projection_reproject(const struct map_projection_reference_s *ref, float x, float y, double *lat,
 			     double *lon);
 
+/**
+ * Transforms an array of points in the geographic coordinate system to the local
+ * azimuthal equidistant plane using the projection given by the argument.
+ * Gives the same result as calling map_projection_project() for each point.
+ *
+ * @param lat array of latitudes in degrees (47.1234567°, not 471234567°)
+ * @param lon array of longitudes in degrees (8.1234567°, not 81234567°)
+ * @param x array of north positions (m)
+ * @param y array of east positions (m)
+ * @param count number of points
+ * @return 0 if map_projection_init was called before, -1 else
+ */
+int map_projection_project_array(const struct map_projection_reference_s *ref, const double *lat, const double *lon,
+				 float *x, float *y, unsigned count);
+
+/**
+ * Transforms an array of points in the local azimuthal equidistant plane to the
+ * geographic coordinate system using the projection given by the argument.
+ * Gives the same result as calling map_projection_reproject() for each point.
+ *
+ * @param x array of north positions (m)
+ * @param y array of east positions (m)
+ * @param lat array of latitudes in degrees (47.1234567°, not 471234567°)
+ * @param lon array of longitudes in degrees (8.1234567°, not 81234567°)
+ * @param count number of points
+ * @return 0 if map_projection_init was called before, -1 else
+ */
+int map_projection_reproject_array(const struct map_projection_reference_s *ref, const float *x, const float *y,
+				   double *lat, double *lon, unsigned count);
+
+/**
+ * Fast single precision approximation of map_projection_project_array() for points close to the
+ * reference. Uses a second order expansion of the projection about the reference, so that the
+ * loop contains no trigonometry and can be vectorised. The position error relative to
+ * map_projection_project() is below 0.005% of the distance from the reference for distances
+ * up to 10 km below 80 deg latitude.
+ *
+ * @return 0 if map_projection_init was called before, -1 else
+ */
+int map_projection_project_array_fast(const struct map_projection_reference_s *ref, const double *lat,
+				      const double *lon, float *x, float *y, unsigned count);
+
+/**
+ * Fast single precision approximation of map_projection_reproject_array(), the inverse of
+ * map_projection_project_array_fast() with the same error bound.
+ *
+ * @return 0 if map_projection_init was called before, -1 else
+ */
+int map_projection_reproject_array_fast(const struct map_projection_reference_s *ref, const float *x,
+					const float *y, double *lat, double *lon, unsigned count);
+
 /**
  * Get reference position of the global map projection
  */
@@ -219,6 +270,46 @@ int globallocalconverter_toglobal(float x, float y, float z,  double *lat, doubl
  */
 int globallocalconverter_getref(double *lat_0, double *lon_0, float *alt_0);
 
+/**
+ * Instance based map projection and global to local converter.
+ *
+ * Each instance holds its own reference, so that multiple estimators or planners in one process
+ * can use different references without sharing the global projection state. The functions have the
+ * same behaviour and return values as the map_projection_global_* and globallocalconverter_*
+ * functions, which are implemented using a single global instance. An instance is not locked
+ * internally and must not be re-initialised by one thread while it is being used by another.
+ */
+class MapProjection
+{
+public:
+	MapProjection() = default;
+	~MapProjection() = default;
+
+	// map projection using the reference position (lat_0, lon_0 in degrees)
+	int init(double lat_0, double lon_0, uint64_t timestamp);
+	bool initialized() const { return map_projection_initialized(&_ref); }
+	uint64_t timestamp() const { return map_projection_timestamp(&_ref); }
+	int reference(double *ref_lat_rad, double *ref_lon_rad) const { return map_projection_reference(&_ref, ref_lat_rad, ref_lon_rad); }
+	int getref(double *lat_0, double *lon_0) const;
+	int project(double lat, double lon, float *x, float *y) const { return map_projection_project(&_ref, lat, lon, x, y); }
+	int reproject(float x, float y, double *lat, double *lon) const { return map_projection_reproject(&_ref, x, y, lat, lon); }
+	int project(const double *lat, const double *lon, float *x, float *y, unsigned count) const { return map_projection_project_array(&_ref, lat, lon, x, y, count); }
+	int reproject(const float *x, const float *y, double *lat, double *lon, unsigned count) const { return map_projection_reproject_array(&_ref, x, y, lat, lon, count); }
+
+	// global to local converter using the reference position and altitude (alt_0 in meters)
+	int init_globallocal(double lat_0, double lon_0, float alt_0, uint64_t timestamp);
+	bool globallocal_initialized() const { return _gl_ref.init_done && initialized(); }
+	int tolocal(double lat, double lon, float alt, float *x, float *y, float *z) const;
+	int toglobal(float x, float y, float z, double *lat, double *lon, float *alt) const;
+	int getref(double *lat_0, double *lon_0, float *alt_0) const;
+
+	const struct map_projection_reference_s &get_reference() const { return _ref; }
+
+private:
+	struct map_projection_reference_s _ref {0.0, 0.0, 0.0, 0.0, false, 0};
+	struct globallocal_converter_reference_s _gl_ref {0.0f, false};
+};
+
 /**
  * Returns the distance to the next waypoint in meters.
  *
@@ -230,6 +321,20 @@ int globallocalconverter_getref(double *lat_0, double *lon_0, float *alt_0);
 float get_distance_to_next_waypoint(double lat_now, double lon_now, double lat_next, double lon_next);
 
 
+/**
+ * Returns the distance from the current position to each waypoint in an array, giving the
+ * same result as calling get_distance_to_next_waypoint() for each waypoint.
+ *
+ * @param lat_now current position in degrees (47.1234567°, not 471234567°)
+ * @param lon_now current position in degrees (8.1234567°, not 81234567°)
+ * @param lat_next array of waypoint latitudes in degrees (47.1234567°, not 471234567°)
+ * @param lon_next array of waypoint longitudes in degrees (8.1234567°, not 81234567°)
+ * @param dist array of distances (m)
+ * @param count number of waypoints
+ */
+void get_distance_to_next_waypoint_array(double lat_now, double lon_now, const double *lat_next,
+		const double *lon_next, float *dist, unsigned count);
+
 /**
  * Creates a new waypoint C on the line of two given waypoints (A, B) at certain distance
  * from waypoint A
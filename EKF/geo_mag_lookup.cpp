@@ -0,0 +1,125 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file geo_mag_lookup.cpp
+ * The grid position is converted to Q15 fixed-point table cells once per query, and the clamping
+ * to the table bounds is done with min/max operations so that the interpolation has no data
+ * dependent branches.
+ *
+ * Lookup table from Scott Ferguson <scottfromscott@gmail.com>, 10 deg sampling resolution.
+ *
+ */
+
+#include "geo_mag_lookup.h"
+
+#include <algorithm>
+#include <math.h>
+
+// table sampling resolution and bounds (deg)
+static constexpr float SAMPLING_RES = 10.0f;
+static constexpr float SAMPLING_MIN_LAT = -60.0f;
+static constexpr float SAMPLING_MAX_LAT = 60.0f;
+static constexpr float SAMPLING_MIN_LON = -180.0f;
+static constexpr float SAMPLING_MAX_LON = 180.0f;
+
+static constexpr int LAT_CELLS = 12;
+static constexpr int LON_CELLS = 36;
+
+// number of fractional bits used for the position within a cell
+static constexpr int FRAC_BITS = 15;
+static constexpr int32_t FRAC_ONE = 1 << FRAC_BITS;
+
+// declination (deg) indexed by latitude then longitude
+static constexpr int8_t declination_table[LAT_CELLS + 1][LON_CELLS + 1] = {
+	{ 46, 45, 44, 42, 41, 40, 38, 36, 33, 28, 23, 16, 10, 4, -1, -5, -9, -14, -19, -26, -33, -40, -48, -55, -61, -66, -71, -74, -75, -72, -61, -25, 22, 40, 45, 47, 46 },
+	{ 30, 30, 30, 30, 29, 29, 29, 29, 27, 24, 18, 11, 3, -3, -9, -12, -15, -17, -21, -26, -32, -39, -45, -51, -55, -57, -56, -53, -44, -31, -14, 0, 13, 21, 26, 29, 30 },
+	{ 21, 22, 22, 22, 22, 22, 22, 22, 21, 18, 13, 5, -3, -11, -17, -20, -21, -22, -23, -25, -29, -35, -40, -44, -45, -44, -40, -32, -22, -12, -3, 3, 9, 14, 18, 20, 21 },
+	{ 16, 17, 17, 17, 17, 17, 16, 16, 16, 13, 8, 0, -9, -16, -21, -24, -25, -25, -23, -20, -21, -24, -28, -31, -31, -29, -24, -17, -9, -3, 0, 4, 7, 10, 13, 15, 16 },
+	{ 12, 13, 13, 13, 13, 13, 12, 12, 11, 9, 3, -4, -12, -19, -23, -24, -24, -22, -17, -12, -9, -10, -13, -17, -18, -16, -13, -8, -3, 0, 1, 3, 6, 8, 10, 12, 12 },
+	{ 10, 10, 10, 10, 10, 10, 10, 9, 9, 6, 0, -6, -14, -20, -22, -22, -19, -15, -10, -6, -2, -2, -4, -7, -8, -8, -7, -4, 0, 1, 1, 2, 4, 6, 8, 10, 10 },
+	{ 9, 9, 9, 9, 9, 9, 8, 8, 7, 4, -1, -8, -15, -19, -20, -18, -14, -9, -5, -2, 0, 1, 0, -2, -3, -4, -3, -2, 0, 0, 0, 1, 3, 5, 7, 8, 9 },
+	{ 8, 8, 8, 9, 9, 9, 8, 8, 6, 2, -3, -9, -15, -18, -17, -14, -10, -6, -2, 0, 1, 2, 2, 0, -1, -1, -2, -1, 0, 0, 0, 0, 1, 3, 5, 7, 8 },
+	{ 8, 9, 9, 10, 10, 10, 10, 8, 5, 0, -5, -11, -15, -16, -15, -12, -8, -4, -1, 0, 2, 3, 2, 1, 0, 0, 0, 0, 0, -1, -2, -2, -1, 0, 3, 6, 8 },
+	{ 6, 9, 10, 11, 12, 12, 11, 9, 5, 0, -7, -12, -15, -15, -13, -10, -7, -3, 0, 1, 2, 3, 3, 3, 2, 1, 0, 0, -1, -3, -4, -5, -5, -2, 0, 3, 6 },
+	{ 5, 8, 11, 13, 15, 15, 14, 11, 5, -1, -9, -14, -17, -16, -14, -11, -7, -3, 0, 1, 3, 4, 5, 5, 5, 4, 3, 1, -1, -4, -7, -8, -8, -6, -2, 1, 5 },
+	{ 4, 8, 12, 15, 17, 18, 16, 12, 5, -3, -12, -18, -20, -19, -16, -13, -8, -4, -1, 1, 4, 6, 8, 9, 9, 9, 7, 3, -1, -6, -10, -12, -11, -9, -5, 0, 4 },
+	{ 3, 9, 14, 17, 20, 21, 19, 14, 4, -8, -19, -25, -26, -25, -21, -17, -12, -7, -2, 1, 5, 9, 13, 15, 16, 16, 13, 7, 0, -7, -12, -15, -14, -11, -6, -1, 3 },
+};
+
+float GeoMagLookup::get_declination(float lat, float lon)
+{
+	// If the values exceed valid ranges, return zero as default as we have no way of knowing
+	// what the closest real value would be. This also rejects NaN inputs.
+	if (!(lat >= -90.0f && lat <= 90.0f && lon >= -180.0f && lon <= 180.0f)) {
+		return 0.0f;
+	}
+
+	// position in fixed-point table cells, with latitudes outside the table using the bounding values
+	const float scale = (float)FRAC_ONE / SAMPLING_RES;
+	int32_t x = (int32_t)((std::min(std::max(lon, SAMPLING_MIN_LON), SAMPLING_MAX_LON) - SAMPLING_MIN_LON) * scale);
+	int32_t y = (int32_t)((std::min(std::max(lat, SAMPLING_MIN_LAT), SAMPLING_MAX_LAT) - SAMPLING_MIN_LAT) * scale);
+
+	// index of the south west corner of the cell, using the last cell on the upper bounds
+	const int lon_index = std::min(x >> FRAC_BITS, (int32_t)(LON_CELLS - 1));
+	const int lat_index = std::min(y >> FRAC_BITS, (int32_t)(LAT_CELLS - 1));
+
+	if (!_cell_valid || lat_index != _lat_index || lon_index != _lon_index) {
+		load_cell(lat_index, lon_index);
+	}
+
+	// fractional position within the cell in the range 0 to FRAC_ONE
+	x -= lon_index << FRAC_BITS;
+	y -= lat_index << FRAC_BITS;
+
+	const int32_t declination = _coef[0] * FRAC_ONE + _coef[1] * x + _coef[2] * y + _coef[3] * ((x * y) >> FRAC_BITS);
+
+	return (float)declination * (1.0f / (float)FRAC_ONE);
+}
+
+void GeoMagLookup::load_cell(int lat_index, int lon_index)
+{
+	const int32_t sw = declination_table[lat_index][lon_index];
+	const int32_t se = declination_table[lat_index][lon_index + 1];
+	const int32_t nw = declination_table[lat_index + 1][lon_index];
+	const int32_t ne = declination_table[lat_index + 1][lon_index + 1];
+
+	_coef[0] = sw;
+	_coef[1] = se - sw;
+	_coef[2] = nw - sw;
+	_coef[3] = ne - nw - se + sw;
+
+	_lat_index = lat_index;
+	_lon_index = lon_index;
+	_cell_valid = true;
+}
@@ -0,0 +1,70 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file geo_mag_lookup.h
+ * Lookup of the earth magnetic field declination from a world grid using fixed-point bilinear
+ * interpolation. The interpolation coefficients of the last grid cell used are cached so that
+ * repeated queries in the same cell do not need to read the table.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+class GeoMagLookup
+{
+public:
+	GeoMagLookup() = default;
+	~GeoMagLookup() = default;
+
+	// return the magnetic declination (deg) at the specified WGS-84 latitude and longitude (deg)
+	// zero is returned if the position is outside the valid range
+	float get_declination(float lat, float lon);
+
+	// invalidate the cached grid cell
+	void reset() { _cell_valid = false; }
+
+private:
+	// load the interpolation coefficients for the grid cell with its south west corner at the specified table indices
+	void load_cell(int lat_index, int lon_index);
+
+	bool _cell_valid{false};	// true when the cached coefficients are valid
+	int _lat_index{0};		// latitude table index of the south west corner of the cached cell
+	int _lon_index{0};		// longitude table index of the south west corner of the cached cell
+
+	// coefficients of c0 + c1*x + c2*y + c3*x*y for the cached cell in table units, where x and y are the
+	// fractional east and north position within the cell
+	int32_t _coef[4] {};
+};
@@ -0,0 +1,230 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file gps_blending.cpp
+ * Combines the messages from several GPS receivers into a single message for the EKF.
+ *
+ */
+
+#include "gps_blending.h"
+#include "geo.h"
+
+#include <math.h>
+
+// distance per 1E-7 deg of latitude (m)
+static constexpr double lat_scale = 1.0e-7 * M_PI / 180.0 * CONSTANTS_RADIUS_OF_EARTH;
+
+GpsBlender::GpsBlender()
+{
+	reset();
+}
+
+void GpsBlender::reset()
+{
+	for (uint8_t i = 0; i < ECL_GPS_MAX_RECEIVERS; i++) {
+		_gps[i] = {};
+		_receive_time_us[i] = 0;
+		_updated[i] = false;
+		_hpos_weight[i] = 0.0f;
+	}
+
+	_blended = {};
+	_blended_receive_time_us = 0;
+}
+
+bool GpsBlender::update(uint8_t instance, const gps_message &gps, uint64_t time_us)
+{
+	if (instance >= ECL_GPS_MAX_RECEIVERS) {
+		return false;
+	}
+
+	_gps[instance] = gps;
+	_receive_time_us[instance] = time_us;
+	_updated[instance] = true;
+
+	// wait until every receiver that is still reporting has provided a new message, receivers are dropped from the
+	// blend when nothing has been received for more than the maximum GPS interval
+	for (uint8_t i = 0; i < ECL_GPS_MAX_RECEIVERS; i++) {
+		const bool active = (_receive_time_us[i] != 0) && (time_us - _receive_time_us[i] < (uint64_t)GPS_MAX_INTERVAL);
+
+		if (active && !_updated[i]) {
+			return false;
+
+		} else if (!active) {
+			// do not blend an old message from a receiver that has stopped reporting
+			_updated[i] = false;
+		}
+	}
+
+	blend(instance);
+
+	for (uint8_t i = 0; i < ECL_GPS_MAX_RECEIVERS; i++) {
+		_updated[i] = false;
+	}
+
+	return true;
+}
+
+void GpsBlender::blend(uint8_t newest)
+{
+	// the weights are the inverse variances of the receivers with a 3D fix that reported for this blend
+	float hpos_weight[ECL_GPS_MAX_RECEIVERS] {};
+	float vpos_weight[ECL_GPS_MAX_RECEIVERS] {};
+	float vel_weight[ECL_GPS_MAX_RECEIVERS] {};
+	float hpos_sum = 0.0f;
+	float vpos_sum = 0.0f;
+	float vel_sum = 0.0f;
+	uint8_t num_used = 0;
+	uint8_t last_used = 0;
+
+	for (uint8_t i = 0; i < ECL_GPS_MAX_RECEIVERS; i++) {
+		if (_updated[i] && _gps[i].fix_type >= 3) {
+			hpos_weight[i] = 1.0f / fmaxf(_gps[i].eph * _gps[i].eph, 1e-4f);
+			vpos_weight[i] = 1.0f / fmaxf(_gps[i].epv * _gps[i].epv, 1e-4f);
+			vel_weight[i] = 1.0f / fmaxf(_gps[i].sacc * _gps[i].sacc, 1e-4f);
+			hpos_sum += hpos_weight[i];
+			vpos_sum += vpos_weight[i];
+			vel_sum += vel_weight[i];
+			num_used++;
+			last_used = i;
+		}
+	}
+
+	// find the newest receive time of the messages in this blend
+	_blended_receive_time_us = 0;
+
+	for (uint8_t i = 0; i < ECL_GPS_MAX_RECEIVERS; i++) {
+		if (_updated[i] && _receive_time_us[i] > _blended_receive_time_us) {
+			_blended_receive_time_us = _receive_time_us[i];
+		}
+	}
+
+	if (num_used <= 1) {
+		// nothing to blend, pass the only usable or else the newest message through unchanged
+		const uint8_t selected = (num_used == 1) ? last_used : newest;
+
+		_blended = _gps[selected];
+
+		for (uint8_t i = 0; i < ECL_GPS_MAX_RECEIVERS; i++) {
+			_hpos_weight[i] = (i == selected) ? 1.0f : 0.0f;
+		}
+
+		return;
+	}
+
+	for (uint8_t i = 0; i < ECL_GPS_MAX_RECEIVERS; i++) {
+		hpos_weight[i] /= hpos_sum;
+		vpos_weight[i] /= vpos_sum;
+		vel_weight[i] /= vel_sum;
+		_hpos_weight[i] = hpos_weight[i];
+	}
+
+	// the blended measurement time is the position weighted average of the measurement times
+	const gps_message &ref = _gps[last_used];
+	double time_offset_us = 0.0;
+
+	for (uint8_t i = 0; i < ECL_GPS_MAX_RECEIVERS; i++) {
+		if (hpos_weight[i] > 0.0f) {
+			time_offset_us += (double)hpos_weight[i] * (double)((int64_t)(_gps[i].time_usec - ref.time_usec));
+		}
+	}
+
+	const uint64_t blended_time_us = ref.time_usec + (int64_t)llround(time_offset_us);
+
+	// blend the offsets of each receiver from the reference receiver after moving each position to the blended time
+	const double lon_scale = lat_scale * cos(ref.lat * 1.0e-7 * M_PI / 180.0);
+	double offset_n = 0.0;
+	double offset_e = 0.0;
+	double alt = 0.0;
+	float vel[3] = {};
+	float eph = 0.0f;
+	float epv = 0.0f;
+	float sacc = 0.0f;
+
+	_blended = ref;
+	_blended.nsats = 0;
+	_blended.fix_type = 0;
+	_blended.gdop = ref.gdop;
+	_blended.vel_ned_valid = true;
+
+	for (uint8_t i = 0; i < ECL_GPS_MAX_RECEIVERS; i++) {
+		if (hpos_weight[i] <= 0.0f) {
+			continue;
+		}
+
+		const gps_message &gps = _gps[i];
+		const float dt = 1e-6f * (float)((int64_t)(blended_time_us - gps.time_usec));
+
+		offset_n += (double)hpos_weight[i] * ((double)(gps.lat - ref.lat) * lat_scale + (double)(gps.vel_ned[0] * dt));
+		// wrap the longitude difference across the date line
+		int64_t delta_lon = (int64_t)gps.lon - (int64_t)ref.lon;
+
+		if (delta_lon > 1800000000) {
+			delta_lon -= 3600000000LL;
+
+		} else if (delta_lon < -1800000000) {
+			delta_lon += 3600000000LL;
+		}
+
+		offset_e += (double)hpos_weight[i] * ((double)delta_lon * lon_scale + (double)(gps.vel_ned[1] * dt));
+		alt += (double)vpos_weight[i] * (1e-3 * (double)gps.alt - (double)(gps.vel_ned[2] * dt));
+
+		for (uint8_t axis = 0; axis < 3; axis++) {
+			vel[axis] += vel_weight[i] * gps.vel_ned[axis];
+		}
+
+		// the reported errors of different receivers are correlated so a weighted average is used rather than the
+		// smaller combined uncertainty of independent measurements
+		eph += hpos_weight[i] * gps.eph;
+		epv += vpos_weight[i] * gps.epv;
+		sacc += vel_weight[i] * gps.sacc;
+
+		_blended.nsats += gps.nsats;
+		_blended.fix_type = gps.fix_type > _blended.fix_type ? gps.fix_type : _blended.fix_type;
+		_blended.gdop = fminf(_blended.gdop, gps.gdop);
+		_blended.vel_ned_valid = _blended.vel_ned_valid && gps.vel_ned_valid;
+	}
+
+	_blended.time_usec = blended_time_us;
+	_blended.lat = ref.lat + (int32_t)lround(offset_n / lat_scale);
+	_blended.lon = ref.lon + (int32_t)lround(offset_e / lon_scale);
+	_blended.alt = (int32_t)lround(alt * 1e3);
+	_blended.eph = eph;
+	_blended.epv = epv;
+	_blended.sacc = sacc;
+	_blended.vel_ned[0] = vel[0];
+	_blended.vel_ned[1] = vel[1];
+	_blended.vel_ned[2] = vel[2];
+	_blended.vel_m_s = sqrtf(vel[0] * vel[0] + vel[1] * vel[1]);
+}
@@ -0,0 +1,89 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file gps_blending.h
+ * Combines the messages from several GPS receivers into a single message for the EKF.
+ *
+ * The newest message from each receiver is held until every active receiver has reported. The positions are then
+ * time aligned to a common time using the reported velocity and averaged using weights from the inverse of the
+ * reported horizontal position, vertical position and speed variances.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <matrix/matrix/math.hpp>
+#include "common.h"
+
+using namespace estimator;
+
+// maximum number of receivers that can be blended
+#ifndef ECL_GPS_MAX_RECEIVERS
+#define ECL_GPS_MAX_RECEIVERS 2
+#endif
+
+class GpsBlender
+{
+public:
+	GpsBlender();
+	~GpsBlender() = default;
+
+	// forget all receiver data
+	void reset();
+
+	// store a message from the specified receiver received at time_us
+	// returns true when a new blended message is available
+	bool update(uint8_t instance, const gps_message &gps, uint64_t time_us);
+
+	// get the last blended message and the time the latest contributing message was received
+	const gps_message &get_blended() const { return _blended; }
+	uint64_t get_blended_receive_time() const { return _blended_receive_time_us; }
+
+	// get the weight given to each receiver in the last blended horizontal position
+	float get_weight(uint8_t instance) const { return instance < ECL_GPS_MAX_RECEIVERS ? _hpos_weight[instance] : 0.0f; }
+
+private:
+	// combine the stored messages into _blended, newest is the receiver that completed the set
+	void blend(uint8_t newest);
+
+	gps_message _gps[ECL_GPS_MAX_RECEIVERS] {};		// newest message from each receiver
+	uint64_t _receive_time_us[ECL_GPS_MAX_RECEIVERS] {};	// time the newest message was received (uSec)
+	bool _updated[ECL_GPS_MAX_RECEIVERS] {};		// true when the receiver has reported since the last blend
+	float _hpos_weight[ECL_GPS_MAX_RECEIVERS] {};		// horizontal position weight used by the last blend
+
+	gps_message _blended{};			// last blended message
+	uint64_t _blended_receive_time_us{0};	// time the latest message in the last blend was received (uSec)
+
+};
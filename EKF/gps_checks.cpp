@@ -79,7 +79,7 @@ bool Ekf::collect_gps(uint64_t time_usec, struct gps_message *gps)
 			_NED_origin_initialised = true;
 			_last_gps_origin_time_us = _time_last_imu;
 			// set the magnetic declination returned by the geo library using the current GPS position
-			_mag_declination_gps = math::radians(get_mag_declination(lat, lon));
+			_mag_declination_gps = math::radians(_geo_mag_lookup.get_declination((float)lat, (float)lon));
 			// save the horizontal and vertical position uncertainty of the origin
 			_gps_origin_eph = gps->eph;
 			_gps_origin_epv = gps->epv;
@@ -129,86 +129,25 @@ bool Ekf::gps_is_good(struct gps_message *gps)
 	// Check the reported speed accuracy
 	_gps_check_fail_status.flags.sacc = (gps->sacc > _params.req_sacc);
 
-	// Calculate position movement since last measurement
-	float delta_posN = 0.0f;
-	float delta_PosE = 0.0f;
-	double lat = gps->lat * 1.0e-7;
-	double lon = gps->lon * 1.0e-7;
+	// update the drift and speed statistics, limiting the drift rates to 10x the thresholds
+	_gps_monitor.update(*gps, _time_last_imu, 10.0f * _params.req_hdrift, 10.0f * _params.req_vdrift, _state.vel(2),
+			    !_control_status.flags.in_air);
 
-	// calculate position movement since last GPS fix
-	if (_gps_pos_prev.timestamp > 0) {
-		map_projection_project(&_gps_pos_prev, lat, lon, &delta_posN, &delta_PosE);
-	} else {
-		// no previous position has been set
-		map_projection_init_timestamped(&_gps_pos_prev, lat, lon, _time_last_imu);
-		_gps_alt_prev = 1e-3f * (float)gps->alt;
-	}
-
-	// Calculate time lapsed since last update, limit to prevent numerical errors and calculate the lowpass filter coefficient
-	const float filt_time_const = 10.0f;
-	float dt = fminf(fmaxf(float(_time_last_imu - _gps_pos_prev.timestamp) * 1e-6f, 0.001f), filt_time_const);
-	float filter_coef = dt / filt_time_const;
-
-	// save GPS fix for next time
-	map_projection_init_timestamped(&_gps_pos_prev, lat, lon, _time_last_imu);
-
-	// Calculate the horizontal drift velocity components and limit to 10x the threshold
-	float vel_limit = 10.0f * _params.req_hdrift;
-	float velN = fminf(fmaxf(delta_posN / dt, -vel_limit), vel_limit);
-	float velE = fminf(fmaxf(delta_PosE / dt, -vel_limit), vel_limit);
-
-	// Apply a low pass filter
-	_gpsDriftVelN = velN * filter_coef + _gpsDriftVelN * (1.0f - filter_coef);
-	_gpsDriftVelE = velE * filter_coef + _gpsDriftVelE * (1.0f - filter_coef);
-
-	// Calculate the horizontal drift speed and fail if too high
-	// This check can only be used if the vehicle is stationary during alignment
+	// The horizontal drift, vertical drift and horizontal speed checks can only be used if the vehicle is stationary
+	// during alignment
 	if (!_control_status.flags.in_air) {
-		float drift_speed = sqrtf(_gpsDriftVelN * _gpsDriftVelN + _gpsDriftVelE * _gpsDriftVelE);
-		_gps_check_fail_status.flags.hdrift = (drift_speed > _params.req_hdrift);
+		_gps_check_fail_status.flags.hdrift = (_gps_monitor.get_horizontal_drift() > _params.req_hdrift);
+		_gps_check_fail_status.flags.vdrift = (fabsf(_gps_monitor.get_vertical_drift()) > _params.req_vdrift);
+		_gps_check_fail_status.flags.hspeed = (_gps_monitor.get_horizontal_speed() > _params.req_hdrift);
 
 	} else {
 		_gps_check_fail_status.flags.hdrift = false;
-	}
-
-	// Calculate the vertical drift velocity and limit to 10x the threshold
-	vel_limit = 10.0f * _params.req_vdrift;
-	float gps_alt_m = 1e-3f * (float)gps->alt;
-	float velD = math::constrain(((_gps_alt_prev - gps_alt_m) / dt), -vel_limit, vel_limit);
-	_gps_alt_prev = gps_alt_m;
-
-	// Apply a low pass filter to the vertical velocity
-	_gps_drift_velD = velD * filter_coef + _gps_drift_velD * (1.0f - filter_coef);
-
-	// Fail if the vertical drift speed is too high
-	// This check can only be used if the vehicle is stationary during alignment
-	if (!_control_status.flags.in_air) {
-		_gps_check_fail_status.flags.vdrift = (fabsf(_gps_drift_velD) > _params.req_vdrift);
-
-	} else {
 		_gps_check_fail_status.flags.vdrift = false;
-	}
-
-	// Check the magnitude of the filtered horizontal GPS velocity
-	// This check can only be used if the vehicle is stationary during alignment
-	if (!_control_status.flags.in_air) {
-		vel_limit = 10.0f * _params.req_hdrift;
-		float gps_velN = fminf(fmaxf(gps->vel_ned[0], -vel_limit), vel_limit);
-		float gps_velE = fminf(fmaxf(gps->vel_ned[1], -vel_limit), vel_limit);
-		_gps_velN_filt = gps_velN * filter_coef + _gps_velN_filt * (1.0f - filter_coef);
-		_gps_velE_filt  = gps_velE * filter_coef + _gps_velE_filt  * (1.0f - filter_coef);
-		float horiz_speed = sqrtf(_gps_velN_filt * _gps_velN_filt + _gps_velE_filt * _gps_velE_filt);
-		_gps_check_fail_status.flags.hspeed = (horiz_speed > _params.req_hdrift);
-
-	} else {
 		_gps_check_fail_status.flags.hspeed = false;
 	}
 
-	// Check  the filtered difference between GPS and EKF vertical velocity
-	vel_limit = 10.0f * _params.req_vdrift;
-	float vertVel = fminf(fmaxf((gps->vel_ned[2] - _state.vel(2)), -vel_limit), vel_limit);
-	_gps_velD_diff_filt = vertVel * filter_coef + _gps_velD_diff_filt * (1.0f - filter_coef);
-	_gps_check_fail_status.flags.vspeed = (fabsf(_gps_velD_diff_filt) > _params.req_vdrift);
+	// Check the filtered difference between GPS and EKF vertical velocity
+	_gps_check_fail_status.flags.vspeed = (fabsf(_gps_monitor.get_vertical_velocity_error()) > _params.req_vdrift);
 
 	// assume failed first time through
 	if (_last_gps_fail_us == 0) {
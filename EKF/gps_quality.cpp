@@ -0,0 +1,180 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file gps_quality.cpp
+ * Incremental GPS quality statistics used by the GPS pre-flight and aiding checks.
+ *
+ * The position change between messages is calculated from the integer latitude and longitude difference using a
+ * flat earth approximation with a cached longitude scale factor. The separation between consecutive messages is
+ * small enough for the approximation error to be negligible and it avoids the trigonometric functions of a full
+ * map projection for every message.
+ *
+ */
+
+#include "gps_quality.h"
+#include "geo.h"
+#include "mathlib.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// distance per 1E-7 deg of latitude (m)
+static constexpr float lat_scale = (float)(1.0e-7 * M_PI / 180.0 * CONSTANTS_RADIUS_OF_EARTH);
+
+// change in latitude before the longitude scale factor is recalculated (1E-7 deg)
+static constexpr int32_t lat_scale_update = 100000;
+
+GpsQualityMonitor::GpsQualityMonitor()
+{
+	reset();
+}
+
+void GpsQualityMonitor::reset()
+{
+	_time_prev_us = 0;
+	_lat_prev = 0;
+	_lon_prev = 0;
+	_alt_prev = 0.0f;
+	_vel_ne_prev[0] = 0.0f;
+	_vel_ne_prev[1] = 0.0f;
+	_lat_scale_ref = 0;
+	_lon_scale = lat_scale;
+	_drift_vel_n = 0.0f;
+	_drift_vel_e = 0.0f;
+	_drift_vel_d = 0.0f;
+	_vel_n_filt = 0.0f;
+	_vel_e_filt = 0.0f;
+	_vel_d_diff_filt = 0.0f;
+	_vel_change_var = 0.0f;
+	_fix_filt = 0.0f;
+	_count = 0;
+}
+
+void GpsQualityMonitor::update(const gps_message &gps, uint64_t time_us, float hdrift_limit, float vdrift_limit,
+			       float vel_d_ekf, bool stationary)
+{
+	const float alt = 1e-3f * (float)gps.alt;
+
+	// calculate position movement since the last message
+	float delta_pos_n = 0.0f;
+	float delta_pos_e = 0.0f;
+
+	if (_count == 0) {
+		// no previous position has been set
+		_time_prev_us = time_us;
+		_alt_prev = alt;
+		_vel_ne_prev[0] = gps.vel_ned[0];
+		_vel_ne_prev[1] = gps.vel_ned[1];
+		_lat_scale_ref = gps.lat;
+		_lon_scale = lat_scale * cosf(math::radians(1e-7f * (float)gps.lat));
+
+	} else {
+		if (abs(gps.lat - _lat_scale_ref) > lat_scale_update) {
+			_lat_scale_ref = gps.lat;
+			_lon_scale = lat_scale * cosf(math::radians(1e-7f * (float)gps.lat));
+		}
+
+		// wrap the longitude difference across the date line
+		int64_t delta_lon = (int64_t)gps.lon - (int64_t)_lon_prev;
+
+		if (delta_lon > 1800000000) {
+			delta_lon -= 3600000000LL;
+
+		} else if (delta_lon < -1800000000) {
+			delta_lon += 3600000000LL;
+		}
+
+		delta_pos_n = lat_scale * (float)((int64_t)gps.lat - (int64_t)_lat_prev);
+		delta_pos_e = _lon_scale * (float)delta_lon;
+	}
+
+	// Calculate time lapsed since last update, limit to prevent numerical errors and calculate the lowpass filter coefficient
+	const float dt = fminf(fmaxf(float(time_us - _time_prev_us) * 1e-6f, 0.001f), _filt_time_const);
+	const float filter_coef = dt / _filt_time_const;
+
+	_time_prev_us = time_us;
+	_lat_prev = gps.lat;
+	_lon_prev = gps.lon;
+
+	// Calculate the horizontal drift velocity components, limit and apply a low pass filter
+	const float vel_n = math::constrain(delta_pos_n / dt, -hdrift_limit, hdrift_limit);
+	const float vel_e = math::constrain(delta_pos_e / dt, -hdrift_limit, hdrift_limit);
+	_drift_vel_n = vel_n * filter_coef + _drift_vel_n * (1.0f - filter_coef);
+	_drift_vel_e = vel_e * filter_coef + _drift_vel_e * (1.0f - filter_coef);
+
+	// Calculate the vertical drift velocity, limit and apply a low pass filter
+	const float vel_d = math::constrain((_alt_prev - alt) / dt, -vdrift_limit, vdrift_limit);
+	_alt_prev = alt;
+	_drift_vel_d = vel_d * filter_coef + _drift_vel_d * (1.0f - filter_coef);
+
+	// filter the reported horizontal velocity, this is only meaningful when stationary
+	if (stationary) {
+		const float gps_vel_n = math::constrain(gps.vel_ned[0], -hdrift_limit, hdrift_limit);
+		const float gps_vel_e = math::constrain(gps.vel_ned[1], -hdrift_limit, hdrift_limit);
+		_vel_n_filt = gps_vel_n * filter_coef + _vel_n_filt * (1.0f - filter_coef);
+		_vel_e_filt = gps_vel_e * filter_coef + _vel_e_filt * (1.0f - filter_coef);
+	}
+
+	// filter the difference between the GPS and EKF vertical velocity
+	const float vel_d_diff = math::constrain(gps.vel_ned[2] - vel_d_ekf, -vdrift_limit, vdrift_limit);
+	_vel_d_diff_filt = vel_d_diff * filter_coef + _vel_d_diff_filt * (1.0f - filter_coef);
+
+	// the change in velocity between messages contains the noise of both messages
+	const float vel_change_n = gps.vel_ned[0] - _vel_ne_prev[0];
+	const float vel_change_e = gps.vel_ned[1] - _vel_ne_prev[1];
+	const float vel_change_sq = vel_change_n * vel_change_n + vel_change_e * vel_change_e;
+	_vel_change_var = vel_change_sq * filter_coef + _vel_change_var * (1.0f - filter_coef);
+	_vel_ne_prev[0] = gps.vel_ned[0];
+	_vel_ne_prev[1] = gps.vel_ned[1];
+
+	_fix_filt = (gps.fix_type >= 3 ? 1.0f : 0.0f) * filter_coef + _fix_filt * (1.0f - filter_coef);
+
+	_count++;
+}
+
+float GpsQualityMonitor::get_horizontal_drift() const
+{
+	return sqrtf(_drift_vel_n * _drift_vel_n + _drift_vel_e * _drift_vel_e);
+}
+
+float GpsQualityMonitor::get_horizontal_speed() const
+{
+	return sqrtf(_vel_n_filt * _vel_n_filt + _vel_e_filt * _vel_e_filt);
+}
+
+float GpsQualityMonitor::get_speed_noise() const
+{
+	// per axis standard deviation of a single message
+	return sqrtf(0.25f * _vel_change_var);
+}
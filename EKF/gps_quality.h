@@ -0,0 +1,111 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file gps_quality.h
+ * Incremental GPS quality statistics used by the GPS pre-flight and aiding checks.
+ *
+ * All statistics are first order filters updated once per GPS message, so the cost and memory do not depend on the
+ * receiver rate and a separate monitor can be kept for each receiver.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <matrix/matrix/math.hpp>
+#include "common.h"
+
+using namespace estimator;
+
+class GpsQualityMonitor
+{
+public:
+	GpsQualityMonitor();
+	~GpsQualityMonitor() = default;
+
+	// clear the statistics, the next message becomes the reference for the position change
+	void reset();
+
+	// update the statistics using a GPS message received at time_us
+	// the drift rate samples are limited to hdrift_limit and vdrift_limit (m/s) to reject position jumps
+	// vel_d_ekf is the EKF down velocity (m/s) and the horizontal speed filter only runs when stationary is true
+	void update(const gps_message &gps, uint64_t time_us, float hdrift_limit, float vdrift_limit, float vel_d_ekf, bool stationary);
+
+	// clear the vertical drift rate
+	void reset_vertical_drift() { _drift_vel_d = 0.0f; }
+
+	// filtered horizontal drift speed calculated from the position change between messages (m/s)
+	float get_horizontal_drift() const;
+
+	// filtered down drift velocity calculated from the height change between messages (m/s)
+	float get_vertical_drift() const { return _drift_vel_d; }
+
+	// magnitude of the filtered GPS horizontal velocity (m/s), only updated when stationary
+	float get_horizontal_speed() const;
+
+	// filtered difference between the GPS and EKF down velocity (m/s)
+	float get_vertical_velocity_error() const { return _vel_d_diff_filt; }
+
+	// standard deviation of the horizontal velocity noise estimated from the change between messages (m/s)
+	float get_speed_noise() const;
+
+	// fraction of recent messages with a 3D fix
+	float get_fix_stability() const { return _fix_filt; }
+
+	// number of messages used since the last reset
+	uint32_t get_count() const { return _count; }
+
+private:
+	static constexpr float _filt_time_const = 10.0f;	// time constant of the statistics filters (sec)
+
+	uint64_t _time_prev_us;		// time the previous message was received (uSec)
+	int32_t _lat_prev;		// latitude of the previous message (1E-7 deg)
+	int32_t _lon_prev;		// longitude of the previous message (1E-7 deg)
+	float _alt_prev;		// height of the previous message (m)
+	float _vel_ne_prev[2];		// horizontal velocity of the previous message (m/s)
+
+	int32_t _lat_scale_ref;		// latitude used to calculate the longitude scale factor (1E-7 deg)
+	float _lon_scale;		// distance per 1E-7 deg of longitude at _lat_scale_ref (m)
+
+	float _drift_vel_n;		// filtered north position derivative (m/s)
+	float _drift_vel_e;		// filtered east position derivative (m/s)
+	float _drift_vel_d;		// filtered down position derivative (m/s)
+	float _vel_n_filt;		// filtered north velocity (m/s)
+	float _vel_e_filt;		// filtered east velocity (m/s)
+	float _vel_d_diff_filt;		// filtered difference between the GPS and EKF down velocity (m/s)
+	float _vel_change_var;		// filtered squared change in horizontal velocity between messages (m/s)**2
+	float _fix_filt;		// filtered 3D fix indicator
+	uint32_t _count;		// number of messages used since the last reset
+
+};
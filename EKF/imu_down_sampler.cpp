@@ -0,0 +1,122 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file imu_down_sampler.cpp
+ * Pre-integration of high rate IMU delta angle and delta velocity data with coning and sculling
+ * compensation, used to down sample the IMU data to the EKF prediction rate.
+ *
+ * The delta angle and delta velocity data is summed in the body frame at the start of the accumulation period
+ * and corrected using the two sample coning and sculling algorithms from Savage, "Strapdown Inertial Navigation
+ * Integration Algorithm Design". This avoids forming a quaternion and rotation matrix for every IMU sample,
+ * which is only required once per accumulation period to rotate the delta velocity into the final body frame.
+ *
+ */
+
+#include "imu_down_sampler.h"
+
+ImuDownSampler::ImuDownSampler()
+{
+	_last_delta_ang.setZero();
+	_last_delta_vel.setZero();
+	reset();
+}
+
+void ImuDownSampler::reset()
+{
+	_delta_ang.setZero();
+	_delta_vel.setZero();
+	_delta_ang_coning.setZero();
+	_delta_vel_sculling.setZero();
+	_delta_ang_dt = 0.0f;
+	_delta_vel_dt = 0.0f;
+	_time_us = 0;
+	_count = 0;
+
+	// the previous sample is retained so that the first sample of the next period is corrected
+}
+
+void ImuDownSampler::accumulate(const imuSample &imu)
+{
+	// the corrections use 1/12 weighting of the previous sample which is applied to the half cross products
+	const float k = 1.0f / 12.0f;
+
+	const Vector3f &da = imu.delta_ang;
+	const Vector3f &dv = imu.delta_vel;
+
+	// angle and velocity terms used by the coning and sculling corrections
+	Vector3f ang = _delta_ang * 0.5f + _last_delta_ang * k;
+	Vector3f vel = _delta_vel * 0.5f + _last_delta_vel * k;
+
+	// coning correction : 1/2 * (alpha + 1/6 * last_delta_ang) x delta_ang
+	_delta_ang_coning(0) += ang(1) * da(2) - ang(2) * da(1);
+	_delta_ang_coning(1) += ang(2) * da(0) - ang(0) * da(2);
+	_delta_ang_coning(2) += ang(0) * da(1) - ang(1) * da(0);
+
+	// sculling correction : 1/2 * ((alpha + 1/6 * last_delta_ang) x delta_vel + (nu + 1/6 * last_delta_vel) x delta_ang)
+	_delta_vel_sculling(0) += ang(1) * dv(2) - ang(2) * dv(1) + vel(1) * da(2) - vel(2) * da(1);
+	_delta_vel_sculling(1) += ang(2) * dv(0) - ang(0) * dv(2) + vel(2) * da(0) - vel(0) * da(2);
+	_delta_vel_sculling(2) += ang(0) * dv(1) - ang(1) * dv(0) + vel(0) * da(1) - vel(1) * da(0);
+
+	_delta_ang += da;
+	_delta_vel += dv;
+	_last_delta_ang = da;
+	_last_delta_vel = dv;
+
+	_delta_ang_dt += imu.delta_ang_dt;
+	_delta_vel_dt += imu.delta_vel_dt;
+	_time_us = imu.time_us;
+	_count++;
+}
+
+void ImuDownSampler::getDownSampled(imuSample &imu) const
+{
+	// rotation vector from the start to the end of the accumulation period
+	imu.delta_ang = _delta_ang + _delta_ang_coning;
+
+	// delta velocity in the body frame at the start of the period including the rotation correction 1/2 * alpha x nu
+	Vector3f delta_vel = _delta_vel + _delta_vel_sculling;
+	delta_vel(0) += 0.5f * (_delta_ang(1) * _delta_vel(2) - _delta_ang(2) * _delta_vel(1));
+	delta_vel(1) += 0.5f * (_delta_ang(2) * _delta_vel(0) - _delta_ang(0) * _delta_vel(2));
+	delta_vel(2) += 0.5f * (_delta_ang(0) * _delta_vel(1) - _delta_ang(1) * _delta_vel(0));
+
+	// rotate into the body frame at the end of the period
+	Quaternion delta_q;
+	delta_q.from_axis_angle(imu.delta_ang);
+	matrix::Dcm<float> delta_R(delta_q.inversed());
+	imu.delta_vel = delta_R * delta_vel;
+
+	imu.delta_ang_dt = _delta_ang_dt;
+	imu.delta_vel_dt = _delta_vel_dt;
+	imu.time_us = _time_us;
+}
@@ -0,0 +1,83 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file imu_down_sampler.h
+ * Pre-integration of high rate IMU delta angle and delta velocity data with coning and sculling
+ * compensation, used to down sample the IMU data to the EKF prediction rate.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <matrix/matrix/math.hpp>
+#include "common.h"
+
+using namespace estimator;
+
+class ImuDownSampler
+{
+public:
+	ImuDownSampler();
+	~ImuDownSampler() = default;
+
+	// add an IMU sample to the accumulated data
+	void accumulate(const imuSample &imu);
+
+	// get the accumulated data. The delta angle includes the coning correction and the delta velocity includes
+	// the rotation and sculling corrections and is expressed in the body frame at the end of the accumulation period.
+	void getDownSampled(imuSample &imu) const;
+
+	// clear the accumulated data to start a new accumulation period
+	void reset();
+
+	// return the accumulated delta angle integration period in seconds
+	float get_delta_ang_dt() const { return _delta_ang_dt; }
+
+	// return the number of samples accumulated since the last reset
+	unsigned get_count() const { return _count; }
+
+private:
+	Vector3f _delta_ang;		// sum of the delta angles (rad)
+	Vector3f _delta_vel;		// sum of the delta velocities (m/s)
+	Vector3f _delta_ang_coning;	// accumulated coning correction (rad)
+	Vector3f _delta_vel_sculling;	// accumulated sculling correction (m/s)
+	Vector3f _last_delta_ang;	// delta angle of the previous sample (rad)
+	Vector3f _last_delta_vel;	// delta velocity of the previous sample (m/s)
+	float _delta_ang_dt;		// accumulated delta angle integration period (sec)
+	float _delta_vel_dt;		// accumulated delta velocity integration period (sec)
+	uint64_t _time_us;		// timestamp of the newest sample (uSec)
+	unsigned _count;		// number of samples accumulated since the last reset
+
+};
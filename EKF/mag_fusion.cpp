@@ -42,9 +42,13 @@
 #include "../ecl.h"
 #include "ekf.h"
 #include "mathlib.h"
+#include "fast_math.h"
 
+#ifndef ECL_EKF_NO_MAG_STATES
 void Ekf::fuseMag()
 {
+	EKF_TIMED_SCOPE(EKF_TIMING_FUSE_MAG);
+
 	// assign intermediate variables
 	float q0 = _state.quat_nominal(0);
 	float q1 = _state.quat_nominal(1);
@@ -72,8 +76,7 @@ void Ekf::fuseMag()
 	SH_MAG[8] = 2.0f*magE*q3;
 
 	// rotate magnetometer earth field state into body frame
-	matrix::Dcm<float> R_to_body(_state.quat_nominal);
-	R_to_body = R_to_body.transpose();
+	const matrix::Dcm<float> &R_to_body = stateToBody();
 
 	Vector3f mag_I_rot = R_to_body * _state.mag_I;
 
@@ -82,10 +85,6 @@ void Ekf::fuseMag()
 	_mag_innov[1] = (mag_I_rot(1) + _state.mag_B(1)) - _mag_sample_delayed.mag(1);
 	_mag_innov[2] = (mag_I_rot(2) + _state.mag_B(2)) - _mag_sample_delayed.mag(2);
 
-	// Observation jacobian and Kalman gain vectors
-	float H_MAG[24];
-	float Kfusion[24];
-
 	// X axis innovation variance
 	_mag_innov_var[0] = (P[19][19] + R_MAG + P[1][19]*SH_MAG[0] - P[2][19]*SH_MAG[1] + P[3][19]*SH_MAG[2] - P[16][19]*(SH_MAG[3] + SH_MAG[4] - SH_MAG[5] - SH_MAG[6]) + (2.0f*q0*q3 + 2.0f*q1*q2)*(P[19][17] + P[1][17]*SH_MAG[0] - P[2][17]*SH_MAG[1] + P[3][17]*SH_MAG[2] - P[16][17]*(SH_MAG[3] + SH_MAG[4] - SH_MAG[5] - SH_MAG[6]) + P[17][17]*(2.0f*q0*q3 + 2.0f*q1*q2) - P[18][17]*(2.0f*q0*q2 - 2.0f*q1*q3) + P[0][17]*(SH_MAG[7] + SH_MAG[8] - 2.0f*magD*q2)) - (2.0f*q0*q2 - 2.0f*q1*q3)*(P[19][18] + P[1][18]*SH_MAG[0] - P[2][18]*SH_MAG[1] + P[3][18]*SH_MAG[2] - P[16][18]*(SH_MAG[3] + SH_MAG[4] - SH_MAG[5] - SH_MAG[6]) + P[17][18]*(2.0f*q0*q3 + 2.0f*q1*q2) - P[18][18]*(2.0f*q0*q2 - 2.0f*q1*q3) + P[0][18]*(SH_MAG[7] + SH_MAG[8] - 2.0f*magD*q2)) + (SH_MAG[7] + SH_MAG[8] - 2.0f*magD*q2)*(P[19][0] + P[1][0]*SH_MAG[0] - P[2][0]*SH_MAG[1] + P[3][0]*SH_MAG[2] - P[16][0]*(SH_MAG[3] + SH_MAG[4] - SH_MAG[5] - SH_MAG[6]) + P[17][0]*(2.0f*q0*q3 + 2.0f*q1*q2) - P[18][0]*(2.0f*q0*q2 - 2.0f*q1*q3) + P[0][0]*(SH_MAG[7] + SH_MAG[8] - 2.0f*magD*q2)) + P[17][19]*(2.0f*q0*q3 + 2.0f*q1*q2) - P[18][19]*(2.0f*q0*q2 - 2.0f*q1*q3) + SH_MAG[0]*(P[19][1] + P[1][1]*SH_MAG[0] - P[2][1]*SH_MAG[1] + P[3][1]*SH_MAG[2] - P[16][1]*(SH_MAG[3] + SH_MAG[4] - SH_MAG[5] - SH_MAG[6]) + P[17][1]*(2.0f*q0*q3 + 2.0f*q1*q2) - P[18][1]*(2.0f*q0*q2 - 2.0f*q1*q3) + P[0][1]*(SH_MAG[7] + SH_MAG[8] - 2.0f*magD*q2)) - SH_MAG[1]*(P[19][2] + P[1][2]*SH_MAG[0] - P[2][2]*SH_MAG[1] + P[3][2]*SH_MAG[2] - P[16][2]*(SH_MAG[3] + SH_MAG[4] - SH_MAG[5] - SH_MAG[6]) + P[17][2]*(2.0f*q0*q3 + 2.0f*q1*q2) - P[18][2]*(2.0f*q0*q2 - 2.0f*q1*q3) + P[0][2]*(SH_MAG[7] + SH_MAG[8] - 2.0f*magD*q2)) + SH_MAG[2]*(P[19][3] + P[1][3]*SH_MAG[0] - P[2][3]*SH_MAG[1] + P[3][3]*SH_MAG[2] - P[16][3]*(SH_MAG[3] + SH_MAG[4] - SH_MAG[5] - SH_MAG[6]) + P[17][3]*(2.0f*q0*q3 + 2.0f*q1*q2) - P[18][3]*(2.0f*q0*q2 - 2.0f*q1*q3) + P[0][3]*(SH_MAG[7] + SH_MAG[8] - 2.0f*magD*q2)) - (SH_MAG[3] + SH_MAG[4] - SH_MAG[5] - SH_MAG[6])*(P[19][16] + P[1][16]*SH_MAG[0] - P[2][16]*SH_MAG[1] + P[3][16]*SH_MAG[2] - P[16][16]*(SH_MAG[3] + SH_MAG[4] - SH_MAG[5] - SH_MAG[6]) + P[17][16]*(2.0f*q0*q3 + 2.0f*q1*q2) - P[18][16]*(2.0f*q0*q2 - 2.0f*q1*q3) + P[0][16]*(SH_MAG[7] + SH_MAG[8] - 2.0f*magD*q2)) + P[0][19]*(SH_MAG[7] + SH_MAG[8] - 2.0f*magD*q2));
 	// check for a badly conditioned covariance matrix
@@ -147,11 +146,13 @@ void Ekf::fuseMag()
 	bool healthy = true;
 	for (uint8_t index = 0; index <= 2; index++) {
 		_mag_test_ratio[index] = sq(_mag_innov[index]) / (sq(math::max(_params.mag_innov_gate, 1.0f)) * _mag_innov_var[index]);
+		EKF_RECORD_FUSION(FLIGHT_RECORDER_MAG_X + index, _mag_innov[index], _mag_innov_var[index], _mag_test_ratio[index],
+				  _mag_test_ratio[index] > 1.0f);
 		if (_mag_test_ratio[index] > 1.0f) {
 			healthy = false;
 			_innov_check_fail_status.value |= (1 << (index + 3));
 		} else {
-			_innov_check_fail_status.value &= !(1 << (index + 3));
+			_innov_check_fail_status.value &= ~(1 << (index + 3));
 		}
 	}
 
@@ -163,22 +164,54 @@ void Ekf::fuseMag()
 		return;
 	}
 
-	// update the states and covariance using sequential fusion of the magnetometer components
+	// update the states and covariance using the magnetometer components
+	// the observation jacobians are only non-zero for the quaternion and magnetic field states
+	// and are the same for sequential and batched fusion so are calculated once for all axes
+	const uint8_t H_index[10] = {0, 1, 2, 3, 16, 17, 18, 19, 20, 21};
+	float H_MAG[3][_k_num_states] = {};
+
+	// X axis observation jacobians
+	H_MAG[0][0] = SH_MAG[7] + SH_MAG[8] - 2.0f*magD*q2;
+	H_MAG[0][1] = SH_MAG[0];
+	H_MAG[0][2] = -SH_MAG[1];
+	H_MAG[0][3] = SH_MAG[2];
+	H_MAG[0][16] = SH_MAG[5] - SH_MAG[4] - SH_MAG[3] + SH_MAG[6];
+	H_MAG[0][17] = 2.0f*q0*q3 + 2.0f*q1*q2;
+	H_MAG[0][18] = 2.0f*q1*q3 - 2.0f*q0*q2;
+	H_MAG[0][19] = 1.0f;
+
+	// Y axis observation jacobians
+	H_MAG[1][0] = SH_MAG[2];
+	H_MAG[1][1] = SH_MAG[1];
+	H_MAG[1][2] = SH_MAG[0];
+	H_MAG[1][3] = 2.0f*magD*q2 - SH_MAG[8] - SH_MAG[7];
+	H_MAG[1][16] = 2.0f*q1*q2 - 2.0f*q0*q3;
+	H_MAG[1][17] = SH_MAG[4] - SH_MAG[3] - SH_MAG[5] + SH_MAG[6];
+	H_MAG[1][18] = 2.0f*q0*q1 + 2.0f*q2*q3;
+	H_MAG[1][20] = 1.0f;
+
+	// Z axis observation jacobians
+	H_MAG[2][0] = SH_MAG[1];
+	H_MAG[2][1] = -SH_MAG[2];
+	H_MAG[2][2] = SH_MAG[7] + SH_MAG[8] - 2.0f*magD*q2;
+	H_MAG[2][3] = SH_MAG[0];
+	H_MAG[2][16] = 2.0f*q0*q2 + 2.0f*q1*q3;
+	H_MAG[2][17] = 2.0f*q2*q3 - 2.0f*q0*q1;
+	H_MAG[2][18] = SH_MAG[3] - SH_MAG[4] - SH_MAG[5] + SH_MAG[6];
+	H_MAG[2][21] = 1.0f;
+
+	if (_params.mag_fuse_batch) {
+		fuseMagBatched(H_MAG, H_index);
+		return;
+	}
+
+	// sequential fusion of the X, Y and Z components
+	float Kfusion[_k_num_states];
+
 	for (uint8_t index = 0; index <= 2; index++) {
 
-		// Calculate Kalman gains and observation jacobians
+		// Calculate Kalman gains
 		if (index == 0) {
-			// Calculate X axis observation jacobians
-			memset(H_MAG, 0, sizeof(H_MAG));
-			H_MAG[0] = SH_MAG[7] + SH_MAG[8] - 2.0f*magD*q2;
-			H_MAG[1] = SH_MAG[0];
-			H_MAG[2] = -SH_MAG[1];
-			H_MAG[3] = SH_MAG[2];
-			H_MAG[16] = SH_MAG[5] - SH_MAG[4] - SH_MAG[3] + SH_MAG[6];
-			H_MAG[17] = 2.0f*q0*q3 + 2.0f*q1*q2;
-			H_MAG[18] = 2.0f*q1*q3 - 2.0f*q0*q2;
-			H_MAG[19] = 1.0f;
-
 			// Calculate X axis Kalman gains
 			float SK_MX[5];
 			SK_MX[0] = 1.0f / _mag_innov_var[0];
@@ -209,21 +242,12 @@ void Ekf::fuseMag()
 			Kfusion[19] = SK_MX[0]*(P[19][19] + P[19][1]*SH_MAG[0] - P[19][2]*SH_MAG[1] + P[19][3]*SH_MAG[2] + P[19][0]*SK_MX[2] - P[19][16]*SK_MX[1] + P[19][17]*SK_MX[4] - P[19][18]*SK_MX[3]);
 			Kfusion[20] = SK_MX[0]*(P[20][19] + P[20][1]*SH_MAG[0] - P[20][2]*SH_MAG[1] + P[20][3]*SH_MAG[2] + P[20][0]*SK_MX[2] - P[20][16]*SK_MX[1] + P[20][17]*SK_MX[4] - P[20][18]*SK_MX[3]);
 			Kfusion[21] = SK_MX[0]*(P[21][19] + P[21][1]*SH_MAG[0] - P[21][2]*SH_MAG[1] + P[21][3]*SH_MAG[2] + P[21][0]*SK_MX[2] - P[21][16]*SK_MX[1] + P[21][17]*SK_MX[4] - P[21][18]*SK_MX[3]);
+#ifndef ECL_EKF_NO_WIND_STATES
 			Kfusion[22] = SK_MX[0]*(P[22][19] + P[22][1]*SH_MAG[0] - P[22][2]*SH_MAG[1] + P[22][3]*SH_MAG[2] + P[22][0]*SK_MX[2] - P[22][16]*SK_MX[1] + P[22][17]*SK_MX[4] - P[22][18]*SK_MX[3]);
 			Kfusion[23] = SK_MX[0]*(P[23][19] + P[23][1]*SH_MAG[0] - P[23][2]*SH_MAG[1] + P[23][3]*SH_MAG[2] + P[23][0]*SK_MX[2] - P[23][16]*SK_MX[1] + P[23][17]*SK_MX[4] - P[23][18]*SK_MX[3]);
+#endif
 
 		} else if (index == 1) {
-			// Calculate Y axis observation jacobians
-			memset(H_MAG, 0, sizeof(H_MAG));
-			H_MAG[0] = SH_MAG[2];
-			H_MAG[1] = SH_MAG[1];
-			H_MAG[2] = SH_MAG[0];
-			H_MAG[3] = 2.0f*magD*q2 - SH_MAG[8] - SH_MAG[7];
-			H_MAG[16] = 2.0f*q1*q2 - 2.0f*q0*q3;
-			H_MAG[17] = SH_MAG[4] - SH_MAG[3] - SH_MAG[5] + SH_MAG[6];
-			H_MAG[18] = 2.0f*q0*q1 + 2.0f*q2*q3;
-			H_MAG[20] = 1.0f;
-
 			// Calculate Y axis Kalman gains
 			float SK_MY[5];
 			SK_MY[0] = 1.0f / _mag_innov_var[1];
@@ -254,21 +278,12 @@ void Ekf::fuseMag()
 			Kfusion[19] = SK_MY[0]*(P[19][20] + P[19][0]*SH_MAG[2] + P[19][1]*SH_MAG[1] + P[19][2]*SH_MAG[0] - P[19][3]*SK_MY[2] - P[19][17]*SK_MY[1] - P[19][16]*SK_MY[3] + P[19][18]*SK_MY[4]);
 			Kfusion[20] = SK_MY[0]*(P[20][20] + P[20][0]*SH_MAG[2] + P[20][1]*SH_MAG[1] + P[20][2]*SH_MAG[0] - P[20][3]*SK_MY[2] - P[20][17]*SK_MY[1] - P[20][16]*SK_MY[3] + P[20][18]*SK_MY[4]);
 			Kfusion[21] = SK_MY[0]*(P[21][20] + P[21][0]*SH_MAG[2] + P[21][1]*SH_MAG[1] + P[21][2]*SH_MAG[0] - P[21][3]*SK_MY[2] - P[21][17]*SK_MY[1] - P[21][16]*SK_MY[3] + P[21][18]*SK_MY[4]);
+#ifndef ECL_EKF_NO_WIND_STATES
 			Kfusion[22] = SK_MY[0]*(P[22][20] + P[22][0]*SH_MAG[2] + P[22][1]*SH_MAG[1] + P[22][2]*SH_MAG[0] - P[22][3]*SK_MY[2] - P[22][17]*SK_MY[1] - P[22][16]*SK_MY[3] + P[22][18]*SK_MY[4]);
 			Kfusion[23] = SK_MY[0]*(P[23][20] + P[23][0]*SH_MAG[2] + P[23][1]*SH_MAG[1] + P[23][2]*SH_MAG[0] - P[23][3]*SK_MY[2] - P[23][17]*SK_MY[1] - P[23][16]*SK_MY[3] + P[23][18]*SK_MY[4]);
+#endif
 
 		} else if (index == 2) {
-			// calculate Z axis observation jacobians
-			memset(H_MAG, 0, sizeof(H_MAG));
-			H_MAG[0] = SH_MAG[1];
-			H_MAG[1] = -SH_MAG[2];
-			H_MAG[2] = SH_MAG[7] + SH_MAG[8] - 2.0f*magD*q2;
-			H_MAG[3] = SH_MAG[0];
-			H_MAG[16] = 2.0f*q0*q2 + 2.0f*q1*q3;
-			H_MAG[17] = 2.0f*q2*q3 - 2.0f*q0*q1;
-			H_MAG[18] = SH_MAG[3] - SH_MAG[4] - SH_MAG[5] + SH_MAG[6];
-			H_MAG[21] = 1.0f;
-
 			// Calculate Z axis Kalman gains
 			float SK_MZ[5];
 			SK_MZ[0] = 1.0f / _mag_innov_var[2];
@@ -299,92 +314,170 @@ void Ekf::fuseMag()
 			Kfusion[19] = SK_MZ[0]*(P[19][21] + P[19][0]*SH_MAG[1] - P[19][1]*SH_MAG[2] + P[19][3]*SH_MAG[0] + P[19][2]*SK_MZ[2] + P[19][18]*SK_MZ[1] + P[19][16]*SK_MZ[4] - P[19][17]*SK_MZ[3]);
 			Kfusion[20] = SK_MZ[0]*(P[20][21] + P[20][0]*SH_MAG[1] - P[20][1]*SH_MAG[2] + P[20][3]*SH_MAG[0] + P[20][2]*SK_MZ[2] + P[20][18]*SK_MZ[1] + P[20][16]*SK_MZ[4] - P[20][17]*SK_MZ[3]);
 			Kfusion[21] = SK_MZ[0]*(P[21][21] + P[21][0]*SH_MAG[1] - P[21][1]*SH_MAG[2] + P[21][3]*SH_MAG[0] + P[21][2]*SK_MZ[2] + P[21][18]*SK_MZ[1] + P[21][16]*SK_MZ[4] - P[21][17]*SK_MZ[3]);
+#ifndef ECL_EKF_NO_WIND_STATES
 			Kfusion[22] = SK_MZ[0]*(P[22][21] + P[22][0]*SH_MAG[1] - P[22][1]*SH_MAG[2] + P[22][3]*SH_MAG[0] + P[22][2]*SK_MZ[2] + P[22][18]*SK_MZ[1] + P[22][16]*SK_MZ[4] - P[22][17]*SK_MZ[3]);
 			Kfusion[23] = SK_MZ[0]*(P[23][21] + P[23][0]*SH_MAG[1] - P[23][1]*SH_MAG[2] + P[23][3]*SH_MAG[0] + P[23][2]*SK_MZ[2] + P[23][18]*SK_MZ[1] + P[23][16]*SK_MZ[4] - P[23][17]*SK_MZ[3]);
+#endif
 
 		} else {
 			return;
 		}
 
 		// apply covariance correction via P_new = (I -K*H)*P
-		// first calculate expression for KHP
-		// then calculate P - KHP
-		float KHP[_k_num_states][_k_num_states];
-		float KH[10];
-		for (unsigned row = 0; row < _k_num_states; row++) {
-
-			KH[0] = Kfusion[row] * H_MAG[0];
-			KH[1] = Kfusion[row] * H_MAG[1];
-			KH[2] = Kfusion[row] * H_MAG[2];
-			KH[3] = Kfusion[row] * H_MAG[3];
-			KH[4] = Kfusion[row] * H_MAG[16];
-			KH[5] = Kfusion[row] * H_MAG[17];
-			KH[6] = Kfusion[row] * H_MAG[18];
-			KH[7] = Kfusion[row] * H_MAG[19];
-			KH[8] = Kfusion[row] * H_MAG[20];
-			KH[9] = Kfusion[row] * H_MAG[21];
-
-			for (unsigned column = 0; column < _k_num_states; column++) {
-				float tmp = KH[0] * P[0][column];
-				tmp += KH[1] * P[1][column];
-				tmp += KH[2] * P[2][column];
-				tmp += KH[3] * P[3][column];
-				tmp += KH[4] * P[16][column];
-				tmp += KH[5] * P[17][column];
-				tmp += KH[6] * P[18][column];
-				tmp += KH[7] * P[19][column];
-				tmp += KH[8] * P[20][column];
-				tmp += KH[9] * P[21][column];
-				KHP[row][column] = tmp;
-			}
-		}
-
 		// if the covariance correction will result in a negative variance, then
 		// the covariance marix is unhealthy and must be corrected
 		_fault_status.flags.bad_mag_x = false;
 		_fault_status.flags.bad_mag_y = false;
 		_fault_status.flags.bad_mag_z = false;
-		for (int i = 0; i < _k_num_states; i++) {
-			if (P[i][i] < KHP[i][i]) {
-				// zero rows and columns
-				zeroRows(P,i,i);
-				zeroCols(P,i,i);
-
-				//flag as unhealthy
-				healthy = false;
-
-				// update individual measurement health status
-				if (index == 0) {
-					_fault_status.flags.bad_mag_x = true;
-				} else if (index == 1) {
-					_fault_status.flags.bad_mag_y = true;
-				} else if (index == 2) {
-					_fault_status.flags.bad_mag_z = true;
-				}
+
+		if (!updateCovariance(Kfusion, H_MAG[index], H_index, 10)) {
+			// update individual measurement health status and abort fusion of the remaining axes
+			if (index == 0) {
+				_fault_status.flags.bad_mag_x = true;
+			} else if (index == 1) {
+				_fault_status.flags.bad_mag_y = true;
+			} else if (index == 2) {
+				_fault_status.flags.bad_mag_z = true;
 			}
+
+			return;
 		}
 
-		// only apply covariance and state corrrections if healthy
-		if (healthy) {
-			// apply the covariance corrections
-			for (unsigned row = 0; row < _k_num_states; row++) {
-				for (unsigned column = 0; column < _k_num_states; column++) {
-					P[row][column] = P[row][column] - KHP[row][column];
-				}
+		// correct the covariance marix for gross errors
+		fixTouchedCovarianceErrors();
+
+		// apply the state corrections
+		fuse(Kfusion, _mag_innov[index]);
+	}
+}
+
+void Ekf::fuseMagBatched(const float (&H_MAG)[3][_k_num_states], const uint8_t (&H_index)[10])
+{
+	// PHT = P*H' is evaluated once using only the non-zero elements of H and is shared by the
+	// innovation covariance, Kalman gain and covariance update calculations. The sums are accumulated
+	// in cov_accum_t like the covariance update.
+	float PHT[3][_k_num_states];
+
+	for (uint8_t axis = 0; axis < 3; axis++) {
+		for (uint8_t row = 0; row < _k_num_states; row++) {
+			cov_accum_t tmp = 0.0f;
+
+			for (uint8_t i = 0; i < 10; i++) {
+				tmp += (cov_accum_t)P[row][H_index[i]] * H_MAG[axis][H_index[i]];
 			}
 
-			// correct the covariance marix for gross errors
-			fixCovarianceErrors();
+			PHT[axis][row] = (float)tmp;
+		}
+	}
+
+	// innovation covariance S = H*P*H' + R
+	// the diagonal has already been calculated and checked by the innovation consistency checks
+	float S[3][3];
 
-			// apply the state corrections
-			fuse(Kfusion, _mag_innov[index]);
+	for (uint8_t axis = 0; axis < 3; axis++) {
+		S[axis][axis] = _mag_innov_var[axis];
 
+		for (uint8_t col = axis + 1; col < 3; col++) {
+			cov_accum_t tmp = 0.0f;
+
+			for (uint8_t i = 0; i < 10; i++) {
+				tmp += (cov_accum_t)H_MAG[axis][H_index[i]] * PHT[col][H_index[i]];
+			}
+
+			S[axis][col] = (float)tmp;
+			S[col][axis] = (float)tmp;
 		}
 	}
+
+	// invert S using the adjugate, checking it is positive definite
+	float cof[3][3];
+	cof[0][0] = S[1][1] * S[2][2] - S[1][2] * S[2][1];
+	cof[0][1] = S[0][2] * S[2][1] - S[0][1] * S[2][2];
+	cof[0][2] = S[0][1] * S[1][2] - S[0][2] * S[1][1];
+	cof[1][1] = S[0][0] * S[2][2] - S[0][2] * S[2][0];
+	cof[1][2] = S[0][2] * S[1][0] - S[0][0] * S[1][2];
+	cof[2][2] = S[0][0] * S[1][1] - S[0][1] * S[1][0];
+	cof[1][0] = cof[0][1];
+	cof[2][0] = cof[0][2];
+	cof[2][1] = cof[1][2];
+
+	float det = S[0][0] * cof[0][0] + S[0][1] * cof[1][0] + S[0][2] * cof[2][0];
+
+	if (cof[2][2] <= 0.0f || det <= 0.0f) {
+		// the innovation covariance matrix is badly conditioned so the state covariances must be reset
+		_fault_status.flags.bad_mag_x = true;
+		_fault_status.flags.bad_mag_y = true;
+		_fault_status.flags.bad_mag_z = true;
+
+		resetMagCovariance();
+		ECL_ERR("EKF mag batch fusion numerical error - covariance reset");
+		return;
+	}
+
+	float S_inv[3][3];
+
+	for (uint8_t row = 0; row < 3; row++) {
+		for (uint8_t col = 0; col < 3; col++) {
+			S_inv[row][col] = cof[row][col] / det;
+		}
+	}
+
+	// Kalman gain K = PHT*inv(S) and the combined state correction K*innovation
+	float Kfusion[3][_k_num_states];
+	float Kinnov[_k_num_states];
+
+	for (uint8_t row = 0; row < _k_num_states; row++) {
+		Kinnov[row] = 0.0f;
+
+		for (uint8_t axis = 0; axis < 3; axis++) {
+			Kfusion[axis][row] = PHT[0][row] * S_inv[0][axis] + PHT[1][row] * S_inv[1][axis] + PHT[2][row] * S_inv[2][axis];
+			Kinnov[row] += Kfusion[axis][row] * _mag_innov[axis];
+		}
+	}
+
+	// apply covariance correction via P_new = P - K*H*P = P - K*PHT'
+	// if the covariance correction will result in a negative variance, then
+	// the covariance marix is unhealthy and must be corrected
+	bool healthy = true;
+
+	for (uint8_t i = 0; i < _k_num_states; i++) {
+		float KHP_ii = Kfusion[0][i] * PHT[0][i] + Kfusion[1][i] * PHT[1][i] + Kfusion[2][i] * PHT[2][i];
+
+		if (P[i][i] < KHP_ii) {
+			// zero rows and columns
+			P.zeroRowsCols(i, i);
+
+			//flag as unhealthy
+			healthy = false;
+		}
+	}
+
+	_fault_status.flags.bad_mag_x = !healthy;
+	_fault_status.flags.bad_mag_y = !healthy;
+	_fault_status.flags.bad_mag_z = !healthy;
+
+	if (!healthy) {
+		return;
+	}
+
+	// K*PHT' is the sum of the outer products of the per axis gain and PHT columns
+	for (uint8_t axis = 0; axis < 3; axis++) {
+		P.subtractUpperProduct<cov_accum_t>(Kfusion[axis], PHT[axis]);
+		markCovarianceTouched(Kfusion[axis]);
+	}
+
+	// correct the covariance marix for gross errors
+	fixTouchedCovarianceErrors();
+
+	// apply the state corrections
+	fuse(Kinnov, 1.0f);
 }
+#endif
 
 void Ekf::fuseHeading()
 {
+	EKF_TIMED_SCOPE(EKF_TIMING_FUSE_HEADING);
+
 	// assign intermediate state variables
 	float q0 = _state.quat_nominal(0);
 	float q1 = _state.quat_nominal(1);
@@ -442,12 +535,12 @@ void Ekf::fuseHeading()
 			// rotate the magnetometer measurements into earth frame using a zero yaw angle
 			mag_earth_pred = R_to_earth * _mag_sample_delayed.mag;
 			// the angle of the projection onto the horizontal gives the yaw angle
-			measured_hdg = -atan2f(mag_earth_pred(1), mag_earth_pred(0)) + _mag_declination;
+			measured_hdg = -ecl::atan2(mag_earth_pred(1), mag_earth_pred(0)) + _mag_declination;
 		} else if (_control_status.flags.ev_yaw) {
 			// convert the observed quaternion to a rotation matrix
 			matrix::Dcm<float> R_to_earth_ev(_ev_sample_delayed.quat);	// transformation matrix from body to world frame
 			// calculate the yaw angle for a 312 sequence
-			measured_hdg = atan2f(R_to_earth_ev(1, 0) , R_to_earth_ev(0, 0));
+			measured_hdg = ecl::atan2(R_to_earth_ev(1, 0) , R_to_earth_ev(0, 0));
 		} else {
 			// there is no yaw observation
 			return;
@@ -487,9 +580,9 @@ void Ekf::fuseHeading()
 		// Calculate the 312 sequence euler angles that rotate from earth to body frame
 		// See http://www.atacolorado.com/eulersequences.doc
 		Vector3f euler312;
-		euler312(0) = atan2f(-_R_to_earth(0, 1) , _R_to_earth(1, 1)); // first rotation (yaw)
+		euler312(0) = ecl::atan2(-_R_to_earth(0, 1) , _R_to_earth(1, 1)); // first rotation (yaw)
 		euler312(1) = asinf(_R_to_earth(2, 1)); // second rotation (roll)
-		euler312(2) = atan2f(-_R_to_earth(2, 0) , _R_to_earth(2, 2)); // third rotation (pitch)
+		euler312(2) = ecl::atan2(-_R_to_earth(2, 0) , _R_to_earth(2, 2)); // third rotation (pitch)
 
 		predicted_hdg = euler312(0); // we will need the predicted heading to calculate the innovation
 
@@ -497,12 +590,10 @@ void Ekf::fuseHeading()
 		euler312(0) = 0.0f;
 
 		// Calculate the body to earth frame rotation matrix from the euler angles using a 312 rotation sequence
-		float c2 = cosf(euler312(2));
-		float s2 = sinf(euler312(2));
-		float s1 = sinf(euler312(1));
-		float c1 = cosf(euler312(1));
-		float s0 = sinf(euler312(0));
-		float c0 = cosf(euler312(0));
+		float s2, c2, s1, c1, s0, c0;
+		ecl::sin_cos(euler312(2), s2, c2);
+		ecl::sin_cos(euler312(1), s1, c1);
+		ecl::sin_cos(euler312(0), s0, c0);
 
 		matrix::Dcm<float> R_to_earth;
 		R_to_earth(0, 0) = c0 * c2 - s0 * s1 * s2;
@@ -520,12 +611,12 @@ void Ekf::fuseHeading()
 			// rotate the magnetometer measurements into earth frame using a zero yaw angle
 			mag_earth_pred = R_to_earth * _mag_sample_delayed.mag;
 			// the angle of the projection onto the horizontal gives the yaw angle
-			measured_hdg = -atan2f(mag_earth_pred(1), mag_earth_pred(0)) + _mag_declination;
+			measured_hdg = -ecl::atan2(mag_earth_pred(1), mag_earth_pred(0)) + _mag_declination;
 		} else if (_control_status.flags.ev_yaw) {
 			// convert the observed quaternion to a rotation matrix
 			matrix::Dcm<float> R_to_earth_ev(_ev_sample_delayed.quat);	// transformation matrix from body to world frame
 			// calculate the yaw angle for a 312 sequence
-			measured_hdg = atan2f(-R_to_earth_ev(0, 1) , R_to_earth_ev(1, 1));
+			measured_hdg = ecl::atan2(-R_to_earth_ev(0, 1) , R_to_earth_ev(1, 1));
 		} else {
 			// there is no yaw observation
 			return;
@@ -576,32 +667,6 @@ void Ekf::fuseHeading()
 		return;
 	}
 
-	// calculate the Kalman gains
-	// only calculate gains for states we are using
-	float Kfusion[_k_num_states] = {};
-
-	for (uint8_t row = 0; row <= 15; row++) {
-		Kfusion[row] = 0.0f;
-
-		for (uint8_t col = 0; col <= 3; col++) {
-			Kfusion[row] += P[row][col] * H_YAW[col];
-		}
-
-		Kfusion[row] *= heading_innov_var_inv;
-	}
-
-	if (_control_status.flags.wind) {
-		for (uint8_t row = 22; row <= 23; row++) {
-			Kfusion[row] = 0.0f;
-
-			for (uint8_t col = 0; col <= 3; col++) {
-				Kfusion[row] += P[row][col] * H_YAW[col];
-			}
-
-			Kfusion[row] *= heading_innov_var_inv;
-		}
-	}
-
 	// wrap the heading to the interval between +-pi
 	measured_hdg = matrix::wrap_pi(measured_hdg);
 
@@ -613,6 +678,7 @@ void Ekf::fuseHeading()
 
 	// innovation test ratio
 	_yaw_test_ratio = sq(_heading_innov) / (sq(math::max(_params.heading_innov_gate, 1.0f)) * _heading_innov_var);
+	EKF_RECORD_FUSION(FLIGHT_RECORDER_HEADING, _heading_innov, _heading_innov_var, _yaw_test_ratio, _yaw_test_ratio > 1.0f);
 
 	// we are no longer using 3-axis fusion so set the reported test levels to zero
 	memset(_mag_test_ratio, 0, sizeof(_mag_test_ratio));
@@ -637,57 +703,45 @@ void Ekf::fuseHeading()
 		_innov_check_fail_status.flags.reject_yaw = false;
 	}
 
-	// apply covariance correction via P_new = (I -K*H)*P
-	// first calculate expression for KHP
-	// then calculate P - KHP
-	float KHP[_k_num_states][_k_num_states];
-	float KH[4];
-	for (unsigned row = 0; row < _k_num_states; row++) {
-
-		KH[0] = Kfusion[row] * H_YAW[0];
-		KH[1] = Kfusion[row] * H_YAW[1];
-		KH[2] = Kfusion[row] * H_YAW[2];
-		KH[3] = Kfusion[row] * H_YAW[3];
-
-		for (unsigned column = 0; column < _k_num_states; column++) {
-			float tmp = KH[0] * P[0][column];
-			tmp += KH[1] * P[1][column];
-			tmp += KH[2] * P[2][column];
-			tmp += KH[3] * P[3][column];
-			KHP[row][column] = tmp;
+	// calculate the Kalman gains now that the measurement has passed the innovation test
+	// only calculate gains for states we are using
+	float Kfusion[_k_num_states] = {};
+
+	for (uint8_t row = 0; row <= 15; row++) {
+		Kfusion[row] = 0.0f;
+
+		for (uint8_t col = 0; col <= 3; col++) {
+			Kfusion[row] += P[row][col] * H_YAW[col];
 		}
-	}
 
-	// if the covariance correction will result in a negative variance, then
-	// the covariance marix is unhealthy and must be corrected
-	bool healthy = true;
-	_fault_status.flags.bad_mag_hdg = false;
-	for (int i = 0; i < _k_num_states; i++) {
-		if (P[i][i] < KHP[i][i]) {
-			// zero rows and columns
-			zeroRows(P,i,i);
-			zeroCols(P,i,i);
+		Kfusion[row] *= heading_innov_var_inv;
+	}
 
-			//flag as unhealthy
-			healthy = false;
+#ifndef ECL_EKF_NO_WIND_STATES
+	if (_control_status.flags.wind) {
+		for (uint8_t row = 22; row <= 23; row++) {
+			Kfusion[row] = 0.0f;
 
-			// update individual measurement health status
-			_fault_status.flags.bad_mag_hdg = true;
+			for (uint8_t col = 0; col <= 3; col++) {
+				Kfusion[row] += P[row][col] * H_YAW[col];
+			}
 
+			Kfusion[row] *= heading_innov_var_inv;
 		}
 	}
+#endif
 
-	// only apply covariance and state corrrections if healthy
-	if (healthy) {
-		// apply the covariance corrections
-		for (unsigned row = 0; row < _k_num_states; row++) {
-			for (unsigned column = 0; column < _k_num_states; column++) {
-				P[row][column] = P[row][column] - KHP[row][column];
-			}
-		}
+	// apply covariance correction via P_new = (I -K*H)*P
+	// if the covariance correction will result in a negative variance, then
+	// the covariance marix is unhealthy and must be corrected
+	const uint8_t H_index[4] = {0, 1, 2, 3};
+	bool healthy = updateCovariance(Kfusion, H_YAW, H_index, 4);
+	_fault_status.flags.bad_mag_hdg = !healthy;
 
+	// only apply state corrections if healthy
+	if (healthy) {
 		// correct the covariance marix for gross errors
-		fixCovarianceErrors();
+		fixTouchedCovarianceErrors();
 
 		// apply the state corrections
 		fuse(Kfusion, _heading_innov);
@@ -695,8 +749,11 @@ void Ekf::fuseHeading()
 	}
 }
 
+#ifndef ECL_EKF_NO_MAG_STATES
 void Ekf::fuseDeclination()
 {
+	EKF_TIMED_SCOPE(EKF_TIMING_FUSE_DECLINATION);
+
 	// assign intermediate state variables
 	float magN = _state.mag_I(0);
 	float magE = _state.mag_I(1);
@@ -739,7 +796,7 @@ void Ekf::fuseDeclination()
 
 	// Calculate the observation Jacobian
 	// Note only 2 terms are non-zero which can be used in matrix operations for calculation of Kalman gains and covariance update to significantly reduce cost
-	float H_DECL[24] = {};
+	float H_DECL[_k_num_states] = {};
 	H_DECL[16] = -magE*t21;
 	H_DECL[17] = magN*t21;
 
@@ -767,64 +824,30 @@ void Ekf::fuseDeclination()
 	Kfusion[19] = -t4*t13*(P[19][16]*magE-P[19][17]*magN);
 	Kfusion[20] = -t4*t13*(P[20][16]*magE-P[20][17]*magN);
 	Kfusion[21] = -t4*t13*(P[21][16]*magE-P[21][17]*magN);
+#ifndef ECL_EKF_NO_WIND_STATES
 	Kfusion[22] = -t4*t13*(P[22][16]*magE-P[22][17]*magN);
 	Kfusion[23] = -t4*t13*(P[23][16]*magE-P[23][17]*magN);
+#endif
 
 	// calculate innovation and constrain
-	float innovation = atan2f(magE , magN) - _mag_declination;
+	float innovation = ecl::atan2(magE , magN) - _mag_declination;
 	innovation = math::constrain(innovation, -0.5f, 0.5f);
 
 	// apply covariance correction via P_new = (I -K*H)*P
-	// first calculate expression for KHP
-	// then calculate P - KHP
-	// take advantage of the empty columns in KH to reduce the number of operations
-	float KHP[_k_num_states][_k_num_states];
-	float KH[2];
-	for (unsigned row = 0; row < _k_num_states; row++) {
-
-		KH[0] = Kfusion[row] * H_DECL[16];
-		KH[1] = Kfusion[row] * H_DECL[17];
-
-		for (unsigned column = 0; column < _k_num_states; column++) {
-			float tmp = KH[0] * P[16][column];
-			tmp += KH[1] * P[17][column];
-			KHP[row][column] = tmp;
-		}
-	}
-
 	// if the covariance correction will result in a negative variance, then
 	// the covariance marix is unhealthy and must be corrected
-	bool healthy = true;
-	_fault_status.flags.bad_mag_decl = false;
-	for (int i = 0; i < _k_num_states; i++) {
-		if (P[i][i] < KHP[i][i]) {
-			// zero rows and columns
-			zeroRows(P,i,i);
-			zeroCols(P,i,i);
+	const uint8_t H_index[2] = {16, 17};
+	bool healthy = updateCovariance(Kfusion, H_DECL, H_index, 2);
+	_fault_status.flags.bad_mag_decl = !healthy;
 
-			//flag as unhealthy
-			healthy = false;
-
-			// update individual measurement health status
-			_fault_status.flags.bad_mag_decl = true;
-
-		}
-	}
-
-	// only apply covariance and state corrrections if healthy
+	// only apply state corrections if healthy
 	if (healthy) {
-		// apply the covariance corrections
-		for (unsigned row = 0; row < _k_num_states; row++) {
-			for (unsigned column = 0; column < _k_num_states; column++) {
-				P[row][column] = P[row][column] - KHP[row][column];
-			}
-		}
-
 		// correct the covariance marix for gross errors
-		fixCovarianceErrors();
+		fixTouchedCovarianceErrors();
 
 		// apply the state corrections
 		fuse(Kfusion, innovation);
 
 	}
 }
+#endif
@@ -0,0 +1,363 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file output_predictor.cpp
+ * Output predictor that runs the strapdown inertial navigation at the full IMU rate on a separate thread
+ * to the EKF and is corrected asynchronously by the EKF states on the delayed fusion time horizon.
+ *
+ */
+
+#include "../ecl.h"
+#include "output_predictor.h"
+#include "geo.h"
+#include "mathlib.h"
+#include "fast_math.h"
+
+OutputPredictor::OutputPredictor():
+	_time_last_imu(0),
+	_dt_imu_avg(0.0f),
+	_dt_ekf_avg(0.012f),
+	_align_counter(0),
+	_aligned(false)
+{
+	_quat_offset = Quaternion();
+	_vel_offset.setZero();
+	_pos_offset.setZero();
+	_output_new = {};
+	_imu_sample_new = {};
+	_R_to_earth_now.setIdentity();
+	_gyro_bias.setZero();
+	_accel_bias.setZero();
+	_imu_pos_body.setZero();
+	_reset_status = {};
+	_delta_angle_corr.setZero();
+	_vel_err_integ.setZero();
+	_pos_err_integ.setZero();
+}
+
+bool OutputPredictor::init(uint16_t history_ms, uint16_t imu_interval_us)
+{
+	if (imu_interval_us == 0) {
+		return false;
+	}
+
+	unsigned history_length = (unsigned)history_ms * 1000 / imu_interval_us + 1;
+
+	if (!(_output_buffer.allocate(history_length) &&
+	      _correction_buffer.allocate(CORRECTION_QUEUE_LENGTH))) {
+		ECL_ERR("output predictor buffer allocation failed!");
+		_output_buffer.unallocate();
+		return false;
+	}
+
+	// every IMU sample is stored so the EKF fusion time horizon should match a stored sample within an IMU interval
+	_output_buffer.set_max_sample_age(2 * imu_interval_us);
+
+	_quat_offset = Quaternion();
+	_vel_offset.setZero();
+	_pos_offset.setZero();
+	_output_new.quat_nominal = Quaternion();
+	_output_new.vel.setZero();
+	_output_new.pos.setZero();
+	_output_new.time_us = 0;
+	_time_last_imu = 0;
+	_dt_imu_avg = 1e-6f * (float)imu_interval_us;
+	_dt_ekf_avg = 0.012f;	// nominal EKF prediction period until the first correction is received
+	_delta_angle_corr.setZero();
+	_vel_err_integ.setZero();
+	_pos_err_integ.setZero();
+	_aligned = false;
+
+	return true;
+}
+
+void OutputPredictor::setIMUData(uint64_t time_usec, uint64_t delta_ang_dt, uint64_t delta_vel_dt,
+				 float (&delta_ang)[3], float (&delta_vel)[3])
+{
+	if (_time_last_imu > 0) {
+		float dt = (float)(time_usec - _time_last_imu) / 1000 / 1000;
+		dt = math::constrain(dt, 1.0e-4f, 0.02f);
+		_dt_imu_avg = 0.8f * _dt_imu_avg + 0.2f * dt;
+	}
+
+	_time_last_imu = time_usec;
+
+	// copy data
+	memcpy(&_imu_sample_new.delta_ang._data[0], &delta_ang[0], sizeof(_imu_sample_new.delta_ang._data));
+	memcpy(&_imu_sample_new.delta_vel._data[0], &delta_vel[0], sizeof(_imu_sample_new.delta_vel._data));
+
+	// convert time from us to secs
+	_imu_sample_new.delta_ang_dt = delta_ang_dt / 1e6f;
+	_imu_sample_new.delta_vel_dt = delta_vel_dt / 1e6f;
+	_imu_sample_new.time_us = time_usec;
+
+	// apply the corrections received from the EKF thread since the last IMU sample
+	outputCorrection correction;
+
+	while (_correction_buffer.pop_oldest(&correction)) {
+		applyCorrection(correction);
+	}
+
+	calculateOutputStates();
+}
+
+bool OutputPredictor::setCorrection(const outputCorrection &correction)
+{
+	return _correction_buffer.push(correction);
+}
+
+void OutputPredictor::calculateOutputStates()
+{
+	// correct delta angles and delta velocity for bias offsets
+	float dt_scale_correction = _dt_imu_avg / _dt_ekf_avg;
+	Vector3f delta_angle = _imu_sample_new.delta_ang - _gyro_bias * dt_scale_correction;
+	Vector3f delta_vel = _imu_sample_new.delta_vel - _accel_bias * dt_scale_correction;
+
+	// Apply corrections to the delta angle required to track the quaternion states at the EKF fusion time horizon
+	delta_angle += _delta_angle_corr;
+
+	// convert the delta angle to an equivalent delta quaternions
+	Quaternion dq;
+	ecl::quat_from_rotation_vector(dq, delta_angle);
+
+	// rotate the previous INS quaternion by the delta quaternions
+	_output_new.time_us = _imu_sample_new.time_us;
+	_output_new.quat_nominal = dq * _output_new.quat_nominal;
+
+	// the quaternions must always be normalised afer modification
+	ecl::normalize_quat(_output_new.quat_nominal);
+
+	// calculate the rotation matrix from body to earth frame
+	_R_to_earth_now = matrix::Dcm<float>(_output_new.quat_nominal);
+
+	// rotate the delta velocity to earth frame
+	Vector3f delta_vel_NED = _R_to_earth_now * delta_vel;
+
+	// corrrect for measured accceleration due to gravity
+	delta_vel_NED(2) += CONSTANTS_ONE_G * _imu_sample_new.delta_vel_dt;
+
+	// save the previous velocity so we can use trapezidal integration
+	Vector3f vel_last = _output_new.vel;
+
+	// increment the INS velocity states by the measurement plus corrections
+	_output_new.vel += delta_vel_NED;
+
+	// use trapezoidal integration to calculate the INS position states
+	_output_new.pos += (_output_new.vel + vel_last) * (_imu_sample_new.delta_vel_dt * 0.5f);
+
+	// store the INS states relative to the accumulated corrections
+	outputSample output_stored;
+	output_stored.quat_nominal = _output_new.quat_nominal * _quat_offset.inversed();
+	output_stored.vel = _output_new.vel - _vel_offset;
+	output_stored.pos = _output_new.pos - _pos_offset;
+	output_stored.time_us = _output_new.time_us;
+	_output_buffer.push(output_stored);
+}
+
+void OutputPredictor::applyCorrection(const outputCorrection &correction)
+{
+	_gyro_bias = correction.gyro_bias;
+	_accel_bias = correction.accel_bias;
+	_dt_ekf_avg = correction.dt_ekf_avg;
+	_imu_pos_body = correction.imu_pos_body;
+
+	// the history already contains the output states before the resets that have been applied to the EKF states
+	bool align = !_aligned || correction.align_counter != _align_counter;
+
+	if (!align) {
+		applyResets(correction.reset_status);
+	}
+
+	// get the INS states at the EKF fusion time horizon
+	outputSample output_delayed;
+
+	if (!_output_buffer.get_first_older_than(correction.time_us, &output_delayed)) {
+		// the EKF fusion time horizon is outside the stored history
+		return;
+	}
+
+	output_delayed.quat_nominal = output_delayed.quat_nominal * _quat_offset;
+	ecl::normalize_quat(output_delayed.quat_nominal);
+	output_delayed.vel += _vel_offset;
+	output_delayed.pos += _pos_offset;
+
+	if (align) {
+		alignOutputStates(correction, output_delayed);
+		_reset_status = correction.reset_status;
+		_align_counter = correction.align_counter;
+		_aligned = true;
+		return;
+	}
+
+	// calculate the quaternion delta between the INS and EKF quaternions at the EKF fusion time horizon
+	Quaternion q_error = output_delayed.quat_nominal * correction.quat_nominal.inversed();
+	ecl::normalize_quat(q_error);
+
+	// convert the quaternion delta to a delta angle
+	float scalar = (q_error(0) >= 0.0f) ? -2.0f : 2.0f;
+	Vector3f delta_ang_error;
+	delta_ang_error(0) = scalar * q_error(1);
+	delta_ang_error(1) = scalar * q_error(2);
+	delta_ang_error(2) = scalar * q_error(3);
+
+	// calculate a gain that provides tight tracking of the estimator attitude states and
+	// adjust for changes in time delay to maintain consistent damping ratio of ~0.7
+	float time_delay = 1e-6f * (float)(_output_new.time_us - correction.time_us);
+	time_delay = fmaxf(time_delay, _dt_imu_avg);
+	float att_gain = 0.5f * _dt_imu_avg / time_delay;
+
+	// calculate a corrrection to the delta angle
+	// that will cause the INS to track the EKF quaternions
+	_delta_angle_corr = delta_ang_error * att_gain;
+
+	// calculate velocity and position tracking errors
+	Vector3f vel_err = correction.vel - output_delayed.vel;
+	Vector3f pos_err = correction.pos - output_delayed.pos;
+
+	// collect magnitude tracking error for diagnostics
+	_output_tracking_error[0] = delta_ang_error.norm();
+	_output_tracking_error[1] = vel_err.norm();
+	_output_tracking_error[2] = pos_err.norm();
+
+	// calculate a velocity correction that will be applied to the output state history
+	float vel_gain = _dt_ekf_avg / math::constrain(correction.vel_Tau, _dt_ekf_avg, 10.0f);
+	_vel_err_integ += vel_err;
+	Vector3f vel_correction = vel_err * vel_gain + _vel_err_integ * vel_gain * vel_gain * 0.1f;
+
+	// calculate a position correction that will be applied to the output state history
+	float pos_gain = _dt_ekf_avg / math::constrain(correction.pos_Tau, _dt_ekf_avg, 10.0f);
+	_pos_err_integ += pos_err;
+	Vector3f pos_correction = pos_err * pos_gain + _pos_err_integ * pos_gain * pos_gain * 0.1f;
+
+	// apply the corrections to the output state history and the newest output states
+	_vel_offset += vel_correction;
+	_pos_offset += pos_correction;
+	_output_new.vel += vel_correction;
+	_output_new.pos += pos_correction;
+}
+
+void OutputPredictor::applyResets(const stateResetStatus &reset_status)
+{
+	if (reset_status.velNE_counter != _reset_status.velNE_counter) {
+		_vel_offset(0) += reset_status.velNE_change(0);
+		_vel_offset(1) += reset_status.velNE_change(1);
+		_output_new.vel(0) += reset_status.velNE_change(0);
+		_output_new.vel(1) += reset_status.velNE_change(1);
+	}
+
+	if (reset_status.velD_counter != _reset_status.velD_counter) {
+		_vel_offset(2) += reset_status.velD_change;
+		_output_new.vel(2) += reset_status.velD_change;
+	}
+
+	if (reset_status.posNE_counter != _reset_status.posNE_counter) {
+		_pos_offset(0) += reset_status.posNE_change(0);
+		_pos_offset(1) += reset_status.posNE_change(1);
+		_output_new.pos(0) += reset_status.posNE_change(0);
+		_output_new.pos(1) += reset_status.posNE_change(1);
+	}
+
+	if (reset_status.posD_counter != _reset_status.posD_counter) {
+		_pos_offset(2) += reset_status.posD_change;
+		_output_new.pos(2) += reset_status.posD_change;
+	}
+
+	if (reset_status.quat_counter != _reset_status.quat_counter) {
+		_quat_offset = _quat_offset * reset_status.quat_change;
+		_output_new.quat_nominal = _output_new.quat_nominal * reset_status.quat_change;
+	}
+
+	_reset_status = reset_status;
+}
+
+void OutputPredictor::alignOutputStates(const outputCorrection &correction, const outputSample &output_delayed)
+{
+	// calculate the quaternion delta that rotates the INS quaternion at the EKF fusion time horizon onto the EKF quaternion
+	Quaternion q_delta = output_delayed.quat_nominal.inversed() * correction.quat_nominal;
+	ecl::normalize_quat(q_delta);
+
+	// apply the deltas to the output state history and the newest output states
+	_quat_offset = _quat_offset * q_delta;
+	ecl::normalize_quat(_quat_offset);
+	_output_new.quat_nominal = _output_new.quat_nominal * q_delta;
+	ecl::normalize_quat(_output_new.quat_nominal);
+	_R_to_earth_now = matrix::Dcm<float>(_output_new.quat_nominal);
+
+	Vector3f vel_delta = correction.vel - output_delayed.vel;
+	Vector3f pos_delta = correction.pos - output_delayed.pos;
+	_vel_offset += vel_delta;
+	_pos_offset += pos_delta;
+	_output_new.vel += vel_delta;
+	_output_new.pos += pos_delta;
+}
+
+void OutputPredictor::copy_quaternion(float *quat)
+{
+	for (unsigned i = 0; i < 4; i++) {
+		quat[i] = _output_new.quat_nominal(i);
+	}
+}
+
+void OutputPredictor::get_velocity(float *vel)
+{
+	// calculate the average angular rate across the last IMU update
+	Vector3f ang_rate = _imu_sample_new.delta_ang * (1.0f / math::max(_imu_sample_new.delta_ang_dt, 1e-4f));
+
+	// calculate the velocity of the IMU relative to the body origin
+	Vector3f vel_imu_rel_body = matrix::Vector3f(ang_rate) % matrix::Vector3f(_imu_pos_body);
+
+	// rotate the relative velocty into earth frame and subtract from the INS velocity
+	// (which is at the IMU) to get velocity of the body origin
+	Vector3f vel_earth = _output_new.vel - _R_to_earth_now * vel_imu_rel_body;
+
+	for (unsigned i = 0; i < 3; i++) {
+		vel[i] = vel_earth(i);
+	}
+}
+
+void OutputPredictor::get_position(float *pos)
+{
+	// rotate the position of the IMU relative to the body origin into earth frame
+	Vector3f pos_offset_earth = _R_to_earth_now * _imu_pos_body;
+
+	// subtract from the INS position (which is at the IMU) to get position at the body origin
+	for (unsigned i = 0; i < 3; i++) {
+		pos[i] = _output_new.pos(i) - pos_offset_earth(i);
+	}
+}
+
+void OutputPredictor::get_output_tracking_error(float error[3])
+{
+	memcpy(error, _output_tracking_error, 3 * sizeof(float));
+}
@@ -0,0 +1,133 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file output_predictor.h
+ * Output predictor that runs the strapdown inertial navigation at the full IMU rate on a separate thread
+ * to the EKF and is corrected asynchronously by the EKF states on the delayed fusion time horizon.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <matrix/matrix/math.hpp>
+#include "RingBuffer.h"
+#include "common.h"
+
+using namespace estimator;
+
+class OutputPredictor
+{
+public:
+	OutputPredictor();
+	~OutputPredictor() = default;
+
+	// allocate the output state history. The history must be long enough to span the delay from the newest
+	// IMU sample to the EKF fusion time horizon plus the worst case latency of the EKF thread.
+	// This must be called before the IMU and EKF threads start using the predictor.
+	bool init(uint16_t history_ms, uint16_t imu_interval_us);
+
+	// called by the IMU thread for every IMU sample to update the output states
+	void setIMUData(uint64_t time_usec, uint64_t delta_ang_dt, uint64_t delta_vel_dt, float (&delta_ang)[3],
+			float (&delta_vel)[3]);
+
+	// called by the EKF thread with the states returned by Ekf::get_output_correction()
+	// the correction is applied by the IMU thread on the next IMU sample
+	// returns false if the correction queue is full and the correction has been discarded
+	bool setCorrection(const outputCorrection &correction);
+
+	// the remaining functions must be called from the IMU thread
+
+	// return true when the output states have been aligned to the EKF states
+	bool attitude_valid() const { return _aligned; }
+
+	void copy_quaternion(float *quat);
+
+	// get the velocity of the body frame origin in local NED earth frame
+	void get_velocity(float *vel);
+
+	// get the position of the body frame origin in local NED earth frame
+	void get_position(float *pos);
+
+	void copy_timestamp(uint64_t *time_us) { *time_us = _output_new.time_us; }
+
+	// return an array containing the output predictor angular, velocity and position tracking
+	// error magnitudes (rad), (m/s), (m)
+	void get_output_tracking_error(float error[3]);
+
+private:
+	static const uint8_t CORRECTION_QUEUE_LENGTH = 4;	// number of EKF corrections that can be waiting for the IMU thread
+
+	// The output state history is stored relative to the accumulated corrections so that a correction can be
+	// applied to the complete history in constant time. The corrected value of a stored sample is given by
+	// quat_nominal * _quat_offset, vel + _vel_offset and pos + _pos_offset.
+	RingBuffer<outputSample> _output_buffer;
+	SpscRingBuffer<outputCorrection> _correction_buffer;
+	Quaternion _quat_offset;	// accumulated quaternion correction applied to the output state history
+	Vector3f _vel_offset;		// accumulated velocity correction applied to the output state history (m/s)
+	Vector3f _pos_offset;		// accumulated position correction applied to the output state history (m)
+
+	outputSample _output_new;	// output states at the time of the newest IMU sample
+	imuSample _imu_sample_new;	// newest IMU sample
+	Matrix3f _R_to_earth_now;	// rotation matrix from body to earth frame at current time
+	uint64_t _time_last_imu;	// timestamp of the newest IMU sample (uSec)
+	float _dt_imu_avg;		// average imu update period in s
+
+	// latest EKF states and parameters received in a correction
+	Vector3f _gyro_bias;		// delta angle bias estimate in rad
+	Vector3f _accel_bias;		// delta velocity bias estimate in m/s
+	float _dt_ekf_avg;		// average update rate of the ekf
+	Vector3f _imu_pos_body;		// xyz position of IMU in body frame (m)
+	stateResetStatus _reset_status;	// reset events already applied to the output states
+	uint8_t _align_counter;		// alignment events already applied to the output states
+	bool _aligned;			// true when the output states have been aligned to the EKF states
+
+	Vector3f _delta_angle_corr;	// delta angle correction vector
+	Vector3f _vel_err_integ;	// integral of velocity tracking error
+	Vector3f _pos_err_integ;	// integral of position tracking error
+	float _output_tracking_error[3] {};	// contains the magnitude of the angle, velocity and position track errors (rad, m/s, m)
+
+	// apply a correction from the EKF to the output states
+	void applyCorrection(const outputCorrection &correction);
+
+	// apply the EKF state reset events that have occurred since the last correction
+	void applyResets(const stateResetStatus &reset_status);
+
+	// shift the output states by the difference to the EKF states on the delayed fusion time horizon
+	void alignOutputStates(const outputCorrection &correction, const outputSample &output_delayed);
+
+	// integrate the newest IMU sample to update the output states
+	void calculateOutputStates();
+
+};
@@ -0,0 +1,174 @@
+############################################################################
+#
+#   Copyright (c) 2019 ECL Development Team. All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in
+#    the documentation and/or other materials provided with the
+#    distribution.
+# 3. Neither the name ECL nor the names of its contributors may be
+#    used to endorse or promote products derived from this software
+#    without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+# COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+# INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+# BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+# OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+# AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+# ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+#
+############################################################################
+
+"""
+Reports the worst case stack depth of the EKF library from the call graph
+files written by gcc -fcallgraph-info=su and fails if it exceeds a budget.
+
+The depth of a function is its own frame plus the deepest function it calls.
+Calls through function pointers and virtual functions, which are the timing
+and prediction hooks and the EstimatorInterface accessors, and calls to
+functions outside the library, such as the C maths library, are not followed
+and are listed so the caller can allow for them.
+
+Usage: stack_usage.py [--budget <bytes>] [--root <function>] <directory>
+"""
+
+import argparse
+import os
+import re
+import sys
+
+NODE = re.compile(r'node: \{ title: "([^"]*)" label: "([^"]*)"')
+EDGE = re.compile(r'edge: \{ sourcename: "([^"]*)" targetname: "([^"]*)"')
+FRAME = re.compile(r'(\d+) bytes \(([a-z,]+)\)')
+
+INDIRECT_CALL = "__indirect_call"
+
+
+class Function:
+	def __init__(self, name):
+		self.name = name
+		self.frame = None	# None if the function is not defined in the library
+		self.bounded = True
+		self.callees = set()
+
+
+def read_call_graph(directory):
+	functions = {}
+
+	def get(title):
+		if title not in functions:
+			functions[title] = Function(title)
+		return functions[title]
+
+	for root, _, files in os.walk(directory):
+		for file_name in files:
+			if not file_name.endswith(".ci"):
+				continue
+
+			with open(os.path.join(root, file_name)) as file:
+				for line in file:
+					node = NODE.match(line)
+					if node:
+						label = node.group(2).split("\\n")
+						frame = FRAME.search(node.group(2))
+						function = get(node.group(1))
+						function.name = label[0]
+						if frame:
+							function.frame = int(frame.group(1))
+							function.bounded = frame.group(2) != "dynamic"
+						continue
+
+					edge = EDGE.match(line)
+					if edge:
+						get(edge.group(1)).callees.add(edge.group(2))
+						get(edge.group(2))
+
+	# the complete object constructors and destructors of the Itanium C++ ABI are aliases of the base object
+	# versions, which are the only ones given a frame size
+	for title, function in list(functions.items()):
+		alias = re.sub(r"([CD])1E", r"\g<1>2E", title)
+		if function.frame is None and alias != title and alias in functions:
+			functions[title] = functions[alias]
+
+	return functions
+
+
+def worst_case_depth(functions, title, depths, active):
+	"""Return the depth and deepest call chain below a function, recursion is reported and not followed"""
+	if title in depths:
+		return depths[title]
+
+	function = functions[title]
+	if title in active:
+		sys.stderr.write("recursive call to %s is not included\n" % function.name)
+		return (0, [])
+
+	active.add(title)
+	deepest = (0, [])
+	for callee in function.callees:
+		if callee != INDIRECT_CALL:
+			depth = worst_case_depth(functions, callee, depths, active)
+			if depth[0] > deepest[0]:
+				deepest = depth
+	active.remove(title)
+
+	depths[title] = ((function.frame or 0) + deepest[0], [title] + deepest[1])
+	return depths[title]
+
+
+def main():
+	parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+	parser.add_argument("directory", help="directory searched for the .ci call graph files")
+	parser.add_argument("--root", default="Ekf::update()", help="function the depth is calculated from")
+	parser.add_argument("--budget", type=int, default=0, help="fail if the depth exceeds this number of bytes")
+	args = parser.parse_args()
+
+	functions = read_call_graph(args.directory)
+	roots = [title for title, function in functions.items()
+		 if function.frame is not None and function.name.split(" ")[-1] == args.root]
+	if not roots:
+		sys.stderr.write("%s not found in the call graph files in %s\n" % (args.root, args.directory))
+		return 1
+
+	depths = {}
+	depth, chain = worst_case_depth(functions, roots[0], depths, set())
+
+	print("worst case stack depth of %s is %d bytes" % (args.root, depth))
+	for title in chain:
+		function = functions[title]
+		frame = "external" if function.frame is None else "%d bytes" % function.frame
+		print("  %-12s%s%s" % (frame, function.name, "" if function.bounded else " (unbounded)"))
+
+	reachable = set(depths.keys())
+	indirect = sorted(functions[title].name for title in reachable if INDIRECT_CALL in functions[title].callees)
+	external = sorted(title for title in reachable if functions[title].frame is None)
+	unbounded = sorted(functions[title].name for title in reachable if not functions[title].bounded)
+
+	if indirect:
+		print("indirect calls not followed from:\n  " + "\n  ".join(indirect))
+	if external:
+		print("external functions not included:\n  " + "\n  ".join(external))
+	if unbounded:
+		print("functions with an unbounded dynamic stack allocation:\n  " + "\n  ".join(unbounded))
+
+	if args.budget > 0 and (depth > args.budget or unbounded):
+		sys.stderr.write("stack depth of %d bytes exceeds the budget of %d bytes\n" % (depth, args.budget))
+		return 1
+
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
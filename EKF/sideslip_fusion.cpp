@@ -43,46 +43,34 @@
 #include "ekf.h"
 #include "mathlib.h"
 
-void Ekf::fuseSideslip()
-{ 
+#ifndef ECL_EKF_NO_WIND_STATES
+void Ekf::fuseSideslip(const airDataTerms &terms)
+{
+	EKF_TIMED_SCOPE(EKF_TIMING_FUSE_SIDESLIP);
+
 	float SH_BETA[13] = {}; // Varialbe used to optimise calculations of measurement jacobian
 	float H_BETA[24] = {}; // Observation Jacobian
 	float SK_BETA[8] = {}; // Varialbe used to optimise calculations of the Kalman gain vector
 	float Kfusion[24] = {}; // Kalman gain vector
     float R_BETA = _params.beta_noise;
 
-	// get latest estimated orientation
-	float q0 = _state.quat_nominal(0);
-	float q1 = _state.quat_nominal(1);
-	float q2 = _state.quat_nominal(2);
-	float q3 = _state.quat_nominal(3);
-
-	// get latest velocity in earth frame
-	float vn = _state.vel(0);
-	float ve = _state.vel(1);
-	float vd = _state.vel(2);
-
-	// get latest wind velocity in earth frame
-	float vwn = _state.wind_vel(0);
-	float vwe = _state.wind_vel(1);
+	// get the orientation, velocity and wind velocity the observation is linearised about
+	const float q0 = terms.q0;
+	const float q1 = terms.q1;
+	const float q2 = terms.q2;
+	const float q3 = terms.q3;
+	const float vn = terms.vn;
+	const float ve = terms.ve;
+	const float vd = terms.vd;
+	const float vwn = terms.vwn;
+	const float vwe = terms.vwe;
 
-	// relative wind velocity in earth frame
-    Vector3f rel_wind; 
-    rel_wind(0) = vn - vwn;
-    rel_wind(1) = ve - vwe;
-    rel_wind(2) = vd;
-
-    matrix::Dcm<float> earth_to_body(_state.quat_nominal);
-	earth_to_body = earth_to_body.transpose(); //Why transpose?
-
-    // rotate into body axes
-    rel_wind = earth_to_body * rel_wind;
+	// relative wind velocity in body axes
+    const Vector3f &rel_wind = terms.rel_wind_body;
 
     // perform fusion of assumed sideslip  = 0
     if (rel_wind(0) > 7.0f){
-		// Calculate the observation jacobians
-
-		// intermediate variable from algebraic optimisation
+		// intermediate variable from algebraic optimisation used by the innovation variance and observation jacobian
 	SH_BETA[0] = (vn - vwn)*(sq(q0) + sq(q1) - sq(q2) - sq(q3)) - vd*(2.0f*q0*q2 - 2.0f*q1*q3) + (ve - vwe)*(2.0f*q0*q3 + 2.0f*q1*q2);
 	if (fabsf(SH_BETA[0]) <= 1e-9f) {
 		return;
@@ -100,20 +88,6 @@ void Ekf::fuseSideslip()
 	SH_BETA[11] = 2.0f*q1*SH_BETA[2] + 2.0f*q2*SH_BETA[3] + 2.0f*q3*vd;
 	SH_BETA[12] = 2.0f*q0*q3;
 
-        H_BETA[0] = SH_BETA[5]*SH_BETA[8] - SH_BETA[1]*SH_BETA[4]*SH_BETA[9];
-        H_BETA[1] = SH_BETA[5]*SH_BETA[10] - SH_BETA[1]*SH_BETA[4]*SH_BETA[11];
-        H_BETA[2] = SH_BETA[5]*SH_BETA[11] + SH_BETA[1]*SH_BETA[4]*SH_BETA[10];
-        H_BETA[3] = - SH_BETA[5]*SH_BETA[9] - SH_BETA[1]*SH_BETA[4]*SH_BETA[8];
-        H_BETA[4] = - SH_BETA[5]*(SH_BETA[12] - 2.0f*q1*q2) - SH_BETA[1]*SH_BETA[4]*SH_BETA[7];
-        H_BETA[5] = SH_BETA[6] - SH_BETA[1]*SH_BETA[4]*(SH_BETA[12] + 2.0f*q1*q2);
-        H_BETA[6] = SH_BETA[5]*(2.0f*q0*q1 + 2.0f*q2*q3) + SH_BETA[1]*SH_BETA[4]*(2.0f*q0*q2 - 2.0f*q1*q3);
-        H_BETA[22] = SH_BETA[5]*(SH_BETA[12] - 2.0f*q1*q2) + SH_BETA[1]*SH_BETA[4]*SH_BETA[7];
-        H_BETA[23] = SH_BETA[1]*SH_BETA[4]*(SH_BETA[12] + 2.0f*q1*q2) - SH_BETA[6];
-
-        for (uint8_t i=7; i<=21; i++) {
-		H_BETA[i] = 0.0f;
-        }
-
 	// determine if we need the sideslip fusion to correct states other than wind
 	bool update_wind_only = ((_time_last_imu - _time_last_gps) < 1e6) || ((_time_last_imu - _time_last_ext_vision) < 1e6) || ((_time_last_imu - _time_last_optflow) < 1e6);
 
@@ -138,6 +112,51 @@ void Ekf::fuseSideslip()
 	    }
             return;
         }
+
+        // form the observation jacobian, which is also used to correct the innovation for a preceding airspeed update
+        H_BETA[0] = SH_BETA[5]*SH_BETA[8] - SH_BETA[1]*SH_BETA[4]*SH_BETA[9];
+        H_BETA[1] = SH_BETA[5]*SH_BETA[10] - SH_BETA[1]*SH_BETA[4]*SH_BETA[11];
+        H_BETA[2] = SH_BETA[5]*SH_BETA[11] + SH_BETA[1]*SH_BETA[4]*SH_BETA[10];
+        H_BETA[3] = - SH_BETA[5]*SH_BETA[9] - SH_BETA[1]*SH_BETA[4]*SH_BETA[8];
+        H_BETA[4] = - SH_BETA[5]*(SH_BETA[12] - 2.0f*q1*q2) - SH_BETA[1]*SH_BETA[4]*SH_BETA[7];
+        H_BETA[5] = SH_BETA[6] - SH_BETA[1]*SH_BETA[4]*(SH_BETA[12] + 2.0f*q1*q2);
+        H_BETA[6] = SH_BETA[5]*(2.0f*q0*q1 + 2.0f*q2*q3) + SH_BETA[1]*SH_BETA[4]*(2.0f*q0*q2 - 2.0f*q1*q3);
+        H_BETA[22] = SH_BETA[5]*(SH_BETA[12] - 2.0f*q1*q2) + SH_BETA[1]*SH_BETA[4]*SH_BETA[7];
+        H_BETA[23] = SH_BETA[1]*SH_BETA[4]*(SH_BETA[12] + 2.0f*q1*q2) - SH_BETA[6];
+
+        for (uint8_t i=7; i<=21; i++) {
+		H_BETA[i] = 0.0f;
+        }
+
+        // Calculate predicted sideslip angle and innovation using small angle approximation
+        _beta_innov = rel_wind(1) / rel_wind(0);
+
+        // the predicted sideslip angle is evaluated at the prior state, so add the effect of any state
+        // change made by an airspeed update since then
+        const uint8_t H_index[9] = {0, 1, 2, 3, 4, 5, 6, 22, 23};
+
+        for (uint8_t i = 0; i < 9; i++) {
+		_beta_innov += H_BETA[H_index[i]] * terms.state_delta[i];
+        }
+
+        // Compute the ratio of innovation to gate size
+        _beta_test_ratio = sq(_beta_innov) / (sq(fmaxf(_params.beta_innov_gate, 1.0f)) * _beta_innov_var);
+	EKF_RECORD_FUSION(FLIGHT_RECORDER_SIDESLIP, _beta_innov, _beta_innov_var, _beta_test_ratio, _beta_test_ratio > 1.0f);
+
+	// if the innovation consistency check fails then don't fuse the sample and indicate bad beta health
+	if (_beta_test_ratio > 1.0f) {
+		_innov_check_fail_status.flags.reject_sideslip = true;
+		return;
+
+	} else {
+                _innov_check_fail_status.flags.reject_sideslip = false;
+
+        }
+
+        // synthetic sideslip measurement sample has passed check so record it
+        _time_last_beta_fuse = _time_last_imu;
+
+        // calculate the Kalman gains now that the measurement has passed the innovation test
         SK_BETA[1] = SH_BETA[5]*(SH_BETA[12] - 2.0f*q1*q2) + SH_BETA[1]*SH_BETA[4]*SH_BETA[7];
         SK_BETA[2] = SH_BETA[6] - SH_BETA[1]*SH_BETA[4]*(SH_BETA[12] + 2.0f*q1*q2);
         SK_BETA[3] = SH_BETA[5]*(2.0f*q0*q1 + 2.0f*q2*q3) + SH_BETA[1]*SH_BETA[4]*(2.0f*q0*q2 - 2.0f*q1*q3);
@@ -191,86 +210,16 @@ void Ekf::fuseSideslip()
         Kfusion[22] = SK_BETA[0]*(P[22][0]*SK_BETA[5] + P[22][1]*SK_BETA[4] - P[22][4]*SK_BETA[1] + P[22][5]*SK_BETA[2] + P[22][2]*SK_BETA[6] + P[22][6]*SK_BETA[3] - P[22][3]*SK_BETA[7] + P[22][22]*SK_BETA[1] - P[22][23]*SK_BETA[2]);
         Kfusion[23] = SK_BETA[0]*(P[23][0]*SK_BETA[5] + P[23][1]*SK_BETA[4] - P[23][4]*SK_BETA[1] + P[23][5]*SK_BETA[2] + P[23][2]*SK_BETA[6] + P[23][6]*SK_BETA[3] - P[23][3]*SK_BETA[7] + P[23][22]*SK_BETA[1] - P[23][23]*SK_BETA[2]);
 
-        // Calculate predicted sideslip angle and innovation using small angle approximation
-        _beta_innov = rel_wind(1) / rel_wind(0);
-
-        // Compute the ratio of innovation to gate size
-        _beta_test_ratio = sq(_beta_innov) / (sq(fmaxf(_params.beta_innov_gate, 1.0f)) * _beta_innov_var);
-
-	// if the innovation consistency check fails then don't fuse the sample and indicate bad beta health
-	if (_beta_test_ratio > 1.0f) {
-		_innov_check_fail_status.flags.reject_sideslip = true;
-		return;
-
-	} else {
-                _innov_check_fail_status.flags.reject_sideslip = false;
-
-        }
-
-        // synthetic sideslip measurement sample has passed check so record it
-        _time_last_beta_fuse = _time_last_imu;
-
 	// apply covariance correction via P_new = (I -K*H)*P
-	// first calculate expression for KHP
-	// then calculate P - KHP
-	float KHP[_k_num_states][_k_num_states];
-	float KH[9];
-	for (unsigned row = 0; row < _k_num_states; row++) {
-
-		KH[0] = Kfusion[row] * H_BETA[0];
-		KH[1] = Kfusion[row] * H_BETA[1];
-		KH[2] = Kfusion[row] * H_BETA[2];
-		KH[3] = Kfusion[row] * H_BETA[3];
-		KH[4] = Kfusion[row] * H_BETA[4];
-		KH[5] = Kfusion[row] * H_BETA[5];
-		KH[6] = Kfusion[row] * H_BETA[6];
-		KH[7] = Kfusion[row] * H_BETA[22];
-		KH[8] = Kfusion[row] * H_BETA[23];
-
-		for (unsigned column = 0; column < _k_num_states; column++) {
-			float tmp = KH[0] * P[0][column];
-			tmp += KH[1] * P[1][column];
-			tmp += KH[2] * P[2][column];
-			tmp += KH[3] * P[3][column];
-			tmp += KH[4] * P[4][column];
-			tmp += KH[5] * P[5][column];
-			tmp += KH[6] * P[6][column];
-			tmp += KH[7] * P[22][column];
-			tmp += KH[8] * P[23][column];
-			KHP[row][column] = tmp;
-		}
-	}
-
 	// if the covariance correction will result in a negative variance, then
 	// the covariance marix is unhealthy and must be corrected
-	bool healthy = true;
-	_fault_status.flags.bad_sideslip = false;
-	for (int i = 0; i < _k_num_states; i++) {
-		if (P[i][i] < KHP[i][i]) {
-			// zero rows and columns
-			zeroRows(P,i,i);
-			zeroCols(P,i,i);
+	bool healthy = updateCovariance(Kfusion, H_BETA, H_index, 9);
+	_fault_status.flags.bad_sideslip = !healthy;
 
-			//flag as unhealthy
-			healthy = false;
-
-			// update individual measurement health status
-			_fault_status.flags.bad_sideslip = true;
-
-		}
-	}
-
-	// only apply covariance and state corrrections if healthy
+	// only apply state corrections if healthy
 	if (healthy) {
-		// apply the covariance corrections
-		for (unsigned row = 0; row < _k_num_states; row++) {
-			for (unsigned column = 0; column < _k_num_states; column++) {
-				P[row][column] = P[row][column] - KHP[row][column];
-			}
-		}
-
 		// correct the covariance marix for gross errors
-		fixCovarianceErrors();
+		fixTouchedCovarianceErrors();
 
 		// apply the state corrections
 		fuse(Kfusion, _beta_innov);
@@ -278,3 +227,4 @@ void Ekf::fuseSideslip()
         }
     }
 }
+#endif
@@ -45,13 +45,14 @@
 bool Ekf::initHagl()
 {
 	// get most recent range measurement from buffer
-	rangeSample latest_measurement = _range_buffer.get_newest();
+	const rangeSample &latest_measurement = _range_buffer.get_newest();
 
 	if ((_time_last_imu - latest_measurement.time_us) < 2e5 && _R_rng_to_earth_2_2 > 0.7071f) {
 		// if we have a fresh measurement, use it to initialise the terrain estimator
 		_terrain_vpos = _state.pos(2) + latest_measurement.rng * _R_rng_to_earth_2_2;
 		// initialise state variance to variance of measurement
 		_terrain_var = sq(_params.range_noise);
+		resetTerrainHypotheses();
 		// success
 		return true;
 
@@ -60,6 +61,7 @@ bool Ekf::initHagl()
 		_terrain_vpos = _state.pos(2) + _params.rng_gnd_clearance;
 		// Use the ground clearance value as our uncertainty
 		_terrain_var = sq(_params.rng_gnd_clearance);
+		resetTerrainHypotheses();
 		// ths is a guess
 		return false;
 
@@ -82,15 +84,17 @@ void Ekf::runTerrainEstimator()
 
 		// predict the state variance growth where the state is the vertical position of the terrain underneath the vehicle
 
-		// process noise due to errors in vehicle height estimate
-		_terrain_var += sq(_imu_sample_delayed.delta_vel_dt * _params.terrain_p_noise);
+		// process noise due to errors in vehicle height estimate and due to terrain gradient
+		const float process_noise = sq(_imu_sample_delayed.delta_vel_dt * _params.terrain_p_noise)
+					    + sq(_imu_sample_delayed.delta_vel_dt * _params.terrain_gradient) * (sq(_state.vel(0)) + sq(_state.vel(1)));
 
-		// process noise due to terrain gradient
-		_terrain_var += sq(_imu_sample_delayed.delta_vel_dt * _params.terrain_gradient) * (sq(_state.vel(0)) + sq(_state.vel(
-					1)));
+		// all hypotheses follow the same height and gradient process model
+		for (uint8_t i = 0; i < _k_num_terrain_hyp; i++) {
+			// limit the variance to prevent it becoming badly conditioned
+			_terrain_hyp_var[i] = math::constrain(_terrain_hyp_var[i] + process_noise, 0.0f, 1e4f);
+		}
 
-		// limit the variance to prevent it becoming badly conditioned
-		_terrain_var = math::constrain(_terrain_var, 0.0f, 1e4f);
+		_terrain_var = _terrain_hyp_var[_terrain_hyp_index];
 
 		// Fuse range finder data if available
 		if (_range_data_ready) {
@@ -107,34 +111,87 @@ void Ekf::runTerrainEstimator()
 
 void Ekf::fuseHagl()
 {
+	EKF_TIMED_SCOPE(EKF_TIMING_FUSE_HAGL);
+
 	// If the vehicle is excessively tilted, do not try to fuse range finder observations
 	if (_R_rng_to_earth_2_2 > 0.7071f) {
 		// get a height above ground measurement from the range finder assuming a flat earth
 		float meas_hagl = _range_sample_delayed.rng * _R_rng_to_earth_2_2;
 
-		// predict the hagl from the vehicle position and terrain height
-		float pred_hagl = _terrain_vpos - _state.pos(2);
-
-		// calculate the innovation
-		_hagl_innov = pred_hagl - meas_hagl;
-
 		// calculate the observation variance adding the variance of the vehicles own height uncertainty
 		float obs_variance = fmaxf(P[9][9], 0.0f) + sq(_params.range_noise) + sq(_params.range_noise_scaler * _range_sample_delayed.rng);
 
-		// calculate the innovation variance - limiting it to prevent a badly conditioned fusion
-		_hagl_innov_var = fmaxf(_terrain_var + obs_variance, obs_variance);
-
-		// perform an innovation consistency check and only fuse data if it passes
 		float gate_size = fmaxf(_params.range_innov_gate, 1.0f);
-		_terr_test_ratio = sq(_hagl_innov) / (sq(gate_size) * _hagl_innov_var);
+
+		// calculate the innovation and innovation variance for every hypothesis
+		// the innovation variance is limited to prevent a badly conditioned fusion
+		float innov[_k_num_terrain_hyp];
+		float innov_var[_k_num_terrain_hyp];
+		float test_ratio[_k_num_terrain_hyp];
+		float weight_sum = 0.0f;
+
+		for (uint8_t i = 0; i < _k_num_terrain_hyp; i++) {
+			innov[i] = _terrain_hyp_vpos[i] - _state.pos(2) - meas_hagl;
+			innov_var[i] = fmaxf(_terrain_hyp_var[i] + obs_variance, obs_variance);
+			test_ratio[i] = sq(innov[i]) / (sq(gate_size) * innov_var[i]);
+
+			// scale the weight by the likelihood of the measurement, limiting the exponent to prevent underflow
+			_terrain_hyp_weight[i] *= expf(-0.5f * fminf(sq(innov[i]) / innov_var[i], 50.0f)) / sqrtf(innov_var[i]);
+			weight_sum += _terrain_hyp_weight[i];
+		}
+
+		// the innovation statistics of the selected hypothesis are published
+		_hagl_innov = innov[_terrain_hyp_index];
+		_hagl_innov_var = innov_var[_terrain_hyp_index];
+		_terr_test_ratio = test_ratio[_terrain_hyp_index];
+		EKF_RECORD_FUSION(FLIGHT_RECORDER_HAGL, _hagl_innov, _hagl_innov_var, _terr_test_ratio, _terr_test_ratio > 1.0f);
+
+		// update every hypothesis that passes the innovation consistency check
+		bool fused = false;
+
+		for (uint8_t i = 0; i < _k_num_terrain_hyp; i++) {
+			if (_terrain_hyp_weight[i] > 0.0f && test_ratio[i] <= 1.0f) {
+				// calculate the Kalman gain
+				float gain = _terrain_hyp_var[i] / innov_var[i];
+				// correct the state
+				_terrain_hyp_vpos[i] -= gain * innov[i];
+				// correct the variance
+				_terrain_hyp_var[i] = fmaxf(_terrain_hyp_var[i] * (1.0f - gain), 0.0f);
+				fused = true;
+			}
+		}
+
+		if (weight_sum > 0.0f) {
+			for (uint8_t i = 0; i < _k_num_terrain_hyp; i++) {
+				_terrain_hyp_weight[i] /= weight_sum;
+			}
+
+		} else {
+			// every weight has underflowed so restart the weighting from the selected hypothesis
+			for (uint8_t i = 0; i < _k_num_terrain_hyp; i++) {
+				_terrain_hyp_weight[i] = 0.0f;
+			}
+
+			_terrain_hyp_weight[_terrain_hyp_index] = 1.0f;
+		}
+
+		if (!fused) {
+			// the measurement is not consistent with any hypothesis so start a new one from it in the least likely
+			// slot other than the selected one, it then has to earn its weight from subsequent measurements
+			uint8_t slot = (_terrain_hyp_index + 1) % _k_num_terrain_hyp;
+
+			for (uint8_t i = 0; i < _k_num_terrain_hyp; i++) {
+				if (i != _terrain_hyp_index && _terrain_hyp_weight[i] < _terrain_hyp_weight[slot]) {
+					slot = i;
+				}
+			}
+
+			_terrain_hyp_vpos[slot] = _state.pos(2) + meas_hagl;
+			_terrain_hyp_var[slot] = obs_variance;
+			_terrain_hyp_weight[slot] = 0.1f;
+		}
 
 		if (_terr_test_ratio <= 1.0f) {
-			// calculate the Kalman gain
-			float gain = _terrain_var / _hagl_innov_var;
-			// correct the state
-			_terrain_vpos -= gain * _hagl_innov;
-			// correct the variance
-			_terrain_var = fmaxf(_terrain_var * (1.0f - gain), 0.0f);
 			// record last successful fusion event
 			_time_last_hagl_fuse = _time_last_imu;
 			_innov_check_fail_status.flags.reject_hagl = false;
@@ -144,11 +201,59 @@ void Ekf::fuseHagl()
 
 		}
 
+		selectTerrainHypothesis();
+
 	} else {
 		return;
 	}
 }
 
+void Ekf::resetTerrainHypotheses()
+{
+	for (uint8_t i = 0; i < _k_num_terrain_hyp; i++) {
+		_terrain_hyp_vpos[i] = _terrain_vpos;
+		_terrain_hyp_var[i] = _terrain_var;
+		_terrain_hyp_weight[i] = 0.0f;
+	}
+
+	_terrain_hyp_index = 0;
+	_terrain_hyp_weight[0] = 1.0f;
+}
+
+void Ekf::selectTerrainHypothesis()
+{
+	// drop hypotheses that have become negligible and merge those that can no longer be told apart into the more
+	// likely one
+	for (uint8_t i = 0; i < _k_num_terrain_hyp; i++) {
+		if (i != _terrain_hyp_index && _terrain_hyp_weight[i] < 1e-3f) {
+			_terrain_hyp_weight[i] = 0.0f;
+		}
+	}
+
+	for (uint8_t i = 0; i < _k_num_terrain_hyp; i++) {
+		for (uint8_t j = i + 1; j < _k_num_terrain_hyp; j++) {
+			if (_terrain_hyp_weight[i] > 0.0f && _terrain_hyp_weight[j] > 0.0f
+			    && sq(_terrain_hyp_vpos[i] - _terrain_hyp_vpos[j]) < _terrain_hyp_var[i] + _terrain_hyp_var[j]) {
+				const bool keep_i = (i == _terrain_hyp_index) || (j != _terrain_hyp_index && _terrain_hyp_weight[i] >= _terrain_hyp_weight[j]);
+				const uint8_t keep = keep_i ? i : j;
+				const uint8_t drop = keep_i ? j : i;
+				_terrain_hyp_weight[keep] += _terrain_hyp_weight[drop];
+				_terrain_hyp_weight[drop] = 0.0f;
+			}
+		}
+	}
+
+	// switch to a different hypothesis only when it is clearly more likely to prevent the estimate toggling
+	for (uint8_t i = 0; i < _k_num_terrain_hyp; i++) {
+		if (_terrain_hyp_weight[i] > 3.0f * _terrain_hyp_weight[_terrain_hyp_index]) {
+			_terrain_hyp_index = i;
+		}
+	}
+
+	_terrain_vpos = _terrain_hyp_vpos[_terrain_hyp_index];
+	_terrain_var = _terrain_hyp_var[_terrain_hyp_index];
+}
+
 // return true if the estimate is fresh
 // return the estimated vertical position of the terrain relative to the NED origin
 bool Ekf::get_terrain_vert_pos(float *ret)
@@ -163,17 +268,6 @@ bool Ekf::get_terrain_vert_pos(float *ret)
 	}
 }
 
-void Ekf::get_hagl_innov(float *hagl_innov)
-{
-	memcpy(hagl_innov, &_hagl_innov, sizeof(_hagl_innov));
-}
-
-
-void Ekf::get_hagl_innov_var(float *hagl_innov_var)
-{
-	memcpy(hagl_innov_var, &_hagl_innov_var, sizeof(_hagl_innov_var));
-}
-
 // check that the range finder data is continuous
 void Ekf::checkRangeDataContinuity()
 {
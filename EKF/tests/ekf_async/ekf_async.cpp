@@ -0,0 +1,170 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file ekf_async.cpp
+ * Test that EkfAsync only wakes the estimator thread when a down-sampled IMU sample is ready and that the filter
+ * it runs follows an Ekf given the same data
+ *
+ */
+
+#include <stdint.h>
+#include <cassert>
+#include <cmath>
+#include "../../ekf_async.h"
+
+extern "C" __EXPORT int ekf_async_main(int argc, char *argv[]);
+
+static unsigned notify_count = 0;
+
+static void frame_ready(void *arg)
+{
+	notify_count++;
+}
+
+int ekf_async_main(int argc, char *argv[])
+{
+	EkfAsync *async = new EkfAsync();
+	Ekf *ekf = new Ekf();
+	assert(async->init(400, 4000, frame_ready, nullptr));
+
+	const uint64_t dt_us = 4000;
+	float delta_ang[3] = {0.02f * 1e-6f * dt_us, -0.01f * 1e-6f * dt_us, 0.05f * 1e-6f * dt_us};
+	float delta_vel[3] = {0.0f, 0.0f, -CONSTANTS_ONE_G * 1e-6f * dt_us};
+	float mag[3] = {0.2f, 0.0f, 0.4f};
+	uint64_t time_usec = 1000000;
+
+	// the first sample wakes the estimator thread so that it can initialise the filter
+	async->setIMUData(time_usec, dt_us, dt_us, delta_ang, delta_vel);
+	assert(notify_count == 1);
+
+	ekf->setIMUData(time_usec, dt_us, dt_us, delta_ang, delta_vel);
+	ekf->update();
+
+	// the estimator thread is not woken again until it has run
+	notify_count = 0;
+
+	for (unsigned i = 0; i < 10; i++) {
+		time_usec += dt_us;
+		async->setIMUData(time_usec, dt_us, dt_us, delta_ang, delta_vel);
+		ekf->setIMUData(time_usec, dt_us, dt_us, delta_ang, delta_vel);
+		ekf->update();
+	}
+
+	assert(notify_count == 0);
+	async->process();
+
+	unsigned num_updates = 0;
+	unsigned num_updates_ekf = 0;
+	unsigned num_empty = 0;
+	unsigned samples_since_notify = 0;
+	unsigned max_samples_since_notify = 0;
+
+	for (unsigned step = 0; step < 5000; step++) {
+		time_usec += dt_us;
+		notify_count = 0;
+		async->setIMUData(time_usec, dt_us, dt_us, delta_ang, delta_vel);
+
+		ekf->setIMUData(time_usec, dt_us, dt_us, delta_ang, delta_vel);
+		imuSample imu_sample;
+
+		if (ekf->get_imu_sample_down_sampled(imu_sample)) {
+			num_updates_ekf++;
+		}
+
+		if (step % 5 == 0) {
+			async->get_ekf().setMagData(time_usec, mag);
+			async->get_ekf().setBaroData(time_usec, 100.0f);
+			ekf->setMagData(time_usec, mag);
+			ekf->setBaroData(time_usec, 100.0f);
+		}
+
+		ekf->update();
+
+		samples_since_notify++;
+		assert(notify_count <= 1);
+
+		if (notify_count == 1) {
+			// a notification is only raised when the queued data completes a down-sampled sample
+			const unsigned updates = async->process();
+			num_updates += updates;
+
+			if (updates == 0) {
+				num_empty++;
+			}
+
+			max_samples_since_notify = math::max(max_samples_since_notify, samples_since_notify);
+			samples_since_notify = 0;
+		}
+	}
+
+	// every down-sampled sample is processed and the estimator thread is woken with the sample that completes it
+	assert(num_updates == num_updates_ekf);
+	assert(num_empty == 0);
+	assert(max_samples_since_notify <= ekf->get_filter_update_period_ms() * 1000 / dt_us);
+	assert(async->get_imu_queue_overruns() == 0);
+
+	// the filter and the output predictor follow the Ekf given the same data
+	float state[24];
+	float state_async[24];
+	ekf->get_state_delayed(state);
+	async->get_ekf().get_state_delayed(state_async);
+
+	for (unsigned i = 0; i < 24; i++) {
+		assert(fabsf(state_async[i] - state[i]) < 1e-4f);
+	}
+
+	assert(async->get_output_predictor().attitude_valid());
+	float quat[4];
+	float quat_async[4];
+	ekf->copy_quaternion(quat);
+	async->get_output_predictor().copy_quaternion(quat_async);
+
+	for (unsigned i = 0; i < 4; i++) {
+		assert(fabsf(quat_async[i] - quat[i]) < 1e-4f);
+	}
+
+	float pos[3];
+	float pos_async[3];
+	ekf->get_position(pos);
+	async->get_output_predictor().get_position(pos_async);
+
+	for (unsigned i = 0; i < 3; i++) {
+		assert(fabsf(pos_async[i] - pos[i]) < 1e-3f);
+	}
+
+	delete async;
+	delete ekf;
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file ekf_bank.cpp
+ * Test that the parallel update of an EkfBank gives the same result as the sequential update
+ *
+ */
+
+#include <stdint.h>
+#include <cassert>
+#include <cstring>
+#include "../../ekf_bank.h"
+
+extern "C" __EXPORT int ekf_bank_main(int argc, char *argv[]);
+
+// feed one IMU sample at 250 Hz for a slowly rotating vehicle and the magnetometer and baro data at 50 Hz
+static void set_data(EkfBank &bank, uint64_t time_usec, unsigned step)
+{
+	const uint64_t dt_us = 4000;
+	float delta_ang[3] = {0.02f * 1e-6f * dt_us, -0.01f * 1e-6f * dt_us, 0.05f * 1e-6f * dt_us};
+	float delta_vel[3] = {0.1f * 1e-6f * dt_us, 0.0f, -CONSTANTS_ONE_G * 1e-6f * dt_us};
+	bank.setIMUData(time_usec, dt_us, dt_us, delta_ang, delta_vel);
+
+	if (step % 5 == 0) {
+		for (uint8_t i = 0; i < bank.get_num_instances(); i++) {
+			float mag[3] = {0.2f, 0.0f, 0.4f};
+			bank.get_instance(i).setMagData(time_usec, mag);
+			bank.get_instance(i).setBaroData(time_usec, 100.0f + 0.1f * (step % 7));
+		}
+	}
+}
+
+int ekf_bank_main(int argc, char *argv[])
+{
+	const uint8_t num_instances = EkfBank::max_instances;
+	EkfBank *sequential = new EkfBank(num_instances);
+	EkfBank *parallel = new EkfBank(num_instances);
+
+	// give each instance a different baro noise so that the instances differ from each other
+	for (uint8_t i = 0; i < num_instances; i++) {
+		sequential->get_instance(i).getParamHandle()->baro_noise = 1.0f + i;
+		parallel->get_instance(i).getParamHandle()->baro_noise = 1.0f + i;
+	}
+
+	const unsigned num_states = Ekf::get_num_states();
+	float *cov = new float[num_states * num_states];
+	float *cov_parallel = new float[num_states * num_states];
+	uint64_t time_usec = 1000000;
+	unsigned num_updates = 0;
+
+	for (unsigned step = 0; step < 5000; step++) {
+		time_usec += 4000;
+		set_data(*sequential, time_usec, step);
+		set_data(*parallel, time_usec, step);
+
+		const uint8_t updated = sequential->update();
+		assert(parallel->update_parallel() == updated);
+
+		if (updated != 0) {
+			num_updates++;
+		}
+
+		// the instances are independent so the results are the same to the bit
+		for (uint8_t i = 0; i < num_instances; i++) {
+			float state[24];
+			float state_parallel[24];
+			sequential->get_instance(i).get_state_delayed(state);
+			parallel->get_instance(i).get_state_delayed(state_parallel);
+			assert(memcmp(state, state_parallel, sizeof(state)) == 0);
+
+			sequential->get_instance(i).get_covariance_matrix(cov);
+			parallel->get_instance(i).get_covariance_matrix(cov_parallel);
+			assert(memcmp(cov, cov_parallel, sizeof(float) * num_states * num_states) == 0);
+		}
+	}
+
+	assert(num_updates > 0);
+
+	delete[] cov;
+	delete[] cov_parallel;
+	delete sequential;
+	delete parallel;
+
+	return 0;
+}
@@ -0,0 +1,188 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file ekf_batch.cpp
+ * Test that the instances of an EkfBatch follow the Ekf they were copied from when given the same IMU data
+ *
+ */
+
+#include <stdint.h>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include "../../ekf_batch.h"
+
+extern "C" __EXPORT int ekf_batch_main(int argc, char *argv[]);
+
+// The batch uses the same order of operations as Ekf, the small tolerance allows for the compiler contracting
+// multiplications and additions differently in the two implementations
+static bool is_close(float a, float b)
+{
+	return fabsf(a - b) <= 1e-5f * fmaxf(fabsf(a), fabsf(b)) + 1e-12f;
+}
+
+// feed one IMU sample at 250 Hz for a slowly rotating vehicle and optionally the magnetometer and baro data at 50 Hz,
+// then run the filter update, returns true if the IMU data was down-sampled to a new prediction step
+static bool run_step(Ekf &ekf, uint64_t time_usec, unsigned step, bool aiding)
+{
+	const uint64_t dt_us = 4000;
+	float delta_ang[3] = {0.02f * 1e-6f * dt_us, -0.01f * 1e-6f * dt_us, 0.1f * 1e-6f * dt_us};
+	float delta_vel[3] = {0.1f * 1e-6f * dt_us, 0.0f, -CONSTANTS_ONE_G * 1e-6f * dt_us};
+	ekf.setIMUData(time_usec, dt_us, dt_us, delta_ang, delta_vel);
+
+	imuSample imu_sample;
+	const bool down_sampled = ekf.get_imu_sample_down_sampled(imu_sample);
+
+	if (aiding && step % 5 == 0) {
+		float mag[3] = {0.2f, 0.0f, 0.4f};
+		ekf.setMagData(time_usec, mag);
+		ekf.setBaroData(time_usec, 100.0f);
+	}
+
+	ekf.update();
+
+	return down_sampled;
+}
+
+int ekf_batch_main(int argc, char *argv[])
+{
+	// use more instances than fit in one block so that a partly filled block is included
+	const unsigned num_instances = EkfBatch::lane_width + 3;
+	const unsigned num_states = EkfBatch::get_num_states();
+
+	Ekf *ekf = new Ekf();
+	EkfBatch *batch = new EkfBatch();
+	assert(batch->allocate(num_instances));
+	batch->setParameters(*ekf->getParamHandle());
+
+	// run the filter until the tilt alignment is complete
+	uint64_t time_usec = 1000000;
+	unsigned step = 0;
+	filter_control_status_u control_status = {};
+
+	while (!control_status.flags.tilt_align) {
+		time_usec += 4000;
+		run_step(*ekf, time_usec, step, true);
+		ekf->get_control_mode(&control_status.value);
+		step++;
+		assert(step < 10000);
+	}
+
+	// Without aiding data the filter only predicts except for the fake position fusion at 5 Hz. Each prediction is
+	// repeated by the batch instances starting from a copy of the filter states.
+	unsigned num_compared = 0;
+	float *cov = new float[num_states * num_states];
+	float *cov_batch = new float[num_states * num_states];
+
+	for (unsigned i = 0; i < 250; i++, step++) {
+		for (unsigned index = 0; index < num_instances; index++) {
+			batch->set_instance(index, *ekf);
+		}
+
+		float innov_var_prev[6];
+		ekf->get_vel_pos_innov_var(innov_var_prev);
+
+		time_usec += 4000;
+
+		if (!run_step(*ekf, time_usec, step, false)) {
+			continue;
+		}
+
+		// the fusion changes the innovation variances
+		float innov_var[6];
+		ekf->get_vel_pos_innov_var(innov_var);
+
+		if (memcmp(innov_var, innov_var_prev, sizeof(innov_var)) != 0) {
+			continue;
+		}
+
+		const imuSample &imu_delayed = ekf->get_imu_sample_delayed();
+		float delta_ang[3][num_instances];
+		float delta_vel[3][num_instances];
+		float delta_ang_dt[num_instances];
+		float delta_vel_dt[num_instances];
+
+		for (unsigned index = 0; index < num_instances; index++) {
+			for (unsigned axis = 0; axis < 3; axis++) {
+				delta_ang[axis][index] = imu_delayed.delta_ang(axis);
+				delta_vel[axis][index] = imu_delayed.delta_vel(axis);
+			}
+
+			delta_ang_dt[index] = imu_delayed.delta_ang_dt;
+			delta_vel_dt[index] = imu_delayed.delta_vel_dt;
+		}
+
+		ekf_batch_imu imu_batch;
+		imu_batch.time_us = ekf->get_imu_sample_newest().time_us;
+
+		for (unsigned axis = 0; axis < 3; axis++) {
+			imu_batch.delta_ang[axis] = delta_ang[axis];
+			imu_batch.delta_vel[axis] = delta_vel[axis];
+		}
+
+		imu_batch.delta_ang_dt = delta_ang_dt;
+		imu_batch.delta_vel_dt = delta_vel_dt;
+		batch->predict(imu_batch);
+
+		// the predicted states and covariances must be those of the filter
+		float state[24];
+		ekf->get_state_delayed(state);
+		ekf->get_covariance_matrix(cov);
+
+		for (unsigned index = 0; index < num_instances; index++) {
+			float state_batch[24];
+			batch->get_state_delayed(index, state_batch);
+			batch->get_covariance_matrix(index, cov_batch);
+			for (unsigned i = 0; i < 24; i++) {
+				assert(is_close(state_batch[i], state[i]));
+			}
+
+			for (unsigned i = 0; i < num_states * num_states; i++) {
+				assert(is_close(cov_batch[i], cov[i]));
+			}
+		}
+
+		num_compared++;
+	}
+
+	// most of the updates were a prediction only
+	assert(num_compared > 40);
+
+	delete[] cov;
+	delete[] cov_batch;
+	delete batch;
+	delete ekf;
+
+	return 0;
+}
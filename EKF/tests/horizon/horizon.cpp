@@ -0,0 +1,101 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file horizon.cpp
+ * Test that the fusion time horizon stays at the maximum sensor delay when the adaptive prediction period changes
+ *
+ */
+
+#include <stdint.h>
+#include <cassert>
+#include "../../ekf.h"
+
+extern "C" __EXPORT int horizon_main(int argc, char *argv[]);
+
+// feed IMU data at 250 Hz rotating about the Z axis at the given rate with the specific force opposing gravity
+static void run_imu(Ekf &ekf, uint64_t &time_usec, float duration, float yaw_rate)
+{
+	const uint64_t dt_us = 4000;
+	float delta_ang[3] = {0.0f, 0.0f, yaw_rate * 1e-6f * dt_us};
+	float delta_vel[3] = {0.0f, 0.0f, -CONSTANTS_ONE_G * 1e-6f * dt_us};
+
+	for (unsigned i = 0; i < (unsigned)(duration * 250.0f); i++) {
+		time_usec += dt_us;
+		ekf.setIMUData(time_usec, dt_us, dt_us, delta_ang, delta_vel);
+	}
+}
+
+// check that the delayed time horizon is within one prediction period of the maximum sensor delay
+static void check_horizon(Ekf &ekf, unsigned max_delay_ms, unsigned period_ms)
+{
+	assert(ekf.get_filter_update_period_ms() == period_ms);
+
+	const uint64_t delay_us = ekf.get_imu_sample_newest().time_us - ekf.get_imu_sample_delayed().time_us;
+	assert(delay_us + period_ms * 1000 >= max_delay_ms * 1000);
+	assert(delay_us <= (max_delay_ms + period_ms) * 1000);
+}
+
+int horizon_main(int argc, char *argv[])
+{
+	Ekf ekf;
+	parameters *params = ekf.getParamHandle();
+	params->filter_update_adaptive = 1;
+	params->filter_update_period_min_ms = 4;
+	params->filter_update_period_max_ms = 24;
+	params->gps_delay_ms = 110;
+	params->mag_delay_ms = 0;
+	params->baro_delay_ms = 0;
+	params->airspeed_delay_ms = 0;
+	params->range_delay_ms = 0;
+	params->flow_delay_ms = 0;
+	params->ev_delay_ms = 0;
+	const unsigned max_delay_ms = 110;
+
+	uint64_t time_usec = 1000000;
+
+	// on the ground and stationary the longest period is used
+	run_imu(ekf, time_usec, 5.0f, 0.0f);
+	check_horizon(ekf, max_delay_ms, 24);
+
+	// the shortest period is used during aggressive manoeuvres, the horizon is checked after the lengthened
+	// IMU buffer has filled
+	run_imu(ekf, time_usec, 0.5f, 6.0f);
+	check_horizon(ekf, max_delay_ms, 4);
+
+	// the period is lengthened again once the vehicle has been stationary for a second
+	run_imu(ekf, time_usec, 2.0f, 0.0f);
+	check_horizon(ekf, max_delay_ms, 24);
+
+	return 0;
+}
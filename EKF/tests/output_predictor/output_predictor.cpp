@@ -0,0 +1,133 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file output_predictor.cpp
+ * Test that an OutputPredictor corrected by an Ekf tracks the output states of that Ekf
+ *
+ */
+
+#include <stdint.h>
+#include <cassert>
+#include <cmath>
+#include "../../ekf.h"
+#include "../../output_predictor.h"
+
+extern "C" __EXPORT int output_predictor_main(int argc, char *argv[]);
+
+int output_predictor_main(int argc, char *argv[])
+{
+	OutputPredictor *predictor = new OutputPredictor();
+	Ekf *ekf = new Ekf();
+	assert(predictor->init(400, 4000));
+
+	const uint64_t dt_us = 4000;
+	float delta_ang[3] = {0.02f * 1e-6f * dt_us, -0.01f * 1e-6f * dt_us, 0.05f * 1e-6f * dt_us};
+	float delta_vel[3] = {0.1f * 1e-6f * dt_us, 0.0f, -CONSTANTS_ONE_G * 1e-6f * dt_us};
+	float mag[3] = {0.2f, 0.0f, 0.4f};
+	uint64_t time_usec = 1000000;
+	unsigned num_corrections = 0;
+	outputCorrection correction;
+
+	for (unsigned step = 0; step < 5000; step++) {
+		time_usec += dt_us;
+		predictor->setIMUData(time_usec, dt_us, dt_us, delta_ang, delta_vel);
+		ekf->setIMUData(time_usec, dt_us, dt_us, delta_ang, delta_vel);
+
+		if (step % 5 == 0) {
+			ekf->setMagData(time_usec, mag);
+			ekf->setBaroData(time_usec, 100.0f);
+		}
+
+		ekf->update();
+
+		if (ekf->get_output_correction(&correction)) {
+			assert(predictor->setCorrection(correction));
+			num_corrections++;
+		}
+
+		// the output states are not valid until the first correction from the aligned filter has been applied
+		if (num_corrections == 0) {
+			assert(!predictor->attitude_valid());
+		}
+	}
+
+	assert(num_corrections > 0);
+	assert(predictor->attitude_valid());
+
+	// The corrections are applied with the next IMU sample, so the output states agree with those of the Ekf, which
+	// predicts and corrects its outputs in the same update, to within one sample
+	float quat[4];
+	float quat_predictor[4];
+	ekf->copy_quaternion(quat);
+	predictor->copy_quaternion(quat_predictor);
+
+	for (unsigned i = 0; i < 4; i++) {
+		assert(fabsf(quat_predictor[i] - quat[i]) < 1e-4f);
+	}
+
+	float vel[3];
+	float vel_predictor[3];
+	ekf->get_velocity(vel);
+	predictor->get_velocity(vel_predictor);
+
+	float pos[3];
+	float pos_predictor[3];
+	ekf->get_position(pos);
+	predictor->get_position(pos_predictor);
+
+	for (unsigned i = 0; i < 3; i++) {
+		assert(fabsf(vel_predictor[i] - vel[i]) < 1e-2f);
+		assert(fabsf(pos_predictor[i] - pos[i]) < 1e-3f);
+	}
+
+	// corrections that arrive while the IMU thread is stalled are queued up to the queue length
+	unsigned num_queued = 0;
+
+	while (predictor->setCorrection(correction)) {
+		num_queued++;
+		assert(num_queued < 100);
+	}
+
+	assert(num_queued > 0);
+
+	// the queued corrections are applied with the next IMU sample
+	time_usec += dt_us;
+	predictor->setIMUData(time_usec, dt_us, dt_us, delta_ang, delta_vel);
+	assert(predictor->setCorrection(correction));
+
+	delete predictor;
+	delete ekf;
+
+	return 0;
+}
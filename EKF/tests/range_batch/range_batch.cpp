@@ -0,0 +1,94 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file range_batch.cpp
+ * Test that the range finder samples set between observation buffer entries are combined by their median
+ *
+ */
+
+#include <stdint.h>
+#include <cassert>
+#include "../../ekf.h"
+
+extern "C" __EXPORT int range_batch_main(int argc, char *argv[]);
+
+int range_batch_main(int argc, char *argv[])
+{
+	Ekf *ekf = new Ekf();
+
+	// feed IMU data for a second to fill the buffers and set the minimum observation interval
+	const uint64_t dt_us = 4000;
+	float delta_ang[3] = {0.0f, 0.0f, 0.0f};
+	float delta_vel[3] = {0.0f, 0.0f, -CONSTANTS_ONE_G * 1e-6f * dt_us};
+	uint64_t time_usec = 1000000;
+
+	for (unsigned i = 0; i < 250; i++) {
+		time_usec += dt_us;
+		ekf->setIMUData(time_usec, dt_us, dt_us, delta_ang, delta_vel);
+	}
+
+	// the first sample is buffered on its own
+	ekf->setRangeData(time_usec, 10.0f);
+	assert(ekf->get_range_sample_newest().rng == 10.0f);
+
+	// Samples set within the buffer interval are collected until one arrives after the interval. More than twice
+	// the batch length are set so the median must be taken over the newest 8 having overwritten the older ones.
+	const float newest[8] = {3.0f, 8.0f, 1.0f, 6.0f, 2.0f, 7.0f, 5.0f, 4.0f};
+
+	for (unsigned i = 0; i < 13; i++) {
+		ekf->setRangeData(time_usec + 1 + i, 100.0f);
+	}
+
+	for (unsigned i = 0; i < 7; i++) {
+		ekf->setRangeData(time_usec + 100 + i, newest[i]);
+	}
+
+	assert(ekf->get_range_sample_newest().rng == 10.0f);
+
+	time_usec += 1000000;
+	ekf->setRangeData(time_usec, newest[7]);
+	assert(ekf->get_range_sample_newest().rng == 4.5f);
+
+	// a batch that is not full uses the samples it holds
+	ekf->setRangeData(time_usec + 1, 2.0f);
+	ekf->setRangeData(time_usec + 2, 9.0f);
+
+	time_usec += 1000000;
+	ekf->setRangeData(time_usec, 5.0f);
+	assert(ekf->get_range_sample_newest().rng == 5.0f);
+
+	delete ekf;
+
+	return 0;
+}
@@ -79,7 +79,8 @@ int ringbuffer_main(int argc, char *argv[])
 	// Test3: pushing data into ringbuffer
 	buffer.push(x);
 	assert(buffer.get_newest().time_us == x.time_us);
-	assert(buffer.get_oldest().time_us == 0);
+	// a single sample is both the newest and the oldest
+	assert(buffer.get_oldest().time_us == x.time_us);
 	buffer.push(y);
 	buffer.push(z);
 	assert(buffer.get_newest().time_us == z.time_us);
@@ -101,7 +102,8 @@ int ringbuffer_main(int argc, char *argv[])
 	buffer.allocate(10);
 	buffer.push(x);
 	assert(buffer.get_newest().time_us == x.time_us);
-	assert(buffer.get_oldest().time_us == 0);
+	// a single sample is both the newest and the oldest
+	assert(buffer.get_oldest().time_us == x.time_us);
 	buffer.push(y);
 	buffer.push(z);
 	assert(buffer.get_newest().time_us == z.time_us);
@@ -117,5 +119,138 @@ int ringbuffer_main(int argc, char *argv[])
 	assert(buffer.pop_first_older_than(z.time_us + 100 , &pop) == true);
 	assert(pop.time_us == z.time_us);
 
+	// Test 5: single producer single consumer buffer
+	SpscRingBuffer<sample> spsc_buffer;
+	assert(spsc_buffer.allocate(0) == false);
+	assert(spsc_buffer.allocate(2) == true);
+	assert(spsc_buffer.pop_oldest(&pop) == false);
+	assert(spsc_buffer.push(x) == true);
+	assert(spsc_buffer.push(y) == true);
+
+	// the buffer is full so new data is rejected rather than overwriting unread data
+	assert(spsc_buffer.push(z) == false);
+	assert(spsc_buffer.get_count() == 2);
+
+	assert(spsc_buffer.pop_oldest(&pop) == true);
+	assert(pop.time_us == x.time_us);
+	assert(spsc_buffer.push(z) == true);
+
+	// popping a sample discards all older data
+	assert(spsc_buffer.pop_first_older_than(0, &pop) == false);
+	assert(spsc_buffer.pop_first_older_than(z.time_us + 100, &pop) == true);
+	assert(pop.time_us == z.time_us);
+	assert(spsc_buffer.get_count() == 0);
+
+	// the samples stay in order when the counters wrap for a length that is not a power of two
+	assert(spsc_buffer.allocate(3) == true);
+	sample spsc_sample = {};
+
+	for (unsigned i = 0; i < 100; i++) {
+		spsc_sample.time_us = i;
+		assert(spsc_buffer.push(spsc_sample) == true);
+
+		if (i % 2 == 0) {
+			spsc_sample.time_us = i + 1000;
+			assert(spsc_buffer.push(spsc_sample) == true);
+			assert(spsc_buffer.get_count() == 2);
+			assert(spsc_buffer.pop_oldest(&pop) == true);
+			assert(pop.time_us == i);
+			assert(spsc_buffer.pop_oldest(&pop) == true);
+			assert(pop.time_us == i + 1000);
+
+		} else {
+			assert(spsc_buffer.pop_first_older_than(i, &pop) == true);
+			assert(pop.time_us == i);
+		}
+
+		assert(spsc_buffer.get_count() == 0);
+	}
+
+	// Test 6: user defined maximum sample age
+	buffer.allocate(3);
+	buffer.set_max_sample_age(1000);
+	buffer.push(x);
+	assert(buffer.pop_first_older_than(x.time_us + 2000, &pop) == false);
+	assert(buffer.pop_first_older_than(x.time_us + 500, &pop) == true);
+	assert(pop.time_us == x.time_us);
+
+	// Test 7: reading data without removing it from the buffer
+	buffer.allocate(3);
+	buffer.set_max_sample_age(100000);
+	buffer.push(x);
+	buffer.push(y);
+	assert(buffer.get_first_older_than(x.time_us - 1, &pop) == false);
+	assert(buffer.get_first_older_than(x.time_us + 500, &pop) == true);
+	assert(pop.time_us == x.time_us);
+	assert(buffer.get_first_older_than(y.time_us + 500, &pop) == true);
+	assert(pop.time_us == y.time_us);
+
+	// the older sample is still available
+	assert(buffer.get_first_older_than(x.time_us + 500, &pop) == true);
+	assert(pop.time_us == x.time_us);
+
+	// Test 8: writing data in place
+	buffer.allocate(2);
+	buffer.push(x);
+	sample &slot = buffer.emplace(y.time_us);
+	slot.data[0] = 2.0f;
+	assert(buffer.get_newest().time_us == y.time_us);
+	assert(buffer.get_newest().data[0] == 2.0f);
+	assert(buffer.get_oldest().time_us == x.time_us);
+
+	// the oldest data is overwritten when the buffer is full
+	buffer.emplace(z.time_us);
+	assert(buffer.get_newest().time_us == z.time_us);
+	assert(buffer.get_oldest().time_us == y.time_us);
+
+	// the timestamp searches use the timestamps set by emplace
+	assert(buffer.pop_first_older_than(y.time_us + 1, &pop) == true);
+	assert(pop.time_us == y.time_us);
+	assert(pop.data[0] == 2.0f);
+
+	// Test 9: resizing keeps the newest samples in time order
+	sample seq[8];
+
+	for (unsigned i = 0; i < 8; i++) {
+		seq[i].time_us = (i + 1) * 1000000;
+		seq[i].data[0] = seq[i].data[1] = seq[i].data[2] = (float)i;
+	}
+
+	buffer.allocate(3);
+
+	for (unsigned i = 0; i < 4; i++) {
+		buffer.push(seq[i]);
+	}
+
+	assert(buffer.get_count() == 3);
+	assert(buffer.get_from_oldest(0).time_us == seq[1].time_us);
+	assert(buffer.resize(5) == true);
+	assert(buffer.get_length() == 5);
+	assert(buffer.get_count() == 3);
+	assert(buffer.get_oldest().time_us == seq[1].time_us);
+	assert(buffer.get_newest().time_us == seq[3].time_us);
+
+	// the lengthened buffer fills before the oldest sample is overwritten
+	buffer.push(seq[4]);
+	buffer.push(seq[5]);
+	assert(buffer.get_count() == 5);
+	assert(buffer.get_oldest().time_us == seq[1].time_us);
+	buffer.push(seq[6]);
+	assert(buffer.get_oldest().time_us == seq[2].time_us);
+
+	assert(buffer.resize(2) == true);
+	assert(buffer.get_count() == 2);
+	assert(buffer.get_oldest().time_us == seq[5].time_us);
+	assert(buffer.get_newest().time_us == seq[6].time_us);
+	assert(buffer.pop_first_older_than(seq[5].time_us + 100, &pop) == true);
+	assert(pop.time_us == seq[5].time_us);
+	assert(pop.data[0] == 5.0f);
+	assert(buffer.get_count() == 1);
+
+	// the shortened buffer keeps its length when pushed to
+	buffer.push(seq[7]);
+	assert(buffer.get_newest().time_us == seq[7].time_us);
+	assert(buffer.get_length() == 2);
+
 	return 0;
 }
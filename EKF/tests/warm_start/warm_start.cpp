@@ -0,0 +1,161 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file warm_start.cpp
+ * Test that a filter restarted from a warm start record resumes with the saved states
+ *
+ */
+
+#include <stdint.h>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include "../../ekf.h"
+
+extern "C" __EXPORT int warm_start_main(int argc, char *argv[]);
+
+// the record starts with a 16 byte header followed by the gyro bias, accel bias, earth field, body field and wind
+// values and then the height of the vehicle above the terrain
+static const size_t terrain_hagl_offset = 16 + 14 * sizeof(float);
+
+// feed one IMU sample at 250 Hz for a level, stationary vehicle with a gyro offset and the magnetometer, baro and
+// optionally range finder data at 50 Hz, then run the filter update
+static void run_step(Ekf &ekf, uint64_t time_usec, unsigned step, bool range)
+{
+	const uint64_t dt_us = 4000;
+	float delta_ang[3] = {0.002f * 1e-6f * dt_us, -0.003f * 1e-6f * dt_us, 0.001f * 1e-6f * dt_us};
+	float delta_vel[3] = {0.0f, 0.0f, -CONSTANTS_ONE_G * 1e-6f * dt_us};
+	ekf.setIMUData(time_usec, dt_us, dt_us, delta_ang, delta_vel);
+
+	if (step % 5 == 0) {
+		float mag[3] = {0.2f, 0.0f, 0.4f};
+		ekf.setMagData(time_usec, mag);
+		ekf.setBaroData(time_usec, 100.0f);
+
+		if (range) {
+			ekf.setRangeData(time_usec, 1.0f);
+		}
+	}
+
+	ekf.update();
+}
+
+static float get_terrain_hagl(const uint8_t *record)
+{
+	float hagl;
+	memcpy(&hagl, record + terrain_hagl_offset, sizeof(hagl));
+	return hagl;
+}
+
+int warm_start_main(int argc, char *argv[])
+{
+	const size_t size = Ekf::get_warm_start_size();
+	uint8_t *record = new uint8_t[size];
+	uint8_t *record_warm = new uint8_t[size];
+	uint8_t *record_cold = new uint8_t[size];
+
+	// run a filter with the range finder 1 m above the terrain and save its state
+	Ekf *saved = new Ekf();
+	uint64_t time_usec = 1000000;
+	unsigned step = 0;
+
+	assert(saved->get_warm_start(record, size) == 0);
+
+	for (; step < 5000; step++) {
+		time_usec += 4000;
+		run_step(*saved, time_usec, step, true);
+	}
+
+	assert(saved->get_warm_start(record, size) == size);
+
+	float state_saved[24];
+	saved->get_state_delayed(state_saved);
+	float delta_quat[4];
+	uint8_t quat_counter_saved;
+	saved->get_quat_reset(delta_quat, &quat_counter_saved);
+	delete saved;
+
+	// a corrupted record is rejected
+	Ekf *rejected = new Ekf();
+	record[size - 1] ^= 0x01;
+	assert(!rejected->set_warm_start(record, size));
+	record[size - 1] ^= 0x01;
+	delete rejected;
+
+	// restart one filter from the record and one without it on the same data without the range finder
+	Ekf *warm = new Ekf();
+	Ekf *cold = new Ekf();
+	assert(warm->set_warm_start(record, size));
+
+	while (!(warm->get_warm_start(record_warm, size) > 0 && cold->get_warm_start(record_cold, size) > 0)) {
+		time_usec += 4000;
+		run_step(*warm, time_usec, step, false);
+		run_step(*cold, time_usec, step, false);
+		step++;
+		assert(step < 10000);
+	}
+
+	assert(warm->warm_started());
+	assert(!cold->warm_started());
+
+	// the gyro bias, accel bias and field states continue from the saved values
+	float state_warm[24];
+	float state_cold[24];
+	warm->get_state_delayed(state_warm);
+	cold->get_state_delayed(state_cold);
+
+	for (unsigned i = 10; i < 22; i++) {
+		assert(fabsf(state_warm[i] - state_saved[i]) < 1e-3f * fabsf(state_saved[i]) + 1e-6f);
+	}
+
+	// the restored terrain estimate is kept instead of being replaced by the ground clearance guess
+	assert(fabsf(get_terrain_hagl(record) - 1.0f) < 0.05f);
+	assert(fabsf(get_terrain_hagl(record_warm) - get_terrain_hagl(record)) < 0.05f);
+	assert(fabsf(get_terrain_hagl(record_cold) - get_terrain_hagl(record)) > 0.5f);
+
+	// the reset counters continue on from the saved values and include the resets made during alignment
+	uint8_t quat_counter_warm;
+	uint8_t quat_counter_cold;
+	warm->get_quat_reset(delta_quat, &quat_counter_warm);
+	cold->get_quat_reset(delta_quat, &quat_counter_cold);
+	assert(quat_counter_warm == (uint8_t)(quat_counter_saved + quat_counter_cold));
+
+	delete warm;
+	delete cold;
+	delete[] record;
+	delete[] record_warm;
+	delete[] record_cold;
+
+	return 0;
+}
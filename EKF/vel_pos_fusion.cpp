@@ -46,11 +46,13 @@
 
 void Ekf::fuseVelPosHeight()
 {
+	EKF_TIMED_SCOPE(EKF_TIMING_FUSE_VEL_POS_HEIGHT);
+
 	bool fuse_map[6] = {}; // map of booleans true when [VN,VE,VD,PN,PE,PD] observations are available
 	bool innov_check_pass_map[6] = {}; // true when innovations consistency checks pass for [VN,VE,VD,PN,PE,PD] observations
 	float R[6] = {}; // observation variances for [VN,VE,VD,PN,PE,PD]
 	float gate_size[6] = {}; // innovation consistency check gate sizes for [VN,VE,VD,PN,PE,PD] observations
-	float Kfusion[24] = {}; // Kalman gain vector for any single observation - sequential fusion is used
+	float Kfusion[_k_num_states] = {}; // Kalman gain vector for any single observation - sequential fusion is used
 
 	// calculate innovations, innovations gate sizes and observation variances
 	if (_fuse_hor_vel) {
@@ -200,6 +202,13 @@ void Ekf::fuseVelPosHeight()
 	innov_check_pass_map[4] = innov_check_pass_map[3] = pos_check_pass;
 	innov_check_pass_map[5] = (_vel_pos_test_ratio[5] <= 1.0f) || !_control_status.flags.tilt_align;
 
+	for (unsigned obs_index = 0; obs_index < 6; obs_index++) {
+		if (fuse_map[obs_index]) {
+			EKF_RECORD_FUSION(FLIGHT_RECORDER_VEL_N + obs_index, _vel_pos_innov[obs_index], _vel_pos_innov_var[obs_index],
+					  _vel_pos_test_ratio[obs_index], !innov_check_pass_map[obs_index]);
+		}
+	}
+
 	// record the successful velocity fusion event
 	if (vel_check_pass && _fuse_hor_vel) {
 		_time_last_vel_fuse = _time_last_imu;
@@ -224,6 +233,8 @@ void Ekf::fuseVelPosHeight()
 		_innov_check_fail_status.flags.reject_pos_D = true;
 	}
 
+	bool fused_any = false;
+
 	for (unsigned obs_index = 0; obs_index < 6; obs_index++) {
 		// skip fusion if not requested or checks have failed
 		if (!fuse_map[obs_index] || !innov_check_pass_map[obs_index]) {
@@ -232,77 +243,37 @@ void Ekf::fuseVelPosHeight()
 
 		unsigned state_index = obs_index + 4;	// we start with vx and this is the 4. state
 
-		// calculate kalman gain K = PHS, where S = 1/innovation variance
-		for (int row = 0; row < _k_num_states; row++) {
-			Kfusion[row] = P[row][state_index] / _vel_pos_innov_var[obs_index];
-		}
-
-		// update covarinace matrix via Pnew = (I - KH)P
-		float KHP[_k_num_states][_k_num_states];
-		for (unsigned row = 0; row < _k_num_states; row++) {
-			for (unsigned column = 0; column < _k_num_states; column++) {
-				KHP[row][column] = Kfusion[row] * P[state_index][column];
-			}
-		}
-
+		// calculate kalman gain K = PHS, where S = 1/innovation variance, and apply the covariance
+		// correction via P_new = (I -K*H)*P. H selects a single state so this works on one row of P.
 		// if the covariance correction will result in a negative variance, then
 		// the covariance marix is unhealthy and must be corrected
-		bool healthy = true;
-		for (int i = 0; i < _k_num_states; i++) {
-			if (P[i][i] < KHP[i][i]) {
-				// zero rows and columns
-				zeroRows(P,i,i);
-				zeroCols(P,i,i);
-
-				//flag as unhealthy
-				healthy = false;
-
-				// update individual measurement health status
-				if (obs_index == 0) {
-					_fault_status.flags.bad_vel_N = true;
-				} else if (obs_index == 1) {
-					_fault_status.flags.bad_vel_E = true;
-				} else if (obs_index == 2) {
-					_fault_status.flags.bad_vel_D = true;
-				} else if (obs_index == 3) {
-					_fault_status.flags.bad_pos_N = true;
-				} else if (obs_index == 4) {
-					_fault_status.flags.bad_pos_E = true;
-				} else if (obs_index == 5) {
-					_fault_status.flags.bad_pos_D = true;
-				}
-			} else {
-				// update individual measurement health status
-				if (obs_index == 0) {
-					_fault_status.flags.bad_vel_N = false;
-				} else if (obs_index == 1) {
-					_fault_status.flags.bad_vel_E = false;
-				} else if (obs_index == 2) {
-					_fault_status.flags.bad_vel_D = false;
-				} else if (obs_index == 3) {
-					_fault_status.flags.bad_pos_N = false;
-				} else if (obs_index == 4) {
-					_fault_status.flags.bad_pos_E = false;
-				} else if (obs_index == 5) {
-					_fault_status.flags.bad_pos_D = false;
-				}
-			}
+		bool healthy = updateCovarianceDirect(state_index, _vel_pos_innov_var[obs_index], Kfusion);
+
+		// update individual measurement health status
+		if (obs_index == 0) {
+			_fault_status.flags.bad_vel_N = !healthy;
+		} else if (obs_index == 1) {
+			_fault_status.flags.bad_vel_E = !healthy;
+		} else if (obs_index == 2) {
+			_fault_status.flags.bad_vel_D = !healthy;
+		} else if (obs_index == 3) {
+			_fault_status.flags.bad_pos_N = !healthy;
+		} else if (obs_index == 4) {
+			_fault_status.flags.bad_pos_E = !healthy;
+		} else if (obs_index == 5) {
+			_fault_status.flags.bad_pos_D = !healthy;
 		}
 
-		// only apply covariance and state corrrections if healthy
+		// only apply state corrections if healthy
 		if (healthy) {
-			// apply the covariance corrections
-			for (unsigned row = 0; row < _k_num_states; row++) {
-				for (unsigned column = 0; column < _k_num_states; column++) {
-					P[row][column] = P[row][column] - KHP[row][column];
-				}
-			}
-
-			// correct the covariance marix for gross errors
-			fixCovarianceErrors();
-
 			// apply the state corrections
 			fuse(Kfusion, _vel_pos_innov[obs_index]);
+			fused_any = true;
 		}
 	}
+
+	// correct the covariance marix for gross errors once for all of the fused observations
+	if (fused_any) {
+		fixTouchedCovarianceErrors();
+	}
 }
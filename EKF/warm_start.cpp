@@ -0,0 +1,298 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file warm_start.cpp
+ * Save the converged filter state to a versioned binary record and use it to warm start the filter
+ * after a power cycle.
+ *
+ * The record holds the IMU bias, magnetic field, wind and terrain states, the covariances of the bias
+ * and field states and the reset counters. The attitude, velocity and position are not kept because the
+ * vehicle may have been moved while it was powered down; they are aligned from the sensors as usual. The
+ * record is written in the byte order of the host.
+ */
+
+#include "../ecl.h"
+#include "ekf.h"
+#include "mathlib.h"
+
+#include <cstring>
+
+#ifndef __PX4_QURT
+#if defined(__cplusplus) && !defined(__PX4_NUTTX)
+#include <cmath>
+#define ISFINITE(x) std::isfinite(x)
+#else
+#define ISFINITE(x) isfinite(x)
+#endif
+#endif
+
+#if defined(__PX4_QURT)
+// Missing math.h defines
+#define ISFINITE(x) __builtin_isfinite(x)
+#endif
+
+namespace
+{
+
+const uint32_t warm_start_magic = 0x454b4657;	// "WFKE" when read as little endian bytes
+const uint16_t warm_start_version = 1;
+
+// the record starts with this header and is followed by the payload
+struct warmStartHeader {
+	uint32_t magic;
+	uint16_t version;
+	uint8_t num_states;	// number of states of the filter that wrote the record
+	uint8_t reserved;
+	uint32_t payload_size;	// size of the payload in bytes
+	uint32_t checksum;	// FNV-1a hash of the payload
+};
+
+// number of float values in the payload that come before the covariances
+const size_t warm_start_num_values = 16;
+
+// number of reset counters at the end of the payload
+const size_t warm_start_num_counters = 5;
+
+uint32_t fnv1a(const uint8_t *data, size_t size)
+{
+	uint32_t hash = 2166136261u;
+
+	for (size_t i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+}
+
+size_t Ekf::get_warm_start_size()
+{
+	return sizeof(warmStartHeader) + sizeof(float) * (warm_start_num_values + _k_warm_start_cov_size) + warm_start_num_counters;
+}
+
+size_t Ekf::get_warm_start(uint8_t *buffer, size_t buffer_size)
+{
+	// only a converged and aligned filter is worth saving
+	if (!_filter_initialised || !_control_status.flags.tilt_align || !_control_status.flags.yaw_align) {
+		return 0;
+	}
+
+	const size_t size = get_warm_start_size();
+
+	if (buffer == nullptr || buffer_size < size) {
+		return 0;
+	}
+
+	float values[warm_start_num_values + _k_warm_start_cov_size];
+	unsigned index = 0;
+
+	for (unsigned i = 0; i < 3; i++) {
+		values[index++] = _state.gyro_bias(i);
+	}
+
+	for (unsigned i = 0; i < 3; i++) {
+		values[index++] = _state.accel_bias(i);
+	}
+
+	for (unsigned i = 0; i < 3; i++) {
+		values[index++] = _state.mag_I(i);
+	}
+
+	for (unsigned i = 0; i < 3; i++) {
+		values[index++] = _state.mag_B(i);
+	}
+
+	values[index++] = _state.wind_vel(0);
+	values[index++] = _state.wind_vel(1);
+
+	// the terrain is saved relative to the vehicle because the local origin is reset when the filter starts
+	values[index++] = _terrain_vpos - _state.pos(2);
+	values[index++] = _terrain_var;
+
+	// upper triangle of the covariance matrix from the gyro bias states onwards
+	for (uint8_t row = 10; row < _k_num_states; row++) {
+		for (uint8_t column = row; column < _k_num_states; column++) {
+			values[index++] = P[row][column];
+		}
+	}
+
+	const uint8_t counters[warm_start_num_counters] = {
+		_state_reset_status.velNE_counter,
+		_state_reset_status.velD_counter,
+		_state_reset_status.posNE_counter,
+		_state_reset_status.posD_counter,
+		_state_reset_status.quat_counter
+	};
+
+	uint8_t *payload = buffer + sizeof(warmStartHeader);
+	memcpy(payload, values, sizeof(values));
+	memcpy(payload + sizeof(values), counters, sizeof(counters));
+
+	warmStartHeader header = {};
+	header.magic = warm_start_magic;
+	header.version = warm_start_version;
+	header.num_states = _k_num_states;
+	header.payload_size = size - sizeof(warmStartHeader);
+	header.checksum = fnv1a(payload, header.payload_size);
+	memcpy(buffer, &header, sizeof(header));
+
+	return size;
+}
+
+bool Ekf::set_warm_start(const uint8_t *buffer, size_t size)
+{
+	_warm_start_pending = false;
+
+	if (buffer == nullptr || size != get_warm_start_size()) {
+		return false;
+	}
+
+	warmStartHeader header;
+	memcpy(&header, buffer, sizeof(header));
+
+	const uint8_t *payload = buffer + sizeof(warmStartHeader);
+
+	if (header.magic != warm_start_magic || header.version != warm_start_version || header.num_states != _k_num_states
+	    || header.payload_size != size - sizeof(warmStartHeader) || header.checksum != fnv1a(payload, header.payload_size)) {
+		ECL_WARN("EKF warm start record rejected");
+		return false;
+	}
+
+	float values[warm_start_num_values + _k_warm_start_cov_size];
+	uint8_t counters[warm_start_num_counters];
+	memcpy(values, payload, sizeof(values));
+	memcpy(counters, payload + sizeof(values), sizeof(counters));
+
+	for (unsigned i = 0; i < warm_start_num_values + _k_warm_start_cov_size; i++) {
+		if (!ISFINITE(values[i])) {
+			ECL_WARN("EKF warm start record rejected");
+			return false;
+		}
+	}
+
+	unsigned index = 0;
+
+	for (unsigned i = 0; i < 3; i++) {
+		_warm_start.gyro_bias(i) = values[index++];
+	}
+
+	for (unsigned i = 0; i < 3; i++) {
+		_warm_start.accel_bias(i) = values[index++];
+	}
+
+	for (unsigned i = 0; i < 3; i++) {
+		_warm_start.mag_I(i) = values[index++];
+	}
+
+	for (unsigned i = 0; i < 3; i++) {
+		_warm_start.mag_B(i) = values[index++];
+	}
+
+	_warm_start.wind_vel(0) = values[index++];
+	_warm_start.wind_vel(1) = values[index++];
+	_warm_start.terrain_hagl = values[index++];
+	_warm_start.terrain_var = values[index++];
+	memcpy(_warm_start.cov, &values[index], sizeof(_warm_start.cov));
+	memcpy(_warm_start.reset_counters, counters, sizeof(counters));
+
+	// the record is applied when the filter next aligns
+	_warm_start_pending = !_filter_initialised;
+	return _warm_start_pending;
+}
+
+bool Ekf::applyWarmStart(const Vector3f &mag_init)
+{
+	if (!_warm_start_pending) {
+		return false;
+	}
+
+	_warm_start_pending = false;
+
+	// The saved earth field must agree with the averaged magnetometer reading once the saved body field
+	// offsets are removed and it is rotated into earth frame using the tilt just aligned from the
+	// accelerometers. The horizontal and vertical components are compared so the check does not depend on
+	// the yaw alignment. A mismatch means the vehicle has moved to a different location or its magnetic
+	// environment or sensor calibration has changed, so the saved states cannot be trusted.
+	const Vector3f mag_earth = _R_to_earth * (mag_init - _warm_start.mag_B);
+	const float hor_error = sqrtf(sq(mag_earth(0)) + sq(mag_earth(1)))
+				- sqrtf(sq(_warm_start.mag_I(0)) + sq(_warm_start.mag_I(1)));
+	const float vert_error = mag_earth(2) - _warm_start.mag_I(2);
+
+	if (sqrtf(sq(hor_error) + sq(vert_error)) > _params.warm_start_mag_tol) {
+		ECL_WARN("EKF warm start inconsistent with magnetometer - starting cold");
+		return false;
+	}
+
+	_state.gyro_bias = _warm_start.gyro_bias;
+	_state.accel_bias = _warm_start.accel_bias;
+	_state.mag_B = _warm_start.mag_B;
+	_state.wind_vel = _warm_start.wind_vel;
+
+	// keep the earth field aligned with the heading that has just been set
+	_state.mag_I = mag_earth;
+
+	// the saved states are not correlated with the newly aligned attitude, velocity and position
+	P.zeroRowsCols(10, _k_num_states - 1);
+	unsigned index = 0;
+
+	for (uint8_t row = 10; row < _k_num_states; row++) {
+		for (uint8_t column = row; column < _k_num_states; column++) {
+			P[row][column] = _warm_start.cov[index++];
+		}
+	}
+
+	// a measured terrain height takes precedence over the saved one
+	// and the restored estimate must not be overwritten by the ground clearance guess on the next update
+	if (!_terrain_initialised) {
+		_terrain_vpos = _state.pos(2) + _warm_start.terrain_hagl;
+		_terrain_var = _warm_start.terrain_var;
+		resetTerrainHypotheses();
+		_terrain_initialised = true;
+	}
+
+	// continue the reset counters on from the saved values so consumers of the reset events do not see them go
+	// backwards and still see the resets made during this alignment
+	_state_reset_status.velNE_counter += _warm_start.reset_counters[0];
+	_state_reset_status.velD_counter += _warm_start.reset_counters[1];
+	_state_reset_status.posNE_counter += _warm_start.reset_counters[2];
+	_state_reset_status.posD_counter += _warm_start.reset_counters[3];
+	_state_reset_status.quat_counter += _warm_start.reset_counters[4];
+
+	fixCovarianceErrors();
+
+	ECL_INFO("EKF warm started from saved state");
+	return true;
+}
@@ -63,7 +63,10 @@ ECL_Controller::ECL_Controller(const char *name) :
 	_integrator(0.0f),
 	_rate_error(0.0f),
 	_rate_setpoint(0.0f),
-	_bodyrate_setpoint(0.0f)
+	_bodyrate_setpoint(0.0f),
+	_airspeed_trim(0.0f),
+	_gains{},
+	_gains_airspeed(0.0f)
 {
 }
 
@@ -82,16 +85,19 @@ void ECL_Controller::set_time_constant(float time_constant)
 void ECL_Controller::set_k_p(float k_p)
 {
 	_k_p = k_p;
+	_gain_schedule.invalidate();
 }
 
 void ECL_Controller::set_k_i(float k_i)
 {
 	_k_i = k_i;
+	_gain_schedule.invalidate();
 }
 
 void ECL_Controller::set_k_ff(float k_ff)
 {
 	_k_ff = k_ff;
+	_gain_schedule.invalidate();
 }
 
 void ECL_Controller::set_integrator_max(float max)
@@ -99,6 +105,12 @@ void ECL_Controller::set_integrator_max(float max)
 	_integrator_max = max;
 }
 
+void ECL_Controller::set_airspeed_trim(float airspeed_trim)
+{
+	_airspeed_trim = airspeed_trim;
+	_gain_schedule.invalidate();
+}
+
 void ECL_Controller::set_max_rate(float max_rate)
 {
 	_max_rate = max_rate;
@@ -133,3 +145,44 @@ float ECL_Controller::constrain_airspeed(float airspeed, float minspeed, float m
 
 	return airspeed_result;
 }
+
+void ECL_Controller::compute_gains(float scaler, struct ECL_ScheduledGains &gains)
+{
+	gains.k_p = _k_p * scaler * scaler;
+	gains.k_i = _k_i * scaler;
+	gains.k_ff = _k_ff * scaler;
+	gains.k_int = 1.0f;
+}
+
+const struct ECL_ScheduledGains &ECL_Controller::get_gains(const struct ECL_ControlData &ctl_data)
+{
+	if (_airspeed_trim > 0.0f) {
+		if (!_gain_schedule.valid() || ctl_data.airspeed_min != _gain_schedule.get_airspeed_min()
+		    || ctl_data.airspeed_max != _gain_schedule.get_airspeed_max()) {
+
+			if (_gain_schedule.set_airspeed_range(ctl_data.airspeed_min, ctl_data.airspeed_max)) {
+				for (unsigned i = 0; i < ECL_GAIN_SCHEDULE_POINTS; i++) {
+					struct ECL_ScheduledGains point;
+					compute_gains(_airspeed_trim / _gain_schedule.get_airspeed(i), point);
+					_gain_schedule.set_gains(i, point);
+				}
+
+				_gain_schedule.lookup(ctl_data.airspeed, _gains);
+				_gains_airspeed = ctl_data.airspeed;
+				return _gains;
+			}
+
+		} else {
+			// the airspeed is updated at a lower rate than the control loop runs
+			if (ctl_data.airspeed != _gains_airspeed) {
+				_gain_schedule.lookup(ctl_data.airspeed, _gains);
+				_gains_airspeed = ctl_data.airspeed;
+			}
+
+			return _gains;
+		}
+	}
+
+	compute_gains(ctl_data.scaler, _gains);
+	return _gains;
+}
@@ -52,6 +52,8 @@
 #include <stdint.h>
 #include <systemlib/perf_counter.h>
 
+#include "ecl_gain_schedule.h"
+
 struct ECL_ControlData {
 	float roll;
 	float pitch;
@@ -93,6 +95,13 @@ public:
 	void set_max_rate(float max_rate);
 	void set_bodyrate_setpoint(float rate) {_bodyrate_setpoint = rate;};
 
+	/*
+	 * Set the airspeed at which the rate gains are defined. When this is positive the rate
+	 * gains are taken from a table indexed by airspeed instead of being scaled by
+	 * ECL_ControlData::scaler on every call.
+	 */
+	void set_airspeed_trim(float airspeed_trim);
+
 	/* Getters */
 	float get_rate_error();
 	float get_desired_rate();
@@ -113,5 +122,23 @@ protected:
 	float _rate_error;
 	float _rate_setpoint;
 	float _bodyrate_setpoint;
+	float _airspeed_trim;
+	ECL_GainSchedule _gain_schedule;
+	struct ECL_ScheduledGains _gains;	///< gains returned by the last call to get_gains()
+	float _gains_airspeed;			///< airspeed used for the last schedule lookup (m/s)
 	float constrain_airspeed(float airspeed, float minspeed, float maxspeed);
+
+	/*
+	 * Rate gains for the given airspeed scaler. The default scales the feed forward and
+	 * integrator gains with the scaler and the proportional gain with its square.
+	 */
+	virtual void compute_gains(float scaler, struct ECL_ScheduledGains &gains);
+
+	/*
+	 * Rate gains for the current flight condition, looked up from the gain schedule when an
+	 * airspeed trim is set and computed from ctl_data.scaler otherwise. The schedule is
+	 * rebuilt when a gain or the airspeed limits have changed and the lookup is skipped
+	 * while the airspeed is unchanged.
+	 */
+	const struct ECL_ScheduledGains &get_gains(const struct ECL_ControlData &ctl_data);
 };
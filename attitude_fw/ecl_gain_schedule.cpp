@@ -0,0 +1,112 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2013 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file ecl_gain_schedule.cpp
+ * Table of airspeed scaled rate controller gains.
+ */
+
+#include "ecl_gain_schedule.h"
+
+#include <mathlib/mathlib.h>
+
+ECL_GainSchedule::ECL_GainSchedule() :
+	_table{},
+	_airspeed_min(0.0f),
+	_airspeed_max(0.0f),
+	_index_scale(0.0f),
+	_valid(false)
+{
+}
+
+bool ECL_GainSchedule::set_airspeed_range(float airspeed_min, float airspeed_max)
+{
+	_valid = false;
+	_airspeed_min = airspeed_min;
+	_airspeed_max = airspeed_max;
+
+	if (!(PX4_ISFINITE(airspeed_min) && PX4_ISFINITE(airspeed_max)) || airspeed_min <= 0.0f
+	    || airspeed_max <= airspeed_min) {
+		_index_scale = 0.0f;
+		return false;
+	}
+
+	_index_scale = (float)(ECL_GAIN_SCHEDULE_POINTS - 1) / (airspeed_max - airspeed_min);
+	return true;
+}
+
+float ECL_GainSchedule::get_airspeed(unsigned index) const
+{
+	return _airspeed_min + (_airspeed_max - _airspeed_min) * (float)index / (float)(ECL_GAIN_SCHEDULE_POINTS - 1);
+}
+
+void ECL_GainSchedule::set_gains(unsigned index, const struct ECL_ScheduledGains &gains)
+{
+	if (index >= ECL_GAIN_SCHEDULE_POINTS || _index_scale <= 0.0f) {
+		return;
+	}
+
+	_table[index] = gains;
+
+	// entries are set in increasing order so the table is complete when the last one arrives
+	_valid = (index == ECL_GAIN_SCHEDULE_POINTS - 1);
+}
+
+void ECL_GainSchedule::lookup(float airspeed, struct ECL_ScheduledGains &gains) const
+{
+	float position;
+
+	if (!PX4_ISFINITE(airspeed)) {
+		/* airspeed is NaN, +- INF or not available, pick center of band */
+		position = 0.5f * (float)(ECL_GAIN_SCHEDULE_POINTS - 1);
+
+	} else {
+		position = math::constrain((airspeed - _airspeed_min) * _index_scale, 0.0f,
+					   (float)(ECL_GAIN_SCHEDULE_POINTS - 1));
+	}
+
+	unsigned index = (unsigned)position;
+
+	if (index > ECL_GAIN_SCHEDULE_POINTS - 2) {
+		index = ECL_GAIN_SCHEDULE_POINTS - 2;
+	}
+
+	const float frac = position - (float)index;
+	const struct ECL_ScheduledGains &lower = _table[index];
+	const struct ECL_ScheduledGains &upper = _table[index + 1];
+
+	gains.k_p = lower.k_p + (upper.k_p - lower.k_p) * frac;
+	gains.k_i = lower.k_i + (upper.k_i - lower.k_i) * frac;
+	gains.k_ff = lower.k_ff + (upper.k_ff - lower.k_ff) * frac;
+	gains.k_int = lower.k_int + (upper.k_int - lower.k_int) * frac;
+}
@@ -0,0 +1,99 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2013 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file ecl_gain_schedule.h
+ * Table of airspeed scaled rate controller gains.
+ *
+ * The gains are evaluated at evenly spaced airspeeds between the minimum and maximum airspeed when the
+ * parameters change. The control loop then only needs a linear interpolation between two table entries
+ * instead of forming the airspeed scaling of each gain on every call.
+ */
+
+#ifndef ECL_GAIN_SCHEDULE_H
+#define ECL_GAIN_SCHEDULE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef ECL_GAIN_SCHEDULE_POINTS
+#define ECL_GAIN_SCHEDULE_POINTS 16	///< number of airspeed breakpoints in the table
+#endif
+
+struct ECL_ScheduledGains {
+	float k_p;	///< gain from rate error to output
+	float k_i;	///< gain from integrated rate error to integrator state
+	float k_ff;	///< gain from rate setpoint to output
+	float k_int;	///< gain from integrator state to output
+};
+
+class __EXPORT ECL_GainSchedule
+{
+public:
+	ECL_GainSchedule();
+	~ECL_GainSchedule() = default;
+
+	/*
+	 * Set the airspeed range covered by the table. This invalidates the table until all entries have been
+	 * set and returns false if the range cannot be used.
+	 */
+	bool set_airspeed_range(float airspeed_min, float airspeed_max);
+
+	// airspeed in m/s at the breakpoint with the given index
+	float get_airspeed(unsigned index) const;
+
+	// set the gains at the breakpoint with the given index, the table becomes valid when the last entry is set
+	void set_gains(unsigned index, const struct ECL_ScheduledGains &gains);
+
+	/*
+	 * Interpolate the gains at the given airspeed. The airspeed is constrained to the table range and a
+	 * non finite airspeed uses the centre of the range.
+	 */
+	void lookup(float airspeed, struct ECL_ScheduledGains &gains) const;
+
+	// force the table to be rebuilt before the next lookup
+	void invalidate() { _valid = false; }
+
+	bool valid() const { return _valid; }
+	float get_airspeed_min() const { return _airspeed_min; }
+	float get_airspeed_max() const { return _airspeed_max; }
+
+private:
+	struct ECL_ScheduledGains _table[ECL_GAIN_SCHEDULE_POINTS];
+	float _airspeed_min;	///< airspeed at the first breakpoint (m/s)
+	float _airspeed_max;	///< airspeed at the last breakpoint (m/s)
+	float _index_scale;	///< number of breakpoint intervals per m/s
+	bool _valid;		///< true when all table entries are set for the current range
+};
+
+#endif // ECL_GAIN_SCHEDULE_H
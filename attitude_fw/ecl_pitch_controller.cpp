@@ -105,6 +105,9 @@ float ECL_PitchController::control_bodyrate(const struct ECL_ControlData &ctl_da
 	_last_run = ecl_absolute_time();
 	float dt = (float)dt_micros * 1e-6f;
 
+	/* airspeed scaled gains */
+	const struct ECL_ScheduledGains &gains = get_gains(ctl_data);
+
 	/* lock integral for long intervals */
 	bool lock_integrator = ctl_data.lock_integrator;
 
@@ -116,7 +119,7 @@ float ECL_PitchController::control_bodyrate(const struct ECL_ControlData &ctl_da
 
 	if (!lock_integrator && _k_i > 0.0f) {
 
-		float id = _rate_error * dt * ctl_data.scaler;
+		float id = _rate_error * dt * gains.k_i;
 
 		/*
 		 * anti-windup: do not allow integrator to increase if actuator is at limit
@@ -130,7 +133,7 @@ float ECL_PitchController::control_bodyrate(const struct ECL_ControlData &ctl_da
 			id = math::min(id, 0.0f);
 		}
 
-		_integrator += id * _k_i;
+		_integrator += id;
 	}
 
 	/* integrator limit */
@@ -138,9 +141,8 @@ float ECL_PitchController::control_bodyrate(const struct ECL_ControlData &ctl_da
 	float integrator_constrained = math::constrain(_integrator, -_integrator_max, _integrator_max);
 
 	/* Apply PI rate controller and store non-limited output */
-	_last_output = _bodyrate_setpoint * _k_ff * ctl_data.scaler +
-		       _rate_error * _k_p * ctl_data.scaler * ctl_data.scaler
-		       + integrator_constrained;  //scaler is proportional to 1/airspeed
+	_last_output = _bodyrate_setpoint * gains.k_ff + _rate_error * gains.k_p
+		       + integrator_constrained * gains.k_int;
 
 	return math::constrain(_last_output, -1.0f, 1.0f);
 }
@@ -148,6 +148,9 @@ float ECL_YawController::control_bodyrate(const struct ECL_ControlData &ctl_data
 	_last_run = ecl_absolute_time();
 	float dt = (float)dt_micros * 1e-6f;
 
+	/* airspeed scaled gains */
+	const struct ECL_ScheduledGains &gains = get_gains(ctl_data);
+
 	/* lock integral for long intervals */
 	bool lock_integrator = ctl_data.lock_integrator;
 
@@ -191,7 +194,7 @@ float ECL_YawController::control_bodyrate(const struct ECL_ControlData &ctl_data
 			id = math::min(id, 0.0f);
 		}
 
-		_integrator += id * _k_i;
+		_integrator += id * gains.k_i;
 	}
 
 	/* integrator limit */
@@ -199,13 +202,21 @@ float ECL_YawController::control_bodyrate(const struct ECL_ControlData &ctl_data
 	float integrator_constrained = math::constrain(_integrator, -_integrator_max, _integrator_max);
 
 	/* Apply PI rate controller and store non-limited output */
-	_last_output = (_bodyrate_setpoint * _k_ff + _rate_error * _k_p + integrator_constrained) * ctl_data.scaler *
-		       ctl_data.scaler;  //scaler is proportional to 1/airspeed
+	_last_output = _bodyrate_setpoint * gains.k_ff + _rate_error * gains.k_p + integrator_constrained * gains.k_int;
 
 
 	return math::constrain(_last_output, -1.0f, 1.0f);
 }
 
+void ECL_YawController::compute_gains(float scaler, struct ECL_ScheduledGains &gains)
+{
+	/* the integrator state is held unscaled and all terms are scaled with the square of the scaler */
+	gains.k_p = _k_p * scaler * scaler;
+	gains.k_i = _k_i;
+	gains.k_ff = _k_ff * scaler * scaler;
+	gains.k_int = scaler * scaler;
+}
+
 float ECL_YawController::control_attitude_impl_accclosedloop(const struct ECL_ControlData &ctl_data)
 {
 	/* dont set a rate setpoint */
@@ -90,6 +90,8 @@ protected:
 
 	float control_attitude_impl_accclosedloop(const struct ECL_ControlData &ctl_data);
 
+	void compute_gains(float scaler, struct ECL_ScheduledGains &gains);
+
 };
 
 #endif // ECL_YAW_CONTROLLER_H
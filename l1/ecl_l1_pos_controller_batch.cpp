@@ -0,0 +1,310 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2013 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file ecl_l1_pos_controller_batch.cpp
+ * L1 position control for many vehicles in one call.
+ * Authors and acknowledgements in ecl_l1_pos_controller.h.
+ *
+ * Each loop iteration is a transcription of the corresponding ECL_L1_Pos_Controller function onto scalar NE
+ * components. The expressions keep the operand order of the vector operations they replace so that the results
+ * are bit identical to the single vehicle controller.
+ *
+ */
+
+#include <float.h>
+
+#include "ecl_l1_pos_controller_batch.h"
+
+/*
+ * approximation of the local planar NE vector from origin to target for small angles, proposed by [2]
+ * cos_origin_lat is cosf(math::radians(origin_lat)) so it can be shared by vectors with the same origin
+ */
+static inline void local_planar_vector(float origin_lat, float origin_lon, float cos_origin_lat, float target_lat,
+				       float target_lon, float &north, float &east)
+{
+	north = math::radians((target_lat - origin_lat)) * static_cast<float>(CONSTANTS_RADIUS_OF_EARTH);
+	east = math::radians((target_lon - origin_lon) * cos_origin_lat) * static_cast<float>(CONSTANTS_RADIUS_OF_EARTH);
+}
+
+void ECL_L1_Pos_Controller_Batch::set_output(const ECL_L1_Batch_Output &out, unsigned i, float lateral_accel,
+		float nav_bearing, float bearing_error, float target_bearing, float crosstrack_error, float L1_distance,
+		bool circle_mode) const
+{
+	out.lateral_accel[i] = lateral_accel;
+	out.nav_roll[i] = math::constrain(atanf(lateral_accel * 1.0f / CONSTANTS_ONE_G), -_roll_lim_rad, _roll_lim_rad);
+
+	if (out.nav_bearing != nullptr) {
+		out.nav_bearing[i] = _wrap_pi(nav_bearing);
+	}
+
+	if (out.bearing_error != nullptr) {
+		out.bearing_error[i] = bearing_error;
+	}
+
+	if (out.target_bearing != nullptr) {
+		out.target_bearing[i] = target_bearing;
+	}
+
+	if (out.crosstrack_error != nullptr) {
+		out.crosstrack_error[i] = crosstrack_error;
+	}
+
+	if (out.L1_distance != nullptr) {
+		out.L1_distance[i] = L1_distance;
+	}
+
+	if (out.circle_mode != nullptr) {
+		out.circle_mode[i] = circle_mode;
+	}
+}
+
+void ECL_L1_Pos_Controller_Batch::navigate_waypoints(unsigned count, const float *A_lat, const float *A_lon,
+		const float *B_lat, const float *B_lon, const float *lat, const float *lon, const float *vel_n, const float *vel_e,
+		const ECL_L1_Batch_Output &out) const
+{
+	/* this follows the logic presented in [1] */
+
+	for (unsigned i = 0; i < count; i++) {
+		float eta;
+		float xtrack_vel;
+		float ltrack_vel;
+		float nav_bearing;
+
+		/* get the direction between the last (visited) and next waypoint */
+		float target_bearing = get_bearing_to_next_waypoint(lat[i], lon[i], B_lat[i], B_lon[i]);
+
+		/* enforce a minimum ground speed of 0.1 m/s to avoid singularities */
+		float ground_speed = math::max(sqrtf(vel_n[i] * vel_n[i] + vel_e[i] * vel_e[i]), 0.1f);
+
+		/* calculate the L1 length required for the desired period */
+		float L1_distance = _L1_ratio * ground_speed;
+
+		/* calculate vector from A to B */
+		const float cos_A_lat = cosf(math::radians(A_lat[i]));
+		float AB_n, AB_e;
+		local_planar_vector(A_lat[i], A_lon[i], cos_A_lat, B_lat[i], B_lon[i], AB_n, AB_e);
+
+		/*
+		 * check if waypoints are on top of each other. If yes,
+		 * skip A and directly continue to B
+		 */
+		if (sqrtf(AB_n * AB_n + AB_e * AB_e) < 1.0e-6f) {
+			local_planar_vector(lat[i], lon[i], cosf(math::radians(lat[i])), B_lat[i], B_lon[i], AB_n, AB_e);
+		}
+
+		float AB_length = sqrtf(AB_n * AB_n + AB_e * AB_e);
+		AB_n = AB_n / AB_length;
+		AB_e = AB_e / AB_length;
+
+		/* calculate the vector from waypoint A to the aircraft */
+		float AP_n, AP_e;
+		local_planar_vector(A_lat[i], A_lon[i], cos_A_lat, lat[i], lon[i], AP_n, AP_e);
+
+		/* calculate crosstrack error (output only) */
+		float crosstrack_error = AB_n * AP_e - AB_e * AP_n;
+
+		/*
+		 * If the current position is in a +-135 degree angle behind waypoint A
+		 * and further away from A than the L1 distance, then A becomes the L1 point.
+		 * If the aircraft is already between A and B normal L1 logic is applied.
+		 */
+		float distance_A_to_airplane = sqrtf(AP_n * AP_n + AP_e * AP_e);
+		float alongTrackDist = AP_n * AB_n + AP_e * AB_e;
+
+		/* estimate airplane position WRT to B */
+		float BP_n, BP_e;
+		local_planar_vector(B_lat[i], B_lon[i], cosf(math::radians(B_lat[i])), lat[i], lon[i], BP_n, BP_e);
+		float BP_length = sqrtf(BP_n * BP_n + BP_e * BP_e);
+		BP_n = BP_n / BP_length;
+		BP_e = BP_e / BP_length;
+
+		/* calculate angle of airplane position vector relative to line) */
+		float AB_to_BP_bearing = atan2f(BP_n * AB_e - BP_e * AB_n, BP_n * AB_n + BP_e * AB_e);
+
+		/* extension from [2], fly directly to A */
+		if (distance_A_to_airplane > L1_distance && alongTrackDist / math::max(distance_A_to_airplane, 1.0f) < -0.7071f) {
+
+			/* calculate eta to fly to waypoint A */
+
+			/* unit vector from waypoint A to current position */
+			float AP_unit_n = AP_n / distance_A_to_airplane;
+			float AP_unit_e = AP_e / distance_A_to_airplane;
+			/* velocity across / orthogonal to line */
+			xtrack_vel = vel_n[i] * (-AP_unit_e) - vel_e[i] * (-AP_unit_n);
+			/* velocity along line */
+			ltrack_vel = vel_n[i] * (-AP_unit_n) + vel_e[i] * (-AP_unit_e);
+			eta = atan2f(xtrack_vel, ltrack_vel);
+			/* bearing from current position to L1 point */
+			nav_bearing = atan2f(-AP_unit_e, -AP_unit_n);
+
+			/*
+			 * If the AB vector and the vector from B to airplane point in the same
+			 * direction, we have missed the waypoint. At +- 90 degrees we are just passing it.
+			 */
+
+		} else if (fabsf(AB_to_BP_bearing) < math::radians(100.0f)) {
+			/*
+			 * Extension, fly back to waypoint.
+			 */
+
+			/* velocity across / orthogonal to line */
+			xtrack_vel = vel_n[i] * (-BP_e) - vel_e[i] * (-BP_n);
+			/* velocity along line */
+			ltrack_vel = vel_n[i] * (-BP_n) + vel_e[i] * (-BP_e);
+			eta = atan2f(xtrack_vel, ltrack_vel);
+			/* bearing from current position to L1 point */
+			nav_bearing = atan2f(-BP_e, -BP_n);
+
+		} else {
+
+			/* calculate eta to fly along the line between A and B */
+
+			/* velocity across / orthogonal to line */
+			xtrack_vel = vel_n[i] * AB_e - vel_e[i] * AB_n;
+			/* velocity along line */
+			ltrack_vel = vel_n[i] * AB_n + vel_e[i] * AB_e;
+			/* calculate eta2 (angle of velocity vector relative to line) */
+			float eta2 = atan2f(xtrack_vel, ltrack_vel);
+			/* calculate eta1 (angle to L1 point) */
+			float xtrackErr = AP_n * AB_e - AP_e * AB_n;
+			float sine_eta1 = xtrackErr / math::max(L1_distance, 0.1f);
+			/* limit output to 45 degrees */
+			sine_eta1 = math::constrain(sine_eta1, -0.7071f, 0.7071f); //sin(pi/4) = 0.7071
+			float eta1 = asinf(sine_eta1);
+			eta = eta1 + eta2;
+			/* bearing from current position to L1 point */
+			nav_bearing = atan2f(AB_e, AB_n) + eta1;
+
+		}
+
+		/* limit angle to +-90 degrees */
+		eta = math::constrain(eta, (-M_PI_F) / 2.0f, +M_PI_F / 2.0f);
+		float lateral_accel = _K_L1 * ground_speed * ground_speed / L1_distance * sinf(eta);
+
+		/* flying to waypoints, not circling them, the bearing error is eta */
+		set_output(out, i, lateral_accel, nav_bearing, eta, target_bearing, crosstrack_error, L1_distance, false);
+	}
+}
+
+void ECL_L1_Pos_Controller_Batch::navigate_loiter(unsigned count, const float *A_lat, const float *A_lon, const float *lat,
+		const float *lon, const float *radius, const int8_t *loiter_direction, const float *vel_n, const float *vel_e,
+		const ECL_L1_Batch_Output &out) const
+{
+	/* the complete guidance logic in this section was proposed by [2] */
+
+	/* calculate the gains for the PD loop (circle tracking) */
+	float omega = (2.0f * M_PI_F / _L1_period);
+	float K_crosstrack = omega * omega;
+	float K_velocity = 2.0f * _L1_damping * omega;
+
+	for (unsigned i = 0; i < count; i++) {
+		/* update bearing to next waypoint */
+		float target_bearing = get_bearing_to_next_waypoint(lat[i], lon[i], A_lat[i], A_lon[i]);
+
+		/* ground speed, enforce minimum of 0.1 m/s to avoid singularities */
+		float ground_speed = math::max(sqrtf(vel_n[i] * vel_n[i] + vel_e[i] * vel_e[i]), 0.1f);
+
+		/* calculate the L1 length required for the desired period */
+		float L1_distance = _L1_ratio * ground_speed;
+
+		/* calculate the vector from waypoint A to current position */
+		float AP_n, AP_e;
+		local_planar_vector(A_lat[i], A_lon[i], cosf(math::radians(A_lat[i])), lat[i], lon[i], AP_n, AP_e);
+		float AP_length = sqrtf(AP_n * AP_n + AP_e * AP_e);
+
+		float AP_unit_n = AP_n;
+		float AP_unit_e = AP_e;
+
+		/* prevent NaN when normalizing */
+		if (AP_length > FLT_EPSILON) {
+			/* store the normalized vector from waypoint A to current position */
+			AP_unit_n = AP_n / AP_length;
+			AP_unit_e = AP_e / AP_length;
+		}
+
+		/* calculate eta angle towards the loiter center */
+
+		/* velocity across / orthogonal to line from waypoint to current position */
+		float xtrack_vel_center = AP_unit_n * vel_e[i] - AP_unit_e * vel_n[i];
+		/* velocity along line from waypoint to current position */
+		float ltrack_vel_center = - (vel_n[i] * AP_unit_n + vel_e[i] * AP_unit_e);
+		float eta = atan2f(xtrack_vel_center, ltrack_vel_center);
+		/* limit eta to 90 degrees */
+		eta = math::constrain(eta, -M_PI_F / 2.0f, +M_PI_F / 2.0f);
+
+		/* calculate the lateral acceleration to capture the center point */
+		float lateral_accel_sp_center = _K_L1 * ground_speed * ground_speed / L1_distance * sinf(eta);
+
+		/* for PD control: Calculate radial position and velocity errors */
+
+		/* radial velocity error */
+		float xtrack_vel_circle = -ltrack_vel_center;
+		/* radial distance from the loiter circle (not center) */
+		float xtrack_err_circle = AP_length - radius[i];
+
+		/* calculate PD update to circle waypoint */
+		float lateral_accel_sp_circle_pd = (xtrack_err_circle * K_crosstrack + xtrack_vel_circle * K_velocity);
+
+		/* calculate velocity on circle / along tangent */
+		float tangent_vel = xtrack_vel_center * loiter_direction[i];
+
+		/* prevent PD output from turning the wrong way */
+		if (tangent_vel < 0.0f) {
+			lateral_accel_sp_circle_pd = math::max(lateral_accel_sp_circle_pd, 0.0f);
+		}
+
+		/* calculate centripetal acceleration setpoint */
+		float lateral_accel_sp_circle_centripetal = tangent_vel * tangent_vel / math::max((0.5f * radius[i]),
+				(radius[i] + xtrack_err_circle));
+
+		/* add PD control on circle and centripetal acceleration for total circle command */
+		float lateral_accel_sp_circle = loiter_direction[i] * (lateral_accel_sp_circle_pd + lateral_accel_sp_circle_centripetal);
+
+		/* bearing from current position to L1 point */
+		float nav_bearing = atan2f(-AP_unit_e, -AP_unit_n);
+
+		/*
+		 * Switch between circle (loiter) and capture (towards waypoint center) mode when
+		 * the commands switch over. Only fly towards waypoint if outside the circle.
+		 */
+		if ((lateral_accel_sp_center < lateral_accel_sp_circle && loiter_direction[i] > 0 && xtrack_err_circle > 0.0f) ||
+		    (lateral_accel_sp_center > lateral_accel_sp_circle && loiter_direction[i] < 0 && xtrack_err_circle > 0.0f)) {
+			/* the bearing error is the angle between requested and current velocity vector */
+			set_output(out, i, lateral_accel_sp_center, nav_bearing, eta, target_bearing, xtrack_err_circle, L1_distance, false);
+
+		} else {
+			set_output(out, i, lateral_accel_sp_circle, nav_bearing, 0.0f, target_bearing, xtrack_err_circle, L1_distance, true);
+		}
+	}
+}
@@ -0,0 +1,151 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2013 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file ecl_l1_pos_controller_batch.h
+ * L1 position control for many vehicles in one call.
+ *
+ * The vehicle data is passed as separate arrays for each quantity so that the arithmetic of all vehicles can be
+ * processed in a single pass without gathering from per vehicle objects. The guidance logic and the order of the
+ * floating point operations are those of ECL_L1_Pos_Controller, so the outputs for each vehicle are identical to
+ * those of a single vehicle controller with the same tuning.
+ *
+ */
+
+#ifndef ECL_L1_POS_CONTROLLER_BATCH_H
+#define ECL_L1_POS_CONTROLLER_BATCH_H
+
+#include <mathlib/mathlib.h>
+#include <geo/geo.h>
+#include <ecl/ecl.h>
+
+/**
+ * Output arrays of a batch L1 update, each with one entry per vehicle.
+ * The lateral acceleration and roll outputs are required, the others may be nullptr if not needed.
+ */
+struct ECL_L1_Batch_Output {
+	float *lateral_accel;		///< lateral acceleration demand in m/s^2
+	float *nav_roll;		///< roll angle setpoint limited to the roll limit in rad
+	float *nav_bearing;		///< bearing to the L1 reference point (-pi..pi, in NED frame)
+	float *bearing_error;		///< bearing error in rad
+	float *target_bearing;		///< bearing from the vehicle to the current target (-pi..pi, in NED frame)
+	float *crosstrack_error;	///< crosstrack error in meters
+	float *L1_distance;		///< L1 lead distance in meters
+	bool *circle_mode;		///< true if following a loiter circle
+};
+
+/**
+ * L1 Nonlinear Guidance Logic for a batch of vehicles sharing the same tuning
+ */
+class __EXPORT ECL_L1_Pos_Controller_Batch
+{
+public:
+	ECL_L1_Pos_Controller_Batch() :
+		_L1_period(25.0),
+		_L1_damping(0.75),
+		_L1_ratio(5.0),
+		_K_L1(2.0),
+		_roll_lim_rad(math::radians(10.0))
+	{
+	}
+
+	/**
+	 * Navigate between two waypoints for each vehicle.
+	 *
+	 * Positions are latitude and longitude in degrees and the ground velocity is NE in m/s.
+	 *
+	 * @param count number of vehicles
+	 */
+	void navigate_waypoints(unsigned count, const float *A_lat, const float *A_lon, const float *B_lat, const float *B_lon,
+				const float *lat, const float *lon, const float *vel_n, const float *vel_e,
+				const ECL_L1_Batch_Output &out) const;
+
+	/**
+	 * Navigate on an orbit around a loiter waypoint for each vehicle.
+	 *
+	 * Positions are latitude and longitude in degrees and the ground velocity is NE in m/s.
+	 *
+	 * @param count number of vehicles
+	 */
+	void navigate_loiter(unsigned count, const float *A_lat, const float *A_lon, const float *lat, const float *lon,
+			     const float *radius, const int8_t *loiter_direction, const float *vel_n, const float *vel_e,
+			     const ECL_L1_Batch_Output &out) const;
+
+	/**
+	 * Set the L1 period.
+	 */
+	void set_l1_period(float period) {
+		_L1_period = period;
+		/* calculate the ratio introduced in [2] */
+		_L1_ratio = 1.0f / M_PI_F * _L1_damping * _L1_period;
+	}
+
+	/**
+	 * Set the L1 damping factor.
+	 *
+	 * The original publication recommends a default of sqrt(2) / 2 = 0.707
+	 */
+	void set_l1_damping(float damping) {
+		_L1_damping = damping;
+		/* calculate the ratio introduced in [2] */
+		_L1_ratio = 1.0f / M_PI_F * _L1_damping * _L1_period;
+		/* calculate the L1 gain (following [2]) */
+		_K_L1 = 4.0f * _L1_damping * _L1_damping;
+	}
+
+	/**
+	 * Set the maximum roll angle output in radians
+	 */
+	void set_l1_roll_limit(float roll_lim_rad) {
+		_roll_lim_rad = roll_lim_rad;
+	}
+
+private:
+
+	float _L1_period;		///< L1 tracking period in seconds
+	float _L1_damping;		///< L1 damping ratio
+	float _L1_ratio;		///< L1 ratio for navigation
+	float _K_L1;			///< L1 control gain for _L1_damping
+
+	float _roll_lim_rad;  ///<maximum roll angle
+
+	/**
+	 * Write the outputs of one vehicle.
+	 */
+	void set_output(const ECL_L1_Batch_Output &out, unsigned i, float lateral_accel, float nav_bearing, float bearing_error,
+			float target_bearing, float crosstrack_error, float L1_distance, bool circle_mode) const;
+
+};
+
+
+#endif /* ECL_L1_POS_CONTROLLER_BATCH_H */
@@ -0,0 +1,94 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file ecl_rover_controller.cpp
+ * Combined guidance and steering control for ground vehicles.
+ *
+ */
+
+#include <string.h>
+
+#include "ecl_rover_controller.h"
+
+/* ground speed below which the steering gains are no longer increased (m/s) */
+static constexpr float ROVER_MIN_SCALING_SPEED = 2.0f;
+
+ECL_Rover_Controller::ECL_Rover_Controller() :
+	_waypoints_changed(false),
+	_guidance_interval_us(20000),
+	_guidance_timestamp(0),
+	_groundspeed_trim(1.0f),
+	_yaw_setpoint(0.0f),
+	_crosstrack_error(0.0f)
+{
+	memset(&_control_data, 0, sizeof(_control_data));
+}
+
+void ECL_Rover_Controller::set_waypoints(const math::Vector<2> &prev_wp, const math::Vector<2> &curr_wp)
+{
+	_prev_wp = prev_wp;
+	_curr_wp = curr_wp;
+	_waypoints_changed = true;
+}
+
+void ECL_Rover_Controller::control(const ECL_RoverState &state, bool lock_integrator, ECL_RoverOutput &out)
+{
+	/* shared geometry, computed once for both stages */
+	const float groundspeed = state.ground_speed.length();
+
+	/* guidance at its own rate, the outputs are held for the cycles in between */
+	out.guidance_updated = _waypoints_changed || state.timestamp < _guidance_timestamp
+			       || state.timestamp - _guidance_timestamp >= _guidance_interval_us;
+
+	if (out.guidance_updated) {
+		_guidance.navigate_waypoints(_prev_wp, _curr_wp, state.position, state.ground_speed);
+		_yaw_setpoint = _guidance.nav_bearing();
+		_crosstrack_error = _guidance.crosstrack_error();
+		_guidance_timestamp = state.timestamp;
+		_waypoints_changed = false;
+	}
+
+	/* heading and yaw rate control */
+	_control_data.yaw = state.yaw;
+	_control_data.yaw_setpoint = _yaw_setpoint;
+	_control_data.body_z_rate = state.yaw_rate;
+	_control_data.groundspeed = groundspeed;
+	_control_data.groundspeed_scaler = _groundspeed_trim / math::max(groundspeed, ROVER_MIN_SCALING_SPEED);
+	_control_data.lock_integrator = lock_integrator;
+
+	out.yaw_rate_setpoint = _steering.control_attitude(_control_data);
+	out.steering = _steering.control_bodyrate(_control_data);
+	out.yaw_setpoint = _yaw_setpoint;
+	out.crosstrack_error = _crosstrack_error;
+}
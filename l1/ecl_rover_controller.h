@@ -0,0 +1,147 @@
+/****************************************************************************
+ *
+ *   Copyright (c) 2015 Estimation and Control Library (ECL). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name ECL nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************/
+
+/**
+ * @file ecl_rover_controller.h
+ * Combined guidance and steering control for ground vehicles.
+ *
+ * The L1 waypoint guidance and the wheel heading and yaw rate controllers are run from a single call per
+ * rate loop cycle. The vehicle state is read once per cycle, the ground speed and speed scaling are computed
+ * once and shared by both stages, and the guidance is only updated at its own lower rate with the bearing
+ * and crosstrack error cached for the rate loop cycles in between.
+ *
+ */
+
+#ifndef ECL_ROVER_CONTROLLER_H
+#define ECL_ROVER_CONTROLLER_H
+
+#include <stdint.h>
+
+#include "ecl_l1_pos_controller.h"
+#include "../attitude_fw/ecl_wheel_controller.h"
+
+/**
+ * Vehicle state for one control cycle, filled once per cycle from the estimator outputs.
+ */
+struct ECL_RoverState {
+	uint64_t timestamp;		///< time of the estimator outputs in microseconds
+	math::Vector<2> position;	///< latitude and longitude in degrees
+	math::Vector<2> ground_speed;	///< NE ground velocity in m/s
+	float yaw;			///< heading in rad (-pi..pi, in NED frame)
+	float yaw_rate;			///< body z rate in rad/s
+};
+
+/**
+ * Outputs of one control cycle.
+ */
+struct ECL_RoverOutput {
+	float steering;			///< steering demand (-1..1)
+	float yaw_setpoint;		///< heading setpoint from the guidance in rad (-pi..pi, in NED frame)
+	float yaw_rate_setpoint;	///< yaw rate setpoint from the heading controller in rad/s
+	float crosstrack_error;		///< crosstrack error in meters
+	bool guidance_updated;		///< true if the guidance was updated in this cycle
+};
+
+/**
+ * L1 waypoint guidance followed by wheel heading and yaw rate control
+ */
+class __EXPORT ECL_Rover_Controller
+{
+public:
+	ECL_Rover_Controller();
+	~ECL_Rover_Controller() = default;
+
+	/**
+	 * Run one rate loop cycle.
+	 *
+	 * The guidance is updated when the guidance interval has elapsed since its last update or when the
+	 * waypoints have changed, the heading and yaw rate controllers are run on every call.
+	 *
+	 * @param state vehicle state at the time of the cycle
+	 * @param lock_integrator true to hold the yaw rate integrator, e.g. while the vehicle is disarmed
+	 */
+	void control(const ECL_RoverState &state, bool lock_integrator, ECL_RoverOutput &out);
+
+	/**
+	 * Set the line segment to follow, from the previous to the current waypoint in latitude and longitude
+	 * (degrees). The guidance is updated on the next call to control().
+	 */
+	void set_waypoints(const math::Vector<2> &prev_wp, const math::Vector<2> &curr_wp);
+
+	/**
+	 * Set the interval between guidance updates in microseconds, zero runs the guidance on every cycle.
+	 */
+	void set_guidance_interval(uint32_t interval_us) {
+		_guidance_interval_us = interval_us;
+	}
+
+	/**
+	 * Set the ground speed at which the steering gains are defined in m/s.
+	 */
+	void set_groundspeed_trim(float groundspeed_trim) {
+		_groundspeed_trim = groundspeed_trim;
+	}
+
+	/**
+	 * Guidance and steering controllers, for setting the tuning and reading the remaining outputs.
+	 */
+	ECL_L1_Pos_Controller &guidance() {
+		return _guidance;
+	}
+
+	ECL_WheelController &steering() {
+		return _steering;
+	}
+
+private:
+
+	ECL_L1_Pos_Controller _guidance;
+	ECL_WheelController _steering;
+
+	math::Vector<2> _prev_wp;		///< previous waypoint in degrees
+	math::Vector<2> _curr_wp;		///< current waypoint in degrees
+	bool _waypoints_changed;		///< the guidance has not been updated since the waypoints were set
+
+	uint32_t _guidance_interval_us;		///< interval between guidance updates in microseconds
+	uint64_t _guidance_timestamp;		///< state timestamp of the last guidance update in microseconds
+	float _groundspeed_trim;		///< ground speed at which the steering gains are defined in m/s
+
+	/* cached guidance outputs, used until the next guidance update */
+	float _yaw_setpoint;			///< heading setpoint in rad
+	float _crosstrack_error;		///< crosstrack error in meters
+
+	ECL_ControlData _control_data;		///< controller inputs, only the fields used by the wheel controller are set
+
+};
+
+#endif /* ECL_ROVER_CONTROLLER_H */
@@ -0,0 +1,47 @@
+function ekfData = importEkfBatch(fname)
+
+% import a .ekf file written by the ecl_batch_replay tool
+% INPUTS
+%   fname: path to a valid .ekf file
+% OUTPUT
+%   ekfData: a Matlab struct with a field for each column in the file.
+%   Vector quantities are stored as one column per element, eg state_0 to
+%   state_23. Each field is a column vector with one element per ekf
+%   prediction step.
+
+fid = fopen(fname, 'r', 'ieee-le');
+if fid < 0
+    error('unable to open %s', fname);
+end
+
+magic = fread(fid, [1 8], '*char');
+if ~strcmp(magic, 'ECLEKF01')
+    fclose(fid);
+    error('%s is not an ecl_batch_replay output file', fname);
+end
+
+numColumns = fread(fid, 1, 'uint32');
+fread(fid, 1, 'uint32');
+numRows = fread(fid, 1, 'uint64');
+
+names = cell(numColumns, 1);
+types = zeros(numColumns, 1);
+for i = 1:numColumns
+    name = fread(fid, [1 32], '*char');
+    names{i} = deblank(strtok(name, char(0)));
+    types(i) = fread(fid, 1, 'uint32');
+    fread(fid, 1, 'uint32');
+end
+
+ekfData = struct();
+for i = 1:numColumns
+    if types(i) == 0
+        ekfData.(names{i}) = fread(fid, numRows, '*uint64');
+    else
+        ekfData.(names{i}) = fread(fid, numRows, '*single');
+    end
+end
+
+fclose(fid);
+
+end
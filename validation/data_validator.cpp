@@ -74,7 +74,16 @@ DataValidator::put(uint64_t timestamp, float val, uint64_t error_count_in, int p
 void
 DataValidator::put(uint64_t timestamp, float val[dimensions], uint64_t error_count_in, int priority_in)
 {
-	_event_count++;
+	put(timestamp, reinterpret_cast<const float (*)[dimensions]>(val), 1, error_count_in, priority_in);
+}
+
+void
+DataValidator::put(uint64_t timestamp, const float val[][dimensions], unsigned count, uint64_t error_count_in,
+		   int priority_in)
+{
+	if (count == 0) {
+		return;
+	}
 
 	if (error_count_in > _error_count) {
 		_error_density += (error_count_in - _error_count);
@@ -82,28 +91,54 @@ DataValidator::put(uint64_t timestamp, float val[dimensions], uint64_t error_cou
 		_error_density--;
 	}
 
+	/* the remaining items in the burst have no new errors */
+	if (count > 1) {
+		_error_density = (_error_density > (int)(count - 1)) ? _error_density - (int)(count - 1) : 0;
+	}
+
 	_error_count = error_count_in;
 	_priority = priority_in;
 
-	for (unsigned i = 0; i < dimensions; i++) {
-		if (_time_last == 0) {
+	unsigned k = 0;
+
+	if (_time_last == 0) {
+		_event_count++;
+
+		for (unsigned i = 0; i < dimensions; i++) {
 			_mean[i] = 0;
-			_lp[i] = val[i];
+			_lp[i] = val[0][i];
 			_M2[i] = 0;
-		} else {
-			float lp_val = val[i] - _lp[i];
+			_vibe[i] = _vibe[i] * 0.99f;
+			_lp[i] = _lp[i] * 0.99f + 0.01f * val[0][i];
+			_value[i] = val[0][i];
+		}
 
-			float delta_val = lp_val - _mean[i];
-			_mean[i] += delta_val / _event_count;
-			_M2[i] += delta_val * (lp_val - _mean[i]);
-			_rms[i] = sqrtf(_M2[i] / (_event_count - 1));
+		k++;
+	}
 
-			if (fabsf(_value[i] - val[i]) < 0.000001f) {
-				_value_equal_count++;
-			} else {
-				_value_equal_count = 0;
-			}
-		}
+	for (; k < count; k++) {
+		_event_count++;
+		update(val[k]);
+	}
+
+	_time_last = timestamp;
+}
+
+void
+DataValidator::update(const float val[dimensions])
+{
+	const float event_count = _event_count;
+	bool equal[dimensions];
+
+	/* no branches in the per axis statistics so that they can be vectorised */
+	for (unsigned i = 0; i < dimensions; i++) {
+		float lp_val = val[i] - _lp[i];
+
+		float delta_val = lp_val - _mean[i];
+		_mean[i] += delta_val / event_count;
+		_M2[i] += delta_val * (lp_val - _mean[i]);
+
+		equal[i] = fabsf(_value[i] - val[i]) < 0.000001f;
 
 		_vibe[i] = _vibe[i] * 0.99f + 0.01f * fabsf(val[i] - _lp[i]);
 
@@ -113,7 +148,22 @@ DataValidator::put(uint64_t timestamp, float val[dimensions], uint64_t error_cou
 		_value[i] = val[i];
 	}
 
-	_time_last = timestamp;
+	/* equal values are accumulated across the axes and reset by any axis that changed */
+	for (unsigned i = 0; i < dimensions; i++) {
+		_value_equal_count = equal[i] ? _value_equal_count + 1 : 0;
+	}
+}
+
+float*
+DataValidator::rms()
+{
+	if (_event_count > 1) {
+		for (unsigned i = 0; i < dimensions; i++) {
+			_rms[i] = sqrtf(_M2[i] / (_event_count - 1));
+		}
+	}
+
+	return _rms;
 }
 
 float
@@ -169,9 +219,11 @@ DataValidator::print()
 		return;
 	}
 
+	const float *rms_val = rms();
+
 	for (unsigned i = 0; i < dimensions; i++) {
 		ECL_INFO("\tval: %8.4f, lp: %8.4f mean dev: %8.4f RMS: %8.4f conf: %8.4f",
 			(double) _value[i], (double)_lp[i], (double)_mean[i],
-			(double)_rms[i], (double)confidence(hrt_absolute_time()));
+			(double)rms_val[i], (double)confidence(hrt_absolute_time()));
 	}
 }
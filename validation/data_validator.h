@@ -65,6 +65,17 @@ public:
 	 */
 	void			put(uint64_t timestamp, float val[dimensions], uint64_t error_count, int priority);
 
+	/**
+	 * Put a burst of 3D items into the validator, e.g. the contents of a sensor FIFO.
+	 * This is equivalent to putting each item with the same error count and priority.
+	 *
+	 * @param timestamp	The timestamp of the last item
+	 * @param val		Items to put, oldest first
+	 * @param count		Number of items
+	 */
+	void			put(uint64_t timestamp, const float val[][dimensions], unsigned count, uint64_t error_count,
+				    int priority);
+
 	/**
 	 * Get the next sibling in the group
 	 *
@@ -114,10 +125,10 @@ public:
 	void			reset_state() { _error_mask = ERROR_FLAG_NO_ERROR; }
 
 	/**
-	 * Get the RMS values of this validator
+	 * Get the RMS values of this validator. These are only calculated when read.
 	 * @return		the stored RMS
 	 */
-	float*			rms() { return _rms; }
+	float*			rms();
 
 	/**
 	 * Get the vibration offset
@@ -163,6 +174,11 @@ public:
 	static constexpr uint32_t ERROR_FLAG_HIGH_ERRDENSITY 	= (0x00000001U << 4);
 
 private:
+	/**
+	 * Update the statistics with a 3D item
+	 */
+	void			update(const float val[dimensions]);
+
 	uint32_t _error_mask;			/**< sensor error state */
 	uint32_t _timeout_interval;		/**< interval in which the datastream times out in us */
 	uint64_t _time_last;			/**< last timestamp */
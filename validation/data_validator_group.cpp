@@ -44,86 +44,121 @@
 #include <cfloat>
 
 DataValidatorGroup::DataValidatorGroup(unsigned siblings) :
-	_first(nullptr),
+	_confidence{},
+	_num_validators(0),
+	_confidence_timestamp(0),
+	_confidence_valid(false),
 	_curr_best(-1),
 	_prev_best(-1),
 	_first_failover_time(0),
-	_toggle_count(0)
+	_toggle_count(0),
+	_handler(nullptr),
+	_notified_state{}
 {
-	DataValidator *next = _first;
-
-	for (unsigned i = 0; i < siblings; i++) {
-		next = new DataValidator(next);
+	if (siblings > MAX_SIBLINGS) {
+		ECL_ERR("validator group supports %u sensors, %u requested", MAX_SIBLINGS, siblings);
+		siblings = MAX_SIBLINGS;
 	}
 
-	_first = next;
-	_timeout_interval_us = _first->get_timeout();
+	_num_validators = siblings;
+	_timeout_interval_us = _validators[0].get_timeout();
 }
 
 DataValidatorGroup::~DataValidatorGroup()
 {
-	while (_first) {
-		DataValidator* next = _first->sibling();
-		delete (_first);
-		_first = next;
-	}
 }
 
 DataValidator *DataValidatorGroup::add_new_validator()
 {
-	DataValidator *validator = new DataValidator(_first);
-	if (!validator) {
+	if (_num_validators >= MAX_SIBLINGS) {
 		return nullptr;
 	}
-	_first = validator;
-	_first->set_timeout(_timeout_interval_us);
-	return _first;
+
+	DataValidator *validator = &_validators[_num_validators++];
+	validator->set_timeout(_timeout_interval_us);
+	_confidence_valid = false;
+	return validator;
 }
 
 void
 DataValidatorGroup::set_timeout(uint32_t timeout_interval_us)
 {
-	DataValidator *next = _first;
-
-	while (next != nullptr) {
-		next->set_timeout(timeout_interval_us);
-		next = next->sibling();
+	for (unsigned i = 0; i < MAX_SIBLINGS; i++) {
+		_validators[i].set_timeout(timeout_interval_us);
 	}
+
 	_timeout_interval_us = timeout_interval_us;
+	_confidence_valid = false;
 }
 
 void
 DataValidatorGroup::set_equal_value_threshold(uint32_t threshold)
 {
-	DataValidator *next = _first;
-
-	while (next != nullptr) {
-		next->set_equal_value_threshold(threshold);
-		next = next->sibling();
+	for (unsigned i = 0; i < MAX_SIBLINGS; i++) {
+		_validators[i].set_equal_value_threshold(threshold);
 	}
+
+	_confidence_valid = false;
 }
 
 
 void
 DataValidatorGroup::put(unsigned index, uint64_t timestamp, float val[3], uint64_t error_count, int priority)
 {
-	DataValidator *next = _first;
-	unsigned i = 0;
+	if (index < _num_validators) {
+		_validators[index].put(timestamp, val, error_count, priority);
+		_confidence_valid = false;
+	}
+}
+
+void
+DataValidatorGroup::put(unsigned index, uint64_t timestamp, const float val[][3], unsigned count, uint64_t error_count,
+			int priority)
+{
+	if (index < _num_validators) {
+		_validators[index].put(timestamp, val, count, error_count, priority);
+		_confidence_valid = false;
+	}
+}
+
+void
+DataValidatorGroup::update_confidence(uint64_t timestamp)
+{
+	/* the confidence only changes with new data or a different timestamp */
+	if (_confidence_valid && timestamp == _confidence_timestamp) {
+		return;
+	}
+
+	for (unsigned i = 0; i < _num_validators; i++) {
+		_confidence[i] = _validators[i].confidence(timestamp);
+	}
+
+	_confidence_timestamp = timestamp;
+	_confidence_valid = true;
+
+	notify_state_changes();
+}
+
+void
+DataValidatorGroup::notify_state_changes()
+{
+	for (unsigned i = 0; i < _num_validators; i++) {
+		uint32_t state = _validators[i].state();
+
+		if (state != _notified_state[i]) {
+			if (_handler != nullptr) {
+				_handler->state_changed(i, _notified_state[i], state);
+			}
 
-	while (next != nullptr) {
-		if (i == index) {
-			next->put(timestamp, val, error_count, priority);
-			break;
+			_notified_state[i] = state;
 		}
-		next = next->sibling();
-		i++;
 	}
 }
 
 float*
 DataValidatorGroup::get_best(uint64_t timestamp, int *index)
 {
-	DataValidator *next = _first;
+	update_confidence(timestamp);
 
 	// XXX This should eventually also include voting
 	int pre_check_best = _curr_best;
@@ -134,10 +169,9 @@ DataValidatorGroup::get_best(uint64_t timestamp, int *index)
 	int max_index = -1;
 	DataValidator *best = nullptr;
 
-	unsigned i = 0;
-
-	while (next != nullptr) {
-		float confidence = next->confidence(timestamp);
+	for (unsigned i = 0; i < _num_validators; i++) {
+		DataValidator *next = &_validators[i];
+		float confidence = _confidence[i];
 
 		if (static_cast<int>(i) == pre_check_best) {
 			pre_check_prio = next->priority();
@@ -158,9 +192,6 @@ DataValidatorGroup::get_best(uint64_t timestamp, int *index)
 			max_priority = next->priority();
 			best = next;
 		}
-
-		next = next->sibling();
-		i++;
 	}
 
 	/* the current best sensor is not matching the previous best sensor,
@@ -168,6 +199,8 @@ DataValidatorGroup::get_best(uint64_t timestamp, int *index)
 	if (max_index != _curr_best || ((max_confidence < FLT_EPSILON) && (_curr_best >= 0))) {
 
 		bool true_failsafe = true;
+		int old_best = _curr_best;
+		uint32_t old_state = (old_best >= 0) ? _validators[old_best].state() : DataValidator::ERROR_FLAG_NO_ERROR;
 
 		/* check whether the switch was a failsafe or preferring a higher priority sensor */
 		if (pre_check_prio != -1 && pre_check_prio < max_priority &&
@@ -176,6 +209,7 @@ DataValidatorGroup::get_best(uint64_t timestamp, int *index)
 			true_failsafe = false;
 			/* reset error flags, this is likely a hotplug sensor coming online late */
 			best->reset_state();
+			notify_state_changes();
 		}
 
 		/* if we're no initialized, initialize the bookkeeping but do not count a failsafe */
@@ -197,6 +231,10 @@ DataValidatorGroup::get_best(uint64_t timestamp, int *index)
 
 		/* for all cases we want to keep a record of the best index */
 		_curr_best = max_index;
+
+		if (_handler != nullptr && old_best != max_index) {
+			_handler->best_changed(old_best, max_index, true_failsafe && (old_best >= 0), old_state);
+		}
 	}
 	*index = max_index;
 	return (best) ? best->value() : nullptr;
@@ -205,15 +243,15 @@ DataValidatorGroup::get_best(uint64_t timestamp, int *index)
 float
 DataValidatorGroup::get_vibration_factor(uint64_t timestamp)
 {
-	DataValidator *next = _first;
+	update_confidence(timestamp);
 
 	float vibe = 0.0f;
 
 	/* find the best RMS value of a non-timed out sensor */
-	while (next != nullptr) {
+	for (unsigned i = 0; i < _num_validators; i++) {
 
-		if (next->confidence(timestamp) > 0.5f) {
-			float* rms = next->rms();
+		if (_confidence[i] > 0.5f) {
+			float* rms = _validators[i].rms();
 
 			for (unsigned j = 0; j < 3; j++) {
 				if (rms[j] > vibe) {
@@ -221,8 +259,6 @@ DataValidatorGroup::get_vibration_factor(uint64_t timestamp)
 				}
 			}
 		}
-
-		next = next->sibling();
 	}
 
 	return vibe;
@@ -231,22 +267,20 @@ DataValidatorGroup::get_vibration_factor(uint64_t timestamp)
 float
 DataValidatorGroup::get_vibration_offset(uint64_t timestamp, int axis)
 {
-	DataValidator *next = _first;
+	update_confidence(timestamp);
 
 	float vibe = -1.0f;
 
 	/* find the best vibration value of a non-timed out sensor */
-	while (next != nullptr) {
+	for (unsigned i = 0; i < _num_validators; i++) {
 
-		if (next->confidence(timestamp) > 0.5f) {
-			float* vibration_offset = next->vibration_offset();
+		if (_confidence[i] > 0.5f) {
+			float* vibration_offset = _validators[i].vibration_offset();
 
 			if (vibe < 0.0f || vibration_offset[axis] < vibe) {
 				vibe = vibration_offset[axis];
 			}
 		}
-
-		next = next->sibling();
 	}
 
 	return vibe;
@@ -260,10 +294,9 @@ DataValidatorGroup::print()
 		_curr_best, _prev_best, (_toggle_count > 0) ? "YES" : "NO",
 		_toggle_count);
 
-	DataValidator *next = _first;
-	unsigned i = 0;
+	for (unsigned i = 0; i < _num_validators; i++) {
+		DataValidator *next = &_validators[i];
 
-	while (next != nullptr) {
 		if (next->used()) {
 			uint32_t flags = next->state();
 
@@ -277,8 +310,6 @@ DataValidatorGroup::print()
 
 			next->print();
 		}
-		next = next->sibling();
-		i++;
 	}
 }
 
@@ -291,31 +322,27 @@ DataValidatorGroup::failover_count()
 int
 DataValidatorGroup::failover_index()
 {
-	DataValidator *next = _first;
-	unsigned i = 0;
+	if (_prev_best >= 0 && (unsigned)_prev_best < _num_validators) {
+		DataValidator *prev = &_validators[_prev_best];
 
-	while (next != nullptr) {
-		if (next->used() && (next->state() != DataValidator::ERROR_FLAG_NO_ERROR) && (i == (unsigned)_prev_best)) {
-			return i;
+		if (prev->used() && (prev->state() != DataValidator::ERROR_FLAG_NO_ERROR)) {
+			return _prev_best;
 		}
-		next = next->sibling();
-		i++;
 	}
+
 	return -1;
 }
 
 uint32_t
 DataValidatorGroup::failover_state()
 {
-	DataValidator *next = _first;
-	unsigned i = 0;
+	if (_prev_best >= 0 && (unsigned)_prev_best < _num_validators) {
+		DataValidator *prev = &_validators[_prev_best];
 
-	while (next != nullptr) {
-		if (next->used() && (next->state() != DataValidator::ERROR_FLAG_NO_ERROR) && (i == (unsigned)_prev_best)) {
-			return next->state();
+		if (prev->used() && (prev->state() != DataValidator::ERROR_FLAG_NO_ERROR)) {
+			return prev->state();
 		}
-		next = next->sibling();
-		i++;
 	}
+
 	return DataValidator::ERROR_FLAG_NO_ERROR;
 }
@@ -43,17 +43,52 @@
 
 #include "data_validator.h"
 
+// maximum number of validators in a group. The validators are held in a fixed size array within the group.
+#ifndef ECL_VALIDATOR_MAX_SIBLINGS
+#define ECL_VALIDATOR_MAX_SIBLINGS 4
+#endif
+
+/**
+ * Interface for receiving sensor selection and error state changes from a DataValidatorGroup,
+ * so that users do not need to poll the group for failovers. The handler functions are called
+ * from within the group function that detected the change.
+ */
+class __EXPORT DataValidatorGroupHandler {
+public:
+	virtual ~DataValidatorGroupHandler() = default;
+
+	/**
+	 * The best sensor of the group has changed
+	 *
+	 * @param old_index	index of the previous best sensor or -1 if there was none
+	 * @param new_index	index of the new best sensor or -1 if no sensor is valid
+	 * @param failover	true if the switch was caused by a failure of the previous best sensor
+	 * @param old_state	bitmask with the error states of the previous best sensor
+	 */
+	virtual void		best_changed(int /*old_index*/, int /*new_index*/, bool /*failover*/, uint32_t /*old_state*/) {}
+
+	/**
+	 * The error state of a sensor in the group has changed
+	 *
+	 * @param index		sensor index
+	 * @param old_state	bitmask with the previous error states
+	 * @param new_state	bitmask with the new error states
+	 */
+	virtual void		state_changed(unsigned /*index*/, uint32_t /*old_state*/, uint32_t /*new_state*/) {}
+};
+
 class __EXPORT DataValidatorGroup {
 public:
 	/**
-	 * @param siblings initial number of DataValidator's. Must be > 0.
+	 * @param siblings initial number of DataValidator's. Must be > 0 and no more than ECL_VALIDATOR_MAX_SIBLINGS.
 	 */
 	DataValidatorGroup(unsigned siblings);
 	virtual ~DataValidatorGroup();
 
 	/**
 	 * Create a new Validator (with index equal to the number of currently existing validators)
-	 * @return the newly created DataValidator or nullptr on error
+	 * Data for the validator must be put through the group so that the cached confidence is updated.
+	 * @return the newly created DataValidator or nullptr if the group is full
 	 */
 	DataValidator *add_new_validator();
 
@@ -69,6 +104,19 @@ public:
 	void			put(unsigned index, uint64_t timestamp,
 					float val[3], uint64_t error_count, int priority);
 
+	/**
+	 * Put a burst of items into the validator group, e.g. the contents of a sensor FIFO.
+	 *
+	 * @param index		Sensor index
+	 * @param timestamp	The timestamp of the last measurement
+	 * @param val		The 3D vectors, oldest first
+	 * @param count		The number of 3D vectors
+	 * @param error_count	The current error count of the sensor
+	 * @param priority	The priority of the sensor
+	 */
+	void			put(unsigned index, uint64_t timestamp, const float val[][3], unsigned count,
+					uint64_t error_count, int priority);
+
 	/**
 	 * Get the best data triplet of the group
 	 *
@@ -131,14 +179,39 @@ public:
 	 */
 	void			set_equal_value_threshold(uint32_t threshold);
 
+	/**
+	 * Set the handler for sensor selection and error state changes
+	 *
+	 * @param handler	The handler or nullptr to disable the notifications
+	 */
+	void			set_handler(DataValidatorGroupHandler *handler) { _handler = handler; }
+
 
 private:
-	DataValidator *_first;		/**< sibling in the group */
+	/**
+	 * Update the cached confidence of each validator if the cache is not valid for the timestamp
+	 */
+	void			update_confidence(uint64_t timestamp);
+
+	/**
+	 * Notify the handler of any change in the error state of the validators
+	 */
+	void			notify_state_changes();
+
+	static constexpr unsigned MAX_SIBLINGS = ECL_VALIDATOR_MAX_SIBLINGS;
+
+	DataValidator _validators[MAX_SIBLINGS];	/**< validators in the group */
+	float _confidence[MAX_SIBLINGS];	/**< confidence of each validator at _confidence_timestamp */
+	unsigned _num_validators;	/**< number of validators in use */
+	uint64_t _confidence_timestamp;	/**< timestamp the cached confidence values were evaluated at */
+	bool _confidence_valid;		/**< true when the cached confidence values are valid for _confidence_timestamp */
 	uint32_t _timeout_interval_us; /**< currently set timeout */
 	int _curr_best;		/**< currently best index */
 	int _prev_best;		/**< the previous best index */
 	uint64_t _first_failover_time;	/**< timestamp where the first failover occured or zero if none occured */
 	unsigned _toggle_count;		/**< number of back and forth switches between two sensors */
+	DataValidatorGroupHandler *_handler;	/**< handler for selection and error state changes or nullptr */
+	uint32_t _notified_state[MAX_SIBLINGS];	/**< error state of each validator last passed to the handler */
 	static constexpr float MIN_REGULAR_CONFIDENCE = 0.9f;
 
 	/* we don't want this class to be copied */